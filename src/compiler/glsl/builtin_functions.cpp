@@ -39,7 +39,8 @@
  *
  *    The builtin_builder::create_builtins() function contains lists of all
  *    built-in function signatures, where they're available, what types they
- *    take, and so on.
+ *    take, and so on.  The signatures of a function are only built the
+ *    first time a shader references it.
  *
  * 4. Implementations of built-in function signatures
  *
@@ -75,6 +76,10 @@
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "main/consts_exts.h"
 #include "main/shader_types.h"
 #include "main/shaderobj.h"
@@ -1002,22 +1007,39 @@ public:
    ir_function_signature *find(_mesa_glsl_parse_state *state,
                                const char *name, exec_list *actual_parameters);
 
+   /**
+    * Look up a built-in function by name, building its IR first if this is
+    * the first reference to it.
+    */
+   ir_function *get_function(const char *name);
+
    /**
     * A shader to hold all the built-in signatures; created by this module.
     *
-    * This includes signatures for every built-in, regardless of version or
-    * enabled extensions.  The availability predicate associated with each
-    * signature allows matching_signature() to filter out the irrelevant ones.
+    * This includes signatures for every built-in that has been referenced
+    * so far, regardless of version or enabled extensions.  The availability
+    * predicate associated with each signature allows matching_signature() to
+    * filter out the irrelevant ones.
     */
    gl_shader *shader;
 
 private:
    void *mem_ctx;
 
+   /**
+    * Functions which have been declared but whose IR hasn't been built yet,
+    * keyed by name.  Building the IR for every built-in up front is most of
+    * the cost of initialize(), while a shader only references a few of them.
+    */
+   std::unordered_map<std::string, std::vector<std::function<void()>>> pending;
+
    void create_shader();
    void create_intrinsics();
    void create_builtins();
 
+   /** Register \p create to build the function \p name on first use. */
+   void add_lazy_function(const char *name, std::function<void()> create);
+
    /**
     * IR builder helpers:
     *
@@ -1426,7 +1448,7 @@ builtin_builder::find(_mesa_glsl_parse_state *state,
     */
    state->uses_builtin_functions = true;
 
-   ir_function *f = shader->symbols->get_function(name);
+   ir_function *f = get_function(name);
    if (f == NULL)
       return NULL;
 
@@ -1456,6 +1478,8 @@ builtin_builder::initialize()
 void
 builtin_builder::release()
 {
+   pending.clear();
+
    ralloc_free(mem_ctx);
    mem_ctx = NULL;
 
@@ -1476,8 +1500,37 @@ builtin_builder::create_shader()
    shader->symbols = new(mem_ctx) glsl_symbol_table;
 }
 
+ir_function *
+builtin_builder::get_function(const char *name)
+{
+   auto it = pending.find(name);
+   if (it != pending.end()) {
+      /* Remove the entry first: building a function may look up others. */
+      std::vector<std::function<void()>> create = std::move(it->second);
+      pending.erase(it);
+
+      for (auto &c : create)
+         c();
+   }
+
+   return shader->symbols->get_function(name);
+}
+
+void
+builtin_builder::add_lazy_function(const char *name,
+                                   std::function<void()> create)
+{
+   pending[name].push_back(std::move(create));
+}
+
 /** @} */
 
+/* In create_intrinsics() and create_builtins(), only record how to build
+ * each function; get_function() builds it when it's first referenced.
+ */
+#define add_function(NAME, ...) \
+   add_lazy_function(NAME, [this]() { add_function(NAME, __VA_ARGS__); })
+
 /**
  * Create ir_function and ir_function_signature objects for each
  * intrinsic.
@@ -5447,6 +5500,8 @@ builtin_builder::create_builtins()
 #undef FIU2_MIXED
 }
 
+#undef add_function
+
 void
 builtin_builder::add_function(const char *name, ...)
 {
@@ -5517,31 +5572,34 @@ builtin_builder::add_image_function(const char *name,
       glsl_type::uimage2DMSArray_type
    };
 
-   ir_function *f = new(mem_ctx) ir_function(name);
+   add_lazy_function(name, [this, name, intrinsic_name, prototype,
+                            num_arguments, flags, intrinsic_id]() {
+      ir_function *f = new(mem_ctx) ir_function(name);
 
-   for (unsigned i = 0; i < ARRAY_SIZE(types); ++i) {
-      if (types[i]->sampled_type == GLSL_TYPE_FLOAT && !(flags & IMAGE_FUNCTION_SUPPORTS_FLOAT_DATA_TYPE))
-         continue;
-      if (types[i]->sampled_type == GLSL_TYPE_INT && !(flags & IMAGE_FUNCTION_SUPPORTS_SIGNED_DATA_TYPE))
-         continue;
-      if ((types[i]->sampler_dimensionality != GLSL_SAMPLER_DIM_MS) && (flags & IMAGE_FUNCTION_MS_ONLY))
-         continue;
-      if (flags & IMAGE_FUNCTION_SPARSE) {
-         switch (types[i]->sampler_dimensionality) {
-         case GLSL_SAMPLER_DIM_2D:
-         case GLSL_SAMPLER_DIM_3D:
-         case GLSL_SAMPLER_DIM_CUBE:
-         case GLSL_SAMPLER_DIM_RECT:
-         case GLSL_SAMPLER_DIM_MS:
-            break;
-         default:
+      for (unsigned i = 0; i < ARRAY_SIZE(types); ++i) {
+         if (types[i]->sampled_type == GLSL_TYPE_FLOAT && !(flags & IMAGE_FUNCTION_SUPPORTS_FLOAT_DATA_TYPE))
+            continue;
+         if (types[i]->sampled_type == GLSL_TYPE_INT && !(flags & IMAGE_FUNCTION_SUPPORTS_SIGNED_DATA_TYPE))
+            continue;
+         if ((types[i]->sampler_dimensionality != GLSL_SAMPLER_DIM_MS) && (flags & IMAGE_FUNCTION_MS_ONLY))
             continue;
+         if (flags & IMAGE_FUNCTION_SPARSE) {
+            switch (types[i]->sampler_dimensionality) {
+            case GLSL_SAMPLER_DIM_2D:
+            case GLSL_SAMPLER_DIM_3D:
+            case GLSL_SAMPLER_DIM_CUBE:
+            case GLSL_SAMPLER_DIM_RECT:
+            case GLSL_SAMPLER_DIM_MS:
+               break;
+            default:
+               continue;
+            }
          }
+         f->add_signature(_image(prototype, types[i], intrinsic_name,
+                                 num_arguments, flags, intrinsic_id));
       }
-      f->add_signature(_image(prototype, types[i], intrinsic_name,
-                              num_arguments, flags, intrinsic_id));
-   }
-   shader->symbols->add_function(f);
+      shader->symbols->add_function(f);
+   });
 }
 
 void
@@ -7282,7 +7340,7 @@ builtin_builder::_is_sparse_texels_resident(void)
 
    ir_variable *retval = body.make_temp(glsl_type::bool_type, "retval");
    ir_function *f =
-      shader->symbols->get_function("__intrinsic_is_sparse_texels_resident");
+      get_function("__intrinsic_is_sparse_texels_resident");
 
    body.emit(call(f, retval, sig->parameters));
    body.emit(ret(retval));
@@ -8139,7 +8197,7 @@ builtin_builder::_atomic_counter_op(const char *intrinsic,
    MAKE_SIG(glsl_type::uint_type, avail, 1, counter);
 
    ir_variable *retval = body.make_temp(glsl_type::uint_type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8170,7 +8228,7 @@ builtin_builder::_atomic_counter_op1(const char *intrinsic,
       parameters.push_tail(new(mem_ctx) ir_dereference_variable(neg_data));
 
       ir_function *const func =
-         shader->symbols->get_function("__intrinsic_atomic_add");
+         get_function("__intrinsic_atomic_add");
       ir_instruction *const c = call(func, retval, parameters);
 
       assert(c != NULL);
@@ -8178,7 +8236,7 @@ builtin_builder::_atomic_counter_op1(const char *intrinsic,
 
       body.emit(c);
    } else {
-      body.emit(call(shader->symbols->get_function(intrinsic), retval,
+      body.emit(call(get_function(intrinsic), retval,
                      sig->parameters));
    }
 
@@ -8196,7 +8254,7 @@ builtin_builder::_atomic_counter_op2(const char *intrinsic,
    MAKE_SIG(glsl_type::uint_type, avail, 3, counter, compare, data);
 
    ir_variable *retval = body.make_temp(glsl_type::uint_type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8214,7 +8272,7 @@ builtin_builder::_atomic_op2(const char *intrinsic,
    atomic->data.implicit_conversion_prohibited = true;
 
    ir_variable *retval = body.make_temp(type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8233,7 +8291,7 @@ builtin_builder::_atomic_op3(const char *intrinsic,
    atomic->data.implicit_conversion_prohibited = true;
 
    ir_variable *retval = body.make_temp(type, "atomic_retval");
-   body.emit(call(shader->symbols->get_function(intrinsic), retval,
+   body.emit(call(get_function(intrinsic), retval,
                   sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8448,7 +8506,7 @@ builtin_builder::_image(image_prototype_ctr prototype,
 
    if (flags & IMAGE_FUNCTION_EMIT_STUB) {
       ir_factory body(&sig->body, mem_ctx);
-      ir_function *f = shader->symbols->get_function(intrinsic_name);
+      ir_function *f = get_function(intrinsic_name);
 
       if (flags & IMAGE_FUNCTION_RETURNS_VOID) {
          body.emit(call(f, NULL, sig->parameters));
@@ -8500,7 +8558,7 @@ builtin_builder::_memory_barrier(const char *intrinsic_name,
                                  builtin_available_predicate avail)
 {
    MAKE_SIG(glsl_type::void_type, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   NULL, sig->parameters));
    return sig;
 }
@@ -8522,7 +8580,7 @@ builtin_builder::_ballot()
    MAKE_SIG(glsl_type::uint64_t_type, shader_ballot, 1, value);
    ir_variable *retval = body.make_temp(glsl_type::uint64_t_type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_ballot"),
+   body.emit(call(get_function("__intrinsic_ballot"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8545,7 +8603,7 @@ builtin_builder::_read_first_invocation(const glsl_type *type)
    MAKE_SIG(type, shader_ballot, 1, value);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_read_first_invocation"),
+   body.emit(call(get_function("__intrinsic_read_first_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8570,7 +8628,7 @@ builtin_builder::_read_invocation(const glsl_type *type)
    MAKE_SIG(type, shader_ballot, 2, value, invocation);
    ir_variable *retval = body.make_temp(type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_read_invocation"),
+   body.emit(call(get_function("__intrinsic_read_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8589,7 +8647,7 @@ builtin_builder::_invocation_interlock(const char *intrinsic_name,
                                        builtin_available_predicate avail)
 {
    MAKE_SIG(glsl_type::void_type, avail, 0);
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   NULL, sig->parameters));
    return sig;
 }
@@ -8610,7 +8668,7 @@ builtin_builder::_shader_clock(builtin_available_predicate avail,
 
    ir_variable *retval = body.make_temp(glsl_type::uvec2_type, "clock_retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_shader_clock"),
+   body.emit(call(get_function("__intrinsic_shader_clock"),
                   retval, sig->parameters));
 
    if (type == glsl_type::uint64_t_type) {
@@ -8641,7 +8699,7 @@ builtin_builder::_vote(const char *intrinsic_name,
 
    ir_variable *retval = body.make_temp(glsl_type::bool_type, "retval");
 
-   body.emit(call(shader->symbols->get_function(intrinsic_name),
+   body.emit(call(get_function(intrinsic_name),
                   retval, sig->parameters));
    body.emit(ret(retval));
    return sig;
@@ -8662,7 +8720,7 @@ builtin_builder::_helper_invocation()
 
    ir_variable *retval = body.make_temp(glsl_type::bool_type, "retval");
 
-   body.emit(call(shader->symbols->get_function("__intrinsic_helper_invocation"),
+   body.emit(call(get_function("__intrinsic_helper_invocation"),
                   retval, sig->parameters));
    body.emit(ret(retval));
 
@@ -8718,7 +8776,7 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    ir_function *f;
    bool ret = false;
    mtx_lock(&builtins_lock);
-   f = builtins.shader->symbols->get_function(name);
+   f = builtins.get_function(name);
    if (f != NULL) {
       foreach_in_list(ir_function_signature, sig, &f->signatures) {
          if (sig->is_builtin_available(state)) {
@@ -8732,10 +8790,20 @@ _mesa_glsl_has_builtin_function(_mesa_glsl_parse_state *state, const char *name)
    return ret;
 }
 
-gl_shader *
-_mesa_glsl_get_builtin_function_shader()
+/**
+ * Look up a built-in function by name, building it first if that hasn't
+ * happened yet. Once built a function isn't modified anymore, so the caller
+ * may walk its signatures without holding the lock.
+ */
+ir_function *
+_mesa_glsl_get_builtin_function(const char *name)
 {
-   return builtins.shader;
+   ir_function *f;
+   mtx_lock(&builtins_lock);
+   f = builtins.get_function(name);
+   mtx_unlock(&builtins_lock);
+
+   return f;
 }
 
 
@@ -52,7 +52,11 @@ static const struct debug_named_value nir_debug_control[] = {
    { "validate_ssa_dominance", NIR_DEBUG_VALIDATE_SSA_DOMINANCE,
      "Validate SSA dominance in shader at each successful lowering/optimization call" },
    { "validate_gc_list", NIR_DEBUG_VALIDATE_GC_LIST,
-     "Validate the instruction GC list at each successful lowering/optimization call" },
+     "Validate that instructions come from the shader's GC context at each successful lowering/optimization call" },
+   { "pass_stats", NIR_DEBUG_PASS_STATS,
+     "Print the time spent in and progress made by the passes of optimization loops using nir_pass_scheduler" },
+   { "algebraic_hits", NIR_DEBUG_ALGEBRAIC_HITS,
+     "Print how often each algebraic optimization rule matched at exit (debug builds only)" },
    { "tgsi", NIR_DEBUG_TGSI,
      "Dump NIR/TGSI shaders when doing a NIR<->TGSI translation" },
    { "print", NIR_DEBUG_PRINT,
@@ -184,17 +188,6 @@ nir_component_mask_reinterpret(nir_component_mask_t mask,
    return new_mask;
 }
 
-static void
-nir_shader_destructor(void *ptr)
-{
-   nir_shader *shader = ptr;
-
-   /* Free all instrs from the shader, since they're not ralloced. */
-   list_for_each_entry_safe(nir_instr, instr, &shader->gc_list, gc_node) {
-      nir_instr_free(instr);
-   }
-}
-
 nir_shader *
 nir_shader_create(void *mem_ctx,
                   gl_shader_stage stage,
@@ -202,7 +195,6 @@ nir_shader_create(void *mem_ctx,
                   shader_info *si)
 {
    nir_shader *shader = rzalloc(mem_ctx, nir_shader);
-   ralloc_set_destructor(shader, nir_shader_destructor);
 
 #ifndef NDEBUG
    nir_process_debug_variable();
@@ -221,7 +213,7 @@ nir_shader_create(void *mem_ctx,
 
    exec_list_make_empty(&shader->functions);
 
-   list_inithead(&shader->gc_list);
+   shader->gc_ctx = gc_context(shader);
 
    shader->num_inputs = 0;
    shader->num_outputs = 0;
@@ -437,7 +429,7 @@ static void src_free_indirects(nir_src *src)
 {
    if (src_has_indirect(src)) {
       assert(src->reg.indirect->is_ssa || !src->reg.indirect->reg.indirect);
-      free(src->reg.indirect);
+      ralloc_free(src->reg.indirect);
       src->reg.indirect = NULL;
    }
 }
@@ -446,7 +438,7 @@ static void dest_free_indirects(nir_dest *dest)
 {
    if (!dest->is_ssa && dest->reg.indirect) {
       assert(dest->reg.indirect->is_ssa || !dest->reg.indirect->reg.indirect);
-      free(dest->reg.indirect);
+      ralloc_free(dest->reg.indirect);
       dest->reg.indirect = NULL;
    }
 }
@@ -465,7 +457,7 @@ void nir_src_copy(nir_src *dest, const nir_src *src)
       dest->reg.base_offset = src->reg.base_offset;
       dest->reg.reg = src->reg.reg;
       if (src->reg.indirect) {
-         dest->reg.indirect = calloc(1, sizeof(nir_src));
+         dest->reg.indirect = rzalloc(dest->reg.reg, nir_src);
          nir_src_copy(dest->reg.indirect, src->reg.indirect);
       } else {
          dest->reg.indirect = NULL;
@@ -485,7 +477,7 @@ void nir_dest_copy(nir_dest *dest, const nir_dest *src)
    dest->reg.base_offset = src->reg.base_offset;
    dest->reg.reg = src->reg.reg;
    if (src->reg.indirect) {
-      dest->reg.indirect = calloc(1, sizeof(nir_src));
+      dest->reg.indirect = rzalloc(dest->reg.reg, nir_src);
       nir_src_copy(dest->reg.indirect, src->reg.indirect);
    } else {
       dest->reg.indirect = NULL;
@@ -551,6 +543,7 @@ nir_function_impl_create_bare(nir_shader *shader)
    impl->num_blocks = 0;
    impl->valid_metadata = nir_metadata_none;
    impl->structured = true;
+   memset(impl->algebraic_clean, 0, sizeof(impl->algebraic_clean));
 
    /* create start & end blocks */
    nir_block *start_block = nir_block_create(shader);
@@ -694,8 +687,9 @@ nir_alu_instr *
 nir_alu_instr_create(nir_shader *shader, nir_op op)
 {
    unsigned num_srcs = nir_op_infos[op].num_inputs;
-   /* TODO: don't use calloc */
-   nir_alu_instr *instr = calloc(1, sizeof(nir_alu_instr) + num_srcs * sizeof(nir_alu_src));
+   nir_alu_instr *instr =
+      gc_zalloc_size(shader->gc_ctx,
+                     sizeof(nir_alu_instr) + num_srcs * sizeof(nir_alu_src));
 
    instr_init(&instr->instr, nir_instr_type_alu);
    instr->op = op;
@@ -703,15 +697,13 @@ nir_alu_instr_create(nir_shader *shader, nir_op op)
    for (unsigned i = 0; i < num_srcs; i++)
       alu_src_init(&instr->src[i]);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
 nir_deref_instr *
 nir_deref_instr_create(nir_shader *shader, nir_deref_type deref_type)
 {
-   nir_deref_instr *instr = calloc(1, sizeof(*instr));
+   nir_deref_instr *instr = gc_zalloc(shader->gc_ctx, nir_deref_instr, 1);
 
    instr_init(&instr->instr, nir_instr_type_deref);
 
@@ -725,23 +717,19 @@ nir_deref_instr_create(nir_shader *shader, nir_deref_type deref_type)
 
    dest_init(&instr->dest);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
 nir_jump_instr *
 nir_jump_instr_create(nir_shader *shader, nir_jump_type type)
 {
-   nir_jump_instr *instr = malloc(sizeof(*instr));
+   nir_jump_instr *instr = gc_alloc(shader->gc_ctx, nir_jump_instr, 1);
    instr_init(&instr->instr, nir_instr_type_jump);
    src_init(&instr->condition);
    instr->type = type;
    instr->target = NULL;
    instr->else_target = NULL;
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -750,13 +738,12 @@ nir_load_const_instr_create(nir_shader *shader, unsigned num_components,
                             unsigned bit_size)
 {
    nir_load_const_instr *instr =
-      calloc(1, sizeof(*instr) + num_components * sizeof(*instr->value));
+      gc_zalloc_size(shader->gc_ctx,
+                     sizeof(*instr) + num_components * sizeof(*instr->value));
    instr_init(&instr->instr, nir_instr_type_load_const);
 
    nir_ssa_def_init(&instr->instr, &instr->def, num_components, bit_size);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -764,9 +751,9 @@ nir_intrinsic_instr *
 nir_intrinsic_instr_create(nir_shader *shader, nir_intrinsic_op op)
 {
    unsigned num_srcs = nir_intrinsic_infos[op].num_srcs;
-   /* TODO: don't use calloc */
    nir_intrinsic_instr *instr =
-      calloc(1, sizeof(nir_intrinsic_instr) + num_srcs * sizeof(nir_src));
+      gc_zalloc_size(shader->gc_ctx,
+                     sizeof(nir_intrinsic_instr) + num_srcs * sizeof(nir_src));
 
    instr_init(&instr->instr, nir_instr_type_intrinsic);
    instr->intrinsic = op;
@@ -777,8 +764,6 @@ nir_intrinsic_instr_create(nir_shader *shader, nir_intrinsic_op op)
    for (unsigned i = 0; i < num_srcs; i++)
       src_init(&instr->src[i]);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -787,7 +772,8 @@ nir_call_instr_create(nir_shader *shader, nir_function *callee)
 {
    const unsigned num_params = callee->num_params;
    nir_call_instr *instr =
-      calloc(1, sizeof(*instr) + num_params * sizeof(instr->params[0]));
+      gc_zalloc_size(shader->gc_ctx,
+                     sizeof(*instr) + num_params * sizeof(instr->params[0]));
 
    instr_init(&instr->instr, nir_instr_type_call);
    instr->callee = callee;
@@ -795,8 +781,6 @@ nir_call_instr_create(nir_shader *shader, nir_function *callee)
    for (unsigned i = 0; i < num_params; i++)
       src_init(&instr->params[i]);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -811,13 +795,13 @@ static int8_t default_tg4_offsets[4][2] =
 nir_tex_instr *
 nir_tex_instr_create(nir_shader *shader, unsigned num_srcs)
 {
-   nir_tex_instr *instr = calloc(1, sizeof(*instr));
+   nir_tex_instr *instr = gc_zalloc(shader->gc_ctx, nir_tex_instr, 1);
    instr_init(&instr->instr, nir_instr_type_tex);
 
    dest_init(&instr->dest);
 
    instr->num_srcs = num_srcs;
-   instr->src = malloc(sizeof(nir_tex_src) * num_srcs);
+   instr->src = gc_alloc(shader->gc_ctx, nir_tex_src, num_srcs);
    for (unsigned i = 0; i < num_srcs; i++)
       src_init(&instr->src[i].src);
 
@@ -825,8 +809,6 @@ nir_tex_instr_create(nir_shader *shader, unsigned num_srcs)
    instr->sampler_index = 0;
    memcpy(instr->tg4_offsets, default_tg4_offsets, sizeof(instr->tg4_offsets));
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -835,8 +817,8 @@ nir_tex_instr_add_src(nir_tex_instr *tex,
                       nir_tex_src_type src_type,
                       nir_src src)
 {
-   nir_tex_src *new_srcs = calloc(sizeof(*new_srcs),
-                                         tex->num_srcs + 1);
+   nir_tex_src *new_srcs = gc_zalloc(gc_get_context(tex), nir_tex_src,
+                                     tex->num_srcs + 1);
 
    for (unsigned i = 0; i < tex->num_srcs; i++) {
       new_srcs[i].src_type = tex->src[i].src_type;
@@ -844,7 +826,7 @@ nir_tex_instr_add_src(nir_tex_instr *tex,
                          &tex->src[i].src);
    }
 
-   free(tex->src);
+   gc_free(tex->src);
    tex->src = new_srcs;
 
    tex->src[tex->num_srcs].src_type = src_type;
@@ -880,14 +862,12 @@ nir_tex_instr_has_explicit_tg4_offsets(nir_tex_instr *tex)
 nir_phi_instr *
 nir_phi_instr_create(nir_shader *shader)
 {
-   nir_phi_instr *instr = malloc(sizeof(*instr));
+   nir_phi_instr *instr = gc_alloc(shader->gc_ctx, nir_phi_instr, 1);
    instr_init(&instr->instr, nir_instr_type_phi);
 
    dest_init(&instr->dest);
    exec_list_make_empty(&instr->srcs);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -904,7 +884,7 @@ nir_phi_instr_add_src(nir_phi_instr *instr, nir_block *pred, nir_src src)
 {
    nir_phi_src *phi_src;
 
-   phi_src = calloc(1, sizeof(nir_phi_src));
+   phi_src = gc_zalloc(gc_get_context(instr), nir_phi_src, 1);
    phi_src->pred = pred;
    phi_src->src = src;
    phi_src->src.parent_instr = &instr->instr;
@@ -916,13 +896,12 @@ nir_phi_instr_add_src(nir_phi_instr *instr, nir_block *pred, nir_src src)
 nir_parallel_copy_instr *
 nir_parallel_copy_instr_create(nir_shader *shader)
 {
-   nir_parallel_copy_instr *instr = malloc(sizeof(*instr));
+   nir_parallel_copy_instr *instr =
+      gc_alloc(shader->gc_ctx, nir_parallel_copy_instr, 1);
    instr_init(&instr->instr, nir_instr_type_parallel_copy);
 
    exec_list_make_empty(&instr->entries);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -931,13 +910,12 @@ nir_ssa_undef_instr_create(nir_shader *shader,
                            unsigned num_components,
                            unsigned bit_size)
 {
-   nir_ssa_undef_instr *instr = malloc(sizeof(*instr));
+   nir_ssa_undef_instr *instr =
+      gc_alloc(shader->gc_ctx, nir_ssa_undef_instr, 1);
    instr_init(&instr->instr, nir_instr_type_ssa_undef);
 
    nir_ssa_def_init(&instr->instr, &instr->def, num_components, bit_size);
 
-   list_add(&instr->instr.gc_node, &shader->gc_list);
-
    return instr;
 }
 
@@ -1172,7 +1150,8 @@ nir_instr_insert(nir_cursor cursor, nir_instr *instr)
       nir_handle_add_jump(instr->block);
 
    nir_function_impl *impl = nir_cf_node_get_function(&instr->block->cf_node);
-   impl->valid_metadata &= ~nir_metadata_instr_index;
+   impl->valid_metadata &= ~(nir_metadata_instr_index |
+                             nir_metadata_algebraic_clean);
 }
 
 bool
@@ -1256,13 +1235,13 @@ void nir_instr_free(nir_instr *instr)
 
    switch (instr->type) {
    case nir_instr_type_tex:
-      free(nir_instr_as_tex(instr)->src);
+      gc_free(nir_instr_as_tex(instr)->src);
       break;
 
    case nir_instr_type_phi: {
       nir_phi_instr *phi = nir_instr_as_phi(instr);
       nir_foreach_phi_src_safe(phi_src, phi) {
-         free(phi_src);
+         gc_free(phi_src);
       }
       break;
    }
@@ -1271,8 +1250,7 @@ void nir_instr_free(nir_instr *instr)
       break;
    }
 
-   list_del(&instr->gc_node);
-   free(instr);
+   gc_free(instr);
 }
 
 void
@@ -92,6 +92,8 @@ extern bool nir_debug_print_shader[MESA_SHADER_KERNEL + 1];
 #define NIR_DEBUG_PRINT_KS               (1u << 19)
 #define NIR_DEBUG_PRINT_CONSTS           (1u << 20)
 #define NIR_DEBUG_VALIDATE_GC_LIST       (1u << 21)
+#define NIR_DEBUG_PASS_STATS             (1u << 22)
+#define NIR_DEBUG_ALGEBRAIC_HITS         (1u << 23)
 
 #define NIR_DEBUG_PRINT (NIR_DEBUG_PRINT_VS  | \
                          NIR_DEBUG_PRINT_TCS | \
@@ -877,7 +879,6 @@ typedef enum PACKED {
 
 typedef struct nir_instr {
    struct exec_node node;
-   struct list_head gc_node;
    struct nir_block *block;
    nir_instr_type type;
 
@@ -2963,6 +2964,17 @@ typedef enum {
     */
    nir_metadata_instr_index = 0x20,
 
+   /** Indicates that nir_function_impl::algebraic_clean is valid.
+    *
+    * This includes the algebraic tables which were last run on the impl
+    * without making progress, and so can't make progress until the impl
+    * changes again.
+    *
+    * A pass can only preserve this metadata type if it doesn't change any
+    * instruction at all.
+    */
+   nir_metadata_algebraic_clean = 0x40,
+
    /** All metadata
     *
     * This includes all nir_metadata flags except not_properly_reset.  Passes
@@ -3013,6 +3025,20 @@ typedef struct {
    bool structured;
 
    nir_metadata valid_metadata;
+
+   /** Algebraic tables which can't make progress, see
+    * nir_metadata_algebraic_clean
+    */
+   struct {
+      const void *table;
+
+      /* The conditions and shader state the table was run with. */
+      const struct nir_shader_compiler_options *options;
+      bool *condition_flags; /**< nir_algebraic_table::num_conditions */
+      uint16_t float_controls_execution_mode;
+      uint16_t workgroup_size[3];
+      bool workgroup_size_variable;
+   } algebraic_clean[4];
 } nir_function_impl;
 
 #define nir_foreach_function_temp_variable(var, impl) \
@@ -3674,7 +3700,13 @@ typedef struct nir_shader {
 
    struct exec_list functions; /** < list of nir_function */
 
-   struct list_head gc_list; /** < list of all nir_instrs allocated on the shader but not yet freed. */
+   /** Context the instructions and their sources are allocated from.
+    *  Dead instructions are freed by nir_sweep() or with the shader.
+    */
+   gc_ctx *gc_ctx;
+
+   /** Bumped by NIR_PASS() when a pass makes progress, and by NIR_PASS_V(). */
+   unsigned progress_count;
 
    /**
     * The size of the variable space for load_input_*, load_uniform_*, etc.
@@ -4349,6 +4381,15 @@ static inline bool should_skip_nir(UNUSED const char *pass_name) { return false;
 static inline bool should_print_nir(UNUSED nir_shader *shader) { return false; }
 #endif /* NDEBUG */
 
+/* A function rather than a member access in the macros below, as some
+ * callers hand them a void pointer.
+ */
+static inline void
+nir_shader_count_progress(nir_shader *shader)
+{
+   shader->progress_count++;
+}
+
 #define _PASS(pass, nir, do_pass) do {                               \
    if (should_skip_nir(#pass)) {                                     \
       printf("skipping %s\n", #pass);                                \
@@ -4372,6 +4413,7 @@ static inline bool should_print_nir(UNUSED nir_shader *shader) { return false; }
       nir_validate_shader(nir, "after " #pass " in " __FILE__);      \
       UNUSED bool _;                                                 \
       progress = true;                                               \
+      nir_shader_count_progress(nir);                                \
       if (should_print_nir(nir))                                     \
          nir_print_shader(nir, stdout);                              \
       nir_metadata_check_validation_flag(nir);                       \
@@ -4382,6 +4424,7 @@ static inline bool should_print_nir(UNUSED nir_shader *shader) { return false; }
    if (should_print_nir(nir))                                        \
       printf("%s\n", #pass);                                         \
    pass(nir, ##__VA_ARGS__);                                         \
+   nir_shader_count_progress(nir);                                   \
    nir_validate_shader(nir, "after " #pass " in " __FILE__);         \
    if (should_print_nir(nir))                                        \
       nir_print_shader(nir, stdout);                                 \
@@ -4389,6 +4432,50 @@ static inline bool should_print_nir(UNUSED nir_shader *shader) { return false; }
 
 #define NIR_SKIP(name) should_skip_nir(#name)
 
+/**
+ * Skips the passes of an optimization loop which can't make progress.
+ *
+ * A pass run with NIR_LOOP_PASS() isn't run again until the shader has
+ * changed since it last reported no progress.  Changes are counted by
+ * NIR_PASS(), NIR_PASS_V() and NIR_LOOP_PASS(), so every pass of the loop
+ * has to be run through one of them, and the arguments of each
+ * NIR_LOOP_PASS() call site must not change from one iteration to the next.
+ *
+ * With NIR_DEBUG=pass_stats, nir_pass_scheduler_finish() prints the time
+ * spent in each pass and in which iterations it made progress.
+ */
+typedef struct {
+   nir_shader *shader;
+   struct hash_table *passes;
+} nir_pass_scheduler;
+
+struct nir_pass_record;
+
+void nir_pass_scheduler_init(nir_pass_scheduler *sched, nir_shader *shader);
+void nir_pass_scheduler_finish(nir_pass_scheduler *sched);
+
+/* Returns NULL if the pass should be skipped. */
+struct nir_pass_record *nir_pass_scheduler_begin(nir_pass_scheduler *sched,
+                                                 const char *name);
+void nir_pass_scheduler_end(nir_pass_scheduler *sched,
+                            struct nir_pass_record *rec, bool progress);
+
+#define _NIR_LOOP_PASS_STR(x) #x
+#define _NIR_LOOP_PASS_SITE(pass, line) \
+   #pass " (" __FILE__ ":" _NIR_LOOP_PASS_STR(line) ")"
+
+#define NIR_LOOP_PASS(progress, sched, nir, pass, ...) do {           \
+   struct nir_pass_record *_rec =                                    \
+      nir_pass_scheduler_begin(sched, _NIR_LOOP_PASS_SITE(pass, __LINE__)); \
+   if (_rec) {                                                       \
+      bool _progress = false;                                        \
+      NIR_PASS(_progress, nir, pass, ##__VA_ARGS__);                 \
+      nir_pass_scheduler_end(sched, _rec, _progress);                \
+      if (_progress)                                                 \
+         progress = true;                                            \
+   }                                                                 \
+} while (0)
+
 /** An instruction filtering callback with writemask
  *
  * Returns true if the instruction should be processed with the associated
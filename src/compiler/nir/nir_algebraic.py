@@ -1143,6 +1143,10 @@ static const struct per_op_table ${pass_name}_pass_op_table[nir_num_search_ops]
 % endfor
 };
 
+#ifndef NDEBUG
+static unsigned ${pass_name}_hits[ARRAY_SIZE(${pass_name}_transforms)];
+#endif
+
 /* Mapping from state index to offset in transforms (0 being no transforms) */
 static const uint16_t ${pass_name}_transform_offsets[] = {
 % for offset in automaton.state_pattern_offsets:
@@ -1151,12 +1155,18 @@ static const uint16_t ${pass_name}_transform_offsets[] = {
 };
 
 static const nir_algebraic_table ${pass_name}_table = {
+   .name = "${pass_name}",
    .transforms = ${pass_name}_transforms,
+   .num_transforms = ARRAY_SIZE(${pass_name}_transforms),
+#ifndef NDEBUG
+   .hits = ${pass_name}_hits,
+#endif
    .transform_offsets = ${pass_name}_transform_offsets,
    .pass_op_table = ${pass_name}_pass_op_table,
    .values = ${pass_name}_values,
    .expression_cond = ${ pass_name + "_expression_cond" if expression_cond else "NULL" },
    .variable_cond = ${ pass_name + "_variable_cond" if variable_cond else "NULL" },
+   .num_conditions = ${len(condition_list)},
 };
 
 bool
@@ -0,0 +1,130 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "nir.h"
+#include "util/hash_table.h"
+#include "util/os_time.h"
+
+/**
+ * \file nir_pass_scheduler.c
+ *
+ * Skips the passes of an optimization loop which can't make progress.
+ *
+ * Every call site of NIR_LOOP_PASS() gets a record of the shader's
+ * progress_count the last time the pass ran without making progress.  As
+ * long as the count hasn't moved, nothing changed in the shader since, so
+ * running the pass again would be a waste: in a typical fixed-point loop
+ * that's every pass of the last iteration, and the passes of the other
+ * iterations which come after the last pass that made progress.
+ */
+
+#define NIR_PASS_STATS_ITERATIONS 4
+
+struct nir_pass_record {
+   const char *name;
+
+   /* Whether the last run made no progress, and the shader's progress_count
+    * at that point.
+    */
+   bool clean;
+   unsigned clean_progress_count;
+
+   int64_t start_time;
+
+   /* statistics for NIR_DEBUG=pass_stats */
+   unsigned num_reached;
+   unsigned num_runs;
+   unsigned num_progress;
+   unsigned progress_at[NIR_PASS_STATS_ITERATIONS];
+   int64_t time_ns;
+};
+
+void
+nir_pass_scheduler_init(nir_pass_scheduler *sched, nir_shader *shader)
+{
+   sched->shader = shader;
+   sched->passes = _mesa_pointer_hash_table_create(NULL);
+}
+
+struct nir_pass_record *
+nir_pass_scheduler_begin(nir_pass_scheduler *sched, const char *name)
+{
+   struct hash_entry *entry = _mesa_hash_table_search(sched->passes, name);
+   struct nir_pass_record *rec;
+
+   if (entry) {
+      rec = entry->data;
+   } else {
+      rec = rzalloc(sched->passes, struct nir_pass_record);
+      rec->name = name;
+      _mesa_hash_table_insert(sched->passes, name, rec);
+   }
+
+   rec->num_reached++;
+
+   if (rec->clean &&
+       rec->clean_progress_count == sched->shader->progress_count)
+      return NULL;
+
+   rec->start_time = os_time_get_nano();
+   return rec;
+}
+
+void
+nir_pass_scheduler_end(nir_pass_scheduler *sched,
+                       struct nir_pass_record *rec, bool progress)
+{
+   rec->time_ns += os_time_get_nano() - rec->start_time;
+   rec->num_runs++;
+
+   if (progress) {
+      unsigned iteration = MIN2(rec->num_reached, NIR_PASS_STATS_ITERATIONS);
+
+      rec->num_progress++;
+      rec->progress_at[iteration - 1]++;
+      rec->clean = false;
+   } else {
+      rec->clean = true;
+      rec->clean_progress_count = sched->shader->progress_count;
+   }
+}
+
+static void
+print_pass_stats(nir_pass_scheduler *sched)
+{
+   int64_t total_ns = 0;
+
+   hash_table_foreach(sched->passes, entry) {
+      const struct nir_pass_record *rec = entry->data;
+      total_ns += rec->time_ns;
+   }
+
+   fprintf(stderr, "NIR pass stats for %s shader %s: %.3f ms\n",
+           _mesa_shader_stage_to_abbrev(sched->shader->info.stage),
+           sched->shader->info.name ? sched->shader->info.name : "",
+           total_ns / 1000000.0);
+   fprintf(stderr, "  %10s %6s %6s %8s  %-16s %s\n",
+           "time (us)", "runs", "skips", "progress", "at iter 1/2/3/4+",
+           "pass");
+
+   hash_table_foreach(sched->passes, entry) {
+      const struct nir_pass_record *rec = entry->data;
+
+      fprintf(stderr, "  %10.1f %6u %6u %8u  %3u/%3u/%3u/%3u  %s\n",
+              rec->time_ns / 1000.0, rec->num_runs,
+              rec->num_reached - rec->num_runs, rec->num_progress,
+              rec->progress_at[0], rec->progress_at[1],
+              rec->progress_at[2], rec->progress_at[3], rec->name);
+   }
+}
+
+void
+nir_pass_scheduler_finish(nir_pass_scheduler *sched)
+{
+   if (NIR_DEBUG(PASS_STATS))
+      print_pass_stats(sched);
+
+   _mesa_hash_table_destroy(sched->passes, NULL);
+   sched->passes = NULL;
+}
@@ -30,6 +30,9 @@
 #include "nir_builder.h"
 #include "nir_worklist.h"
 #include "util/half_float.h"
+#include "util/hash_table.h"
+#include "util/simple_mtx.h"
+#include "util/u_atomic.h"
 
 /* This should be the same as nir_search_max_comm_ops in nir_algebraic.py. */
 #define NIR_SEARCH_MAX_COMM_OPS 8
@@ -625,6 +628,10 @@ UNUSED static void dump_value(const nir_algebraic_table *table, const nir_search
       CASE(i2i)
       CASE(f2i)
       CASE(i2f)
+      CASE(u2f)
+      CASE(f2f)
+      CASE(f2u)
+      CASE(u2u)
 #undef CASE
       default:
          fprintf(stderr, "%s", nir_op_infos[expr->opcode].name);
@@ -648,6 +655,27 @@ UNUSED static void dump_value(const nir_algebraic_table *table, const nir_search
       fprintf(stderr, "@%d", val->bit_size);
 }
 
+/**
+ * Whether the automaton found any transforms which could apply to \p instr.
+ * Only those are worth putting in the worklist.
+ */
+static bool
+nir_algebraic_has_transforms(nir_instr *instr,
+                             const struct util_dynarray *states,
+                             const nir_algebraic_table *table)
+{
+   if (instr->type != nir_instr_type_alu)
+      return false;
+
+   nir_alu_instr *alu = nir_instr_as_alu(instr);
+   if (!alu->dest.dest.is_ssa)
+      return false;
+
+   uint16_t state = *util_dynarray_element(states, uint16_t,
+                                           alu->dest.dest.ssa.index);
+   return table->transform_offsets[state] != 0;
+}
+
 static void
 add_uses_to_worklist(nir_instr *instr,
                      nir_instr_worklist *worklist,
@@ -666,7 +694,7 @@ static void
 nir_algebraic_update_automaton(nir_instr *new_instr,
                                nir_instr_worklist *algebraic_worklist,
                                struct util_dynarray *states,
-                               const struct per_op_table *pass_op_table)
+                               const nir_algebraic_table *table)
 {
 
    nir_instr_worklist *automaton_worklist = nir_instr_worklist_create();
@@ -674,12 +702,15 @@ nir_algebraic_update_automaton(nir_instr *new_instr,
    /* Walk through the tree of uses of our new instruction's SSA value,
     * recursively updating the automaton state until it stabilizes.
     */
-   add_uses_to_worklist(new_instr, automaton_worklist, states, pass_op_table);
+   add_uses_to_worklist(new_instr, automaton_worklist, states,
+                        table->pass_op_table);
 
    nir_instr *instr;
    while ((instr = nir_instr_worklist_pop_head(automaton_worklist))) {
-      nir_instr_worklist_push_tail(algebraic_worklist, instr);
-      add_uses_to_worklist(instr, automaton_worklist, states, pass_op_table);
+      if (nir_algebraic_has_transforms(instr, states, table))
+         nir_instr_worklist_push_tail(algebraic_worklist, instr);
+      add_uses_to_worklist(instr, automaton_worklist, states,
+                           table->pass_op_table);
    }
 
    nir_instr_worklist_destroy(automaton_worklist);
@@ -797,7 +828,7 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
     */
    nir_ssa_def_rewrite_uses(&instr->dest.dest.ssa, ssa_val);
    nir_algebraic_update_automaton(ssa_val->parent_instr, algebraic_worklist,
-                                  states, table->pass_op_table);
+                                  states, table);
 
    /* Nothing uses the instr any more, so drop it out of the program.  Note
     * that the instr may be in the worklist still, so we can't free it
@@ -893,6 +924,10 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
                             &table->values[xform->search].expression,
                             &table->values[xform->replace].value, worklist)) {
          _mesa_hash_table_clear(range_ht, NULL);
+#ifndef NDEBUG
+         if (NIR_DEBUG(ALGEBRAIC_HITS))
+            p_atomic_inc(&table->hits[xform - table->transforms]);
+#endif
          return true;
       }
    }
@@ -900,6 +935,187 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
    return false;
 }
 
+#ifndef NDEBUG
+static simple_mtx_t hits_mtx = _SIMPLE_MTX_INITIALIZER_NP;
+static struct util_dynarray hits_tables;
+
+/**
+ * Prints how often each rule of the tables which ran matched, so that rules
+ * which never match can be found.  The automaton lists a rule once for each
+ * state it may apply to, so the hits of a rule are summed over its entries.
+ */
+static void
+print_algebraic_hits(void)
+{
+   simple_mtx_lock(&hits_mtx);
+
+   util_dynarray_foreach(&hits_tables, const nir_algebraic_table *, entry) {
+      const nir_algebraic_table *table = *entry;
+      struct hash_table_u64 *rules = _mesa_hash_table_u64_create(NULL);
+      unsigned num_rules = 0, num_dead = 0;
+
+      for (unsigned i = 0; i < table->num_transforms; i++) {
+         const struct transform *xform = &table->transforms[i];
+         if (xform->condition_offset == ~0)
+            continue;
+
+         uint64_t key = (uint64_t)xform->search << 48 |
+                        (uint64_t)xform->replace << 32 |
+                        xform->condition_offset;
+         uintptr_t hits = (uintptr_t)_mesa_hash_table_u64_search(rules, key);
+         if (!hits)
+            num_rules++;
+
+         /* Stored off by one so that rules without hits are still found. */
+         hits = (hits ? hits : 1) + table->hits[i];
+         _mesa_hash_table_u64_insert(rules, key, (void *)hits);
+      }
+
+      fprintf(stderr, "%s: %u rules\n", table->name, num_rules);
+
+      for (unsigned i = 0; i < table->num_transforms; i++) {
+         const struct transform *xform = &table->transforms[i];
+         if (xform->condition_offset == ~0)
+            continue;
+
+         uint64_t key = (uint64_t)xform->search << 48 |
+                        (uint64_t)xform->replace << 32 |
+                        xform->condition_offset;
+         uintptr_t hits = (uintptr_t)_mesa_hash_table_u64_search(rules, key);
+         if (!hits)
+            continue;
+
+         /* Print each rule once. */
+         _mesa_hash_table_u64_remove(rules, key);
+         if (hits == 1)
+            num_dead++;
+
+         fprintf(stderr, "  %8"PRIuPTR"  ", hits - 1);
+         dump_value(table, &table->values[xform->search].value);
+         fprintf(stderr, " => ");
+         dump_value(table, &table->values[xform->replace].value);
+         fprintf(stderr, "\n");
+      }
+
+      fprintf(stderr, "%s: %u rules never matched\n", table->name, num_dead);
+      _mesa_hash_table_u64_destroy(rules);
+   }
+
+   simple_mtx_unlock(&hits_mtx);
+}
+
+static void
+register_algebraic_hits(const nir_algebraic_table *table)
+{
+   simple_mtx_lock(&hits_mtx);
+
+   if (!hits_tables.data)
+      atexit(print_algebraic_hits);
+
+   bool found = false;
+   util_dynarray_foreach(&hits_tables, const nir_algebraic_table *, entry) {
+      if (*entry == table) {
+         found = true;
+         break;
+      }
+   }
+   if (!found)
+      util_dynarray_append(&hits_tables, const nir_algebraic_table *, table);
+
+   simple_mtx_unlock(&hits_mtx);
+}
+#endif
+
+/**
+ * Whether \p table was already run on \p impl without making progress, and
+ * nothing changed since.  Besides the instructions, what decides whether a
+ * rule can fire are the condition flags, which come from the shader options
+ * and info, and the shader state read by nir_search and the range analysis.
+ * Drivers do swap nir_shader::options between two runs of the same pass.
+ */
+static bool
+nir_algebraic_is_clean(nir_function_impl *impl,
+                       const bool *condition_flags,
+                       const nir_algebraic_table *table)
+{
+   const nir_shader *shader = impl->function->shader;
+
+   if (!(impl->valid_metadata & nir_metadata_algebraic_clean))
+      return false;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(impl->algebraic_clean); i++) {
+      if (impl->algebraic_clean[i].table != table)
+         continue;
+
+      return impl->algebraic_clean[i].options == shader->options &&
+             impl->algebraic_clean[i].float_controls_execution_mode ==
+                shader->info.float_controls_execution_mode &&
+             memcmp(impl->algebraic_clean[i].workgroup_size,
+                    shader->info.workgroup_size,
+                    sizeof(shader->info.workgroup_size)) == 0 &&
+             impl->algebraic_clean[i].workgroup_size_variable ==
+                shader->info.workgroup_size_variable &&
+             memcmp(impl->algebraic_clean[i].condition_flags, condition_flags,
+                    table->num_conditions * sizeof(bool)) == 0;
+   }
+
+   return false;
+}
+
+static void
+nir_algebraic_mark_clean(nir_function_impl *impl,
+                         const bool *condition_flags,
+                         const nir_algebraic_table *table)
+{
+   const nir_shader *shader = impl->function->shader;
+   unsigned i;
+
+   if (!(impl->valid_metadata & nir_metadata_algebraic_clean)) {
+      for (i = 0; i < ARRAY_SIZE(impl->algebraic_clean); i++)
+         ralloc_free(impl->algebraic_clean[i].condition_flags);
+      memset(impl->algebraic_clean, 0, sizeof(impl->algebraic_clean));
+      impl->valid_metadata |= nir_metadata_algebraic_clean;
+   }
+
+   /* A table only has one entry, for the conditions it last ran with. */
+   for (i = 0; i < ARRAY_SIZE(impl->algebraic_clean); i++) {
+      if (impl->algebraic_clean[i].table == NULL ||
+          impl->algebraic_clean[i].table == table)
+         break;
+   }
+
+   if (i == ARRAY_SIZE(impl->algebraic_clean)) {
+      /* Out of slots, forget the oldest table. */
+      ralloc_free(impl->algebraic_clean[0].condition_flags);
+      memmove(impl->algebraic_clean, impl->algebraic_clean + 1,
+              sizeof(impl->algebraic_clean) - sizeof(impl->algebraic_clean[0]));
+      i = ARRAY_SIZE(impl->algebraic_clean) - 1;
+      impl->algebraic_clean[i].table = NULL;
+      impl->algebraic_clean[i].condition_flags = NULL;
+   }
+
+   if (impl->algebraic_clean[i].table != table) {
+      ralloc_free(impl->algebraic_clean[i].condition_flags);
+      impl->algebraic_clean[i].condition_flags =
+         ralloc_array(impl, bool, MAX2(table->num_conditions, 1));
+      if (!impl->algebraic_clean[i].condition_flags) {
+         impl->algebraic_clean[i].table = NULL;
+         return;
+      }
+   }
+
+   impl->algebraic_clean[i].table = table;
+   impl->algebraic_clean[i].options = shader->options;
+   impl->algebraic_clean[i].float_controls_execution_mode =
+      shader->info.float_controls_execution_mode;
+   memcpy(impl->algebraic_clean[i].workgroup_size, shader->info.workgroup_size,
+          sizeof(shader->info.workgroup_size));
+   impl->algebraic_clean[i].workgroup_size_variable =
+      shader->info.workgroup_size_variable;
+   memcpy(impl->algebraic_clean[i].condition_flags, condition_flags,
+          table->num_conditions * sizeof(bool));
+}
+
 bool
 nir_algebraic_impl(nir_function_impl *impl,
                    const bool *condition_flags,
@@ -907,6 +1123,19 @@ nir_algebraic_impl(nir_function_impl *impl,
 {
    bool progress = false;
 
+#ifndef NDEBUG
+   if (NIR_DEBUG(ALGEBRAIC_HITS))
+      register_algebraic_hits(table);
+#endif
+
+   /* Nothing changed since the last time this table was run without making
+    * progress, so it can't make any now.
+    */
+   if (nir_algebraic_is_clean(impl, condition_flags, table)) {
+      nir_metadata_preserve(impl, nir_metadata_all);
+      return false;
+   }
+
    nir_builder build;
    nir_builder_init(&build, impl);
 
@@ -934,11 +1163,12 @@ nir_algebraic_impl(nir_function_impl *impl,
 
    /* Put our instrs in the worklist such that we're popping the last instr
     * first.  This will encourage us to match the biggest source patterns when
-    * possible.
+    * possible.  Instructions for which the automaton found no transforms
+    * can't match anything and are left out.
     */
    nir_foreach_block_reverse(block, impl) {
       nir_foreach_instr_reverse(instr, block) {
-         if (instr->type == nir_instr_type_alu)
+         if (nir_algebraic_has_transforms(instr, &states, table))
             nir_instr_worklist_push_tail(worklist, instr);
       }
    }
@@ -966,6 +1196,7 @@ nir_algebraic_impl(nir_function_impl *impl,
                                   nir_metadata_dominance);
    } else {
       nir_metadata_preserve(impl, nir_metadata_all);
+      nir_algebraic_mark_clean(impl, condition_flags, table);
    }
 
    return progress;
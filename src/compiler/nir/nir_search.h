@@ -200,8 +200,21 @@ typedef bool (*nir_search_variable_cond)(struct hash_table *range_ht,
 
 /* Generated data table for an algebraic optimization pass. */
 typedef struct {
+   /** Name of the pass, for debug output. */
+   const char *name;
+
    /** Array of all transforms in the pass. */
    const struct transform *transforms;
+   unsigned num_transforms;
+
+#ifndef NDEBUG
+   /**
+    * Number of times each entry of *transforms matched, for
+    * NIR_DEBUG=algebraic_hits.
+    */
+   unsigned *hits;
+#endif
+
    /** Mapping from automaton state index to location in *transforms. */
    const uint16_t *transform_offsets;
    const struct per_op_table *pass_op_table;
@@ -218,6 +231,9 @@ typedef struct {
     * nir_search_variable->cond.
     */
    const nir_search_variable_cond *variable_cond;
+
+   /** Number of entries in the condition_flags of nir_algebraic_impl(). */
+   unsigned num_conditions;
 } nir_algebraic_table;
 
 /* Note: these must match the start states created in
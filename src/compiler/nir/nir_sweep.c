@@ -55,8 +55,19 @@ sweep_block(nir_shader *nir, nir_block *block)
    block->live_out = NULL;
 
    nir_foreach_instr(instr, block) {
-      list_del(&instr->gc_node);
-      list_add(&instr->gc_node, &nir->gc_list);
+      gc_mark_live(nir->gc_ctx, instr);
+
+      switch (instr->type) {
+      case nir_instr_type_tex:
+         gc_mark_live(nir->gc_ctx, nir_instr_as_tex(instr)->src);
+         break;
+      case nir_instr_type_phi:
+         nir_foreach_phi_src(src, nir_instr_as_phi(instr))
+            gc_mark_live(nir->gc_ctx, src);
+         break;
+      default:
+         break;
+      }
    }
 }
 
@@ -135,15 +146,16 @@ nir_sweep(nir_shader *nir)
 {
    void *rubbish = ralloc_context(NULL);
 
-   struct list_head instr_gc_list;
-   list_inithead(&instr_gc_list);
-
-   list_replace(&nir->gc_list, &instr_gc_list);
-   list_inithead(&nir->gc_list);
+   /* Instructions are allocated from the GC context: assume them dead too,
+    * until they're marked live while walking the shader.
+    */
+   gc_sweep_start(nir->gc_ctx);
 
    /* First, move ownership of all the memory to a temporary context; assume dead. */
    ralloc_adopt(rubbish, nir);
 
+   ralloc_steal(nir, nir->gc_ctx);
+
    ralloc_steal(nir, (char *)nir->info.name);
    if (nir->info.label)
       ralloc_steal(nir, (char *)nir->info.label);
@@ -156,11 +168,8 @@ nir_sweep(nir_shader *nir)
       sweep_function(nir, func);
    }
 
-   /* Sweep instrs not found while walking the shader. */
-   list_for_each_entry_safe(nir_instr, instr, &instr_gc_list, gc_node) {
-      nir_instr_free(instr);
-   }
-   assert(list_is_empty(&instr_gc_list));
+   /* Free the instrs not found while walking the shader. */
+   gc_sweep_end(nir->gc_ctx);
 
    ralloc_steal(nir, nir->constant_data);
    ralloc_steal(nir, nir->xfb_info);
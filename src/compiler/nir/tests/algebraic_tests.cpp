@@ -149,6 +149,38 @@ TEST_F(nir_opt_algebraic_test, irem_pow2_src2)
    test_2src_op(nir_op_irem, INT32_MIN, -4);
 }
 
+TEST_F(nir_opt_algebraic_test, skip_unchanged_impl)
+{
+   nir_ssa_def *x = nir_load_var(b, res_var);
+   nir_store_var(b, res_var, nir_iadd(b, x, nir_imm_int(b, 0)), 0x1);
+
+   EXPECT_TRUE(nir_opt_algebraic(b->shader));
+   EXPECT_FALSE(nir_opt_algebraic(b->shader));
+   EXPECT_TRUE(b->impl->valid_metadata & nir_metadata_algebraic_clean);
+
+   /* A new instruction has to be looked at again. */
+   b->cursor = nir_after_cf_list(&b->impl->body);
+   nir_store_var(b, res_var, nir_imul(b, x, nir_imm_int(b, 1)), 0x1);
+   EXPECT_FALSE(b->impl->valid_metadata & nir_metadata_algebraic_clean);
+   EXPECT_TRUE(nir_opt_algebraic(b->shader));
+   EXPECT_FALSE(nir_opt_algebraic(b->shader));
+}
+
+TEST_F(nir_opt_algebraic_test, skip_unchanged_impl_options)
+{
+   nir_ssa_def *x = nir_load_var(b, res_var);
+   nir_store_var(b, res_var, nir_extract_u8(b, x, nir_imm_int(b, 1)), 0x1);
+
+   EXPECT_FALSE(nir_opt_algebraic(b->shader));
+   EXPECT_TRUE(b->impl->valid_metadata & nir_metadata_algebraic_clean);
+
+   /* The same impl has to be looked at again with different options. */
+   nir_shader_compiler_options options = *b->shader->options;
+   options.lower_extract_byte = true;
+   b->shader->options = &options;
+   EXPECT_TRUE(nir_opt_algebraic(b->shader));
+}
+
 TEST_F(nir_opt_idiv_const_test, umod)
 {
    for (uint32_t d : {16u, 17u, 0u, UINT32_MAX}) {
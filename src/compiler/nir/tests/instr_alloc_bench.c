@@ -0,0 +1,60 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * Measures how long it takes to build shaders of various sizes, fold and
+ * dead-code eliminate them, sweep them and free them, which is dominated by
+ * allocating and freeing instructions.
+ */
+
+#include <stdio.h>
+
+#include "util/os_time.h"
+#include "nir.h"
+#include "nir_builder.h"
+
+static const nir_shader_compiler_options options = { 0 };
+
+static void
+bench_shader(unsigned num_instrs)
+{
+   nir_builder b =
+      nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, &options, "bench");
+   nir_ssa_def *value = nir_imm_int(&b, 0);
+
+   for (unsigned i = 0; i < num_instrs / 2; i++)
+      value = nir_iadd(&b, value, nir_imm_int(&b, i));
+
+   /* Folding replaces every iadd with a new load_const and DCE frees the
+    * old instructions, so this churns through the allocator.
+    */
+   nir_opt_constant_folding(b.shader);
+   nir_opt_dce(b.shader);
+   nir_sweep(b.shader);
+
+   ralloc_free(b.shader);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+   const unsigned total = 4 * 1024 * 1024;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+      const unsigned reps = total / sizes[i];
+      int64_t start = os_time_get_nano();
+
+      for (unsigned r = 0; r < reps; r++)
+         bench_shader(sizes[i]);
+
+      int64_t end = os_time_get_nano();
+
+      printf("shader %8u instrs: %10.2f us/shader %8.2f ns/instr\n",
+             sizes[i], (end - start) / 1000.0 / reps,
+             (double)(end - start) / ((double)reps * sizes[i]));
+   }
+
+   return 0;
+}
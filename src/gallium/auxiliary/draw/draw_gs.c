@@ -31,6 +31,7 @@
 #include "draw_context.h"
 #ifdef DRAW_LLVM_AVAILABLE
 #include "draw_llvm.h"
+#include "gallivm/lp_bld_nir.h"
 #endif
 
 #include "tgsi/tgsi_parse.h"
@@ -891,6 +892,8 @@ draw_create_geometry_shader(struct draw_context *draw,
             gs->info.file_max[TGSI_FILE_SAMPLER]+1,
             gs->info.file_max[TGSI_FILE_SAMPLER_VIEW]+1,
             gs->info.file_max[TGSI_FILE_IMAGE]+1);
+      if (state->type == PIPE_SHADER_IR_NIR && draw->disk_cache_cookie)
+         lp_nir_sha1(state->ir.nir, llvm_gs->ir_sha1);
    } else
 #endif
    {
@@ -833,28 +833,17 @@ draw_llvm_destroy(struct draw_llvm *llvm)
 }
 
 static void
-draw_get_ir_cache_key(struct nir_shader *nir,
+draw_get_ir_cache_key(const unsigned char ir_sha1[20],
                       const void *key, size_t key_size,
                       uint32_t val_32bit,
                       unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
    struct mesa_sha1 ctx;
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, key, key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
+   _mesa_sha1_update(&ctx, ir_sha1, 20);
    _mesa_sha1_update(&ctx, &val_32bit, 4);
    _mesa_sha1_final(&ctx, ir_sha1_cache_key);
-
-   blob_finish(&blob);
 }
 
 /**
@@ -886,7 +875,7 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
             variant->shader->variants_cached);
 
    if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
+      draw_get_ir_cache_key(shader->ir_sha1,
                             key,
                             shader->variant_key_size,
                             num_inputs,
@@ -2942,7 +2931,7 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    memcpy(&variant->key, key, shader->variant_key_size);
 
    if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
+      draw_get_ir_cache_key(shader->ir_sha1,
                             key,
                             shader->variant_key_size,
                             num_outputs,
@@ -3606,7 +3595,7 @@ draw_tcs_llvm_create_variant(struct draw_llvm *llvm,
    memcpy(&variant->key, key, shader->variant_key_size);
 
    if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
+      draw_get_ir_cache_key(shader->ir_sha1,
                             key,
                             shader->variant_key_size,
                             num_outputs,
@@ -4137,7 +4126,7 @@ draw_tes_llvm_create_variant(struct draw_llvm *llvm,
 
    memcpy(&variant->key, key, shader->variant_key_size);
    if (shader->base.state.ir.nir && llvm->draw->disk_cache_cookie) {
-      draw_get_ir_cache_key(shader->base.state.ir.nir,
+      draw_get_ir_cache_key(shader->ir_sha1,
                             key,
                             shader->variant_key_size,
                             num_outputs,
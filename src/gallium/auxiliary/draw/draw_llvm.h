@@ -797,6 +797,7 @@ struct llvm_vertex_shader {
    struct draw_llvm_variant_list_item variants;
    unsigned variants_created;
    unsigned variants_cached;
+   unsigned char ir_sha1[20];   /**< of the NIR as created */
 };
 
 struct llvm_geometry_shader {
@@ -806,6 +807,7 @@ struct llvm_geometry_shader {
    struct draw_gs_llvm_variant_list_item variants;
    unsigned variants_created;
    unsigned variants_cached;
+   unsigned char ir_sha1[20];   /**< of the NIR as created */
 };
 
 struct llvm_tess_ctrl_shader {
@@ -815,6 +817,7 @@ struct llvm_tess_ctrl_shader {
    struct draw_tcs_llvm_variant_list_item variants;
    unsigned variants_created;
    unsigned variants_cached;
+   unsigned char ir_sha1[20];   /**< of the NIR as created */
 };
 
 struct llvm_tess_eval_shader {
@@ -824,6 +827,7 @@ struct llvm_tess_eval_shader {
    struct draw_tes_llvm_variant_list_item variants;
    unsigned variants_created;
    unsigned variants_cached;
+   unsigned char ir_sha1[20];   /**< of the NIR as created */
 };
 
 struct draw_llvm {
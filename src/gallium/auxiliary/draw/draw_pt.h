@@ -124,6 +124,14 @@ struct draw_pt_middle_end {
 
    int (*get_max_vertex_count)( struct draw_pt_middle_end * );
 
+   /* Optional.  If this returns TRUE, the run calls until end_segments()
+    * are segments of one draw of \p count vertices, and the middle end may
+    * vertex shade them concurrently.  They are still emitted in order, by
+    * end_segments() at the latest.
+    */
+   boolean (*begin_segments)( struct draw_pt_middle_end *, unsigned count );
+   void (*end_segments)( struct draw_pt_middle_end * );
+
    void (*finish)( struct draw_pt_middle_end * );
    void (*destroy)( struct draw_pt_middle_end * );
 };
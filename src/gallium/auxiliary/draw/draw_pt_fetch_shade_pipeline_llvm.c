@@ -25,9 +25,11 @@
  *
  **************************************************************************/
 
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/u_queue.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_tess.h"
@@ -41,6 +43,48 @@
 #include "gallivm/lp_bld_debug.h"
 
 
+/* Draws with at least this many vertices have their segments shaded
+ * concurrently.
+ */
+#define LLVM_SEGMENTS_MIN_VERTICES (8 * 1024)
+#define LLVM_MAX_SEGMENTS 16
+#define LLVM_MAX_VS_THREADS 8
+
+struct llvm_middle_end;
+
+/* The arguments of the vertex shader variant for one segment, which are
+ * captured so that it can run on another thread.
+ */
+struct llvm_vs_args {
+   struct vertex_header *verts;
+   const struct draw_vertex_buffer *vbuffer;
+   struct pipe_vertex_buffer *vertex_buffer;
+   const unsigned *elts;
+   unsigned count;
+   unsigned start_or_maxelt;
+   unsigned vid_base;
+   unsigned instance_id;
+   unsigned start_instance;
+   unsigned drawid;
+   unsigned viewid;
+};
+
+
+/* A segment whose vertices are shaded by a worker thread, and which is
+ * finished on the draw thread in submission order.
+ */
+struct llvm_segment {
+   struct util_queue_fence fence;
+   struct llvm_middle_end *fpme;
+   struct llvm_vs_args args;
+   struct draw_prim_info prim_info;
+   unsigned prim_count;
+   unsigned *fetch_elts;
+   ushort *draw_elts;
+   boolean clipped;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -58,6 +102,13 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /* Segments queued between begin_segments and end_segments, in a ring. */
+   struct util_queue queue;
+   unsigned num_threads;
+   struct llvm_segment segments[LLVM_MAX_SEGMENTS];
+   unsigned next_segment, num_segments, max_segments;
+   boolean segments_active;
 };
 
 
@@ -556,12 +607,93 @@ emit(struct pt_emit *emit,
 }
 
 
+static boolean
+llvm_alloc_vertices(struct llvm_middle_end *fpme, unsigned count,
+                    struct draw_vertex_info *vert_info)
+{
+   vert_info->count = count;
+   vert_info->vertex_size = fpme->vertex_size;
+   vert_info->stride = fpme->vertex_size;
+   vert_info->verts = (struct vertex_header *)
+      MALLOC(fpme->vertex_size *
+             align(count, lp_native_vector_width / 32) +
+             DRAW_EXTRA_VERTICES_PADDING);
+   return vert_info->verts != NULL;
+}
+
+
 static void
-llvm_pipeline_generic(struct draw_pt_middle_end *middle,
-                      const struct draw_fetch_info *fetch_info,
-                      const struct draw_prim_info *in_prim_info)
+llvm_get_vs_args(struct draw_context *draw,
+                 const struct draw_fetch_info *fetch_info,
+                 struct vertex_header *verts,
+                 struct llvm_vs_args *args)
+{
+   args->verts = verts;
+   args->vbuffer = draw->pt.user.vbuffer;
+   args->vertex_buffer = draw->pt.vertex_buffer;
+   args->count = fetch_info->count;
+   args->instance_id = draw->instance_id;
+   args->start_instance = draw->start_instance;
+   args->drawid = draw->pt.user.drawid;
+   args->viewid = draw->pt.user.viewid;
+
+   if (fetch_info->linear) {
+      args->start_or_maxelt = fetch_info->start;
+      args->vid_base = draw->start_index;
+      args->elts = NULL;
+   }
+   else {
+      args->start_or_maxelt = draw->pt.user.eltMax;
+      args->vid_base = draw->pt.user.eltBias;
+      args->elts = fetch_info->elts;
+   }
+}
+
+
+static boolean
+llvm_run_vs(struct llvm_middle_end *fpme, const struct llvm_vs_args *args)
+{
+   return fpme->current_variant->jit_func(&fpme->llvm->jit_context,
+                                          args->verts,
+                                          args->vbuffer,
+                                          args->count,
+                                          args->start_or_maxelt,
+                                          fpme->vertex_size,
+                                          args->vertex_buffer,
+                                          args->instance_id,
+                                          args->vid_base,
+                                          args->start_instance,
+                                          args->elts, args->drawid,
+                                          args->viewid);
+}
+
+
+static void
+llvm_update_statistics(struct draw_context *draw,
+                       const struct draw_fetch_info *fetch_info,
+                       const struct draw_prim_info *prim_info)
+{
+   if (draw->collect_statistics) {
+      draw->statistics.ia_vertices += prim_info->count;
+      if (prim_info->prim == PIPE_PRIM_PATCHES)
+         draw->statistics.ia_primitives += prim_info->count / draw->pt.vertices_per_patch;
+      else
+         draw->statistics.ia_primitives +=
+            u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
+      draw->statistics.vs_invocations += fetch_info->count;
+   }
+}
+
+
+/**
+ * Run everything after the vertex shader, and free the vertices.
+ */
+static void
+llvm_pipeline_finish(struct llvm_middle_end *fpme,
+                     struct draw_vertex_info *llvm_vert_info,
+                     const struct draw_prim_info *in_prim_info,
+                     boolean clipped)
 {
-   struct llvm_middle_end *fpme = llvm_middle_end(middle);
    struct draw_context *draw = fpme->draw;
    struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
    struct draw_tess_ctrl_shader *tcs_shader = draw->tcs.tess_ctrl_shader;
@@ -569,7 +701,6 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
    struct draw_prim_info tcs_prim_info;
    struct draw_prim_info tes_prim_info;
    struct draw_prim_info gs_prim_info[TGSI_MAX_VERTEX_STREAMS];
-   struct draw_vertex_info llvm_vert_info;
    struct draw_vertex_info tcs_vert_info;
    struct draw_vertex_info tes_vert_info;
    struct draw_vertex_info gs_vert_info[TGSI_MAX_VERTEX_STREAMS];
@@ -579,62 +710,11 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
    const struct draw_prim_info *prim_info = in_prim_info;
    boolean free_prim_info = FALSE;
    unsigned opt = fpme->opt;
-   boolean clipped = 0;
-   unsigned start_or_maxelt, vid_base;
-   const unsigned *elts;
    ushort *tes_elts_out = NULL;
 
    memset(&gs_vert_info, 0, sizeof(struct draw_vertex_info) * TGSI_MAX_VERTEX_STREAMS);
-   assert(fetch_info->count > 0);
-   llvm_vert_info.count = fetch_info->count;
-   llvm_vert_info.vertex_size = fpme->vertex_size;
-   llvm_vert_info.stride = fpme->vertex_size;
-   llvm_vert_info.verts = (struct vertex_header *)
-      MALLOC(fpme->vertex_size *
-             align(fetch_info->count, lp_native_vector_width / 32) +
-             DRAW_EXTRA_VERTICES_PADDING);
-   if (!llvm_vert_info.verts) {
-      assert(0);
-      return;
-   }
-
-   if (draw->collect_statistics) {
-      draw->statistics.ia_vertices += prim_info->count;
-      if (prim_info->prim == PIPE_PRIM_PATCHES)
-         draw->statistics.ia_primitives += prim_info->count / draw->pt.vertices_per_patch;
-      else
-         draw->statistics.ia_primitives +=
-            u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
-      draw->statistics.vs_invocations += fetch_info->count;
-   }
 
-   if (fetch_info->linear) {
-      start_or_maxelt = fetch_info->start;
-      vid_base = draw->start_index;
-      elts = NULL;
-   }
-   else {
-      start_or_maxelt = draw->pt.user.eltMax;
-      vid_base = draw->pt.user.eltBias;
-      elts = fetch_info->elts;
-   }
-   clipped = fpme->current_variant->jit_func(&fpme->llvm->jit_context,
-                                             llvm_vert_info.verts,
-                                             draw->pt.user.vbuffer,
-                                             fetch_info->count,
-                                             start_or_maxelt,
-                                             fpme->vertex_size,
-                                             draw->pt.vertex_buffer,
-                                             draw->instance_id,
-                                             vid_base,
-                                             draw->start_instance,
-                                             elts, draw->pt.user.drawid,
-                                             draw->pt.user.viewid);
-
-   /* Finished with fetch and vs:
-    */
-   fetch_info = NULL;
-   vert_info = &llvm_vert_info;
+   vert_info = llvm_vert_info;
 
    if (opt & PT_SHADE) {
       struct draw_vertex_shader *vshader = draw->vs.vertex_shader;
@@ -779,6 +859,166 @@ out:
 }
 
 
+static void
+llvm_segment_shade(void *job, UNUSED void *gdata, UNUSED int thread_index)
+{
+   struct llvm_segment *seg = (struct llvm_segment *)job;
+
+   seg->clipped = llvm_run_vs(seg->fpme, &seg->args);
+}
+
+
+static void
+llvm_segment_finish(struct llvm_middle_end *fpme, struct llvm_segment *seg)
+{
+   struct draw_vertex_info vert_info;
+
+   util_queue_fence_wait(&seg->fence);
+
+   vert_info.count = seg->args.count;
+   vert_info.vertex_size = fpme->vertex_size;
+   vert_info.stride = fpme->vertex_size;
+   vert_info.verts = seg->args.verts;
+
+   llvm_pipeline_finish(fpme, &vert_info, &seg->prim_info, seg->clipped);
+
+   FREE(seg->fetch_elts);
+   FREE(seg->draw_elts);
+   seg->fetch_elts = NULL;
+   seg->draw_elts = NULL;
+}
+
+
+/* Finish the oldest segment. */
+static void
+llvm_finish_oldest_segment(struct llvm_middle_end *fpme)
+{
+   unsigned first = (fpme->next_segment + LLVM_MAX_SEGMENTS -
+                     fpme->num_segments) % LLVM_MAX_SEGMENTS;
+
+   llvm_segment_finish(fpme, &fpme->segments[first]);
+   fpme->num_segments--;
+}
+
+
+/**
+ * Run the whole pipeline for the vertices in vert_info on this thread.
+ */
+static void
+llvm_run_pipeline(struct llvm_middle_end *fpme,
+                  const struct draw_fetch_info *fetch_info,
+                  const struct draw_prim_info *prim_info,
+                  struct draw_vertex_info *vert_info)
+{
+   struct draw_context *draw = fpme->draw;
+   struct llvm_vs_args args;
+   boolean clipped;
+
+   llvm_update_statistics(draw, fetch_info, prim_info);
+   llvm_get_vs_args(draw, fetch_info, vert_info->verts, &args);
+   clipped = llvm_run_vs(fpme, &args);
+
+   llvm_pipeline_finish(fpme, vert_info, prim_info, clipped);
+}
+
+
+/**
+ * Queue the vertex shader of the segment on the worker threads. The rest
+ * of the pipeline runs when the segment is finished.
+ */
+static void
+llvm_queue_segment(struct llvm_middle_end *fpme,
+                   const struct draw_fetch_info *fetch_info,
+                   const struct draw_prim_info *prim_info)
+{
+   struct draw_context *draw = fpme->draw;
+   struct draw_vertex_info vert_info;
+   struct llvm_segment *seg;
+
+   if (fpme->num_segments == fpme->max_segments)
+      llvm_finish_oldest_segment(fpme);
+
+   seg = &fpme->segments[fpme->next_segment];
+
+   if (!llvm_alloc_vertices(fpme, fetch_info->count, &vert_info)) {
+      assert(0);
+      return;
+   }
+
+   /* The element lists belong to the caller, which reuses them for the next
+    * segment.
+    */
+   if (!fetch_info->linear) {
+      seg->fetch_elts = MALLOC(fetch_info->count * sizeof(unsigned));
+      if (!seg->fetch_elts)
+         goto fail;
+      memcpy(seg->fetch_elts, fetch_info->elts,
+             fetch_info->count * sizeof(unsigned));
+   }
+
+   seg->prim_info = *prim_info;
+   seg->prim_count = prim_info->count;
+   seg->prim_info.primitive_lengths = &seg->prim_count;
+   if (!prim_info->linear) {
+      seg->draw_elts = MALLOC(prim_info->count * sizeof(ushort));
+      if (!seg->draw_elts)
+         goto fail;
+      memcpy(seg->draw_elts, prim_info->elts, prim_info->count * sizeof(ushort));
+      seg->prim_info.elts = seg->draw_elts;
+   }
+
+   llvm_update_statistics(draw, fetch_info, prim_info);
+   llvm_get_vs_args(draw, fetch_info, vert_info.verts, &seg->args);
+   seg->args.elts = seg->fetch_elts;
+   seg->fpme = fpme;
+
+   util_queue_add_job(&fpme->queue, seg, &seg->fence,
+                      llvm_segment_shade, NULL, 0);
+
+   fpme->next_segment = (fpme->next_segment + 1) % LLVM_MAX_SEGMENTS;
+   fpme->num_segments++;
+   return;
+
+fail:
+   FREE(seg->fetch_elts);
+   FREE(seg->draw_elts);
+   seg->fetch_elts = NULL;
+   seg->draw_elts = NULL;
+
+   /* Shade it here instead, after the queued segments to keep the order of
+    * the primitives.
+    */
+   while (fpme->num_segments)
+      llvm_finish_oldest_segment(fpme);
+
+   llvm_run_pipeline(fpme, fetch_info, prim_info, &vert_info);
+}
+
+
+static void
+llvm_pipeline_generic(struct draw_pt_middle_end *middle,
+                      const struct draw_fetch_info *fetch_info,
+                      const struct draw_prim_info *prim_info)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   struct draw_vertex_info vert_info;
+
+   assert(fetch_info->count > 0);
+
+   if (fpme->segments_active) {
+      llvm_queue_segment(fpme, fetch_info, prim_info);
+      return;
+   }
+
+   if (!llvm_alloc_vertices(fpme, fetch_info->count, &vert_info)) {
+      assert(0);
+      return;
+   }
+
+   llvm_run_pipeline(fpme, fetch_info, prim_info, &vert_info);
+}
+
+
 static inline unsigned
 prim_type(unsigned prim, unsigned flags)
 {
@@ -879,6 +1119,40 @@ llvm_middle_end_linear_run_elts(struct draw_pt_middle_end *middle,
 }
 
 
+static boolean
+llvm_middle_end_begin_segments(struct draw_pt_middle_end *middle,
+                               unsigned count)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+
+   if (count < LLVM_SEGMENTS_MIN_VERTICES || !fpme->num_threads)
+      return FALSE;
+
+   /* Only create the threads once a draw is large enough to need them. */
+   if (!util_queue_is_initialized(&fpme->queue) &&
+       !util_queue_init(&fpme->queue, "drawvs", LLVM_MAX_SEGMENTS,
+                        fpme->num_threads, 0, NULL)) {
+      fpme->num_threads = 0;
+      return FALSE;
+   }
+
+   fpme->segments_active = TRUE;
+   return TRUE;
+}
+
+
+static void
+llvm_middle_end_end_segments(struct draw_pt_middle_end *middle)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+
+   while (fpme->num_segments)
+      llvm_finish_oldest_segment(fpme);
+
+   fpme->segments_active = FALSE;
+}
+
+
 static void
 llvm_middle_end_finish(struct draw_pt_middle_end *middle)
 {
@@ -903,6 +1177,12 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
    if (fpme->post_vs)
       draw_pt_post_vs_destroy( fpme->post_vs );
 
+   if (util_queue_is_initialized(&fpme->queue))
+      util_queue_destroy(&fpme->queue);
+
+   for (unsigned i = 0; i < LLVM_MAX_SEGMENTS; i++)
+      util_queue_fence_destroy(&fpme->segments[i].fence);
+
    FREE(middle);
 }
 
@@ -924,11 +1204,23 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    fpme->base.run             = llvm_middle_end_run;
    fpme->base.run_linear      = llvm_middle_end_linear_run;
    fpme->base.run_linear_elts = llvm_middle_end_linear_run_elts;
+   fpme->base.begin_segments  = llvm_middle_end_begin_segments;
+   fpme->base.end_segments    = llvm_middle_end_end_segments;
    fpme->base.finish          = llvm_middle_end_finish;
    fpme->base.destroy         = llvm_middle_end_destroy;
 
    fpme->draw = draw;
 
+   for (unsigned i = 0; i < LLVM_MAX_SEGMENTS; i++)
+      util_queue_fence_init(&fpme->segments[i].fence);
+
+   /* Off by default: drivers like llvmpipe already keep the CPUs busy with
+    * their own threads.
+    */
+   fpme->num_threads = debug_get_num_option("DRAW_VS_THREADS", 0);
+   fpme->num_threads = MIN2(fpme->num_threads, LLVM_MAX_VS_THREADS);
+   fpme->max_segments = MIN2(fpme->num_threads * 2, LLVM_MAX_SEGMENTS);
+
    fpme->fetch = draw_pt_fetch_create( draw );
    if (!fpme->fetch)
       goto fail;
@@ -23,8 +23,10 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_prim.h"
 
 #include "draw/draw_context.h"
 #include "draw/draw_private.h"
@@ -32,6 +34,7 @@
 
 #define SEGMENT_SIZE 1024
 #define MAP_SIZE     256
+#define FIFO_MAX_SIZE 128
 
 /* The largest possible index within an index buffer */
 #define MAX_ELT_IDX 0xffffffff
@@ -44,6 +47,10 @@ struct vsplit_frontend {
 
    struct draw_pt_middle_end *middle;
 
+   /* The split function for the index size. */
+   void (*run)(struct draw_pt_front_end *frontend,
+               unsigned start, unsigned count);
+
    unsigned max_vertices;
    ushort segment_size;
 
@@ -60,7 +67,20 @@ struct vsplit_frontend {
 
       ushort num_fetch_elts;
       ushort num_draw_elts;
+
+      /* The most recently shaded fetch elements, in a ring, for when the
+       * direct mapped lookup above misses because of a collision.
+       */
+      unsigned fifo_fetches[FIFO_MAX_SIZE];
+      ushort fifo_draws[FIFO_MAX_SIZE];
+      ushort fifo_head;
+      ushort fifo_count;
+      ushort fifo_size;
    } cache;
+
+   /* per-draw statistics for DRAW_VCACHE_STATS */
+   boolean report_stats;
+   unsigned num_shaded;
 };
 
 
@@ -71,16 +91,51 @@ vsplit_clear_cache(struct vsplit_frontend *vsplit)
    vsplit->cache.has_max_fetch = FALSE;
    vsplit->cache.num_fetch_elts = 0;
    vsplit->cache.num_draw_elts = 0;
+   vsplit->cache.fifo_head = 0;
+   vsplit->cache.fifo_count = 0;
 }
 
 static void
 vsplit_flush_cache(struct vsplit_frontend *vsplit, unsigned flags)
 {
+   vsplit->num_shaded += vsplit->cache.num_fetch_elts;
    vsplit->middle->run(vsplit->middle,
          vsplit->fetch_elts, vsplit->cache.num_fetch_elts,
          vsplit->draw_elts, vsplit->cache.num_draw_elts, flags);
 }
 
+/**
+ * Look for a fetch element in the FIFO of recently shaded elements.
+ * Returns the draw element, or -1 when the element is not there.
+ */
+static inline int
+vsplit_fifo_lookup(const struct vsplit_frontend *vsplit, unsigned fetch)
+{
+   unsigned i;
+
+   for (i = 0; i < vsplit->cache.fifo_count; i++) {
+      if (vsplit->cache.fifo_fetches[i] == fetch)
+         return vsplit->cache.fifo_draws[i];
+   }
+
+   return -1;
+}
+
+static inline void
+vsplit_fifo_add(struct vsplit_frontend *vsplit, unsigned fetch, ushort draw)
+{
+   const unsigned head = vsplit->cache.fifo_head;
+
+   if (!vsplit->cache.fifo_size)
+      return;
+
+   vsplit->cache.fifo_fetches[head] = fetch;
+   vsplit->cache.fifo_draws[head] = draw;
+   vsplit->cache.fifo_head = (head + 1) % vsplit->cache.fifo_size;
+   if (vsplit->cache.fifo_count < vsplit->cache.fifo_size)
+      vsplit->cache.fifo_count++;
+}
+
 /**
  * Add a fetch element and add it to the draw elements.
  */
@@ -94,13 +149,20 @@ vsplit_add_cache(struct vsplit_frontend *vsplit, unsigned fetch)
    /* If the value isn't in the cache or it's an overflow due to the
     * element bias */
    if (vsplit->cache.fetches[hash] != fetch) {
+      int draw_elt = vsplit_fifo_lookup(vsplit, fetch);
+
+      if (draw_elt < 0) {
+         draw_elt = vsplit->cache.num_fetch_elts;
+
+         /* add fetch */
+         assert(vsplit->cache.num_fetch_elts < vsplit->segment_size);
+         vsplit->fetch_elts[vsplit->cache.num_fetch_elts++] = fetch;
+         vsplit_fifo_add(vsplit, fetch, draw_elt);
+      }
+
       /* update cache */
       vsplit->cache.fetches[hash] = fetch;
-      vsplit->cache.draws[hash] = vsplit->cache.num_fetch_elts;
-
-      /* add fetch */
-      assert(vsplit->cache.num_fetch_elts < vsplit->segment_size);
-      vsplit->fetch_elts[vsplit->cache.num_fetch_elts++] = fetch;
+      vsplit->cache.draws[hash] = draw_elt;
    }
 
    vsplit->draw_elts[vsplit->cache.num_draw_elts++] = vsplit->cache.draws[hash];
@@ -197,6 +259,36 @@ vsplit_add_cache_uint(struct vsplit_frontend *vsplit, const uint *elts,
 #include "draw_pt_vsplit_tmp.h"
 
 
+/**
+ * Split the draw, letting the middle end shade the segments of large draws
+ * concurrently.
+ */
+static void vsplit_run(struct draw_pt_front_end *frontend,
+                       unsigned start, unsigned count)
+{
+   struct vsplit_frontend *vsplit = (struct vsplit_frontend *) frontend;
+   struct draw_pt_middle_end *middle = vsplit->middle;
+   boolean segments = middle->begin_segments &&
+                      middle->begin_segments(middle, count);
+
+   vsplit->num_shaded = 0;
+
+   vsplit->run(frontend, start, count);
+
+   if (segments)
+      middle->end_segments(middle);
+
+   if (vsplit->report_stats && vsplit->draw->pt.user.eltSize) {
+      unsigned num_prims = u_decomposed_prims_for_vertices(vsplit->prim, count);
+
+      /* The average cache miss ratio: shaded vertices per primitive. */
+      debug_printf("draw: %u indices, %u vertices shaded, ACMR %.3f\n",
+                   count, vsplit->num_shaded,
+                   num_prims ? (float) vsplit->num_shaded / num_prims : 0.0f);
+   }
+}
+
+
 static void vsplit_prepare(struct draw_pt_front_end *frontend,
                            unsigned in_prim,
                            struct draw_pt_middle_end *middle,
@@ -206,22 +298,24 @@ static void vsplit_prepare(struct draw_pt_front_end *frontend,
 
    switch (vsplit->draw->pt.user.eltSize) {
    case 0:
-      vsplit->base.run = vsplit_run_linear;
+      vsplit->run = vsplit_run_linear;
       break;
    case 1:
-      vsplit->base.run = vsplit_run_ubyte;
+      vsplit->run = vsplit_run_ubyte;
       break;
    case 2:
-      vsplit->base.run = vsplit_run_ushort;
+      vsplit->run = vsplit_run_ushort;
       break;
    case 4:
-      vsplit->base.run = vsplit_run_uint;
+      vsplit->run = vsplit_run_uint;
       break;
    default:
       assert(0);
       break;
    }
 
+   vsplit->base.run = vsplit_run;
+
    /* split only */
    vsplit->prim = in_prim;
 
@@ -263,6 +357,10 @@ struct draw_pt_front_end *draw_pt_vsplit(struct draw_context *draw)
    vsplit->base.destroy = vsplit_destroy;
    vsplit->draw = draw;
 
+   vsplit->cache.fifo_size = CLAMP(debug_get_num_option("DRAW_VCACHE_SIZE", 0),
+                                   0, FIFO_MAX_SIZE);
+   vsplit->report_stats = debug_get_bool_option("DRAW_VCACHE_STATS", FALSE);
+
    for (i = 0; i < SEGMENT_SIZE; i++)
       vsplit->identity_draw_elts[i] = i;
 
@@ -117,9 +117,13 @@ CONCAT(vsplit_primitive_, ELT_TYPE)(struct vsplit_frontend *vsplit,
       draw_elts = vsplit->draw_elts;
    }
 
-   return vsplit->middle->run_linear_elts(vsplit->middle,
-                                          fetch_start, fetch_count,
-                                          draw_elts, icount, 0x0);
+   if (!vsplit->middle->run_linear_elts(vsplit->middle,
+                                        fetch_start, fetch_count,
+                                        draw_elts, icount, 0x0))
+      return FALSE;
+
+   vsplit->num_shaded += fetch_count;
+   return TRUE;
 }
 
 /**
@@ -25,6 +25,7 @@
 #include "draw_tess.h"
 #ifdef DRAW_LLVM_AVAILABLE
 #include "draw_llvm.h"
+#include "gallivm/lp_bld_nir.h"
 #endif
 
 #include "tessellator/p_tessellator.h"
@@ -463,6 +464,8 @@ draw_create_tess_ctrl_shader(struct draw_context *draw,
                                         tcs->info.file_max[TGSI_FILE_SAMPLER]+1,
                                         tcs->info.file_max[TGSI_FILE_SAMPLER_VIEW]+1,
                                         tcs->info.file_max[TGSI_FILE_IMAGE]+1);
+      if (draw->disk_cache_cookie)
+         lp_nir_sha1(state->ir.nir, llvm_tcs->ir_sha1);
    }
 #endif
    return tcs;
@@ -588,6 +591,8 @@ draw_create_tess_eval_shader(struct draw_context *draw,
                                         tes->info.file_max[TGSI_FILE_SAMPLER]+1,
                                         tes->info.file_max[TGSI_FILE_SAMPLER_VIEW]+1,
                                         tes->info.file_max[TGSI_FILE_IMAGE]+1);
+      if (draw->disk_cache_cookie)
+         lp_nir_sha1(state->ir.nir, llvm_tes->ir_sha1);
    }
 #endif
    return tes;
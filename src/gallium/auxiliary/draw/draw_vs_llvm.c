@@ -34,6 +34,7 @@
 #include "draw_context.h"
 #include "draw_vs.h"
 #include "draw_llvm.h"
+#include "gallivm/lp_bld_nir.h"
 
 #include "tgsi/tgsi_parse.h"
 #include "tgsi/tgsi_scan.h"
@@ -97,6 +98,9 @@ draw_create_vs_llvm(struct draw_context *draw,
       if (!nir->options->lower_uniforms_to_ubo)
          NIR_PASS_V(state->ir.nir, nir_lower_uniforms_to_ubo, false, false);
       nir_tgsi_scan_shader(state->ir.nir, &vs->base.info, true);
+      /* only needed for disk cache keys */
+      if (draw->disk_cache_cookie)
+         lp_nir_sha1(state->ir.nir, vs->ir_sha1);
    } else {
       /* we make a private copy of the tokens */
       vs->base.state.tokens = tgsi_dup_tokens(state->tokens);
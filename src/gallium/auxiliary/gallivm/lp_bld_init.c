@@ -146,7 +146,7 @@ create_pass_manager(struct gallivm_state *gallivm)
    LLVMAddCoroElidePass(gallivm->cgpassmgr);
 #endif
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if (!gallivm->no_opt) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -270,7 +270,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if (gallivm->no_opt) {
          optlevel = None;
       }
       else {
@@ -325,7 +325,8 @@ fail:
  */
 static boolean
 init_gallivm_state(struct gallivm_state *gallivm, const char *name,
-                   LLVMContextRef context, struct lp_cached_code *cache)
+                   LLVMContextRef context, struct lp_cached_code *cache,
+                   boolean no_opt)
 {
    assert(!gallivm->context);
    assert(!gallivm->module);
@@ -335,6 +336,7 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
 
    gallivm->context = context;
    gallivm->cache = cache;
+   gallivm->no_opt = no_opt || (gallivm_perf & GALLIVM_PERF_NO_OPT);
    if (!gallivm->context)
       goto fail;
 
@@ -510,18 +512,15 @@ lp_build_init(void)
 
 
 
-/**
- * Create a new gallivm_state object.
- */
-struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context,
-               struct lp_cached_code *cache)
+static struct gallivm_state *
+create_gallivm(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache, boolean no_opt)
 {
    struct gallivm_state *gallivm;
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm, name, context, cache)) {
+      if (!init_gallivm_state(gallivm, name, context, cache, no_opt)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -532,6 +531,32 @@ gallivm_create(const char *name, LLVMContextRef context,
 }
 
 
+/**
+ * Create a new gallivm_state object.
+ */
+struct gallivm_state *
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache)
+{
+   return create_gallivm(name, context, cache, FALSE);
+}
+
+
+/**
+ * Create a new gallivm_state object for a quick first-tier compile.
+ *
+ * No IR optimization passes are run, and code is generated at -O0, where
+ * LLVM uses the fast instruction selector.  The code is meant to be
+ * replaced by a gallivm_create() compile of the same IR later on.
+ */
+struct gallivm_state *
+gallivm_create_fast(const char *name, LLVMContextRef context,
+                    struct lp_cached_code *cache)
+{
+   return create_gallivm(name, context, cache, TRUE);
+}
+
+
 /**
  * Destroy a gallivm_state object.
  */
@@ -604,10 +629,10 @@ gallivm_compile_module(struct gallivm_state *gallivm)
       LLVMWriteBitcodeToFile(gallivm->module, filename);
       debug_printf("%s written\n", filename);
       debug_printf("Invoke as \"opt %s %s | llc -O%d %s%s\"\n",
-                   gallivm_perf & GALLIVM_PERF_NO_OPT ? "-mem2reg" :
+                   gallivm->no_opt ? "-mem2reg" :
                    "-sroa -early-cse -simplifycfg -reassociate "
                    "-mem2reg -constprop -instcombine -gvn",
-                   filename, gallivm_perf & GALLIVM_PERF_NO_OPT ? 0 : 2,
+                   filename, gallivm->no_opt ? 0 : 2,
                    "[-mcpu=<-mcpu option>] ",
                    "[-mattr=<-mattr option(s)>]");
    }
@@ -628,7 +653,7 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
    LLVMRunPasses(gallivm->module, passes, LLVMGetExecutionEngineTargetMachine(gallivm->engine), opts);
 
-   if (!(gallivm_perf & GALLIVM_PERF_NO_OPT))
+   if (!gallivm->no_opt)
       strcpy(passes, "sroa,early-cse,simplifycfg,reassociate,mem2reg,constprop,instcombine,");
    else
       strcpy(passes, "mem2reg");
@@ -57,6 +57,7 @@ struct gallivm_state
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
    struct lp_cached_code *cache;
+   boolean no_opt;   /**< skip IR optimization, -O0 codegen */
    unsigned compiled;
    LLVMValueRef coro_malloc_hook;
    LLVMValueRef coro_free_hook;
@@ -75,6 +76,10 @@ struct gallivm_state *
 gallivm_create(const char *name, LLVMContextRef context,
                struct lp_cached_code *cache);
 
+struct gallivm_state *
+gallivm_create_fast(const char *name, LLVMContextRef context,
+                    struct lp_cached_code *cache);
+
 void
 gallivm_destroy(struct gallivm_state *gallivm);
 
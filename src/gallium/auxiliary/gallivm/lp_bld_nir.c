@@ -38,6 +38,8 @@
 #include "lp_bld_printf.h"
 #include "nir_deref.h"
 #include "nir_search_helpers.h"
+#include "nir_serialize.h"
+#include "util/mesa-sha1.h"
 
 static bool is_aos(const struct lp_build_nir_context *bld_base)
 {
@@ -2559,3 +2561,21 @@ void lp_build_opt_nir(struct nir_shader *nir)
       NIR_PASS_V(nir, nir_opt_dce);
    }
 }
+
+/*
+ * Hash the shader for the disk cache keys of its variants.
+ *
+ * Compiling a variant lowers the shared NIR in place (out of SSA, into
+ * registers), so this must be done once when the shader is created, or
+ * the key for a given variant would depend on the order in which the
+ * variants happened to be compiled.
+ */
+void lp_nir_sha1(const struct nir_shader *nir, unsigned char sha1[20])
+{
+   struct blob blob;
+
+   blob_init(&blob);
+   nir_serialize(&blob, nir, true);
+   _mesa_sha1_compute(blob.data, blob.size, sha1);
+   blob_finish(&blob);
+}
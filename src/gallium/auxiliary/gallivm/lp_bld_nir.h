@@ -315,6 +315,8 @@ lp_build_nir_llvm(struct lp_build_nir_context *bld_base,
 
 void lp_build_opt_nir(struct nir_shader *nir);
 
+void lp_nir_sha1(const struct nir_shader *nir, unsigned char sha1[20]);
+
 static inline LLVMValueRef
 lp_nir_array_build_gather_values(LLVMBuilderRef builder,
                                  LLVMValueRef * values,
@@ -1269,6 +1269,12 @@ hud_parse_env_var(struct hud_context *hud, struct pipe_screen *screen,
       else if (strcmp(name, "API-thread-num-syncs") == 0) {
          hud_thread_counter_install(pane, name, HUD_COUNTER_SYNCS);
       }
+      else if (strcmp(name, "API-thread-num-flushes") == 0) {
+         hud_thread_counter_install(pane, name, HUD_COUNTER_FLUSHES);
+      }
+      else if (strcmp(name, "API-thread-num-stalls") == 0) {
+         hud_thread_counter_install(pane, name, HUD_COUNTER_STALLS);
+      }
       else if (strcmp(name, "main-thread-busy") == 0) {
          hud_thread_busy_install(pane, name, true);
       }
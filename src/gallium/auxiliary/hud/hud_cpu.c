@@ -413,6 +413,10 @@ static unsigned get_counter(struct hud_graph *gr, enum hud_counter counter)
       return mon->num_direct_items;
    case HUD_COUNTER_SYNCS:
       return mon->num_syncs;
+   case HUD_COUNTER_FLUSHES:
+      return mon->num_flushes;
+   case HUD_COUNTER_STALLS:
+      return mon->num_stalls;
    default:
       assert(0);
       return 0;
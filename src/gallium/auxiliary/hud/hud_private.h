@@ -38,6 +38,8 @@ enum hud_counter {
    HUD_COUNTER_OFFLOADED,
    HUD_COUNTER_DIRECT,
    HUD_COUNTER_SYNCS,
+   HUD_COUNTER_FLUSHES,
+   HUD_COUNTER_STALLS,
 };
 
 struct hud_context {
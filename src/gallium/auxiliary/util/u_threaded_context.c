@@ -77,11 +77,14 @@ tc_buffer_subdata(struct pipe_context *_pipe,
                   unsigned usage, unsigned offset,
                   unsigned size, const void *data);
 
+static void
+tc_batch_eliminate_redundant_calls(struct tc_batch *batch);
+
 static void
 tc_batch_check(UNUSED struct tc_batch *batch)
 {
    tc_assert(batch->sentinel == TC_SENTINEL);
-   tc_assert(batch->num_total_slots <= TC_SLOTS_PER_BATCH);
+   tc_assert(batch->num_total_slots <= batch->num_allocated_slots);
 }
 
 static void
@@ -192,13 +195,16 @@ tc_batch_execute(void *job, UNUSED void *gdata, int thread_index)
 {
    struct tc_batch *batch = job;
    struct pipe_context *pipe = batch->tc->pipe;
-   uint64_t *last = &batch->slots[batch->num_total_slots];
+   uint64_t *last;
 
    tc_batch_check(batch);
    tc_set_driver_thread(batch->tc);
 
    assert(!batch->token);
 
+   tc_batch_eliminate_redundant_calls(batch);
+   last = &batch->slots[batch->num_total_slots];
+
    for (uint64_t *iter = batch->slots; iter != last;) {
       struct tc_call_base *call = (struct tc_call_base *)iter;
 
@@ -227,7 +233,7 @@ tc_batch_execute(void *job, UNUSED void *gdata, int thread_index)
        * the buffer list fences, so that the producer thread can reuse the buffer
        * list structures for the next batches without waiting.
        */
-      unsigned half_ring = TC_MAX_BUFFER_LISTS / 2;
+      unsigned half_ring = tc->num_buffer_lists / 2;
       if (batch->buffer_list_index % half_ring == half_ring - 1)
          pipe->flush(pipe, NULL, PIPE_FLUSH_ASYNC);
    } else {
@@ -242,7 +248,7 @@ tc_batch_execute(void *job, UNUSED void *gdata, int thread_index)
 static void
 tc_begin_next_buffer_list(struct threaded_context *tc)
 {
-   tc->next_buf_list = (tc->next_buf_list + 1) % TC_MAX_BUFFER_LISTS;
+   tc->next_buf_list = (tc->next_buf_list + 1) % tc->num_buffer_lists;
 
    tc->batch_slots[tc->next].buffer_list_index = tc->next_buf_list;
 
@@ -256,6 +262,23 @@ tc_begin_next_buffer_list(struct threaded_context *tc)
    tc->add_all_compute_bindings_to_buffer_list = true;
 }
 
+/* Try to make the batch hold target_slots_per_batch slots. The batch must be
+ * idle. Return whether it can be used at all.
+ */
+static bool
+tc_batch_reserve(struct threaded_context *tc, struct tc_batch *batch)
+{
+   if (batch->num_allocated_slots < tc->target_slots_per_batch) {
+      uint64_t *slots = realloc(batch->slots,
+                                tc->target_slots_per_batch * sizeof(uint64_t));
+      if (slots) {
+         batch->slots = slots;
+         batch->num_allocated_slots = tc->target_slots_per_batch;
+      }
+   }
+   return batch->num_allocated_slots != 0;
+}
+
 static void
 tc_batch_flush(struct threaded_context *tc)
 {
@@ -275,7 +298,29 @@ tc_batch_flush(struct threaded_context *tc)
    util_queue_add_job(&tc->queue, next, &next->fence, tc_batch_execute,
                       NULL, 0);
    tc->last = tc->next;
-   tc->next = (tc->next + 1) % TC_MAX_BATCHES;
+   tc->next = (tc->next + 1) % tc->num_batches;
+
+   /* All batches are busy: wait for the oldest one, or grow. */
+   if (!util_queue_fence_is_signalled(&tc->batch_slots[tc->next].fence)) {
+      p_atomic_inc(&tc->num_batch_stalls);
+
+      if (tc->options.grow_batches && tc->num_batches < tc->max_batches &&
+          tc_batch_reserve(tc, &tc->batch_slots[tc->num_batches])) {
+         tc->next = tc->num_batches++;
+      } else {
+         util_queue_fence_wait(&tc->batch_slots[tc->next].fence);
+
+         /* The driver thread can't keep up. Larger batches lower the overhead
+          * per call.
+          */
+         if (tc->options.grow_batches)
+            tc->target_slots_per_batch = MIN2(tc->target_slots_per_batch * 2,
+                                              TC_MAX_SLOTS_PER_BATCH);
+      }
+   }
+
+   tc_batch_reserve(tc, &tc->batch_slots[tc->next]);
+   tc->slots_per_batch = tc->batch_slots[tc->next].num_allocated_slots;
    tc_begin_next_buffer_list(tc);
 }
 
@@ -288,10 +333,10 @@ tc_add_sized_call(struct threaded_context *tc, enum tc_call_id id,
                   unsigned num_slots)
 {
    struct tc_batch *next = &tc->batch_slots[tc->next];
-   assert(num_slots <= TC_SLOTS_PER_BATCH);
+   assert(num_slots <= tc->slots_per_batch);
    tc_debug_check(tc);
 
-   if (unlikely(next->num_total_slots + num_slots > TC_SLOTS_PER_BATCH)) {
+   if (unlikely(next->num_total_slots + num_slots > tc->slots_per_batch)) {
       tc_batch_flush(tc);
       next = &tc->batch_slots[tc->next];
       tc_assert(next->num_total_slots == 0);
@@ -652,7 +697,7 @@ tc_is_buffer_busy(struct threaded_context *tc, struct threaded_resource *tbuf,
 
    uint32_t id_hash = tbuf->buffer_id_unique & TC_BUFFER_ID_MASK;
 
-   for (unsigned i = 0; i < TC_MAX_BUFFER_LISTS; i++) {
+   for (unsigned i = 0; i < tc->num_buffer_lists; i++) {
       struct tc_buffer_list *buf_list = &tc->buffer_lists[i];
 
       /* If the buffer is referenced by a batch that hasn't been flushed (by tc or the driver),
@@ -3115,7 +3160,7 @@ tc_call_draw_single(struct pipe_context *pipe, void *call, uint64_t *last_ptr)
 
       if (is_next_call_a_mergeable_draw(first, next)) {
          /* The maximum number of merged draws is given by the batch size. */
-         struct pipe_draw_start_count_bias multi[TC_SLOTS_PER_BATCH / call_size(tc_draw_single)];
+         struct pipe_draw_start_count_bias multi[TC_MAX_SLOTS_PER_BATCH / call_size(tc_draw_single)];
          unsigned num_draws = 2;
          bool index_bias_varies = first->index_bias != next->index_bias;
 
@@ -3360,10 +3405,14 @@ tc_draw_vbo(struct pipe_context *_pipe, const struct pipe_draw_info *info,
       while (num_draws) {
          struct tc_batch *next = &tc->batch_slots[tc->next];
 
-         int nb_slots_left = TC_SLOTS_PER_BATCH - next->num_total_slots;
-         /* If there isn't enough place for one draw, try to fill the next one */
-         if (nb_slots_left < slots_for_one_draw)
-            nb_slots_left = TC_SLOTS_PER_BATCH;
+         int nb_slots_left = tc->slots_per_batch - next->num_total_slots;
+         /* If there isn't enough place for one draw, fill the next one. The next
+          * batch can have a different size.
+          */
+         if (nb_slots_left < slots_for_one_draw) {
+            tc_batch_flush(tc);
+            nb_slots_left = tc->slots_per_batch;
+         }
          const int size_left_bytes = nb_slots_left * sizeof(struct tc_call_base);
 
          /* How many draws can we fit in the current batch */
@@ -3406,10 +3455,14 @@ tc_draw_vbo(struct pipe_context *_pipe, const struct pipe_draw_info *info,
       while (num_draws) {
          struct tc_batch *next = &tc->batch_slots[tc->next];
 
-         int nb_slots_left = TC_SLOTS_PER_BATCH - next->num_total_slots;
-         /* If there isn't enough place for one draw, try to fill the next one */
-         if (nb_slots_left < slots_for_one_draw)
-            nb_slots_left = TC_SLOTS_PER_BATCH;
+         int nb_slots_left = tc->slots_per_batch - next->num_total_slots;
+         /* If there isn't enough place for one draw, fill the next one. The next
+          * batch can have a different size.
+          */
+         if (nb_slots_left < slots_for_one_draw) {
+            tc_batch_flush(tc);
+            nb_slots_left = tc->slots_per_batch;
+         }
          const int size_left_bytes = nb_slots_left * sizeof(struct tc_call_base);
 
          /* How many draws can we fit in the current batch */
@@ -3474,7 +3527,7 @@ tc_call_draw_vstate_single(struct pipe_context *pipe, void *call, uint64_t *last
    if (next != last &&
        is_next_call_a_mergeable_draw_vstate(first, next)) {
       /* The maximum number of merged draws is given by the batch size. */
-      struct pipe_draw_start_count_bias draws[TC_SLOTS_PER_BATCH /
+      struct pipe_draw_start_count_bias draws[TC_MAX_SLOTS_PER_BATCH /
                                               call_size(tc_draw_vstate_single)];
       unsigned num_draws = 2;
 
@@ -3567,10 +3620,14 @@ tc_draw_vertex_state(struct pipe_context *_pipe,
    while (num_draws) {
       struct tc_batch *next = &tc->batch_slots[tc->next];
 
-      int nb_slots_left = TC_SLOTS_PER_BATCH - next->num_total_slots;
-      /* If there isn't enough place for one draw, try to fill the next one */
-      if (nb_slots_left < slots_for_one_draw)
-         nb_slots_left = TC_SLOTS_PER_BATCH;
+      int nb_slots_left = tc->slots_per_batch - next->num_total_slots;
+      /* If there isn't enough place for one draw, fill the next one. The next
+       * batch can have a different size.
+       */
+      if (nb_slots_left < slots_for_one_draw) {
+         tc_batch_flush(tc);
+         nb_slots_left = tc->slots_per_batch;
+      }
       const int size_left_bytes = nb_slots_left * sizeof(struct tc_call_base);
 
       /* How many draws can we fit in the current batch */
@@ -4218,6 +4275,300 @@ tc_callback(struct pipe_context *_pipe, void (*fn)(void *), void *data,
 }
 
 
+/********************************************************************
+ * redundant call elimination
+ */
+
+/* The state set by the calls of a batch that have been kept so far. Only
+ * the batch is tracked, because the driver state between batches can be
+ * changed by direct calls after threaded_context_unwrap_sync.
+ *
+ * Each entry is only valid if its generation is the current one, so that
+ * forgetting everything, which happens for most calls that aren't state
+ * changes, is just an increment.
+ */
+struct tc_bound_state {
+   uint32_t generation;
+
+   /* The last kept call of each type setting the whole state with one call. */
+   uint32_t whole_state_gen[TC_NUM_CALLS];
+   struct tc_call_base *whole_state[TC_NUM_CALLS];
+
+   uint32_t const_buffers_gen[PIPE_SHADER_TYPES][PIPE_MAX_CONSTANT_BUFFERS];
+   struct tc_constant_buffer_base *const_buffers[PIPE_SHADER_TYPES][PIPE_MAX_CONSTANT_BUFFERS];
+
+   uint32_t samplers_gen[PIPE_SHADER_TYPES][PIPE_MAX_SAMPLERS];
+   void *samplers[PIPE_SHADER_TYPES][PIPE_MAX_SAMPLERS];
+
+   uint32_t sampler_views_gen[PIPE_SHADER_TYPES][PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   struct pipe_sampler_view *sampler_views[PIPE_SHADER_TYPES][PIPE_MAX_SHADER_SAMPLER_VIEWS];
+};
+
+static void
+tc_bound_state_reset(struct tc_bound_state *state)
+{
+   /* Generation 0 is never current, entries start out invalid. */
+   if (unlikely(++state->generation == 0)) {
+      memset(state, 0, sizeof(*state));
+      state->generation = 1;
+   }
+}
+
+/* Calls that set a whole piece of state with a fixed-size payload without
+ * references, so that two such calls are equivalent if their payloads are.
+ */
+static bool
+tc_call_sets_whole_state(enum tc_call_id id)
+{
+   switch (id) {
+   case TC_CALL_bind_blend_state:
+   case TC_CALL_bind_rasterizer_state:
+   case TC_CALL_bind_depth_stencil_alpha_state:
+   case TC_CALL_bind_compute_state:
+   case TC_CALL_bind_fs_state:
+   case TC_CALL_bind_vs_state:
+   case TC_CALL_bind_gs_state:
+   case TC_CALL_bind_tcs_state:
+   case TC_CALL_bind_tes_state:
+   case TC_CALL_bind_vertex_elements_state:
+   case TC_CALL_set_blend_color:
+   case TC_CALL_set_stencil_ref:
+   case TC_CALL_set_clip_state:
+   case TC_CALL_set_sample_mask:
+   case TC_CALL_set_min_samples:
+   case TC_CALL_set_polygon_stipple:
+   case TC_CALL_set_tess_state:
+   case TC_CALL_set_patch_vertices:
+      return true;
+   default:
+      return false;
+   }
+}
+
+/* Calls that can't change the state bound in the driver other than what
+ * they set themselves. Everything else, e.g. blits that the driver might
+ * implement with its own state, or callbacks that might call the driver
+ * directly, makes us forget what is bound.
+ */
+static bool
+tc_call_preserves_bound_state(enum tc_call_id id)
+{
+   if (tc_call_sets_whole_state(id))
+      return true;
+
+   switch (id) {
+   case TC_CALL_draw_single:
+   case TC_CALL_draw_single_drawid:
+   case TC_CALL_draw_multi:
+   case TC_CALL_draw_indirect:
+   case TC_CALL_draw_vstate_single:
+   case TC_CALL_draw_vstate_multi:
+   case TC_CALL_launch_grid:
+   case TC_CALL_bind_sampler_states:
+   case TC_CALL_set_framebuffer_state:
+   case TC_CALL_set_constant_buffer:
+   case TC_CALL_set_inlinable_constants:
+   case TC_CALL_set_sample_locations:
+   case TC_CALL_set_scissor_states:
+   case TC_CALL_set_viewport_states:
+   case TC_CALL_set_window_rectangles:
+   case TC_CALL_set_sampler_views:
+   case TC_CALL_set_shader_images:
+   case TC_CALL_set_shader_buffers:
+   case TC_CALL_set_vertex_buffers:
+   case TC_CALL_set_stream_output_targets:
+   case TC_CALL_set_active_query_state:
+   case TC_CALL_texture_barrier:
+   case TC_CALL_memory_barrier:
+   case TC_CALL_begin_query:
+   case TC_CALL_end_query:
+   case TC_CALL_emit_string_marker:
+      return true;
+   default:
+      return false;
+   }
+}
+
+/* Return whether the call doesn't change anything, and release the
+ * references it holds if so.
+ */
+static bool
+tc_call_is_redundant(struct tc_bound_state *state, struct tc_call_base *call)
+{
+   if (tc_call_sets_whole_state(call->call_id)) {
+      if (state->whole_state_gen[call->call_id] != state->generation)
+         return false;
+
+      struct tc_call_base *prev = state->whole_state[call->call_id];
+
+      /* Comparing the padding too can only make us keep a redundant call. */
+      return prev->num_slots == call->num_slots &&
+             !memcmp(prev + 1, call + 1,
+                     call->num_slots * 8 - sizeof(struct tc_call_base));
+   }
+
+   switch (call->call_id) {
+   case TC_CALL_set_constant_buffer: {
+      struct tc_constant_buffer *p = (struct tc_constant_buffer *)call;
+
+      if (state->const_buffers_gen[p->base.shader][p->base.index] !=
+          state->generation)
+         return false;
+
+      struct tc_constant_buffer *prev = (struct tc_constant_buffer *)
+         state->const_buffers[p->base.shader][p->base.index];
+
+      if (prev->base.is_null != p->base.is_null)
+         return false;
+
+      if (!p->base.is_null) {
+         if (prev->cb.buffer != p->cb.buffer ||
+             prev->cb.buffer_offset != p->cb.buffer_offset ||
+             prev->cb.buffer_size != p->cb.buffer_size)
+            return false;
+
+         if (p->cb.buffer)
+            tc_drop_resource_reference(p->cb.buffer);
+      }
+      return true;
+   }
+
+   case TC_CALL_bind_sampler_states: {
+      struct tc_sampler_states *p = (struct tc_sampler_states *)call;
+
+      for (unsigned i = 0; i < p->count; i++) {
+         unsigned slot = p->start + i;
+
+         if (state->samplers_gen[p->shader][slot] != state->generation ||
+             state->samplers[p->shader][slot] != p->slot[i])
+            return false;
+      }
+      return true;
+   }
+
+   case TC_CALL_set_sampler_views: {
+      struct tc_sampler_views *p = (struct tc_sampler_views *)call;
+      unsigned end = MIN2(p->start + p->count + p->unbind_num_trailing_slots,
+                          PIPE_MAX_SHADER_SAMPLER_VIEWS);
+
+      for (unsigned slot = p->start; slot < end; slot++) {
+         struct pipe_sampler_view *view =
+            slot < p->start + p->count ? p->slot[slot - p->start] : NULL;
+
+         if (state->sampler_views_gen[p->shader][slot] != state->generation ||
+             state->sampler_views[p->shader][slot] != view)
+            return false;
+      }
+
+      for (unsigned i = 0; i < p->count; i++)
+         pipe_sampler_view_reference(&p->slot[i], NULL);
+      return true;
+   }
+
+   default:
+      return false;
+   }
+}
+
+/* Record the state set by a call that is kept, at its final location. */
+static void
+tc_bound_state_update(struct tc_bound_state *state, struct tc_call_base *call)
+{
+   if (!tc_call_preserves_bound_state(call->call_id)) {
+      tc_bound_state_reset(state);
+      return;
+   }
+
+   if (tc_call_sets_whole_state(call->call_id)) {
+      state->whole_state_gen[call->call_id] = state->generation;
+      state->whole_state[call->call_id] = call;
+      return;
+   }
+
+   switch (call->call_id) {
+   case TC_CALL_set_constant_buffer: {
+      struct tc_constant_buffer_base *p = (struct tc_constant_buffer_base *)call;
+
+      state->const_buffers_gen[p->shader][p->index] = state->generation;
+      state->const_buffers[p->shader][p->index] = p;
+      break;
+   }
+
+   case TC_CALL_bind_sampler_states: {
+      struct tc_sampler_states *p = (struct tc_sampler_states *)call;
+
+      for (unsigned i = 0; i < p->count; i++) {
+         unsigned slot = p->start + i;
+
+         state->samplers_gen[p->shader][slot] = state->generation;
+         state->samplers[p->shader][slot] = p->slot[i];
+      }
+      break;
+   }
+
+   case TC_CALL_set_sampler_views: {
+      struct tc_sampler_views *p = (struct tc_sampler_views *)call;
+      unsigned end = MIN2(p->start + p->count + p->unbind_num_trailing_slots,
+                          PIPE_MAX_SHADER_SAMPLER_VIEWS);
+
+      for (unsigned slot = p->start; slot < end; slot++) {
+         state->sampler_views_gen[p->shader][slot] = state->generation;
+         state->sampler_views[p->shader][slot] =
+            slot < p->start + p->count ? p->slot[slot - p->start] : NULL;
+      }
+      break;
+   }
+
+   default:
+      break;
+   }
+}
+
+/* Drop the calls of the batch that set state to what it already is, and
+ * compact the batch. This also lets draws that were only separated by
+ * redundant state changes be merged when they are executed.
+ */
+static void
+tc_batch_eliminate_redundant_calls(struct tc_batch *batch)
+{
+   struct threaded_context *tc = batch->tc;
+   struct tc_bound_state *state = tc->bound_state;
+   uint64_t *last = &batch->slots[batch->num_total_slots];
+   uint64_t *dst = batch->slots;
+   unsigned num_eliminated = 0;
+
+   tc_bound_state_reset(state);
+
+   for (uint64_t *iter = batch->slots; iter != last;) {
+      struct tc_call_base *call = (struct tc_call_base *)iter;
+      unsigned num_slots = call->num_slots;
+
+      tc_assert(call->sentinel == TC_SENTINEL);
+      iter += num_slots;
+
+      if (tc_call_is_redundant(state, call)) {
+         num_eliminated++;
+         continue;
+      }
+
+      if (dst != (uint64_t *)call)
+         memmove(dst, call, num_slots * 8);
+
+      tc_bound_state_update(state, (struct tc_call_base *)dst);
+      dst += num_slots;
+   }
+
+   batch->num_total_slots = dst - batch->slots;
+   batch->num_eliminated_calls = num_eliminated;
+
+   if (num_eliminated) {
+      p_atomic_add(&tc->num_eliminated_calls, num_eliminated);
+      tc_printf("batch %u: eliminated %u redundant calls",
+                (unsigned)(batch - tc->batch_slots), batch->num_eliminated_calls);
+   }
+}
+
+
 /********************************************************************
  * create & destroy
  */
@@ -4250,12 +4601,17 @@ tc_destroy(struct pipe_context *_pipe)
    assert(tc->batch_slots[tc->next].num_total_slots == 0);
    pipe->destroy(pipe);
 
-   for (unsigned i = 0; i < TC_MAX_BUFFER_LISTS; i++) {
+   for (unsigned i = 0; tc->buffer_lists && i < tc->num_buffer_lists; i++) {
       if (!util_queue_fence_is_signalled(&tc->buffer_lists[i].driver_flushed_fence))
          util_queue_fence_signal(&tc->buffer_lists[i].driver_flushed_fence);
       util_queue_fence_destroy(&tc->buffer_lists[i].driver_flushed_fence);
    }
 
+   for (unsigned i = 0; i < TC_MAX_BATCHES; i++)
+      free(tc->batch_slots[i].slots);
+
+   FREE(tc->buffer_lists);
+   FREE(tc->bound_state);
    FREE(tc);
 }
 
@@ -4344,11 +4700,30 @@ threaded_context_create(struct pipe_context *pipe,
 
    tc->use_forced_staging_uploads = true;
 
+   tc->bound_state = CALLOC_STRUCT(tc_bound_state);
+   if (!tc->bound_state)
+      goto fail;
+
+   tc->num_batches = CLAMP(tc->options.num_batches ? tc->options.num_batches :
+                                                     TC_DEFAULT_BATCHES,
+                           2, TC_MAX_BATCHES);
+   tc->max_batches = tc->options.grow_batches ? TC_MAX_BATCHES : tc->num_batches;
+   tc->target_slots_per_batch =
+      CLAMP(tc->options.slots_per_batch ? tc->options.slots_per_batch :
+                                          TC_DEFAULT_SLOTS_PER_BATCH,
+            TC_MIN_SLOTS_PER_BATCH, TC_MAX_SLOTS_PER_BATCH);
+
+   tc->num_buffer_lists = tc->max_batches * TC_BUFFER_LISTS_PER_BATCH;
+   tc->buffer_lists = CALLOC(tc->num_buffer_lists, sizeof(*tc->buffer_lists));
+   if (!tc->buffer_lists)
+      goto fail;
+
    /* The queue size is the number of batches "waiting". Batches are removed
-    * from the queue before being executed, so keep one tc_batch slot for that
-    * execution. Also, keep one unused slot for an unflushed batch.
+    * from the queue before being executed, and tc_batch_flush waits until
+    * the batch after the one it flushes is idle, so all other batches can be
+    * waiting.
     */
-   if (!util_queue_init(&tc->queue, "gdrv", TC_MAX_BATCHES - 2, 1, 0, NULL))
+   if (!util_queue_init(&tc->queue, "gdrv", tc->max_batches - 1, 1, 0, NULL))
       goto fail;
 
    for (unsigned i = 0; i < TC_MAX_BATCHES; i++) {
@@ -4358,9 +4733,16 @@ threaded_context_create(struct pipe_context *pipe,
       tc->batch_slots[i].tc = tc;
       util_queue_fence_init(&tc->batch_slots[i].fence);
    }
-   for (unsigned i = 0; i < TC_MAX_BUFFER_LISTS; i++)
+   for (unsigned i = 0; i < tc->num_buffer_lists; i++)
       util_queue_fence_init(&tc->buffer_lists[i].driver_flushed_fence);
 
+   /* Batches added later are allocated when they are needed. */
+   for (unsigned i = 0; i < tc->num_batches; i++) {
+      if (!tc_batch_reserve(tc, &tc->batch_slots[i]))
+         goto fail;
+   }
+   tc->slots_per_batch = tc->batch_slots[tc->next].num_allocated_slots;
+
    list_inithead(&tc->unflushed_queries);
 
    slab_create_child(&tc->pool_transfers, parent_transfer_pool);
@@ -211,6 +211,7 @@ extern "C" {
 
 struct threaded_context;
 struct tc_unflushed_batch_token;
+struct tc_bound_state;
 
 /* 0 = disabled, 1 = assertions, 2 = printfs, 3 = logging */
 #define TC_DEBUG 0
@@ -229,30 +230,36 @@ struct tc_unflushed_batch_token;
 /* fence is pre-populated with a fence created by the create_fence callback */
 #define TC_FLUSH_ASYNC        (1u << 31)
 
-/* Size of the queue = number of batch slots in memory.
+/* Number of batch slots in memory.
  * - 1 batch is always idle and records new commands
  * - 1 batch is being executed
- * so the queue size is TC_MAX_BATCHES - 2 = number of waiting batches.
+ * so the number of batches - 2 = number of waiting batches.
  *
- * Use a size as small as possible for low CPU L2 cache usage but large enough
- * so that the queue isn't stalled too often for not having enough idle batch
- * slots.
+ * Use a number as small as possible for low CPU L2 cache usage but large
+ * enough so that the queue isn't stalled too often for not having enough idle
+ * batch slots. The default can be changed with threaded_context_options, and
+ * the number can grow up to TC_MAX_BATCHES.
  */
-#define TC_MAX_BATCHES        10
+#define TC_DEFAULT_BATCHES    10
+#define TC_MAX_BATCHES        32
 
-/* The size of one batch. Non-trivial calls (i.e. not setting a CSO pointer)
- * can occupy multiple call slots.
+/* The size of one batch in 8-byte slots. Non-trivial calls (i.e. not setting
+ * a CSO pointer) can occupy multiple call slots.
  *
  * The idea is to have batches as small as possible but large enough so that
- * the queuing and mutex overhead is negligible.
+ * the queuing and mutex overhead is negligible. The minimum is large enough
+ * for the largest call.
  */
-#define TC_SLOTS_PER_BATCH    1536
+#define TC_DEFAULT_SLOTS_PER_BATCH  1536
+#define TC_MIN_SLOTS_PER_BATCH      512
+#define TC_MAX_SLOTS_PER_BATCH      4096
 
 /* The buffer list queue is much deeper than the batch queue because buffer
  * lists need to stay around until the driver internally flushes its command
  * buffer.
  */
-#define TC_MAX_BUFFER_LISTS   (TC_MAX_BATCHES * 4)
+#define TC_BUFFER_LISTS_PER_BATCH   4
+#define TC_MAX_BUFFER_LISTS   (TC_MAX_BATCHES * TC_BUFFER_LISTS_PER_BATCH)
 
 /* This mask is used to get a hash of a buffer ID. It's also the bit size of
  * the buffer list - 1. It must be 2^n - 1. The size should be as low as
@@ -413,10 +420,15 @@ struct tc_batch {
    unsigned sentinel;
 #endif
    uint16_t num_total_slots;
+   uint16_t num_allocated_slots;
    uint16_t buffer_list_index;
+   /* The number of calls dropped by the driver thread because they didn't
+    * change any state, for the last execution of this batch.
+    */
+   uint16_t num_eliminated_calls;
    struct util_queue_fence fence;
    struct tc_unflushed_batch_token *token;
-   uint64_t slots[TC_SLOTS_PER_BATCH];
+   uint64_t *slots;
 };
 
 struct tc_buffer_list {
@@ -442,6 +454,20 @@ struct threaded_context_options {
     * safe to call without synchronizing with driver thread.
     */
    bool unsynchronized_get_device_reset_status;
+
+   /**
+    * The number of batches and the number of 8-byte slots per batch. 0 means
+    * TC_DEFAULT_BATCHES and TC_DEFAULT_SLOTS_PER_BATCH respectively.
+    */
+   unsigned num_batches;
+   unsigned slots_per_batch;
+
+   /**
+    * If true, add batches up to TC_MAX_BATCHES and then make them larger up
+    * to TC_MAX_SLOTS_PER_BATCH when the frontend thread has to wait for the
+    * driver thread.
+    */
+   bool grow_batches;
 };
 
 struct threaded_context {
@@ -459,6 +485,10 @@ struct threaded_context {
    unsigned num_offloaded_slots;
    unsigned num_direct_slots;
    unsigned num_syncs;
+   /* The sum of tc_batch::num_eliminated_calls over all executed batches. */
+   unsigned num_eliminated_calls;
+   /* How many times the frontend thread waited for a batch to be executed. */
+   unsigned num_batch_stalls;
 
    bool use_forced_staging_uploads;
    bool add_all_gfx_bindings_to_buffer_list;
@@ -499,6 +529,19 @@ struct threaded_context {
 
    unsigned last, next, next_buf_list;
 
+   /* The number of batches in use, which can grow up to max_batches. */
+   unsigned num_batches, max_batches;
+   unsigned num_buffer_lists;
+   /* The size of the batch being recorded, and the size batches should have,
+    * which can grow.
+    */
+   unsigned slots_per_batch, target_slots_per_batch;
+
+   /* State bound by the batch being executed, only accessed by the driver
+    * thread to find redundant calls.
+    */
+   struct tc_bound_state *bound_state;
+
    /* The list fences that the driver should signal after the next flush.
     * If this is empty, all driver command buffers have been flushed.
     */
@@ -519,7 +562,7 @@ struct threaded_context {
    uint32_t sampler_buffers[PIPE_SHADER_TYPES][PIPE_MAX_SHADER_SAMPLER_VIEWS];
 
    struct tc_batch batch_slots[TC_MAX_BATCHES];
-   struct tc_buffer_list buffer_lists[TC_MAX_BUFFER_LISTS];
+   struct tc_buffer_list *buffer_lists; /* num_buffer_lists elements */
 };
 
 void threaded_resource_init(struct pipe_resource *res, bool allow_cpu_storage);
@@ -0,0 +1,112 @@
+/**************************************************************************
+ *
+ * Copyright 2026 The Mesa Authors.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * CPU topology helpers for the rasterizer and compute worker threads.
+ */
+
+#ifndef LP_AFFINITY_H
+#define LP_AFFINITY_H
+
+#include "util/macros.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_thread.h"
+
+
+/**
+ * Pin the calling worker thread to an L3 cache domain.
+ *
+ * Consecutive thread indices are packed onto the same domain, so threads
+ * working on neighbouring bins share a cache.  Since the thread is pinned
+ * before it allocates its per-thread data, first-touch placement puts that
+ * memory on the thread's own NUMA node.
+ *
+ * Only the CPUs the thread may already run on are used, so that threads
+ * aren't moved out of a cpuset or an affinity set by the application, and
+ * domains without any of those CPUs are skipped.
+ */
+static inline void
+lp_thread_pin_to_L3(unsigned thread_index, unsigned num_threads)
+{
+#if defined(HAVE_PTHREAD_SETAFFINITY)
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   unsigned num_words = DIV_ROUND_UP(caps->num_cpu_mask_bits, 32);
+   util_affinity_mask allowed = {0}, mask;
+   unsigned num_domains = 0, domain;
+   cpu_set_t cpuset;
+
+   if (caps->num_L3_caches <= 1 || !caps->L3_affinity_mask)
+      return;
+
+   if (pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+      return;
+
+   for (unsigned i = 0; i < caps->num_cpu_mask_bits && i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &cpuset))
+         allowed[i / 32] |= 1u << (i % 32);
+   }
+
+   for (unsigned L3 = 0; L3 < caps->num_L3_caches; L3++) {
+      for (unsigned w = 0; w < num_words; w++) {
+         if (caps->L3_affinity_mask[L3][w] & allowed[w]) {
+            num_domains++;
+            break;
+         }
+      }
+   }
+
+   /* Nothing to spread the threads over. */
+   if (num_domains <= 1)
+      return;
+
+   domain = thread_index * num_domains / MAX2(num_threads, 1);
+
+   for (unsigned L3 = 0; L3 < caps->num_L3_caches; L3++) {
+      bool usable = false;
+
+      for (unsigned w = 0; w < num_words; w++) {
+         mask[w] = caps->L3_affinity_mask[L3][w] & allowed[w];
+         usable |= mask[w] != 0;
+      }
+
+      if (usable && domain-- == 0) {
+         util_set_current_thread_affinity(mask, NULL, caps->num_cpu_mask_bits);
+         return;
+      }
+   }
+#else
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   unsigned L3;
+
+   if (caps->num_L3_caches <= 1 || !caps->L3_affinity_mask)
+      return;
+
+   L3 = thread_index * caps->num_L3_caches / MAX2(num_threads, 1);
+   util_set_current_thread_affinity(caps->L3_affinity_mask[L3], NULL,
+                                    caps->num_cpu_mask_bits);
+#endif
+}
+
+#endif /* LP_AFFINITY_H */
@@ -0,0 +1,110 @@
+/**************************************************************************
+ *
+ * Copyright 2026 The Mesa Authors.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * Measures the dispatch overhead of the compute shader thread pool for
+ * grids ranging from a single workgroup to a million, and checks that
+ * every iteration ran exactly once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_memory.h"
+#include "lp_cs_tpool.h"
+
+struct bench_job {
+   unsigned *ran;
+};
+
+static void
+bench_work(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct bench_job *job = data;
+   job->ran[iter_idx]++;
+}
+
+static bool
+bench_grid(struct lp_cs_tpool *pool, unsigned num_iters, unsigned reps)
+{
+   struct bench_job job;
+   int64_t start, end;
+   bool pass = true;
+
+   job.ran = CALLOC(num_iters, sizeof(*job.ran));
+   if (!job.ran)
+      return false;
+
+   start = os_time_get_nano();
+   for (unsigned r = 0; r < reps; r++) {
+      struct lp_cs_tpool_task *task =
+         lp_cs_tpool_queue_task(pool, bench_work, &job, num_iters);
+      lp_cs_tpool_wait_for_task(pool, &task);
+   }
+   end = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_iters; i++) {
+      if (job.ran[i] != reps) {
+         fprintf(stderr, "grid %u: iteration %u ran %u times, expected %u\n",
+                 num_iters, i, job.ran[i], reps);
+         pass = false;
+         break;
+      }
+   }
+
+   printf("grid %8u: %10.2f us/dispatch %8.2f ns/iteration\n",
+          num_iters, (end - start) / 1000.0 / reps,
+          (double)(end - start) / ((double)reps * num_iters));
+
+   FREE(job.ran);
+   return pass;
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned grids[] = { 1, 4, 64, 1024, 65536, 1 << 20 };
+   unsigned num_threads;
+   struct lp_cs_tpool *pool;
+   bool pass = true;
+
+   util_cpu_detect();
+   num_threads = argc > 1 ? atoi(argv[1]) : util_get_cpu_caps()->nr_cpus;
+
+   pool = lp_cs_tpool_create(num_threads, false);
+   if (!pool)
+      return EXIT_FAILURE;
+
+   printf("%u threads\n", num_threads);
+   for (unsigned i = 0; i < ARRAY_SIZE(grids); i++) {
+      unsigned reps = CLAMP((1 << 24) / grids[i], 4, 10000);
+      pass &= bench_grid(pool, grids[i], reps);
+   }
+
+   lp_cs_tpool_destroy(pool);
+   return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
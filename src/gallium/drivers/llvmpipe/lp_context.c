@@ -253,10 +253,12 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    if (!llvmpipe->draw)
       goto fail;
 
-   draw_set_disk_cache_callbacks(llvmpipe->draw,
-                                 llvmpipe_screen(screen),
-                                 lp_draw_disk_cache_find_shader,
-                                 lp_draw_disk_cache_insert_shader);
+   /* draw only hashes its shaders for the disk cache when there is one */
+   if (llvmpipe_screen(screen)->disk_shader_cache)
+      draw_set_disk_cache_callbacks(llvmpipe->draw,
+                                    llvmpipe_screen(screen),
+                                    lp_draw_disk_cache_find_shader,
+                                    lp_draw_disk_cache_insert_shader);
 
    draw_set_constant_buffer_stride(llvmpipe->draw, lp_get_constant_buffer_stride(screen));
 
@@ -30,20 +30,59 @@
 
 #include "util/u_thread.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
+#include "util/u_math.h"
 #include "lp_cs_tpool.h"
+#include "lp_affinity.h"
+
+/**
+ * Claim the next grain of iterations from the task, starting with the
+ * worker's own range and stealing from the others once it is drained.
+ * Returns the number of iterations claimed, zero once all have been
+ * handed out.
+ */
+static unsigned
+lp_cs_tpool_claim(struct lp_cs_tpool_task *task, unsigned thread_index,
+                  unsigned *first)
+{
+   unsigned num_ranges = task->num_ranges;
+
+   for (unsigned n = 0; n < num_ranges; n++) {
+      struct lp_cs_tpool_range *range =
+         &task->ranges[(thread_index + n) % num_ranges].r;
+
+      /* Skip drained ranges without dirtying their cache line. */
+      if (p_atomic_read(&range->next) >= range->end)
+         continue;
+
+      *first = p_atomic_add_return(&range->next, task->grain) - task->grain;
+      if (*first < range->end)
+         return MIN2(task->grain, range->end - *first);
+   }
+   return 0;
+}
 
 static int
 lp_cs_tpool_worker(void *data)
 {
    struct lp_cs_tpool *pool = data;
    struct lp_cs_local_mem lmem;
+   unsigned thread_index;
 
    memset(&lmem, 0, sizeof(lmem));
    mtx_lock(&pool->m);
 
+   thread_index = pool->next_thread_index++;
+
+   /* Pin before the first local memory allocation so that it lands on
+    * this thread's NUMA node.
+    */
+   if (pool->pin_threads)
+      lp_thread_pin_to_L3(thread_index, pool->num_threads);
+
    while (!pool->shutdown) {
       struct lp_cs_tpool_task *task;
-      unsigned iter_per_thread;
+      unsigned first, count;
 
       while (list_is_empty(&pool->workqueue) && !pool->shutdown)
          cnd_wait(&pool->new_work, &pool->m);
@@ -53,29 +92,22 @@ lp_cs_tpool_worker(void *data)
 
       task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
                               list);
+      task->active++;
+      mtx_unlock(&pool->m);
 
-      unsigned this_iter = task->iter_start;
-
-      iter_per_thread = task->iter_per_thread;
-
-      if (task->iter_remainder &&
-          task->iter_start + task->iter_remainder == task->iter_total) {
-         task->iter_remainder--;
-         iter_per_thread = 1;
+      while ((count = lp_cs_tpool_claim(task, thread_index, &first))) {
+         for (unsigned i = 0; i < count; i++)
+            task->work(task->data, first + i, &lmem);
+         p_atomic_add(&task->iter_finished, count);
       }
 
-      task->iter_start += iter_per_thread;
-
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
-
-      mtx_unlock(&pool->m);
-      for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
-
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
+      /* Every iteration has been handed out, stop offering the task. */
+      if (task->queued) {
+         list_del(&task->list);
+         task->queued = false;
+      }
+      if (--task->active == 0 && task->iter_finished == task->iter_total)
          cnd_broadcast(&task->finish);
    }
    mtx_unlock(&pool->m);
@@ -84,19 +116,25 @@ lp_cs_tpool_worker(void *data)
 }
 
 struct lp_cs_tpool *
-lp_cs_tpool_create(unsigned num_threads)
+lp_cs_tpool_create(unsigned num_threads, bool pin_threads)
 {
    struct lp_cs_tpool *pool = CALLOC_STRUCT(lp_cs_tpool);
 
    if (!pool)
       return NULL;
 
+   pool->threads = CALLOC(MAX2(1, num_threads), sizeof(*pool->threads));
+   if (!pool->threads) {
+      FREE(pool);
+      return NULL;
+   }
+
    (void) mtx_init(&pool->m, mtx_plain);
    cnd_init(&pool->new_work);
 
    list_inithead(&pool->workqueue);
-   assert (num_threads <= LP_MAX_THREADS);
    pool->num_threads = num_threads;
+   pool->pin_threads = pin_threads;
    for (unsigned i = 0; i < num_threads; i++)
       pool->threads[i] = u_thread_create(lp_cs_tpool_worker, pool);
    return pool;
@@ -119,6 +157,7 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -128,6 +167,13 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
 {
    struct lp_cs_tpool_task *task;
 
+   /* No worker would be woken to take a task without iterations off the
+    * workqueue, and waiting for it would free it while still queued.  As
+    * with the synchronous path below, a NULL task is already complete.
+    */
+   if (num_iters <= 0)
+      return NULL;
+
    if (pool->num_threads == 0) {
       struct lp_cs_local_mem lmem;
 
@@ -143,20 +189,39 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
       return NULL;
    }
 
+   task->ranges = align_calloc(pool->num_threads * sizeof(*task->ranges),
+                               CACHE_LINE_SIZE);
+   if (!task->ranges) {
+      FREE(task);
+      return NULL;
+   }
+
    task->work = work;
    task->data = data;
    task->iter_total = num_iters;
+   task->grain = DIV_ROUND_UP(num_iters,
+                              pool->num_threads * LP_CS_TPOOL_GRAINS_PER_THREAD);
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
+   task->num_ranges = pool->num_threads;
+   for (unsigned i = 0; i < pool->num_threads; i++) {
+      task->ranges[i].r.next = (uint64_t)num_iters * i / pool->num_threads;
+      task->ranges[i].r.end = (uint64_t)num_iters * (i + 1) / pool->num_threads;
+   }
 
    cnd_init(&task->finish);
 
    mtx_lock(&pool->m);
 
    list_addtail(&task->list, &pool->workqueue);
-
-   cnd_broadcast(&pool->new_work);
+   task->queued = true;
+
+   /* Only wake as many workers as there are grains to go around. */
+   if (num_iters >= pool->num_threads) {
+      cnd_broadcast(&pool->new_work);
+   } else {
+      for (unsigned i = 0; i < num_iters; i++)
+         cnd_signal(&pool->new_work);
+   }
    mtx_unlock(&pool->m);
    return task;
 }
@@ -171,11 +236,12 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
       return;
 
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
+   while (task->iter_finished < task->iter_total || task->active)
       cnd_wait(&task->finish, &pool->m);
    mtx_unlock(&pool->m);
 
    cnd_destroy(&task->finish);
+   align_free(task->ranges);
    FREE(task);
    *task_handle = NULL;
 }
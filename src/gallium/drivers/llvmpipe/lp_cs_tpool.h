@@ -28,6 +28,9 @@
  * The item is added to the work queue once, but it must execute
  * number of iterations times. This saves storing a bunch of queue
  * structs with just unique indexes in them.
+ * The iterations are split into one range per worker; workers take
+ * batches (grains) from their own range and steal from the others once
+ * it runs dry, so the pool mutex is only taken once per task and worker.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
  */
@@ -45,8 +48,10 @@ struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
 
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
    unsigned num_threads;
+   unsigned next_thread_index;
+   bool pin_threads;
    struct list_head workqueue;
    bool shutdown;
 };
@@ -58,19 +63,39 @@ struct lp_cs_local_mem {
 
 typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
 
+/* Aim for this many grains per worker, so that stealing can even out
+ * uneven workgroups without making tiny dispatches pay for it.
+ */
+#define LP_CS_TPOOL_GRAINS_PER_THREAD 4
+
+/**
+ * Range of iterations [next, end) owned by one worker.  Workers claim
+ * grain sized chunks from their own range first and then steal from the
+ * other workers' ranges; next is only ever advanced atomically.
+ */
+struct lp_cs_tpool_range {
+   unsigned next;
+   unsigned end;
+};
+
 struct lp_cs_tpool_task {
    lp_cs_tpool_task_func work;
    void *data;
    struct list_head list;
    cnd_t finish;
    unsigned iter_total;
-   unsigned iter_start;
    unsigned iter_finished;
-   unsigned iter_per_thread;
-   unsigned iter_remainder;
+   unsigned grain;
+
+   /* protected by the pool mutex */
+   unsigned active;  /**< workers currently claiming from this task */
+   bool queued;      /**< still on the pool's workqueue */
+
+   unsigned num_ranges;
+   EXCLUSIVE_CACHELINE(struct lp_cs_tpool_range r) *ranges;
 };
 
-struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
+struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads, bool pin_threads);
 void lp_cs_tpool_destroy(struct lp_cs_tpool *);
 
 struct lp_cs_tpool_task *lp_cs_tpool_queue_task(struct lp_cs_tpool *,
@@ -66,7 +66,15 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 16
+/**
+ * Max number of rasterizer / compute threads.  The thread pools are sized
+ * by the number of threads actually in use (LP_NUM_THREADS, defaulting to
+ * the number of CPUs), so this only bounds a few small per-thread arrays.
+ * May be overridden at build time for very large hosts.
+ */
+#ifndef LP_MAX_THREADS
+#define LP_MAX_THREADS 128
+#endif
 
 
 /**
@@ -48,6 +48,7 @@
 #include "gallivm/lp_bld_debug.h"
 #include "lp_scene.h"
 #include "lp_tex_sample.h"
+#include "lp_affinity.h"
 
 
 #ifdef DEBUG
@@ -74,7 +75,7 @@ lp_rast_begin( struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization( scene );
-   lp_scene_bin_iter_begin( scene );
+   lp_scene_bin_iter_begin( scene, MAX2(1, rast->num_threads) );
 }
 
 
@@ -1089,7 +1090,8 @@ rasterize_scene(struct lp_rasterizer_task *task,
          int i, j;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
+         while ((bin = lp_scene_bin_iter_next(scene, task->thread_index,
+                                              &i, &j))) {
             if (!is_empty_bin( bin ))
                rasterize_bin(task, bin, i, j);
          }
@@ -1205,6 +1207,22 @@ thread_function(void *init_data)
    fpstate = util_fpstate_get();
    util_fpstate_set_denorms_to_zero(fpstate);
 
+   if (rast->pin_threads) {
+      struct lp_build_format_cache *cache;
+
+      lp_thread_pin_to_L3(task->thread_index, rast->num_threads);
+
+      /* Reallocate the texture format cache from the pinned thread so that
+       * it is placed on the local NUMA node.
+       */
+      cache = align_malloc(sizeof(struct lp_build_format_cache), 16);
+      if (cache) {
+         memset(cache, 0, sizeof(*cache));
+         align_free(task->thread_data.cache);
+         task->thread_data.cache = cache;
+      }
+   }
+
    while (1) {
       /* wait for work */
       if (debug)
@@ -1286,9 +1304,10 @@ create_rast_threads(struct lp_rasterizer *rast)
  * Create new lp_rasterizer.  If num_threads is zero, don't create any
  * new threads, do rendering synchronously.
  * \param num_threads  number of rasterizer threads to create
+ * \param pin_threads  pin the threads to L3 cache domains
  */
 struct lp_rasterizer *
-lp_rast_create( unsigned num_threads )
+lp_rast_create( unsigned num_threads, boolean pin_threads )
 {
    struct lp_rasterizer *rast;
    unsigned i;
@@ -1298,6 +1317,12 @@ lp_rast_create( unsigned num_threads )
       goto no_rast;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(*rast->tasks));
+   rast->threads = CALLOC(MAX2(1, num_threads), sizeof(*rast->threads));
+   if (!rast->tasks || !rast->threads) {
+      goto no_tasks;
+   }
+
    rast->full_scenes = lp_scene_queue_create();
    if (!rast->full_scenes) {
       goto no_full_scenes;
@@ -1315,6 +1340,7 @@ lp_rast_create( unsigned num_threads )
    }
 
    rast->num_threads = num_threads;
+   rast->pin_threads = pin_threads;
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", FALSE);
 
@@ -1330,7 +1356,7 @@ lp_rast_create( unsigned num_threads )
    return rast;
 
 no_thread_data_cache:
-   for (i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
@@ -1338,6 +1364,9 @@ no_thread_data_cache:
 
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
+no_tasks:
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 no_rast:
    return NULL;
@@ -1391,6 +1420,8 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->threads);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
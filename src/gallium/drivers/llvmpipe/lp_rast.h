@@ -194,7 +194,7 @@ struct lp_rast_clear_rb {
 
 
 struct lp_rasterizer *
-lp_rast_create( unsigned num_threads );
+lp_rast_create( unsigned num_threads, boolean pin_threads );
 
 void
 lp_rast_destroy( struct lp_rasterizer * );
@@ -122,10 +122,13 @@ struct lp_rasterizer
    struct lp_scene *curr_scene;
 
    /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
+
+   /** Pin each thread to an L3 cache domain */
+   boolean pin_threads;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
@@ -28,6 +28,7 @@
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
 #include "util/u_inlines.h"
 #include "util/format/u_format.h"
 #include "lp_scene.h"
@@ -72,8 +73,6 @@ lp_scene_create( struct lp_setup_context *setup )
    scene->setup = setup;
    scene->data.head = &scene->data.first;
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
-
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
    {
@@ -100,7 +99,6 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_scene_end_rasterization(scene);
-   mtx_destroy(&scene->mutex);
    assert(scene->data.head == &scene->data.first);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
@@ -546,61 +544,64 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/**
+ * Split the scene's bins into one contiguous range per rasterizer thread.
+ * Contiguous ranges keep neighbouring tiles, and the texture data they
+ * touch, on the same thread for as long as possible.
+ */
+void
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_threads )
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
-   }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
-   }
-   return TRUE;
-}
+   unsigned num_bins = scene->tiles_x * scene->tiles_y;
+   unsigned i;
 
+   assert(num_threads >= 1 && num_threads <= LP_MAX_THREADS);
 
-void
-lp_scene_bin_iter_begin( struct lp_scene *scene )
-{
-   scene->curr_x = scene->curr_y = -1;
+   scene->num_bin_queues = num_threads;
+   for (i = 0; i < num_threads; i++) {
+      scene->bin_queue[i].q.next = num_bins * i / num_threads;
+      scene->bin_queue[i].q.end = num_bins * (i + 1) / num_threads;
+   }
 }
 
 
 /**
  * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  Each thread takes bins from its own queue
+ * first and then steals from the other threads' queues, without locking.
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned thread_index,
+                        int *x, int *y )
 {
-   struct cmd_bin *bin = NULL;
+   unsigned num_queues = scene->num_bin_queues;
+   unsigned n;
 
-   mtx_lock(&scene->mutex);
+   assert(thread_index < num_queues);
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
+   for (n = 0; n < num_queues; n++) {
+      unsigned q = thread_index + n;
+      struct lp_bin_queue *queue;
+      int idx;
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+      if (q >= num_queues)
+         q -= num_queues;
+      queue = &scene->bin_queue[q].q;
+
+      /* Skip drained queues without dirtying their cache line. */
+      if (p_atomic_read(&queue->next) >= queue->end)
+         continue;
+
+      idx = p_atomic_inc_return(&queue->next) - 1;
+      if (idx < queue->end) {
+         *x = idx % scene->tiles_x;
+         *y = idx / scene->tiles_x;
+         return lp_scene_get_bin(scene, *x, *y);
+      }
+   }
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   return NULL;
 }
 
 
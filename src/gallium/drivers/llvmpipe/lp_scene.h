@@ -38,6 +38,7 @@
 #include "os/os_thread.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
+#include "lp_limits.h"
 
 struct lp_scene_queue;
 struct lp_rast_state;
@@ -99,6 +100,15 @@ struct cmd_bin {
    struct cmd_block *head;
    struct cmd_block *tail;
 };
+
+
+/**
+ * A range of bins handed out to the rasterizer threads.
+ */
+struct lp_bin_queue {
+   int next;
+   int end;
+};
    
 
 /**
@@ -194,8 +204,14 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /**
+    * Per-thread bin queues, each a range [next, end) of linear bin indices
+    * (y * tiles_x + x).  A rasterizer thread drains its own queue first and
+    * then steals from the others.  next is only ever advanced atomically,
+    * so it may overshoot end once a queue is drained.
+    */
+   EXCLUSIVE_CACHELINE(struct lp_bin_queue q) bin_queue[LP_MAX_THREADS];
+   unsigned num_bin_queues;
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
@@ -394,10 +410,11 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 
 
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene );
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_threads );
 
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned thread_index,
+                        int *x, int *y );
 
 
 
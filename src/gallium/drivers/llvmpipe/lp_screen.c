@@ -844,6 +844,9 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
    struct sw_winsys *winsys = screen->winsys;
 
+   if (util_queue_is_initialized(&screen->opt_queue))
+      util_queue_destroy(&screen->opt_queue);
+
    if (screen->cs_tpool)
       lp_cs_tpool_destroy(screen->cs_tpool);
 
@@ -994,19 +997,29 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
    if (screen->late_init_done)
       goto out;
 
-   screen->rast = lp_rast_create(screen->num_threads);
+   screen->rast = lp_rast_create(screen->num_threads, screen->pin_threads);
    if (!screen->rast) {
       ret = false;
       goto out;
    }
 
-   screen->cs_tpool = lp_cs_tpool_create(screen->num_threads);
+   screen->cs_tpool = lp_cs_tpool_create(screen->num_threads,
+                                         screen->pin_threads);
    if (!screen->cs_tpool) {
       lp_rast_destroy(screen->rast);
       ret = false;
       goto out;
    }
 
+   /* Without a queue variants simply get compiled at full optimization
+    * right away.
+    */
+   if (screen->tiered_jit &&
+       !util_queue_init(&screen->opt_queue, "lpopt", 64, 1,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                        UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL))
+      screen->tiered_jit = false;
+
    lp_disk_cache_create(screen);
    screen->late_init_done = true;
 out:
@@ -1077,6 +1090,8 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 #endif
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS", screen->num_threads);
    screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
+   screen->pin_threads = debug_get_bool_option("LP_PIN_THREADS", FALSE);
+   screen->tiered_jit = debug_get_bool_option("LP_TIERED_JIT", FALSE);
 
    lp_build_init(); /* get lp_native_vector_width initialised */
 
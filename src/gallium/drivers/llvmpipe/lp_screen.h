@@ -37,6 +37,7 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
+#include "util/u_queue.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
 
@@ -50,6 +51,7 @@ struct llvmpipe_screen
    struct sw_winsys *winsys;
 
    unsigned num_threads;
+   bool pin_threads;
 
    /* Increments whenever textures are modified.  Contexts can track this.
     */
@@ -72,6 +74,12 @@ struct llvmpipe_screen
    struct disk_cache *disk_shader_cache;
    unsigned num_disk_shader_cache_hits;
    unsigned num_disk_shader_cache_misses;
+
+   /* LP_TIERED_JIT: fragment shader variants are first compiled without
+    * optimization, and recompiled at full optimization on this queue.
+    */
+   bool tiered_jit;
+   struct util_queue opt_queue;
 };
 
 void lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
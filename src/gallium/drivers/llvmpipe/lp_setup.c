@@ -391,6 +391,8 @@ lp_setup_flush( struct lp_setup_context *setup,
                 struct pipe_fence_handle **fence,
                 const char *reason)
 {
+   lp_setup_bin_sync(setup);
+
    set_scene_state( setup, SETUP_FLUSHED, reason );
 
    if (fence) {
@@ -405,6 +407,8 @@ void
 lp_setup_bind_framebuffer( struct lp_setup_context *setup,
                            const struct pipe_framebuffer_state *fb )
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    /* Flush any old scene.
@@ -562,6 +566,8 @@ lp_setup_clear( struct lp_setup_context *setup,
 {
    unsigned i;
 
+   lp_setup_bin_sync(setup);
+
    /*
     * Note any of these (max 9) clears could fail (but at most there should
     * be just one failure!). This avoids doing the previous succeeded
@@ -604,6 +610,8 @@ lp_setup_set_triangle_state( struct lp_setup_context *setup,
                              boolean bottom_edge_rule,
                              boolean multisample)
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    setup->ccw_is_frontface = ccw_is_frontface;
@@ -625,6 +633,8 @@ lp_setup_set_line_state( struct lp_setup_context *setup,
                          float line_width,
                          boolean line_rectangular)
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    setup->line_width = line_width;
@@ -640,6 +650,8 @@ lp_setup_set_point_state( struct lp_setup_context *setup,
                           uint sprite_coord_origin,
                           boolean point_quad_rasterization)
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    setup->point_size = point_size;
@@ -654,6 +666,8 @@ void
 lp_setup_set_setup_variant( struct lp_setup_context *setup,
 			    const struct lp_setup_variant *variant)
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
    
    setup->setup.variant = variant;
@@ -663,6 +677,8 @@ void
 lp_setup_set_fs_variant( struct lp_setup_context *setup,
                          struct lp_fragment_shader_variant *variant)
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__,
           variant);
 
@@ -677,6 +693,8 @@ lp_setup_set_fs_constants(struct lp_setup_context *setup,
 {
    unsigned i;
 
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) buffers);
 
    assert(num <= ARRAY_SIZE(setup->constants));
@@ -698,6 +716,8 @@ lp_setup_set_fs_ssbos(struct lp_setup_context *setup,
 {
    unsigned i;
 
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) buffers);
 
    assert(num <= ARRAY_SIZE(setup->ssbos));
@@ -719,6 +739,8 @@ lp_setup_set_fs_images(struct lp_setup_context *setup,
 {
    unsigned i;
 
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) images);
 
    assert(num <= ARRAY_SIZE(setup->images));
@@ -794,6 +816,8 @@ void
 lp_setup_set_alpha_ref_value( struct lp_setup_context *setup,
                               float alpha_ref_value )
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s %f\n", __FUNCTION__, alpha_ref_value);
 
    if(setup->fs.current.jit_context.alpha_ref_value != alpha_ref_value) {
@@ -806,6 +830,8 @@ void
 lp_setup_set_stencil_ref_values( struct lp_setup_context *setup,
                                  const ubyte refs[2] )
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s %d %d\n", __FUNCTION__, refs[0], refs[1]);
 
    if (setup->fs.current.jit_context.stencil_ref_front != refs[0] ||
@@ -820,6 +846,8 @@ void
 lp_setup_set_blend_color( struct lp_setup_context *setup,
                           const struct pipe_blend_color *blend_color )
 {
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    assert(blend_color);
@@ -836,6 +864,9 @@ lp_setup_set_scissors( struct lp_setup_context *setup,
                        const struct pipe_scissor_state *scissors )
 {
    unsigned i;
+
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    assert(scissors);
@@ -853,6 +884,8 @@ void
 lp_setup_set_sample_mask(struct lp_setup_context *setup,
                          uint32_t sample_mask)
 {
+   lp_setup_bin_sync(setup);
+
    if (setup->fs.current.jit_context.sample_mask != sample_mask) {
       setup->fs.current.jit_context.sample_mask = sample_mask;
       setup->dirty |= LP_SETUP_NEW_FS;
@@ -863,6 +896,8 @@ void
 lp_setup_set_flatshade_first(struct lp_setup_context *setup,
                              boolean flatshade_first)
 {
+   lp_setup_bin_sync(setup);
+
    setup->flatshade_first = flatshade_first;
 }
 
@@ -870,6 +905,8 @@ void
 lp_setup_set_rasterizer_discard(struct lp_setup_context *setup,
                                 boolean rasterizer_discard)
 {
+   lp_setup_bin_sync(setup);
+
    if (setup->rasterizer_discard != rasterizer_discard) {
       setup->rasterizer_discard = rasterizer_discard;
       setup->line = first_line;
@@ -883,6 +920,8 @@ void
 lp_setup_set_vertex_info(struct lp_setup_context *setup,
                          struct vertex_info *vertex_info)
 {
+   lp_setup_bin_sync(setup);
+
    /* XXX: just silently holding onto the pointer:
     */
    setup->vertex_info = vertex_info;
@@ -893,6 +932,8 @@ void
 lp_setup_set_linear_mode( struct lp_setup_context *setup,
                           boolean mode )
 {
+   lp_setup_bin_sync(setup);
+
    /* The linear rasterizer requires sse2 both at compile and runtime,
     * in particular for the code in lp_rast_linear_fallback.c.  This
     * is more than ten-year-old technology, so it's a reasonable
@@ -919,6 +960,8 @@ lp_setup_set_viewports(struct lp_setup_context *setup,
    float half_height, x0, y0;
    unsigned i;
 
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    assert(num_viewports <= PIPE_MAX_VIEWPORTS);
@@ -973,6 +1016,8 @@ lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
 {
    unsigned i, max_tex_num;
 
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    assert(num <= PIPE_MAX_SHADER_SAMPLER_VIEWS);
@@ -1128,6 +1173,8 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
 {
    unsigned i;
 
+   lp_setup_bin_sync(setup);
+
    LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
 
    assert(num <= PIPE_MAX_SAMPLERS);
@@ -1159,7 +1206,7 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
  * being rendered and the current scene being built.
  */
 unsigned
-lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
+lp_setup_is_resource_referenced( struct lp_setup_context *setup,
                                 const struct pipe_resource *texture )
 {
    unsigned i, j;
@@ -1173,6 +1220,12 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
       return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
+   /* Only the scenes need the bin thread to be idle: it adds the resources
+    * of the draws it bins to them, and may start a new one when a scene is
+    * full.  The framebuffer state above only changes on this thread.
+    */
+   lp_setup_bin_sync(setup);
+
    /* check resources referenced by active scenes */
    for (i = 0; i < setup->num_active_scenes; i++) {
       struct lp_scene *scene = setup->scenes[i];
@@ -1275,8 +1328,11 @@ try_update_scene_state( struct lp_setup_context *setup )
       setup->dirty |= LP_SETUP_NEW_FS;
    }
 
+   /* The bin thread only bins with state derived before the batch was
+    * recorded and must not look at the context.
+    */
    struct llvmpipe_context *llvmpipe = llvmpipe_context(setup->pipe);
-   if (llvmpipe->dirty & LP_NEW_FS_CONSTANTS)
+   if (!setup->bin.active && (llvmpipe->dirty & LP_NEW_FS_CONSTANTS))
       lp_setup_set_fs_constants(llvmpipe->setup,
                                 ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]),
                                 llvmpipe->constants[PIPE_SHADER_FRAGMENT]);
@@ -1487,6 +1543,16 @@ lp_setup_update_state( struct lp_setup_context *setup,
     */
    {
       struct llvmpipe_context *lp = llvmpipe_context(setup->pipe);
+
+      /* Batches queued for the bin thread were recorded with the current
+       * derived state, llvmpipe_update_derived() waits for them before
+       * changing it.
+       */
+      if (setup->bin.pending && !lp->dirty) {
+         assert(!update_scene);
+         return TRUE;
+      }
+
       if (lp->dirty) {
          llvmpipe_update_derived(lp);
       }
@@ -1515,7 +1581,22 @@ lp_setup_update_state( struct lp_setup_context *setup,
 		    setup->setup.variant->key.size) == 0);
    }
 
-   if (update_scene && setup->state != SETUP_ACTIVE) {
+   if (!update_scene)
+      return TRUE;
+
+   return lp_setup_update_scene_state(setup);
+}
+
+
+/**
+ * Make sure there is an active scene with the current state stored in it.
+ * Unlike lp_setup_update_state() this doesn't touch the llvmpipe context,
+ * so it is also used on the bin thread.
+ */
+boolean
+lp_setup_update_scene_state( struct lp_setup_context *setup )
+{
+   if (setup->state != SETUP_ACTIVE) {
       if (!set_scene_state( setup, SETUP_ACTIVE, __FUNCTION__ ))
          return FALSE;
    }
@@ -1523,7 +1604,7 @@ lp_setup_update_state( struct lp_setup_context *setup,
    /* Only call into update_scene_state() if we already have a
     * scene:
     */
-   if (update_scene && setup->scene) {
+   if (setup->scene) {
       assert(setup->state == SETUP_ACTIVE);
 
       if (try_update_scene_state(setup))
@@ -1558,6 +1639,8 @@ lp_setup_destroy( struct lp_setup_context *setup )
 {
    uint i;
 
+   lp_setup_destroy_bin_thread( setup );
+
    lp_setup_reset( setup );
 
    util_unreference_framebuffer_state(&setup->fb);
@@ -1621,6 +1704,9 @@ lp_setup_create( struct pipe_context *pipe,
 
 
    setup->num_threads = screen->num_threads;
+   if (setup->num_threads && debug_get_bool_option("LP_BIN_THREAD", FALSE))
+      lp_setup_init_bin_thread(setup);
+
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1673,6 +1759,8 @@ void
 lp_setup_begin_query(struct lp_setup_context *setup,
                      struct llvmpipe_query *pq)
 {
+   lp_setup_bin_sync(setup);
+
    set_scene_state(setup, SETUP_ACTIVE, "begin_query");
 
    if (!(pq->type == PIPE_QUERY_OCCLUSION_COUNTER ||
@@ -1718,6 +1806,8 @@ lp_setup_begin_query(struct lp_setup_context *setup,
 void
 lp_setup_end_query(struct lp_setup_context *setup, struct llvmpipe_query *pq)
 {
+   lp_setup_bin_sync(setup);
+
    set_scene_state(setup, SETUP_ACTIVE, "end_query");
 
    assert(setup->scene);
@@ -1797,7 +1887,7 @@ lp_setup_flush_and_restart(struct lp_setup_context *setup)
    if (!set_scene_state(setup, SETUP_FLUSHED, __FUNCTION__))
       return FALSE;
    
-   if (!lp_setup_update_state(setup, TRUE))
+   if (!lp_setup_update_scene_state(setup))
       return FALSE;
 
    return TRUE;
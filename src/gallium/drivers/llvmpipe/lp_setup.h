@@ -151,7 +151,7 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
                                     struct pipe_sampler_state **samplers);
 
 unsigned
-lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
+lp_setup_is_resource_referenced( struct lp_setup_context *setup,
                                 const struct pipe_resource *texture );
 
 void
@@ -174,6 +174,9 @@ void
 lp_setup_set_linear_mode( struct lp_setup_context *setup, 
                           boolean permit_linear_rasterizer );
 
+void
+lp_setup_bin_sync(struct lp_setup_context *setup);
+
 void
 lp_setup_begin_query(struct lp_setup_context *setup,
                      struct llvmpipe_query *pq);
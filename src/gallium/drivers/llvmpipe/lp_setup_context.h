@@ -44,6 +44,7 @@
 #include "util/u_rect.h"
 #include "util/u_pack_color.h"
 #include "util/slab.h"
+#include "util/u_queue.h"
 
 #define LP_SETUP_NEW_FS          0x01
 #define LP_SETUP_NEW_CONSTANTS   0x02
@@ -53,12 +54,16 @@
 #define LP_SETUP_NEW_SSBOS       0x20
 
 struct lp_setup_variant;
+struct lp_setup_bin_batch;
 
 
 /** Max number of scenes */
 #define INITIAL_SCENES 4
 #define MAX_SCENES 64
 
+/** Number of batches in flight to the bin thread */
+#define LP_SETUP_BIN_BATCHES 4
+
 
 
 /**
@@ -84,6 +89,17 @@ struct lp_setup_context
    uint vertex_buffer_size;
    void *vertex_buffer;
 
+   /** Optional setup and binning thread, see lp_setup_vbuf.c */
+   struct {
+      struct util_queue queue;
+      struct lp_setup_bin_batch *batches[LP_SETUP_BIN_BATCHES];
+      unsigned next;          /**< batch being recorded */
+      unsigned view_index;    /**< view index for the next recorded draw */
+      boolean enabled;
+      boolean pending;        /**< batches recorded since the last sync */
+      boolean active;         /**< only accessed by the bin thread */
+   } bin;
+
    /* Final pipeline stage for draw module.  Draw module should
     * create/install this itself now.
     */
@@ -227,6 +243,12 @@ void lp_setup_init_vbuf(struct lp_setup_context *setup);
 boolean lp_setup_update_state( struct lp_setup_context *setup,
                             boolean update_scene);
 
+boolean lp_setup_update_scene_state( struct lp_setup_context *setup );
+
+void lp_setup_init_bin_thread( struct lp_setup_context *setup );
+
+void lp_setup_destroy_bin_thread( struct lp_setup_context *setup );
+
 void lp_setup_destroy( struct lp_setup_context *setup );
 
 boolean lp_setup_flush_and_restart(struct lp_setup_context *setup);
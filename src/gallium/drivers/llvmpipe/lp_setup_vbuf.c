@@ -42,6 +42,7 @@
 #include "draw/draw_vertex.h"
 #include "util/u_memory.h"
 #include "util/u_math.h"
+#include "util/u_queue.h"
 #include "lp_state_fs.h"
 #include "lp_perf.h"
 
@@ -53,6 +54,12 @@
 
 #define LP_MAX_VBUF_SIZE    4096
 
+/* Bin thread batches hold a number of vbuf flushes worth of primitives.
+ */
+#define LP_BIN_BATCH_VERTEX_BYTES (16 * LP_MAX_VBUF_SIZE)
+#define LP_BIN_BATCH_INDICES      (16 * LP_MAX_VBUF_INDEXES)
+#define LP_BIN_BATCH_DRAWS        64
+
   
 
 /** cast wrapper */
@@ -130,7 +137,13 @@ lp_setup_set_primitive(struct vbuf_render *vbr, enum pipe_prim_type prim)
 static void
 lp_setup_set_view_index(struct vbuf_render *vbr, unsigned view_index)
 {
-   lp_setup_context(vbr)->view_index = view_index;
+   struct lp_setup_context *setup = lp_setup_context(vbr);
+
+   /* The bin thread picks the view index up from each recorded draw. */
+   if (setup->bin.enabled)
+      setup->bin.view_index = view_index;
+   else
+      setup->view_index = view_index;
 }
 
 typedef const float (*const_float4_ptr)[4];
@@ -159,26 +172,20 @@ rect(struct lp_setup_context *setup,
 }
 
 /**
- * draw elements / indexed primitives
+ * Set up and bin indexed primitives.
  */
 static void
-lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
+bin_elements(struct lp_setup_context *setup, enum pipe_prim_type prim,
+             const void *vertex_buffer, unsigned stride,
+             const ushort *indices, uint nr)
 {
-   struct lp_setup_context *setup = lp_setup_context(vbr);
-   const unsigned stride = setup->vertex_info->size * sizeof(float);
-   const void *vertex_buffer = setup->vertex_buffer;
    const boolean flatshade_first = setup->flatshade_first;
    boolean uses_constant_interp;
    unsigned i;
 
-   assert(setup->setup.variant);
-
-   if (!lp_setup_update_state(setup, TRUE))
-      return;
-
    uses_constant_interp = setup->setup.variant->key.uses_constant_interp;
 
-   switch (setup->prim) {
+   switch (prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
          setup->point( setup,
@@ -373,26 +380,19 @@ lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
 
 
 /**
- * This function is hit when the draw module is working in pass-through mode.
- * It's up to us to convert the vertex array into point/line/tri prims.
+ * Set up and bin non-indexed primitives.
  */
 static void
-lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
+bin_arrays(struct lp_setup_context *setup, enum pipe_prim_type prim,
+           const void *vertex_buffer, unsigned stride, uint nr)
 {
-   struct lp_setup_context *setup = lp_setup_context(vbr);
-   const unsigned stride = setup->vertex_info->size * sizeof(float);
-   const void *vertex_buffer =
-      (void *) get_vert(setup->vertex_buffer, start, stride);
    const boolean flatshade_first = setup->flatshade_first;
    boolean uses_constant_interp;
    unsigned i;
 
-   if (!lp_setup_update_state(setup, TRUE))
-      return;
-
    uses_constant_interp = setup->setup.variant->key.uses_constant_interp;
 
-   switch (setup->prim) {
+   switch (prim) {
    case PIPE_PRIM_POINTS:
       for (i = 0; i < nr; i++) {
          setup->point( setup,
@@ -644,6 +644,297 @@ lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
 }
 
 
+/**
+ * Bin thread.
+ *
+ * With LP_BIN_THREAD set, the draw module only records the post-transform
+ * vertices and indices it hands us into a batch, and triangle setup and
+ * binning of the batch run on a dedicated thread.  Vertex processing of
+ * the rest of the draw thus overlaps with setup and binning.
+ *
+ * The bin thread owns the scene state while batches are queued, so
+ * consecutive draws without state changes in between overlap with each
+ * other's setup and binning as well.  Every lp_setup entry point that
+ * changes state or looks at the scene first waits for it through
+ * lp_setup_bin_sync(), as do llvmpipe_update_derived() and fragment shader
+ * deletion.  Flushes wait too, so a scene is never rasterized while it is
+ * still being binned.
+ */
+
+struct lp_setup_bin_draw {
+   enum pipe_prim_type prim;
+   unsigned view_index;
+   unsigned stride;
+   unsigned vertex_offset;   /**< in bytes into lp_setup_bin_batch::vertices */
+   unsigned index_offset;    /**< into lp_setup_bin_batch::indices, or ~0 */
+   unsigned count;
+};
+
+struct lp_setup_bin_batch {
+   struct util_queue_fence fence;
+   struct lp_setup_context *setup;
+
+   unsigned num_draws;
+   unsigned vertex_bytes;
+   unsigned num_indices;
+
+   struct lp_setup_bin_draw draws[LP_BIN_BATCH_DRAWS];
+   ushort indices[LP_BIN_BATCH_INDICES];
+   PIPE_ALIGN_VAR(16) uint8_t vertices[LP_BIN_BATCH_VERTEX_BYTES];
+};
+
+
+static void
+bin_batch_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_setup_bin_batch *batch = data;
+   struct lp_setup_context *setup = batch->setup;
+   unsigned i;
+
+   setup->bin.active = TRUE;
+
+   for (i = 0; i < batch->num_draws; i++) {
+      const struct lp_setup_bin_draw *draw = &batch->draws[i];
+      const void *vertex_buffer = batch->vertices + draw->vertex_offset;
+
+      setup->view_index = draw->view_index;
+
+      if (!lp_setup_update_scene_state(setup))
+         continue;
+
+      if (draw->index_offset == ~0u) {
+         bin_arrays(setup, draw->prim, vertex_buffer, draw->stride,
+                    draw->count);
+      } else {
+         bin_elements(setup, draw->prim, vertex_buffer, draw->stride,
+                      batch->indices + draw->index_offset, draw->count);
+      }
+   }
+
+   setup->bin.active = FALSE;
+}
+
+
+/**
+ * Hand the batch being recorded to the bin thread and start recording into
+ * the next one, once the bin thread is done with it.
+ */
+static void
+bin_batch_submit(struct lp_setup_context *setup)
+{
+   struct lp_setup_bin_batch *batch = setup->bin.batches[setup->bin.next];
+
+   if (!batch->num_draws)
+      return;
+
+   util_queue_add_job(&setup->bin.queue, batch, &batch->fence,
+                      bin_batch_execute, NULL, 0);
+
+   setup->bin.next = (setup->bin.next + 1) % LP_SETUP_BIN_BATCHES;
+   batch = setup->bin.batches[setup->bin.next];
+
+   util_queue_fence_wait(&batch->fence);
+   batch->num_draws = 0;
+   batch->vertex_bytes = 0;
+   batch->num_indices = 0;
+}
+
+
+/**
+ * Record a draw into the current batch, copying the vertices it uses.
+ *
+ * Draws that don't fit in a batch, e.g. geometry or tessellation shader
+ * output, are binned right away once the bin thread is idle.
+ */
+static void
+bin_batch_record(struct lp_setup_context *setup, unsigned stride,
+                 const void *vertices, unsigned num_vertices,
+                 const ushort *indices, uint nr)
+{
+   const uint64_t vertex_bytes = align64((uint64_t)num_vertices * stride, 16);
+   struct lp_setup_bin_batch *batch = setup->bin.batches[setup->bin.next];
+   struct lp_setup_bin_draw *draw;
+
+   if (vertex_bytes > LP_BIN_BATCH_VERTEX_BYTES ||
+       (indices && nr > LP_BIN_BATCH_INDICES)) {
+      lp_setup_bin_sync(setup);
+
+      setup->view_index = setup->bin.view_index;
+      if (!lp_setup_update_scene_state(setup))
+         return;
+
+      if (indices)
+         bin_elements(setup, setup->prim, vertices, stride, indices, nr);
+      else
+         bin_arrays(setup, setup->prim, vertices, stride, nr);
+      return;
+   }
+
+   if (batch->num_draws == LP_BIN_BATCH_DRAWS ||
+       batch->vertex_bytes + vertex_bytes > LP_BIN_BATCH_VERTEX_BYTES ||
+       (indices && batch->num_indices + nr > LP_BIN_BATCH_INDICES)) {
+      bin_batch_submit(setup);
+      batch = setup->bin.batches[setup->bin.next];
+   }
+
+   draw = &batch->draws[batch->num_draws++];
+   draw->prim = setup->prim;
+   draw->view_index = setup->bin.view_index;
+   draw->stride = stride;
+   draw->vertex_offset = batch->vertex_bytes;
+   draw->count = nr;
+
+   memcpy(batch->vertices + batch->vertex_bytes, vertices,
+          num_vertices * stride);
+   batch->vertex_bytes += vertex_bytes;
+
+   if (indices) {
+      draw->index_offset = batch->num_indices;
+      memcpy(batch->indices + batch->num_indices, indices,
+             nr * sizeof(*indices));
+      batch->num_indices += nr;
+   } else {
+      draw->index_offset = ~0u;
+   }
+
+   setup->bin.pending = TRUE;
+}
+
+
+/**
+ * Wait until everything recorded so far has been binned.
+ */
+void
+lp_setup_bin_sync(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   if (!setup->bin.pending)
+      return;
+
+   bin_batch_submit(setup);
+   for (i = 0; i < LP_SETUP_BIN_BATCHES; i++)
+      util_queue_fence_wait(&setup->bin.batches[i]->fence);
+
+   setup->bin.pending = FALSE;
+}
+
+
+void
+lp_setup_init_bin_thread(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   if (!util_queue_init(&setup->bin.queue, "lpbin", LP_SETUP_BIN_BATCHES, 1,
+                        0, NULL))
+      return;
+
+   for (i = 0; i < LP_SETUP_BIN_BATCHES; i++) {
+      struct lp_setup_bin_batch *batch =
+         align_malloc(sizeof(struct lp_setup_bin_batch), 16);
+      if (!batch)
+         goto fail;
+
+      util_queue_fence_init(&batch->fence);
+      batch->setup = setup;
+      batch->num_draws = 0;
+      batch->vertex_bytes = 0;
+      batch->num_indices = 0;
+      setup->bin.batches[i] = batch;
+   }
+
+   setup->bin.enabled = TRUE;
+   return;
+
+fail:
+   lp_setup_destroy_bin_thread(setup);
+}
+
+
+void
+lp_setup_destroy_bin_thread(struct lp_setup_context *setup)
+{
+   unsigned i;
+
+   if (!util_queue_is_initialized(&setup->bin.queue))
+      return;
+
+   lp_setup_bin_sync(setup);
+   util_queue_destroy(&setup->bin.queue);
+   memset(&setup->bin.queue, 0, sizeof(setup->bin.queue));
+
+   for (i = 0; i < LP_SETUP_BIN_BATCHES; i++) {
+      if (setup->bin.batches[i]) {
+         util_queue_fence_destroy(&setup->bin.batches[i]->fence);
+         align_free(setup->bin.batches[i]);
+         setup->bin.batches[i] = NULL;
+      }
+   }
+
+   setup->bin.enabled = FALSE;
+}
+
+
+/**
+ * draw elements / indexed primitives
+ */
+static void
+lp_setup_draw_elements(struct vbuf_render *vbr, const ushort *indices, uint nr)
+{
+   struct lp_setup_context *setup = lp_setup_context(vbr);
+   const unsigned stride = setup->vertex_info->size * sizeof(float);
+
+   assert(setup->setup.variant);
+
+   if (setup->bin.enabled) {
+      unsigned max_index = 0;
+      unsigned i;
+
+      if (!nr)
+         return;
+
+      lp_setup_update_state(setup, FALSE);
+
+      for (i = 0; i < nr; i++)
+         max_index = MAX2(max_index, indices[i]);
+
+      bin_batch_record(setup, stride, setup->vertex_buffer, max_index + 1,
+                       indices, nr);
+      return;
+   }
+
+   if (!lp_setup_update_state(setup, TRUE))
+      return;
+
+   bin_elements(setup, setup->prim, setup->vertex_buffer, stride,
+                indices, nr);
+}
+
+
+/**
+ * This function is hit when the draw module is working in pass-through mode.
+ * It's up to us to convert the vertex array into point/line/tri prims.
+ */
+static void
+lp_setup_draw_arrays(struct vbuf_render *vbr, uint start, uint nr)
+{
+   struct lp_setup_context *setup = lp_setup_context(vbr);
+   const unsigned stride = setup->vertex_info->size * sizeof(float);
+   const void *vertex_buffer =
+      (void *) get_vert(setup->vertex_buffer, start, stride);
+
+   if (setup->bin.enabled) {
+      lp_setup_update_state(setup, FALSE);
+      bin_batch_record(setup, stride, vertex_buffer, nr, NULL, nr);
+      return;
+   }
+
+   if (!lp_setup_update_state(setup, TRUE))
+      return;
+
+   bin_arrays(setup, setup->prim, vertex_buffer, stride, nr);
+}
+
 
 static void
 lp_setup_vbuf_destroy(struct vbuf_render *vbr)
@@ -523,6 +523,10 @@ llvmpipe_create_compute_state(struct pipe_context *pipe,
    int nr_images = shader->info.base.file_max[TGSI_FILE_IMAGE] + 1;
    shader->variant_key_size = lp_cs_variant_key_size(MAX2(nr_samplers, nr_sampler_views), nr_images);
 
+   /* only needed for disk cache keys */
+   if (shader->base.ir.nir && llvmpipe_screen(pipe->screen)->disk_shader_cache)
+      lp_nir_sha1(shader->base.ir.nir, shader->ir_sha1);
+
    return shader;
 }
 
@@ -740,22 +744,12 @@ static void
 lp_cs_get_ir_cache_key(struct lp_compute_shader_variant *variant,
                        unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
    struct mesa_sha1 ctx;
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, &variant->key, variant->shader->variant_key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
+   _mesa_sha1_update(&ctx, variant->shader->ir_sha1,
+                     sizeof(variant->shader->ir_sha1));
    _mesa_sha1_final(&ctx, ir_sha1_cache_key);
-
-   blob_finish(&blob);
 }
 
 static struct lp_compute_shader_variant *
@@ -252,6 +252,11 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
 {
    struct llvmpipe_screen *lp_screen = llvmpipe_screen(llvmpipe->pipe.screen);
 
+   /* Draws queued for the bin thread use the current shader variants, which
+    * may be culled below.
+    */
+   lp_setup_bin_sync(llvmpipe->setup);
+
    /* Check for updated textures.
     */
    if (llvmpipe->tex_timestamp != lp_screen->timestamp) {
@@ -3547,24 +3547,172 @@ static void
 lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
                             unsigned char ir_sha1_cache_key[20])
 {
-   struct blob blob = { 0 };
-   unsigned ir_size;
-   void *ir_binary;
-
-   blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
-   ir_binary = blob.data;
-   ir_size = blob.size;
-
    struct mesa_sha1 ctx;
    _mesa_sha1_init(&ctx);
    _mesa_sha1_update(&ctx, &variant->key, variant->shader->variant_key_size);
-   _mesa_sha1_update(&ctx, ir_binary, ir_size);
+   _mesa_sha1_update(&ctx, variant->shader->ir_sha1,
+                     sizeof(variant->shader->ir_sha1));
    _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+/**
+ * Background recompile of a fragment shader variant (LP_TIERED_JIT).
+ */
+struct lp_fs_opt_job {
+   struct llvmpipe_screen *screen;
+   struct lp_fragment_shader_variant *variant;
+
+   /* Copy of the shader pointing to a private clone of its NIR, as
+    * compiling lowers the NIR in place.
+    */
+   struct lp_fragment_shader shader;
+
+   boolean generate[2];
+   boolean generate_linear;
+   boolean needs_caching;
+   unsigned char ir_sha1_cache_key[20];
+};
+
+
+static void
+fs_variant_opt_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_opt_job *job = data;
+   struct lp_fragment_shader_variant *variant = job->variant;
+   const size_t variant_size = sizeof *variant +
+      job->shader.variant_key_size - sizeof variant->key;
+   struct lp_fragment_shader_variant *opt;
+   struct lp_cached_code cached = { 0 };
+   lp_jit_frag_func edge_test;
+   LLVMContextRef context;
+   char module_name[64];
+   unsigned i;
+
+   /* The LLVM context of the llvmpipe context can't be used from another
+    * thread, and the variant must stay untouched while it is in use, so
+    * build into a scratch copy of it within a context of our own.
+    */
+   opt = MALLOC(variant_size);
+   context = LLVMContextCreate();
+   if (!opt || !context)
+      goto out;
+
+   memcpy(opt, variant, variant_size);
+   opt->shader = &job->shader;
+   opt->jit_context_ptr_type = NULL;
+   opt->jit_thread_data_ptr_type = NULL;
+   opt->jit_linear_context_ptr_type = NULL;
+   opt->function[RAST_EDGE_TEST] = NULL;
+   opt->function[RAST_WHOLE] = NULL;
+   opt->linear_function = NULL;
+
+   snprintf(module_name, sizeof(module_name), "fs%u_variant%u_opt",
+            job->shader.no, variant->no);
+
+   opt->gallivm = gallivm_create(module_name, context, &cached);
+   if (!opt->gallivm)
+      goto out;
+
+   lp_jit_init_types(opt);
+
+   for (i = 0; i < 2; i++) {
+      if (job->generate[i])
+         generate_fragment(NULL, &job->shader, opt, i);
+   }
+   if (job->generate_linear)
+      llvmpipe_fs_variant_linear_llvm(NULL, &job->shader, opt);
+
+   gallivm_compile_module(opt->gallivm);
+
+   /* Pointer stores are atomic, scenes being rasterized run either the
+    * first tier or the optimized code.
+    */
+   edge_test = variant->jit_function[RAST_EDGE_TEST];
+   if (job->generate[RAST_EDGE_TEST]) {
+      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+            gallivm_jit_function(opt->gallivm, opt->function[RAST_EDGE_TEST]);
+   }
+   if (job->generate[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+            gallivm_jit_function(opt->gallivm, opt->function[RAST_WHOLE]);
+   } else if (variant->jit_function[RAST_WHOLE] == edge_test) {
+      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
+   }
+   if (job->generate_linear) {
+      variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
+            gallivm_jit_function(opt->gallivm, opt->linear_function);
+   }
 
-   blob_finish(&blob);
+   if (job->needs_caching) {
+      lp_disk_cache_insert_shader(job->screen, &cached,
+                                  job->ir_sha1_cache_key);
+   }
+
+   gallivm_free_ir(opt->gallivm);
+   variant->opt_gallivm = opt->gallivm;
+
+out:
+   FREE(opt);
+   if (context)
+      LLVMContextDispose(context);
+}
+
+
+static void
+fs_variant_opt_cleanup(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_opt_job *job = data;
+
+   ralloc_free(job->shader.base.ir.nir);
+   FREE(job);
+}
+
+
+/**
+ * Queue the optimized recompile of a variant compiled with
+ * gallivm_create_fast().  Must be called after the first tier compile,
+ * with the IR freed.
+ */
+static void
+fs_variant_queue_opt(struct llvmpipe_screen *screen,
+                     struct lp_fragment_shader_variant *variant,
+                     boolean needs_caching,
+                     const unsigned char ir_sha1_cache_key[20])
+{
+   struct lp_fragment_shader *shader = variant->shader;
+   struct lp_fs_opt_job *job;
+
+   if (!variant->function[RAST_EDGE_TEST] &&
+       !variant->function[RAST_WHOLE] &&
+       !variant->linear_function)
+      return;
+
+   job = CALLOC_STRUCT(lp_fs_opt_job);
+   if (!job)
+      return;
+
+   job->screen = screen;
+   job->variant = variant;
+   job->shader = *shader;
+   if (shader->base.ir.nir) {
+      job->shader.base.ir.nir = nir_shader_clone(NULL, shader->base.ir.nir);
+      if (!job->shader.base.ir.nir) {
+         FREE(job);
+         return;
+      }
+   }
+   job->generate[RAST_EDGE_TEST] = variant->function[RAST_EDGE_TEST] != NULL;
+   job->generate[RAST_WHOLE] = variant->function[RAST_WHOLE] != NULL;
+   job->generate_linear = variant->linear_function != NULL;
+   job->needs_caching = needs_caching;
+   if (needs_caching)
+      memcpy(job->ir_sha1_cache_key, ir_sha1_cache_key, 20);
+
+   util_queue_add_job(&screen->opt_queue, job, &variant->opt_fence,
+                      fs_variant_opt_execute, fs_variant_opt_cleanup, 0);
 }
 
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
@@ -3584,11 +3732,13 @@ generate_variant(struct llvmpipe_context *lp,
    unsigned char ir_sha1_cache_key[20];
    struct lp_cached_code cached = { 0 };
    bool needs_caching = false;
+   bool tiered;
    variant = MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
       return NULL;
 
    memset(variant, 0, sizeof(*variant));
+   util_queue_fence_init(&variant->opt_fence);
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
             shader->no, shader->variants_created);
 
@@ -3604,8 +3754,15 @@ generate_variant(struct llvmpipe_context *lp,
       if (!cached.data_size)
          needs_caching = true;
    }
-   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+
+   /* Code from the disk cache is already optimized. */
+   tiered = screen->tiered_jit && !cached.data_size;
+   if (tiered)
+      variant->gallivm = gallivm_create_fast(module_name, lp->context, &cached);
+   else
+      variant->gallivm = gallivm_create(module_name, lp->context, &cached);
    if (!variant->gallivm) {
+      util_queue_fence_destroy(&variant->opt_fence);
       FREE(variant);
       return NULL;
    }
@@ -3790,12 +3947,15 @@ generate_variant(struct llvmpipe_context *lp,
       lp_linear_check_variant(variant);
    }
 
-   if (needs_caching) {
+   if (needs_caching && !tiered) {
       lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    }
 
    gallivm_free_ir(variant->gallivm);
 
+   if (tiered)
+      fs_variant_queue_opt(screen, variant, needs_caching, ir_sha1_cache_key);
+
    return variant;
 }
 
@@ -3905,6 +4065,10 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    else
      llvmpipe_fs_analyse_nir(shader);
 
+   /* only needed for disk cache keys */
+   if (shader->base.ir.nir && llvmpipe_screen(pipe->screen)->disk_shader_cache)
+      lp_nir_sha1(shader->base.ir.nir, shader->ir_sha1);
+
    return shader;
 }
 
@@ -3960,6 +4124,14 @@ void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                struct lp_fragment_shader_variant *variant)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+   if (util_queue_is_initialized(&screen->opt_queue))
+      util_queue_drop_job(&screen->opt_queue, &variant->opt_fence);
+   util_queue_fence_destroy(&variant->opt_fence);
+
+   if (variant->opt_gallivm)
+      gallivm_destroy(variant->opt_gallivm);
    gallivm_destroy(variant->gallivm);
 
    lp_fs_reference(lp, &variant->shader, NULL);
@@ -3988,6 +4160,9 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    struct lp_fragment_shader *shader = fs;
    struct lp_fs_variant_list_item *li, *next;
 
+   /* The bin thread may still be binning draws with one of the variants. */
+   lp_setup_bin_sync(llvmpipe->setup);
+
    /* Delete all the variants */
    LIST_FOR_EACH_ENTRY_SAFE(li, next, &shader->variants.list, list) {
       struct lp_fragment_shader_variant *variant;
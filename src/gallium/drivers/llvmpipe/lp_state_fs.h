@@ -38,6 +38,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct tgsi_token;
@@ -193,6 +194,13 @@ struct lp_fragment_shader_variant
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /* With LP_TIERED_JIT, the jit functions above are replaced by the ones
+    * of an optimized recompile once opt_fence signals.  The first tier code
+    * is kept until the variant is destroyed, as scenes may still run it.
+    */
+   struct util_queue_fence opt_fence;
+   struct gallivm_state *opt_gallivm;
+
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
@@ -229,6 +237,9 @@ struct lp_fragment_shader
    unsigned variants_created;
    unsigned variants_cached;
 
+   /** sha1 of the NIR as created, the base of the disk cache keys */
+   unsigned char ir_sha1[20];
+
    /** Fragment shader input interpolation info */
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
 };
@@ -15,6 +15,9 @@ OPT_BOOL(enable_sam, false, "Enable Smart Access Memory with Above 4G Decoding f
 OPT_BOOL(disable_sam, false, "Disable Smart Access Memory.")
 OPT_BOOL(fp16, false, "Enable FP16 for mediump.")
 OPT_INT(tc_max_cpu_storage_size, 2500, "Enable the CPU storage for pipelined buffer uploads in TC.")
+OPT_INT(tc_num_batches, 0, "Number of TC batches (0 = default).")
+OPT_INT(tc_slots_per_batch, 0, "Number of 8-byte slots per TC batch (0 = default).")
+OPT_BOOL(tc_grow_batches, false, "Add TC batches and make them larger when the app thread waits for the driver thread.")
 OPT_BOOL(force_use_fma32, false, "Force use fma32 instruction for GPU family newer than gfx9")
 OPT_BOOL(dcc_msaa, false, "Enable DCC for MSAA")
 OPT_BOOL(mall_noalloc, false, "Don't use MALL (infinity cache)")
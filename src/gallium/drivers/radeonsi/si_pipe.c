@@ -892,6 +892,9 @@ static struct pipe_context *si_pipe_create_context(struct pipe_screen *screen, v
                                        si_create_fence : NULL,
                                  .is_resource_busy = si_is_resource_busy,
                                  .driver_calls_flush_notify = true,
+                                 .num_batches = MAX2(sscreen->options.tc_num_batches, 0),
+                                 .slots_per_batch = MAX2(sscreen->options.tc_slots_per_batch, 0),
+                                 .grow_batches = sscreen->options.tc_grow_batches,
                               },
                               &((struct si_context *)ctx)->tc);
 
@@ -173,6 +173,12 @@ static bool si_query_sw_begin(struct si_context *sctx, struct si_query *squery)
    case SI_QUERY_TC_NUM_SYNCS:
       query->begin_result = sctx->tc ? sctx->tc->num_syncs : 0;
       break;
+   case SI_QUERY_TC_NUM_BATCH_STALLS:
+      query->begin_result = sctx->tc ? sctx->tc->num_batch_stalls : 0;
+      break;
+   case SI_QUERY_TC_NUM_ELIMINATED_CALLS:
+      query->begin_result = sctx->tc ? sctx->tc->num_eliminated_calls : 0;
+      break;
    case SI_QUERY_REQUESTED_VRAM:
    case SI_QUERY_REQUESTED_GTT:
    case SI_QUERY_MAPPED_VRAM:
@@ -332,6 +338,12 @@ static bool si_query_sw_end(struct si_context *sctx, struct si_query *squery)
    case SI_QUERY_TC_NUM_SYNCS:
       query->end_result = sctx->tc ? sctx->tc->num_syncs : 0;
       break;
+   case SI_QUERY_TC_NUM_BATCH_STALLS:
+      query->end_result = sctx->tc ? sctx->tc->num_batch_stalls : 0;
+      break;
+   case SI_QUERY_TC_NUM_ELIMINATED_CALLS:
+      query->end_result = sctx->tc ? sctx->tc->num_eliminated_calls : 0;
+      break;
    case SI_QUERY_REQUESTED_VRAM:
    case SI_QUERY_REQUESTED_GTT:
    case SI_QUERY_MAPPED_VRAM:
@@ -1758,6 +1770,8 @@ static struct pipe_driver_query_info si_driver_query_list[] = {
    X("tc-offloaded-slots", TC_OFFLOADED_SLOTS, UINT64, AVERAGE),
    X("tc-direct-slots", TC_DIRECT_SLOTS, UINT64, AVERAGE),
    X("tc-num-syncs", TC_NUM_SYNCS, UINT64, AVERAGE),
+   X("tc-num-batch-stalls", TC_NUM_BATCH_STALLS, UINT64, AVERAGE),
+   X("tc-num-eliminated-calls", TC_NUM_ELIMINATED_CALLS, UINT64, AVERAGE),
    X("CS-thread-busy", CS_THREAD_BUSY, UINT64, AVERAGE),
    X("gallium-thread-busy", GALLIUM_THREAD_BUSY, UINT64, AVERAGE),
    X("requested-VRAM", REQUESTED_VRAM, BYTES, AVERAGE),
@@ -467,30 +467,39 @@ filter_pack_instr(const nir_instr *const_instr, UNUSED const void *data)
 static void
 optimize_nir(struct nir_shader *s)
 {
+   nir_pass_scheduler sched;
    bool progress;
+
+   /* The lowering passes don't count towards progress, but still go through
+    * the scheduler so that they don't mark the shader as changed every time
+    * around the loop.
+    */
+   nir_pass_scheduler_init(&sched, s);
    do {
+      UNUSED bool lowered = false;
       progress = false;
       if (s->options->lower_int64_options)
-         NIR_PASS_V(s, nir_lower_int64);
-      NIR_PASS_V(s, nir_lower_vars_to_ssa);
-      NIR_PASS(progress, s, nir_lower_alu_to_scalar, filter_pack_instr, NULL);
-      NIR_PASS(progress, s, nir_opt_copy_prop_vars);
-      NIR_PASS(progress, s, nir_copy_prop);
-      NIR_PASS(progress, s, nir_opt_remove_phis);
+         NIR_LOOP_PASS(lowered, &sched, s, nir_lower_int64);
+      NIR_LOOP_PASS(lowered, &sched, s, nir_lower_vars_to_ssa);
+      NIR_LOOP_PASS(progress, &sched, s, nir_lower_alu_to_scalar, filter_pack_instr, NULL);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_copy_prop_vars);
+      NIR_LOOP_PASS(progress, &sched, s, nir_copy_prop);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_remove_phis);
       if (s->options->lower_int64_options) {
-         NIR_PASS(progress, s, nir_lower_64bit_phis);
-         NIR_PASS(progress, s, nir_lower_alu_to_scalar, filter_64_bit_instr, NULL);
+         NIR_LOOP_PASS(progress, &sched, s, nir_lower_64bit_phis);
+         NIR_LOOP_PASS(progress, &sched, s, nir_lower_alu_to_scalar, filter_64_bit_instr, NULL);
       }
-      NIR_PASS(progress, s, nir_opt_dce);
-      NIR_PASS(progress, s, nir_opt_dead_cf);
-      NIR_PASS(progress, s, nir_lower_phis_to_scalar, false);
-      NIR_PASS(progress, s, nir_opt_cse);
-      NIR_PASS(progress, s, nir_opt_peephole_select, 8, true, true);
-      NIR_PASS(progress, s, nir_opt_algebraic);
-      NIR_PASS(progress, s, nir_opt_constant_folding);
-      NIR_PASS(progress, s, nir_opt_undef);
-      NIR_PASS(progress, s, zink_nir_lower_b2b);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_dce);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_dead_cf);
+      NIR_LOOP_PASS(progress, &sched, s, nir_lower_phis_to_scalar, false);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_cse);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_peephole_select, 8, true, true);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_algebraic);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_constant_folding);
+      NIR_LOOP_PASS(progress, &sched, s, nir_opt_undef);
+      NIR_LOOP_PASS(progress, &sched, s, zink_nir_lower_b2b);
    } while (progress);
+   nir_pass_scheduler_finish(&sched);
 
    do {
       progress = false;
@@ -1901,7 +1910,10 @@ VkShaderModule
 zink_shader_compile(struct zink_screen *screen, struct zink_shader *zs, nir_shader *base_nir, const struct zink_shader_key *key)
 {
    VkShaderModule mod = VK_NULL_HANDLE;
-   struct zink_shader_info *sinfo = &zs->sinfo;
+   /* async and precompile jobs can compile the same shader concurrently, so
+    * what depends on the key goes into a copy of the shader info
+    */
+   struct zink_shader_info sinfo = zs->sinfo;
    nir_shader *nir = nir_shader_clone(NULL, base_nir);
    bool need_optimize = false;
    bool inlined_uniforms = false;
@@ -1944,7 +1956,7 @@ zink_shader_compile(struct zink_screen *screen, struct zink_shader *zs, nir_shad
       case MESA_SHADER_GEOMETRY:
          if (zink_vs_key_base(key)->last_vertex_stage) {
             if (zs->sinfo.have_xfb)
-               sinfo->last_vertex = true;
+               sinfo.last_vertex = true;
 
             if (!zink_vs_key_base(key)->clip_halfz && screen->driver_workarounds.depth_clip_control_missing) {
                NIR_PASS_V(nir, nir_lower_clip_halfz);
@@ -2016,7 +2028,7 @@ zink_shader_compile(struct zink_screen *screen, struct zink_shader *zs, nir_shad
 
    NIR_PASS_V(nir, nir_convert_from_ssa, true);
 
-   struct spirv_shader *spirv = nir_to_spirv(nir, sinfo, screen->spirv_version);
+   struct spirv_shader *spirv = nir_to_spirv(nir, &sinfo, screen->spirv_version);
    if (spirv)
       mod = zink_shader_spirv_compile(screen, zs, spirv);
 
@@ -178,6 +178,12 @@ EXTENSIONS = [
         alias="dynamic_state2",
         features=True,
         conditions=["$feats.extendedDynamicState2"]),
+    Extension("VK_KHR_pipeline_library"),
+    Extension("VK_EXT_graphics_pipeline_library",
+        alias="gpl",
+        features=True,
+        properties=True,
+        conditions=["$feats.graphicsPipelineLibrary"]),
     Extension("VK_EXT_pipeline_creation_cache_control",
         alias="pipeline_cache_control",
         features=True,
@@ -34,6 +34,7 @@
 
 #include "util/u_debug.h"
 #include "util/u_prim.h"
+#include "util/os_time.h"
 
 static VkBlendFactor
 clamp_void_blend_factor(VkBlendFactor f)
@@ -45,16 +46,22 @@ clamp_void_blend_factor(VkBlendFactor f)
    return f;
 }
 
-VkPipeline
-zink_create_gfx_pipeline(struct zink_screen *screen,
-                         struct zink_gfx_program *prog,
-                         struct zink_gfx_pipeline_state *state,
-                         const uint8_t *binding_map,
-                         VkPrimitiveTopology primitive_topology)
+/* 'libs' is the set of VK_EXT_graphics_pipeline_library parts to create, or 0 for a full pipeline;
+ * state that isn't part of the requested parts is ignored by the implementation
+ */
+static VkPipeline
+create_gfx_pipeline(struct zink_screen *screen,
+                    struct zink_gfx_program *prog,
+                    struct zink_gfx_pipeline_state *state,
+                    const uint8_t *binding_map,
+                    VkPrimitiveTopology primitive_topology,
+                    VkPipelineCreateFlags flags,
+                    VkGraphicsPipelineLibraryFlagsEXT libs)
 {
    struct zink_rasterizer_hw_state *hw_rast_state = (void*)state;
    VkPipelineVertexInputStateCreateInfo vertex_input_state;
    if (!screen->info.have_EXT_vertex_input_dynamic_state || !state->element_state->num_attribs) {
+      assert(!libs || screen->info.have_EXT_vertex_input_dynamic_state);
       memset(&vertex_input_state, 0, sizeof(vertex_input_state));
       vertex_input_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
       vertex_input_state.pVertexBindingDescriptions = state->element_state->b.bindings;
@@ -319,6 +326,7 @@ zink_create_gfx_pipeline(struct zink_screen *screen,
 
    VkGraphicsPipelineCreateInfo pci = {0};
    pci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+   pci.flags = flags;
    pci.layout = prog->base.layout;
    if (state->render_pass)
       pci.renderPass = state->render_pass->render_pass;
@@ -326,6 +334,14 @@ zink_create_gfx_pipeline(struct zink_screen *screen,
       pci.pNext = &state->rendering_info;
    if (!screen->info.have_EXT_vertex_input_dynamic_state || !state->element_state->num_attribs)
       pci.pVertexInputState = &vertex_input_state;
+   VkGraphicsPipelineLibraryCreateInfoEXT gplci = {0};
+   if (libs) {
+      gplci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT;
+      gplci.pNext = (void *)pci.pNext;
+      gplci.flags = libs;
+      pci.pNext = &gplci;
+      pci.flags |= VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+   }
    pci.pInputAssemblyState = &primitive_state;
    pci.pRasterizationState = &rast_state;
    pci.pColorBlendState = &blend_state;
@@ -347,28 +363,106 @@ zink_create_gfx_pipeline(struct zink_screen *screen,
 
    VkPipelineShaderStageCreateInfo shader_stages[ZINK_SHADER_COUNT];
    uint32_t num_stages = 0;
-   for (int i = 0; i < ZINK_SHADER_COUNT; ++i) {
-      if (!prog->modules[i])
-         continue;
+   /* use the modules from the state: this may run on a worker thread while
+    * the context is already using other variants of the program
+    */
+   u_foreach_bit(i, prog->stages_present) {
+      assert(state->modules[i]);
+      if (libs) {
+         VkGraphicsPipelineLibraryFlagsEXT part = i == PIPE_SHADER_FRAGMENT ?
+                                                  VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT :
+                                                  VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT;
+         if (!(libs & part))
+            continue;
+      }
 
       VkPipelineShaderStageCreateInfo stage = {0};
       stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
       stage.stage = zink_shader_stage(i);
-      stage.module = prog->modules[i]->shader;
+      stage.module = state->modules[i];
       stage.pName = "main";
       shader_stages[num_stages++] = stage;
    }
-   assert(num_stages > 0);
+   assert(num_stages > 0 || libs);
 
    pci.pStages = shader_stages;
    pci.stageCount = num_stages;
 
+   VkPipeline pipeline;
+   VkResult result = VKSCR(CreateGraphicsPipelines)(screen->dev, prog->base.pipeline_cache,
+                                                    1, &pci, NULL, &pipeline);
+   if (result != VK_SUCCESS) {
+      /* not an error: the pipeline just isn't in the cache */
+      if (result != VK_PIPELINE_COMPILE_REQUIRED_EXT)
+         mesa_loge("ZINK: vkCreateGraphicsPipelines failed");
+      return VK_NULL_HANDLE;
+   }
+
+   return pipeline;
+}
+
+VkPipeline
+zink_create_gfx_pipeline(struct zink_screen *screen,
+                         struct zink_gfx_program *prog,
+                         struct zink_gfx_pipeline_state *state,
+                         const uint8_t *binding_map,
+                         VkPrimitiveTopology primitive_topology,
+                         VkPipelineCreateFlags flags)
+{
+   int64_t start = unlikely(zink_debug & ZINK_DEBUG_PIPESTATS) ? os_time_get_nano() : 0;
+   VkPipeline pipeline = create_gfx_pipeline(screen, prog, state, binding_map, primitive_topology, flags, 0);
+   if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS) && pipeline) {
+      p_atomic_add(&screen->pipeline_stats.compile_ns, os_time_get_nano() - start);
+      p_atomic_inc(&screen->pipeline_stats.compiles);
+   }
+   return pipeline;
+}
+
+VkPipeline
+zink_create_gfx_pipeline_library(struct zink_screen *screen,
+                                 struct zink_gfx_program *prog,
+                                 struct zink_gfx_pipeline_state *state,
+                                 VkPrimitiveTopology primitive_topology,
+                                 VkGraphicsPipelineLibraryFlagsEXT libs)
+{
+   assert(libs);
+   int64_t start = unlikely(zink_debug & ZINK_DEBUG_PIPESTATS) ? os_time_get_nano() : 0;
+   VkPipeline pipeline = create_gfx_pipeline(screen, prog, state, NULL, primitive_topology, 0, libs);
+   if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS) && pipeline) {
+      p_atomic_add(&screen->pipeline_stats.library_ns, os_time_get_nano() - start);
+      p_atomic_inc(&screen->pipeline_stats.libraries);
+   }
+   return pipeline;
+}
+
+VkPipeline
+zink_create_gfx_pipeline_combined(struct zink_screen *screen,
+                                  struct zink_gfx_program *prog,
+                                  VkPipeline input, VkPipeline library, VkPipeline output)
+{
+   int64_t start = unlikely(zink_debug & ZINK_DEBUG_PIPESTATS) ? os_time_get_nano() : 0;
+   VkPipeline libraries[] = {input, library, output};
+   VkPipelineLibraryCreateInfoKHR libstate = {0};
+   libstate.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR;
+   libstate.libraryCount = ARRAY_SIZE(libraries);
+   libstate.pLibraries = libraries;
+
+   /* no LINK_TIME_OPTIMIZATION: this is the fast link */
+   VkGraphicsPipelineCreateInfo pci = {0};
+   pci.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+   pci.layout = prog->base.layout;
+   pci.pNext = &libstate;
+
    VkPipeline pipeline;
    if (VKSCR(CreateGraphicsPipelines)(screen->dev, prog->base.pipeline_cache,
                                       1, &pci, NULL, &pipeline) != VK_SUCCESS) {
       mesa_loge("ZINK: vkCreateGraphicsPipelines failed");
       return VK_NULL_HANDLE;
    }
+   if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS)) {
+      p_atomic_add(&screen->pipeline_stats.link_ns, os_time_get_nano() - start);
+      p_atomic_inc(&screen->pipeline_stats.links);
+   }
 
    return pipeline;
 }
@@ -95,6 +95,7 @@ struct zink_gfx_pipeline_state {
    VkFormat rendering_formats[PIPE_MAX_COLOR_BUFS];
    VkPipelineRenderingCreateInfo rendering_info;
    VkPipeline pipeline;
+   bool pipeline_pending; //pipeline is an unoptimized fallback awaiting async compile
    unsigned idx : 8;
    enum pipe_prim_type gfx_prim_mode; //pending mode
 };
@@ -122,7 +123,20 @@ zink_create_gfx_pipeline(struct zink_screen *screen,
                          struct zink_gfx_program *prog,
                          struct zink_gfx_pipeline_state *state,
                          const uint8_t *binding_map,
-                         VkPrimitiveTopology primitive_topology);
+                         VkPrimitiveTopology primitive_topology,
+                         VkPipelineCreateFlags flags);
+
+VkPipeline
+zink_create_gfx_pipeline_library(struct zink_screen *screen,
+                                 struct zink_gfx_program *prog,
+                                 struct zink_gfx_pipeline_state *state,
+                                 VkPrimitiveTopology primitive_topology,
+                                 VkGraphicsPipelineLibraryFlagsEXT libs);
+
+VkPipeline
+zink_create_gfx_pipeline_combined(struct zink_screen *screen,
+                                  struct zink_gfx_program *prog,
+                                  VkPipeline input, VkPipeline library, VkPipeline output);
 
 VkPipeline
 zink_create_compute_pipeline(struct zink_screen *screen, struct zink_compute_program *comp, struct zink_compute_pipeline_state *state);
@@ -44,9 +44,93 @@
 #define XXH_INLINE_ALL
 #include "util/xxhash.h"
 
+/* ZINK_ASYNC_PIPELINES: an optimized pipeline being compiled on screen->pipeline_queue;
+ * all the CSO state referenced by the pipeline state is copied since the
+ * objects may be deleted before the job runs
+ */
+struct gfx_pipeline_async_job {
+   struct util_queue_fence fence;
+   struct zink_gfx_program *prog;
+   struct zink_gfx_pipeline_state state;
+   struct zink_vertex_elements_hw_state element_state;
+   struct zink_blend_state blend_state;
+   struct zink_depth_stencil_alpha_hw_state dsa_state;
+   uint8_t binding_map[PIPE_MAX_ATTRIBS];
+   VkPrimitiveTopology vkmode;
+   VkPipeline pipeline;
+};
+
 struct gfx_pipeline_cache_entry {
    struct zink_gfx_pipeline_state state;
    VkPipeline pipeline;
+   /* fallback used while async is compiling; kept until the program is destroyed
+    * since it may still be referenced by in-flight batches
+    */
+   VkPipeline unoptimized_pipeline;
+   struct gfx_pipeline_async_job *async;
+};
+
+/* VK_EXT_graphics_pipeline_library parts; each only depends on the state in its key
+ * since everything else is dynamic when screen->have_gpl is set
+ */
+enum zink_gpl_part {
+   ZINK_GPL_INPUT,
+   ZINK_GPL_SHADERS, //pre-rasterization + fragment shader
+   ZINK_GPL_OUTPUT,
+};
+
+/* must match between the fragment shader and fragment output parts */
+struct gpl_multisample_key {
+   uint32_t rast_samples;
+   VkSampleMask sample_mask;
+   bool force_persample_interp;
+   bool sample_locations_enabled;
+   bool alpha_to_coverage;
+   bool alpha_to_one;
+};
+
+struct gpl_library {
+   union {
+      struct {
+         VkPrimitiveTopology topology;
+         bool has_attribs;
+      } input;
+      struct {
+         VkShaderModule modules[ZINK_SHADER_COUNT];
+         uint32_t rast_state;
+         uint32_t vertices_per_patch;
+         /* the line rasterization state only applies to lines */
+         VkPrimitiveTopology reduced_topology;
+         struct gpl_multisample_key ms;
+      } shaders;
+      struct {
+         uint32_t blend_id;
+         unsigned rp_state;
+         uint32_t void_alpha_attachments;
+         struct gpl_multisample_key ms;
+      } output;
+   } key;
+   VkPipeline pipeline;
+};
+
+/* a portable description of a gfx pipeline for the pipeline state database:
+ * per-session pointers, handles and ids are replaced by the contents they refer to
+ * so that records from a previous run can be compared against the current state
+ */
+struct zink_pipeline_record {
+   struct zink_gfx_pipeline_state state;
+   struct zink_vertex_elements_hw_state element_state;
+   struct zink_blend_state blend_state;
+   struct zink_depth_stencil_alpha_hw_state dsa_state;
+   struct zink_shader_key keys[ZINK_SHADER_COUNT];
+   uint8_t binding_map[PIPE_MAX_ATTRIBS];
+   VkPrimitiveTopology vkmode;
+   bool has_blend;
+};
+
+struct precompiled_pipeline {
+   struct zink_pipeline_record rec;
+   VkPipeline pipeline;
 };
 
 struct compute_pipeline_cache_entry {
@@ -278,6 +362,12 @@ equals_gfx_pipeline_state(const void *a, const void *b)
           !memcmp(a, b, offsetof(struct zink_gfx_pipeline_state, hash));
 }
 
+static bool
+equals_gpl_library(const void *a, const void *b)
+{
+   return !memcmp(a, b, offsetof(struct gpl_library, pipeline));
+}
+
 void
 zink_update_gfx_program(struct zink_context *ctx, struct zink_gfx_program *prog)
 {
@@ -462,6 +552,10 @@ zink_create_gfx_program(struct zink_context *ctx,
    else
       prog->last_vertex_stage = stages[PIPE_SHADER_VERTEX];
 
+   if (screen->have_gpl) {
+      for (int i = 0; i < ARRAY_SIZE(prog->libs); ++i)
+         _mesa_hash_table_init(&prog->libs[i], prog, NULL, equals_gpl_library);
+   }
    for (int i = 0; i < ARRAY_SIZE(prog->pipelines); ++i) {
       _mesa_hash_table_init(&prog->pipelines[i], prog, NULL, equals_gfx_pipeline_state);
       /* only need first 3/4 for point/line/tri/patch */
@@ -470,6 +564,9 @@ zink_create_gfx_program(struct zink_context *ctx,
          break;
    }
 
+   util_dynarray_init(&prog->pipeline_records, NULL);
+   util_queue_fence_init(&prog->precompile_fence);
+
    struct mesa_sha1 sctx;
    _mesa_sha1_init(&sctx);
    for (int i = 0; i < ZINK_SHADER_COUNT; ++i) {
@@ -675,12 +772,73 @@ zink_program_num_bindings(const struct zink_program *pg, bool is_compute)
    return num_bindings;
 }
 
+/* copy the records for zink_gfx_program_write_records();
+ * only called while no cache put job is running
+ */
+void
+zink_gfx_program_snapshot_records(struct zink_gfx_program *prog)
+{
+   if (!prog->records_dirty)
+      return;
+   free(prog->records_snapshot);
+   prog->records_snapshot = malloc(prog->pipeline_records.size);
+   if (!prog->records_snapshot)
+      return;
+   memcpy(prog->records_snapshot, prog->pipeline_records.data, prog->pipeline_records.size);
+   prog->records_snapshot_size = prog->pipeline_records.size;
+   prog->records_dirty = false;
+}
+
+/* write back the snapshot of the records, on the cache put thread or on destruction */
+void
+zink_gfx_program_write_records(struct zink_screen *screen, struct zink_gfx_program *prog)
+{
+   cache_key key;
+   void *data = prog->records_snapshot;
+   prog->records_snapshot = NULL;
+   if (!data)
+      return;
+   if (!zink_gfx_program_records_key(screen, prog, key)) {
+      free(data);
+      return;
+   }
+   /* puts don't replace existing entries */
+   disk_cache_remove(screen->disk_cache, key);
+   disk_cache_put_nocopy(screen->disk_cache, key, data, prog->records_snapshot_size, NULL);
+}
+
 void
 zink_destroy_gfx_program(struct zink_context *ctx,
                          struct zink_gfx_program *prog)
 {
    struct zink_screen *screen = zink_screen(ctx->base.screen);
    util_queue_fence_wait(&prog->base.cache_fence);
+   util_queue_fence_wait(&prog->precompile_fence);
+   util_queue_fence_destroy(&prog->precompile_fence);
+
+   unsigned max_idx = ARRAY_SIZE(prog->pipelines);
+   if (screen->info.have_EXT_extended_dynamic_state) {
+      /* only need first 3/4 for point/line/tri/patch */
+      if ((prog->stages_present &
+          (BITFIELD_BIT(PIPE_SHADER_TESS_EVAL) | BITFIELD_BIT(PIPE_SHADER_GEOMETRY))) ==
+          BITFIELD_BIT(PIPE_SHADER_TESS_EVAL))
+         max_idx = 4;
+      else
+         max_idx = 3;
+      max_idx++;
+   }
+
+   /* async jobs use the layout, shader modules and libraries of the program:
+    * finish all of them before anything is destroyed
+    */
+   for (int i = 0; i < max_idx; ++i) {
+      hash_table_foreach(&prog->pipelines[i], entry) {
+         struct gfx_pipeline_cache_entry *pc_entry = entry->data;
+         if (pc_entry->async)
+            util_queue_fence_wait(&pc_entry->async->fence);
+      }
+   }
+
    if (prog->base.layout)
       VKSCR(DestroyPipelineLayout)(screen->dev, prog->base.layout, NULL);
 
@@ -696,26 +854,41 @@ zink_destroy_gfx_program(struct zink_context *ctx,
       ralloc_free(prog->nir[i]);
    }
 
-   unsigned max_idx = ARRAY_SIZE(prog->pipelines);
-   if (screen->info.have_EXT_extended_dynamic_state) {
-      /* only need first 3/4 for point/line/tri/patch */
-      if ((prog->stages_present &
-          (BITFIELD_BIT(PIPE_SHADER_TESS_EVAL) | BITFIELD_BIT(PIPE_SHADER_GEOMETRY))) ==
-          BITFIELD_BIT(PIPE_SHADER_TESS_EVAL))
-         max_idx = 4;
-      else
-         max_idx = 3;
-      max_idx++;
-   }
-
    for (int i = 0; i < max_idx; ++i) {
       hash_table_foreach(&prog->pipelines[i], entry) {
          struct gfx_pipeline_cache_entry *pc_entry = entry->data;
 
+         if (pc_entry->async) {
+            VKSCR(DestroyPipeline)(screen->dev, pc_entry->async->pipeline, NULL);
+            util_queue_fence_destroy(&pc_entry->async->fence);
+            free(pc_entry->async);
+         }
          VKSCR(DestroyPipeline)(screen->dev, pc_entry->pipeline, NULL);
+         if (pc_entry->unoptimized_pipeline && pc_entry->unoptimized_pipeline != pc_entry->pipeline)
+            VKSCR(DestroyPipeline)(screen->dev, pc_entry->unoptimized_pipeline, NULL);
          free(pc_entry);
       }
    }
+   if (prog->precompiled) {
+      hash_table_foreach(prog->precompiled, entry) {
+         struct precompiled_pipeline *pp = entry->data;
+         VKSCR(DestroyPipeline)(screen->dev, pp->pipeline, NULL);
+         free(pp);
+      }
+      _mesa_hash_table_destroy(prog->precompiled, NULL);
+   }
+   free(prog->precompile_records);
+   zink_gfx_program_snapshot_records(prog);
+   zink_gfx_program_write_records(screen, prog);
+   util_dynarray_fini(&prog->pipeline_records);
+   if (screen->have_gpl) {
+      for (int i = 0; i < ARRAY_SIZE(prog->libs); ++i) {
+         hash_table_foreach(&prog->libs[i], entry) {
+            struct gpl_library *lib = entry->data;
+            VKSCR(DestroyPipeline)(screen->dev, lib->pipeline, NULL);
+         }
+      }
+   }
    if (prog->base.pipeline_cache)
       VKSCR(DestroyPipelineCache)(screen->dev, prog->base.pipeline_cache, NULL);
    screen->descriptor_program_deinit(ctx, &prog->base);
@@ -799,6 +972,422 @@ check_vertex_strides(struct zink_context *ctx)
    return true;
 }
 
+bool
+zink_gfx_program_records_key(struct zink_screen *screen, struct zink_gfx_program *prog, cache_key key)
+{
+   struct mesa_sha1 ctx;
+   unsigned char sha1[20];
+   uint32_t record_size = sizeof(struct zink_pipeline_record);
+
+   _mesa_sha1_init(&ctx);
+   /* the records are raw structs: invalidate them whenever the driver changes */
+   if (!disk_cache_get_function_identifier(zink_gfx_program_precompile, &ctx))
+      return false;
+   _mesa_sha1_update(&ctx, "pipeline_records", strlen("pipeline_records"));
+   _mesa_sha1_update(&ctx, &record_size, sizeof(record_size));
+   _mesa_sha1_update(&ctx, prog->base.sha1, sizeof(prog->base.sha1));
+   _mesa_sha1_final(&ctx, sha1);
+   disk_cache_compute_key(screen->disk_cache, sha1, sizeof(sha1), key);
+   return true;
+}
+
+static bool
+can_record_pipeline(struct zink_screen *screen, struct zink_gfx_program *prog,
+                    const struct zink_gfx_pipeline_state *state)
+{
+   /* render passes and generated tcs variants depend on the context */
+   return screen->disk_cache && !state->render_pass &&
+          !(prog->shaders[PIPE_SHADER_TESS_CTRL] && prog->shaders[PIPE_SHADER_TESS_CTRL]->is_generated);
+}
+
+static void
+init_pipeline_record(struct zink_screen *screen, struct zink_gfx_program *prog,
+                     const struct zink_gfx_pipeline_state *state,
+                     const uint8_t *binding_map, VkPrimitiveTopology vkmode,
+                     struct zink_pipeline_record *rec)
+{
+   /* only copy what affects the pipeline so that dynamic state doesn't cause mismatches */
+   memset(rec, 0, sizeof(*rec));
+   struct zink_gfx_pipeline_state *rs = &rec->state;
+   rs->rast_state = state->rast_state;
+   rs->rast_samples = state->rast_samples;
+   rs->void_alpha_attachments = state->void_alpha_attachments;
+   rs->sample_mask = state->sample_mask;
+   if (!state->have_EXT_extended_dynamic_state) {
+      rs->dyn_state1.front_face = state->dyn_state1.front_face;
+      rs->dyn_state1.cull_mode = state->dyn_state1.cull_mode;
+      rs->dyn_state1.num_viewports = state->dyn_state1.num_viewports;
+      rec->dsa_state = *state->dyn_state1.depth_stencil_alpha_state;
+   }
+   if (!state->have_EXT_extended_dynamic_state2)
+      rs->dyn_state2 = state->dyn_state2;
+   else if (!state->extendedDynamicState2PatchControlPoints)
+      rs->dyn_state2.vertices_per_patch = state->dyn_state2.vertices_per_patch;
+   rs->sample_locations_enabled = state->sample_locations_enabled;
+   rs->uses_dynamic_stride = state->uses_dynamic_stride;
+   rs->have_EXT_extended_dynamic_state = state->have_EXT_extended_dynamic_state;
+   rs->have_EXT_extended_dynamic_state2 = state->have_EXT_extended_dynamic_state2;
+   rs->extendedDynamicState2PatchControlPoints = state->extendedDynamicState2PatchControlPoints;
+   rs->rendering_info.sType = state->rendering_info.sType;
+   rs->rendering_info.viewMask = state->rendering_info.viewMask;
+   rs->rendering_info.colorAttachmentCount = state->rendering_info.colorAttachmentCount;
+   rs->rendering_info.depthAttachmentFormat = state->rendering_info.depthAttachmentFormat;
+   rs->rendering_info.stencilAttachmentFormat = state->rendering_info.stencilAttachmentFormat;
+   memcpy(rs->rendering_formats, state->rendering_formats,
+          state->rendering_info.colorAttachmentCount * sizeof(VkFormat));
+
+   const struct zink_vertex_elements_hw_state *elements = state->element_state;
+   rec->element_state.num_bindings = elements->num_bindings;
+   rec->element_state.num_attribs = elements->num_attribs;
+   if (!screen->info.have_EXT_vertex_input_dynamic_state || !elements->num_attribs) {
+      memcpy(rec->element_state.attribs, elements->attribs, elements->num_attribs * sizeof(elements->attribs[0]));
+      memcpy(rec->element_state.b.divisors, elements->b.divisors, elements->b.divisors_present * sizeof(elements->b.divisors[0]));
+      rec->element_state.b.divisors_present = elements->b.divisors_present;
+      for (unsigned i = 0; i < elements->num_bindings; i++) {
+         rec->element_state.b.bindings[i] = elements->b.bindings[i];
+         /* strides are applied from vertex_strides */
+         rec->element_state.b.bindings[i].stride = 0;
+         rec->binding_map[i] = binding_map[i];
+         if (!state->have_EXT_extended_dynamic_state || !state->uses_dynamic_stride)
+            rs->vertex_strides[binding_map[i]] = state->vertex_strides[binding_map[i]];
+      }
+   }
+   if (state->blend_state) {
+      rec->blend_state = *state->blend_state;
+      rec->blend_state.hash = 0;
+      rec->has_blend = true;
+   }
+
+   /* modules are described by the shader key they were compiled with */
+   u_foreach_bit(i, prog->stages_present) {
+      const struct zink_shader_module *zm = prog->modules[i];
+      struct zink_shader_key *key = &rec->keys[i];
+      const uint32_t nonseamless_size = zm->has_nonseamless ? sizeof(uint32_t) : 0;
+      memcpy(key, zm->key, zm->key_size);
+      key->size = zm->key_size;
+      if (nonseamless_size)
+         memcpy(&key->base.nonseamless_cube_mask, zm->key + zm->key_size, nonseamless_size);
+      if (zm->num_uniforms) {
+         key->inline_uniforms = true;
+         memcpy(key->base.inlined_uniform_values, zm->key + zm->key_size + nonseamless_size,
+                zm->num_uniforms * sizeof(uint32_t));
+      }
+   }
+   rec->vkmode = vkmode;
+}
+
+static uint32_t
+hash_pipeline_record(const void *key)
+{
+   return _mesa_hash_data(key, sizeof(struct zink_pipeline_record));
+}
+
+static bool
+equals_pipeline_record(const void *a, const void *b)
+{
+   return !memcmp(a, b, sizeof(struct zink_pipeline_record));
+}
+
+/* runs in the cache_get job, before cache_fence signals: load the pipeline state
+ * database of the program for zink_gfx_program_precompile()
+ *
+ * returns whether there is anything to precompile
+ */
+bool
+zink_gfx_program_load_records(struct zink_screen *screen, struct zink_gfx_program *prog)
+{
+   cache_key key;
+   size_t size = 0;
+   if (!zink_gfx_program_records_key(screen, prog, key))
+      return false;
+   struct zink_pipeline_record *recs = disk_cache_get(screen->disk_cache, key, &size);
+   if (!recs)
+      return false;
+   unsigned count = MIN2(size / sizeof(struct zink_pipeline_record), ZINK_MAX_PIPELINE_RECORDS);
+   if (size % sizeof(struct zink_pipeline_record) || !count) {
+      free(recs);
+      return false;
+   }
+
+   /* these are already in the database */
+   for (unsigned r = 0; r < count; r++)
+      util_dynarray_append(&prog->pipeline_records, struct zink_pipeline_record, recs[r]);
+   prog->precompile_records = recs;
+   prog->num_precompile_records = count;
+   return true;
+}
+
+/* runs on the cache thread after the pipeline cache is created: compile every pipeline
+ * used by this program in previous runs so that later draws don't have to;
+ * draws until then create their pipelines as usual
+ */
+void
+zink_gfx_program_precompile(struct zink_screen *screen, struct zink_gfx_program *prog)
+{
+   struct zink_pipeline_record *recs = prog->precompile_records;
+   if (!recs)
+      return;
+
+   prog->precompiled = _mesa_hash_table_create(NULL, hash_pipeline_record, equals_pipeline_record);
+   for (unsigned r = 0; r < prog->num_precompile_records && prog->precompiled; r++) {
+      struct zink_pipeline_record *rec = &recs[r];
+
+      struct zink_vertex_elements_hw_state element_state = rec->element_state;
+      struct zink_gfx_pipeline_state state = rec->state;
+      state.element_state = &element_state;
+      state.blend_state = rec->has_blend ? &rec->blend_state : NULL;
+      state.dyn_state1.depth_stencil_alpha_state = &rec->dsa_state;
+      state.rendering_info.pColorAttachmentFormats = state.rendering_formats;
+
+      bool success = true;
+      u_foreach_bit(i, prog->stages_present) {
+         state.modules[i] = zink_shader_compile(screen, prog->shaders[i], prog->nir[i], &rec->keys[i]);
+         success &= !!state.modules[i];
+      }
+      VkPipeline pipeline = VK_NULL_HANDLE;
+      if (success)
+         pipeline = zink_create_gfx_pipeline(screen, prog, &state, rec->binding_map, rec->vkmode, 0);
+      /* the pipeline doesn't need the modules after creation */
+      u_foreach_bit(i, prog->stages_present)
+         VKSCR(DestroyShaderModule)(screen->dev, state.modules[i], NULL);
+      if (!pipeline)
+         continue;
+
+      struct precompiled_pipeline *pp = malloc(sizeof(struct precompiled_pipeline));
+      if (!pp) {
+         VKSCR(DestroyPipeline)(screen->dev, pipeline, NULL);
+         continue;
+      }
+      pp->rec = *rec;
+      pp->pipeline = pipeline;
+      _mesa_hash_table_insert(prog->precompiled, &pp->rec, pp);
+   }
+   free(recs);
+   prog->precompile_records = NULL;
+}
+
+/* use a pipeline compiled by zink_gfx_program_precompile() if one matches the state */
+static VkPipeline
+get_precompiled_pipeline(struct zink_screen *screen, struct zink_gfx_program *prog,
+                         const struct zink_pipeline_record *rec)
+{
+   struct hash_entry *entry = _mesa_hash_table_search(prog->precompiled, rec);
+   if (!entry)
+      return VK_NULL_HANDLE;
+   struct precompiled_pipeline *pp = entry->data;
+   VkPipeline pipeline = pp->pipeline;
+   _mesa_hash_table_remove(prog->precompiled, entry);
+   free(pp);
+   if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS))
+      p_atomic_inc(&screen->pipeline_stats.precompiled);
+   return pipeline;
+}
+
+static void
+record_pipeline(struct zink_screen *screen, struct zink_gfx_program *prog,
+                const struct zink_pipeline_record *rec)
+{
+   if (util_dynarray_num_elements(&prog->pipeline_records, struct zink_pipeline_record) >= ZINK_MAX_PIPELINE_RECORDS)
+      return;
+   util_dynarray_foreach(&prog->pipeline_records, struct zink_pipeline_record, r) {
+      if (equals_pipeline_record(r, rec))
+         return;
+   }
+   util_dynarray_append(&prog->pipeline_records, struct zink_pipeline_record, *rec);
+   prog->records_dirty = true;
+}
+
+static void
+gfx_pipeline_async_job(void *data, void *gdata, int thread_index)
+{
+   struct gfx_pipeline_async_job *job = data;
+   struct zink_screen *screen = gdata;
+
+   job->pipeline = zink_create_gfx_pipeline(screen, job->prog, &job->state,
+                                            job->binding_map, job->vkmode, 0);
+}
+
+static VkPipeline
+get_gpl_library(struct zink_screen *screen, struct zink_gfx_program *prog,
+                struct zink_gfx_pipeline_state *state, VkPrimitiveTopology vkmode,
+                enum zink_gpl_part part, const struct gpl_library *key)
+{
+   static const VkGraphicsPipelineLibraryFlagsEXT parts[] = {
+      [ZINK_GPL_INPUT] = VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+      [ZINK_GPL_SHADERS] = VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT |
+                           VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+      [ZINK_GPL_OUTPUT] = VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+   };
+   uint32_t hash = _mesa_hash_data(key, offsetof(struct gpl_library, pipeline));
+   struct hash_entry *entry = _mesa_hash_table_search_pre_hashed(&prog->libs[part], hash, key);
+   if (entry)
+      return ((struct gpl_library *)entry->data)->pipeline;
+
+   VkPipeline pipeline = zink_create_gfx_pipeline_library(screen, prog, state, vkmode, parts[part]);
+   if (pipeline == VK_NULL_HANDLE)
+      return VK_NULL_HANDLE;
+   struct gpl_library *lib = ralloc(prog, struct gpl_library);
+   if (!lib) {
+      VKSCR(DestroyPipeline)(screen->dev, pipeline, NULL);
+      return VK_NULL_HANDLE;
+   }
+   memcpy(lib, key, sizeof(*lib));
+   lib->pipeline = pipeline;
+   _mesa_hash_table_insert_pre_hashed(&prog->libs[part], hash, lib, lib);
+   return pipeline;
+}
+
+static VkPrimitiveTopology
+reduced_topology(VkPrimitiveTopology vkmode)
+{
+   switch (vkmode) {
+   case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+      return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+   case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+   case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+   case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+   case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+      return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+   case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+      return VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+   default:
+      return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+   }
+}
+
+/* build (or reuse) the input/shaders/output libraries for the state and fast-link them */
+static VkPipeline
+create_gfx_pipeline_gpl(struct zink_screen *screen, struct zink_gfx_program *prog,
+                        struct zink_gfx_pipeline_state *state, VkPrimitiveTopology vkmode)
+{
+   const struct zink_rasterizer_hw_state *hw_rast_state = (void*)state;
+   struct gpl_multisample_key ms;
+   memset(&ms, 0, sizeof(ms));
+   ms.rast_samples = state->rast_samples;
+   ms.sample_mask = state->sample_mask;
+   ms.force_persample_interp = hw_rast_state->force_persample_interp;
+   ms.sample_locations_enabled = state->sample_locations_enabled;
+   if (state->blend_state) {
+      ms.alpha_to_coverage = state->blend_state->alpha_to_coverage;
+      ms.alpha_to_one = state->blend_state->alpha_to_one;
+   }
+
+   struct gpl_library key;
+   memset(&key, 0, sizeof(key));
+   key.key.input.topology = vkmode;
+   key.key.input.has_attribs = state->element_state->num_attribs > 0;
+   VkPipeline input = get_gpl_library(screen, prog, state, vkmode, ZINK_GPL_INPUT, &key);
+
+   memset(&key, 0, sizeof(key));
+   u_foreach_bit(i, prog->stages_present)
+      key.key.shaders.modules[i] = state->modules[i];
+   key.key.shaders.rast_state = state->rast_state;
+   if (prog->shaders[PIPE_SHADER_TESS_CTRL] && !state->extendedDynamicState2PatchControlPoints)
+      key.key.shaders.vertices_per_patch = state->dyn_state2.vertices_per_patch;
+   key.key.shaders.reduced_topology = reduced_topology(vkmode);
+   key.key.shaders.ms = ms;
+   VkPipeline shaders = get_gpl_library(screen, prog, state, vkmode, ZINK_GPL_SHADERS, &key);
+
+   memset(&key, 0, sizeof(key));
+   key.key.output.blend_id = state->blend_id;
+   key.key.output.rp_state = state->rp_state;
+   key.key.output.void_alpha_attachments = state->void_alpha_attachments;
+   key.key.output.ms = ms;
+   VkPipeline output = get_gpl_library(screen, prog, state, vkmode, ZINK_GPL_OUTPUT, &key);
+
+   if (!input || !shaders || !output)
+      return VK_NULL_HANDLE;
+   return zink_create_gfx_pipeline_combined(screen, prog, input, shaders, output);
+}
+
+/* try to avoid compiling an optimized pipeline on the draw thread:
+ * - a pipeline cache hit needs no compile at all
+ * - otherwise, use a fast-linked (or unoptimized) pipeline and compile the optimized one in the background
+ *
+ * on return, pc_entry->pipeline is VK_NULL_HANDLE if the pipeline must be compiled synchronously
+ */
+static void
+create_gfx_pipeline_async(struct zink_context *ctx, struct zink_gfx_program *prog,
+                          struct gfx_pipeline_cache_entry *pc_entry, VkPrimitiveTopology vkmode)
+{
+   struct zink_screen *screen = zink_screen(ctx->base.screen);
+   struct zink_gfx_pipeline_state *state = &pc_entry->state;
+   const uint8_t *binding_map = ctx->element_state->binding_map;
+
+   if (screen->info.have_EXT_pipeline_creation_cache_control && prog->base.pipeline_cache) {
+      pc_entry->pipeline = zink_create_gfx_pipeline(screen, prog, state, binding_map, vkmode,
+                                                    VK_PIPELINE_CREATE_FAIL_ON_PIPELINE_COMPILE_REQUIRED_BIT_EXT);
+      if (pc_entry->pipeline) {
+         if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS))
+            p_atomic_inc(&screen->pipeline_stats.cache_hits);
+         return;
+      }
+   }
+
+   /* render passes are owned by the context, which doesn't wait for the job before destroying them */
+   if (state->render_pass)
+      return;
+
+   struct gfx_pipeline_async_job *job = CALLOC_STRUCT(gfx_pipeline_async_job);
+   if (!job)
+      return;
+   if (screen->have_gpl)
+      pc_entry->pipeline = create_gfx_pipeline_gpl(screen, prog, state, vkmode);
+   if (!pc_entry->pipeline)
+      pc_entry->pipeline = zink_create_gfx_pipeline(screen, prog, state, binding_map, vkmode,
+                                                    VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT);
+   if (!pc_entry->pipeline) {
+      FREE(job);
+      return;
+   }
+   pc_entry->unoptimized_pipeline = pc_entry->pipeline;
+
+   util_queue_fence_init(&job->fence);
+   job->prog = prog;
+   job->vkmode = vkmode;
+   memcpy(&job->state, state, sizeof(*state));
+   memcpy(job->binding_map, binding_map, sizeof(job->binding_map));
+   if (state->element_state) {
+      job->element_state = *state->element_state;
+      job->state.element_state = &job->element_state;
+   }
+   if (state->blend_state) {
+      job->blend_state = *state->blend_state;
+      job->state.blend_state = &job->blend_state;
+   }
+   if (state->dyn_state1.depth_stencil_alpha_state) {
+      job->dsa_state = *state->dyn_state1.depth_stencil_alpha_state;
+      job->state.dyn_state1.depth_stencil_alpha_state = &job->dsa_state;
+   }
+   job->state.rendering_info.pColorAttachmentFormats = job->state.rendering_formats;
+   pc_entry->async = job;
+   util_queue_add_job(&screen->pipeline_queue, job, &job->fence, gfx_pipeline_async_job, NULL, 0);
+   if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS))
+      p_atomic_inc(&screen->pipeline_stats.fallbacks);
+}
+
+/* swap in the optimized pipeline once it's ready; this never blocks */
+static void
+update_gfx_pipeline_async(struct zink_screen *screen, struct zink_gfx_program *prog,
+                          struct gfx_pipeline_cache_entry *pc_entry)
+{
+   struct gfx_pipeline_async_job *job = pc_entry->async;
+   if (!util_queue_fence_is_signalled(&job->fence))
+      return;
+   /* on failure, the unoptimized pipeline is used permanently */
+   if (job->pipeline) {
+      pc_entry->pipeline = job->pipeline;
+      if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS))
+         p_atomic_inc(&screen->pipeline_stats.async_done);
+   }
+   util_queue_fence_destroy(&job->fence);
+   free(job);
+   pc_entry->async = NULL;
+   /* only update if no cache job is pending to avoid blocking */
+   if (util_queue_fence_is_signalled(&prog->base.cache_fence))
+      zink_screen_update_pipeline_cache(screen, &prog->base);
+}
+
 VkPipeline
 zink_get_gfx_pipeline(struct zink_context *ctx,
                       struct zink_gfx_program *prog,
@@ -815,7 +1404,7 @@ zink_get_gfx_pipeline(struct zink_context *ctx,
    assert(idx <= ARRAY_SIZE(prog->pipelines));
    if (!state->dirty && !state->modules_changed &&
        (have_EXT_vertex_input_dynamic_state || !ctx->vertex_state_changed) &&
-       idx == state->idx)
+       idx == state->idx && !state->pipeline_pending)
       return state->pipeline;
 
    struct hash_entry *entry = NULL;
@@ -856,27 +1445,50 @@ zink_get_gfx_pipeline(struct zink_context *ctx,
    entry = _mesa_hash_table_search_pre_hashed(&prog->pipelines[idx], state->final_hash, state);
 
    if (!entry) {
+      if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS) &&
+          !util_queue_fence_is_signalled(&prog->base.cache_fence))
+         p_atomic_inc(&screen->pipeline_stats.stalls);
       util_queue_fence_wait(&prog->base.cache_fence);
-      VkPipeline pipeline = zink_create_gfx_pipeline(screen, prog, state,
-                                                     ctx->element_state->binding_map,
-                                                     vkmode);
-      if (pipeline == VK_NULL_HANDLE)
-         return VK_NULL_HANDLE;
-
-      zink_screen_update_pipeline_cache(screen, &prog->base);
       struct gfx_pipeline_cache_entry *pc_entry = CALLOC_STRUCT(gfx_pipeline_cache_entry);
       if (!pc_entry)
          return VK_NULL_HANDLE;
 
       memcpy(&pc_entry->state, state, sizeof(*state));
-      pc_entry->pipeline = pipeline;
+      struct zink_pipeline_record rec;
+      bool record = can_record_pipeline(screen, prog, state);
+      if (record) {
+         init_pipeline_record(screen, prog, state, ctx->element_state->binding_map, vkmode, &rec);
+         if (util_queue_fence_is_signalled(&prog->precompile_fence) && prog->precompiled)
+            pc_entry->pipeline = get_precompiled_pipeline(screen, prog, &rec);
+      }
+      if (!pc_entry->pipeline && screen->async_pipelines)
+         create_gfx_pipeline_async(ctx, prog, pc_entry, vkmode);
+      if (!pc_entry->pipeline) {
+         pc_entry->pipeline = zink_create_gfx_pipeline(screen, prog, state,
+                                                       ctx->element_state->binding_map,
+                                                       vkmode, 0);
+         if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS))
+            p_atomic_inc(&screen->pipeline_stats.misses);
+      }
+      if (pc_entry->pipeline == VK_NULL_HANDLE) {
+         FREE(pc_entry);
+         return VK_NULL_HANDLE;
+      }
+      if (record)
+         record_pipeline(screen, prog, &rec);
 
+      zink_screen_update_pipeline_cache(screen, &prog->base);
       entry = _mesa_hash_table_insert_pre_hashed(&prog->pipelines[idx], state->final_hash, pc_entry, pc_entry);
       assert(entry);
+   } else if (unlikely(zink_debug & ZINK_DEBUG_PIPESTATS)) {
+      p_atomic_inc(&screen->pipeline_stats.hits);
    }
 
    struct gfx_pipeline_cache_entry *cache_entry = entry->data;
+   if (unlikely(cache_entry->async))
+      update_gfx_pipeline_async(screen, prog, cache_entry);
    state->pipeline = cache_entry->pipeline;
+   state->pipeline_pending = !!cache_entry->async;
    state->idx = idx;
    return state->pipeline;
 }
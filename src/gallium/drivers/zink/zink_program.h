@@ -28,6 +28,8 @@
 
 #include "compiler/shader_enums.h"
 #include "pipe/p_state.h"
+#include "util/disk_cache.h"
+#include "util/u_dynarray.h"
 #include "util/u_inlines.h"
 
 #include "zink_context.h"
@@ -94,6 +96,7 @@ struct zink_program {
 };
 
 #define ZINK_MAX_INLINED_VARIANTS 5
+#define ZINK_MAX_PIPELINE_RECORDS 64
 
 struct zink_gfx_program {
    struct zink_program base;
@@ -110,6 +113,21 @@ struct zink_gfx_program {
 
    struct zink_shader *shaders[ZINK_SHADER_COUNT];
    struct hash_table pipelines[11]; // number of draw modes we support
+   struct hash_table libs[3]; // VK_EXT_graphics_pipeline_library: input, shaders, output
+   /* pipeline state combinations persisted in the disk cache;
+    * only accessed on the cache thread until cache_fence signals
+    */
+   struct util_dynarray pipeline_records;
+   bool records_dirty;
+   /* a copy of the records for the next cache put job to write back */
+   void *records_snapshot;
+   size_t records_snapshot_size;
+   /* the records loaded from the disk cache, consumed by the precompile job */
+   struct zink_pipeline_record *precompile_records;
+   unsigned num_precompile_records;
+   /* precompiled is only accessed on the cache thread until precompile_fence signals */
+   struct util_queue_fence precompile_fence;
+   struct hash_table *precompiled;
    uint32_t default_variant_hash;
    uint32_t last_variant_hash;
 };
@@ -215,6 +233,21 @@ void
 zink_destroy_gfx_program(struct zink_context *ctx,
                          struct zink_gfx_program *prog);
 
+bool
+zink_gfx_program_load_records(struct zink_screen *screen, struct zink_gfx_program *prog);
+
+void
+zink_gfx_program_precompile(struct zink_screen *screen, struct zink_gfx_program *prog);
+
+bool
+zink_gfx_program_records_key(struct zink_screen *screen, struct zink_gfx_program *prog, cache_key key);
+
+void
+zink_gfx_program_snapshot_records(struct zink_gfx_program *prog);
+
+void
+zink_gfx_program_write_records(struct zink_screen *screen, struct zink_gfx_program *prog);
+
 VkPipeline
 zink_get_gfx_pipeline(struct zink_context *ctx,
                       struct zink_gfx_program *prog,
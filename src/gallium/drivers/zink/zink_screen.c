@@ -84,6 +84,8 @@ zink_debug_options[] = {
    { "validation", ZINK_DEBUG_VALIDATION, "Dump Validation layer output" },
    { "sync", ZINK_DEBUG_SYNC, "Force synchronization before draws/dispatches" },
    { "compact", ZINK_DEBUG_COMPACT, "Use only 4 descriptor sets" },
+   { "pipestats", ZINK_DEBUG_PIPESTATS, "Print pipeline cache statistics on exit" },
+   { "nogpl", ZINK_DEBUG_NOGPL, "Don't use VK_EXT_graphics_pipeline_library" },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -195,9 +197,12 @@ disk_cache_init(struct zink_screen *screen)
    if (!screen->disk_cache)
       return true;
 
+   /* precompiling takes long: it gets its own queue so that it doesn't hold up cache_get jobs */
    if (!util_queue_init(&screen->cache_put_thread, "zcq", 8, 1, UTIL_QUEUE_INIT_RESIZE_IF_FULL, screen) ||
       !util_queue_init(&screen->cache_get_thread, "zcfq", 8, 4,
-         UTIL_QUEUE_INIT_RESIZE_IF_FULL, screen)) {
+         UTIL_QUEUE_INIT_RESIZE_IF_FULL, screen) ||
+      !util_queue_init(&screen->precompile_queue, "zpcq", 8, 1,
+         UTIL_QUEUE_INIT_RESIZE_IF_FULL | UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, screen)) {
       mesa_loge("zink: Failed to create disk cache queue\n");
 
       disk_cache_destroy(screen->disk_cache);
@@ -205,6 +210,7 @@ disk_cache_init(struct zink_screen *screen)
 
       util_queue_destroy(&screen->cache_put_thread);
       util_queue_destroy(&screen->cache_get_thread);
+      util_queue_destroy(&screen->precompile_queue);
 
       return false;
    }
@@ -220,6 +226,10 @@ cache_put_job(void *data, void *gdata, int thread_index)
    struct zink_program *pg = data;
    struct zink_screen *screen = gdata;
    size_t size = 0;
+   /* persist the pipeline records regularly: apps often exit without destroying their programs */
+   if (!pg->is_compute)
+      zink_gfx_program_write_records(screen, (struct zink_gfx_program *)pg);
+
    if (VKSCR(GetPipelineCacheData)(screen->dev, pg->pipeline_cache, &size, NULL) != VK_SUCCESS) {
       mesa_loge("ZINK: vkGetPipelineCacheData failed");
       return;
@@ -243,6 +253,9 @@ cache_put_job(void *data, void *gdata, int thread_index)
 void
 zink_screen_update_pipeline_cache(struct zink_screen *screen, struct zink_program *pg)
 {
+   /* the snapshot is owned by the put job once queued */
+   if (!pg->is_compute && util_queue_fence_is_signalled(&pg->cache_fence))
+      zink_gfx_program_snapshot_records((struct zink_gfx_program *)pg);
    util_queue_fence_init(&pg->cache_fence);
    if (!screen->disk_cache)
       return;
@@ -256,10 +269,15 @@ cache_get_job(void *data, void *gdata, int thread_index)
    struct zink_program *pg = data;
    struct zink_screen *screen = gdata;
 
+   bool precompile = !pg->is_compute &&
+                     zink_gfx_program_load_records(screen, (struct zink_gfx_program *)pg);
+
    VkPipelineCacheCreateInfo pcci;
    pcci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
    pcci.pNext = NULL;
-   pcci.flags = screen->info.have_EXT_pipeline_creation_cache_control ? VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT_EXT : 0;
+   /* async pipeline jobs and the precompile job may use the cache concurrently with the draw thread */
+   pcci.flags = screen->info.have_EXT_pipeline_creation_cache_control && !screen->async_pipelines && !precompile ?
+                VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT_EXT : 0;
    pcci.initialDataSize = 0;
    pcci.pInitialData = NULL;
 
@@ -273,6 +291,17 @@ cache_get_job(void *data, void *gdata, int thread_index)
    free((void*)pcci.pInitialData);
 }
 
+static void
+precompile_job(void *data, void *gdata, int thread_index)
+{
+   struct zink_gfx_program *prog = data;
+   struct zink_screen *screen = gdata;
+
+   /* the cache_get job was queued first on its own queue */
+   util_queue_fence_wait(&prog->base.cache_fence);
+   zink_gfx_program_precompile(screen, prog);
+}
+
 void
 zink_screen_get_pipeline_cache(struct zink_screen *screen, struct zink_program *pg)
 {
@@ -280,7 +309,24 @@ zink_screen_get_pipeline_cache(struct zink_screen *screen, struct zink_program *
    if (!screen->disk_cache)
       return;
 
+   /* start loading everything cache_get_job reads on the disk cache threads,
+    * so that programs created back to back don't load one entry at a time
+    */
+   cache_key keys[2];
+   unsigned num_keys = 0;
+   disk_cache_compute_key(screen->disk_cache, pg->sha1, sizeof(pg->sha1), keys[num_keys++]);
+   if (!pg->is_compute &&
+       zink_gfx_program_records_key(screen, (struct zink_gfx_program *)pg, keys[num_keys]))
+      num_keys++;
+   disk_cache_prefetch(screen->disk_cache, keys, num_keys);
+
    util_queue_add_job(&screen->cache_get_thread, pg, &pg->cache_fence, cache_get_job, NULL, 0);
+
+   /* the first draws only wait for the pipeline cache, not for the precompiled pipelines */
+   if (!pg->is_compute) {
+      struct zink_gfx_program *prog = (struct zink_gfx_program *)pg;
+      util_queue_add_job(&screen->precompile_queue, prog, &prog->precompile_fence, precompile_job, NULL, 0);
+   }
 }
 
 static int
@@ -1248,11 +1294,28 @@ zink_destroy_screen(struct pipe_screen *pscreen)
    }
 
    u_transfer_helper_destroy(pscreen->transfer_helper);
+   if (screen->async_pipelines) {
+      util_queue_finish(&screen->pipeline_queue);
+      util_queue_destroy(&screen->pipeline_queue);
+   }
+   if (zink_debug & ZINK_DEBUG_PIPESTATS) {
+      mesa_logi("zink: pipelines: %u hits, %u misses, %u cache hits, %u precompiled, %u fallbacks, %u async, %u stalls\n",
+                screen->pipeline_stats.hits, screen->pipeline_stats.misses,
+                screen->pipeline_stats.cache_hits, screen->pipeline_stats.precompiled,
+                screen->pipeline_stats.fallbacks,
+                screen->pipeline_stats.async_done, screen->pipeline_stats.stalls);
+      mesa_logi("zink: %u monolithic compiles in %.3f ms, %u libraries in %.3f ms, %u fast links in %.3f ms\n",
+                screen->pipeline_stats.compiles, screen->pipeline_stats.compile_ns / 1000000.0,
+                screen->pipeline_stats.libraries, screen->pipeline_stats.library_ns / 1000000.0,
+                screen->pipeline_stats.links, screen->pipeline_stats.link_ns / 1000000.0);
+   }
 #ifdef ENABLE_SHADER_CACHE
    if (screen->disk_cache) {
+      util_queue_finish(&screen->precompile_queue);
       util_queue_finish(&screen->cache_put_thread);
       util_queue_finish(&screen->cache_get_thread);
       disk_cache_wait_for_idle(screen->disk_cache);
+      util_queue_destroy(&screen->precompile_queue);
       util_queue_destroy(&screen->cache_put_thread);
       util_queue_destroy(&screen->cache_get_thread);
    }
@@ -2294,6 +2357,24 @@ zink_internal_create_screen(const struct pipe_screen_config *config)
    zink_screen_init_compiler(screen);
    if (!disk_cache_init(screen))
       goto fail;
+   screen->async_pipelines = debug_get_bool_option("ZINK_ASYNC_PIPELINES", false);
+   /* libraries are only used where all the state they'd otherwise bake in is dynamic,
+    * and the fast-linked pipeline is always replaced by an optimized one in the background
+    */
+   screen->have_gpl = screen->async_pipelines &&
+                      screen->info.have_EXT_graphics_pipeline_library &&
+                      screen->info.have_EXT_extended_dynamic_state &&
+                      screen->info.have_EXT_extended_dynamic_state2 &&
+                      screen->info.have_EXT_vertex_input_dynamic_state &&
+                      screen->info.have_KHR_dynamic_rendering &&
+                      !(zink_debug & ZINK_DEBUG_NOGPL);
+   if (screen->async_pipelines &&
+       !util_queue_init(&screen->pipeline_queue, "zpq", 64,
+                        CLAMP(util_get_cpu_caps()->nr_cpus / 2, 1, 4),
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL | UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, screen)) {
+      mesa_loge("zink: failed to create async pipeline queue\n");
+      screen->async_pipelines = screen->have_gpl = false;
+   }
    populate_format_props(screen);
    pre_hash_descriptor_states(screen);
 
@@ -2367,6 +2448,8 @@ fail:
       util_dl_close(screen->loader_lib);
    if (screen->threaded)
       util_queue_destroy(&screen->flush_queue);
+   if (screen->async_pipelines)
+      util_queue_destroy(&screen->pipeline_queue);
 
    ralloc_free(screen);
    return NULL;
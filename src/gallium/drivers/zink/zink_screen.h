@@ -68,6 +68,8 @@ enum zink_descriptor_type;
 #define ZINK_DEBUG_VALIDATION 0x8
 #define ZINK_DEBUG_SYNC 0x10
 #define ZINK_DEBUG_COMPACT (1<<5)
+#define ZINK_DEBUG_PIPESTATS (1<<6)
+#define ZINK_DEBUG_NOGPL (1<<7)
 
 #define NUM_SLAB_ALLOCATORS 3
 #define MIN_SLAB_ORDER 8
@@ -122,6 +124,27 @@ struct zink_screen {
    struct disk_cache *disk_cache;
    struct util_queue cache_put_thread;
    struct util_queue cache_get_thread;
+   struct util_queue precompile_queue;
+   /* ZINK_ASYNC_PIPELINES: background compiles of optimized gfx pipelines */
+   bool async_pipelines;
+   /* fast-linked VK_EXT_graphics_pipeline_library pipelines are used until the optimized one is ready */
+   bool have_gpl;
+   struct util_queue pipeline_queue;
+
+   /* only updated with ZINK_DEBUG=pipestats */
+   struct {
+      uint32_t hits; //found in the program's pipeline table
+      uint32_t misses; //compiled synchronously on the draw thread
+      uint32_t cache_hits; //created from the VkPipelineCache without compiling
+      uint32_t precompiled; //compiled at program creation from the pipeline state database
+      uint32_t fallbacks; //unoptimized pipeline used while the optimized one compiles
+      uint32_t async_done; //optimized pipeline swapped in
+      uint32_t stalls; //draw thread waited on a background job
+      uint32_t compiles, libraries, links;
+      uint64_t compile_ns; //monolithic pipelines
+      uint64_t library_ns; //VK_EXT_graphics_pipeline_library parts
+      uint64_t link_ns; //fast links of library parts
+   } pipeline_stats;
 
    struct util_live_shader_cache shaders;
 
@@ -221,6 +221,7 @@ lvp_physical_device_init(struct lvp_physical_device *device,
       goto fail;
    }
    device->pld = pld;
+   device->vk.pipeline_cache_import_ops = lvp_pipeline_cache_import_ops;
 
    device->pscreen = pipe_loader_create_screen_vk(device->pld, true);
    if (!device->pscreen)
@@ -233,6 +234,7 @@ lvp_physical_device_init(struct lvp_physical_device *device,
    device->vk.supported_sync_types = device->sync_types;
 
    device->max_images = device->pscreen->get_shader_param(device->pscreen, PIPE_SHADER_FRAGMENT, PIPE_SHADER_CAP_MAX_SHADER_IMAGES);
+   device->num_queues = CLAMP(debug_get_num_option("LVP_NUM_QUEUES", 1), 1, LVP_MAX_QUEUES);
    device->vk.supported_extensions = lvp_device_extensions_supported;
 
    VkSampleCountFlags sample_counts = VK_SAMPLE_COUNT_1_BIT | VK_SAMPLE_COUNT_4_BIT;
@@ -1293,6 +1295,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_GetPhysicalDeviceQueueFamilyProperties2(
    uint32_t*                                   pCount,
    VkQueueFamilyProperties2                   *pQueueFamilyProperties)
 {
+   LVP_FROM_HANDLE(lvp_physical_device, pdevice, physicalDevice);
    VK_OUTARRAY_MAKE_TYPED(VkQueueFamilyProperties2, out, pQueueFamilyProperties, pCount);
 
    vk_outarray_append_typed(VkQueueFamilyProperties2, &out, p) {
@@ -1300,7 +1303,7 @@ VKAPI_ATTR void VKAPI_CALL lvp_GetPhysicalDeviceQueueFamilyProperties2(
          .queueFlags = VK_QUEUE_GRAPHICS_BIT |
          VK_QUEUE_COMPUTE_BIT |
          VK_QUEUE_TRANSFER_BIT,
-         .queueCount = 1,
+         .queueCount = pdevice->num_queues,
          .timestampValidBits = 64,
          .minImageTransferGranularity = (VkExtent3D) { 1, 1, 1 },
       };
@@ -1403,7 +1406,13 @@ destroy_pipelines(struct lvp_queue *queue)
 {
    simple_mtx_lock(&queue->pipeline_lock);
    while (util_dynarray_contains(&queue->pipeline_destroys, struct lvp_pipeline*)) {
-      lvp_pipeline_destroy(queue->device, util_dynarray_pop(&queue->pipeline_destroys, struct lvp_pipeline*));
+      struct lvp_pipeline *pipeline =
+         util_dynarray_pop(&queue->pipeline_destroys, struct lvp_pipeline*);
+
+      /* Every queue deletes its own shaders, the last one the pipeline. */
+      lvp_pipeline_destroy_shaders(queue, pipeline);
+      if (p_atomic_dec_zero(&pipeline->destroy_queue_refs))
+         lvp_pipeline_destroy(queue->device, pipeline);
    }
    simple_mtx_unlock(&queue->pipeline_lock);
 }
@@ -1443,7 +1452,7 @@ lvp_queue_submit(struct vk_queue *vk_queue,
 static VkResult
 lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
                const VkDeviceQueueCreateInfo *create_info,
-               uint32_t index_in_family)
+               uint32_t index_in_family, void *state)
 {
    VkResult result = vk_queue_init(&queue->vk, &device->vk, create_info,
                                    index_in_family);
@@ -1457,6 +1466,7 @@ lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
    }
 
    queue->device = device;
+   queue->state = state;
 
    queue->ctx = device->pscreen->context_create(device->pscreen, NULL, PIPE_CONTEXT_ROBUST_BUFFER_ACCESS);
    queue->cso = cso_create_context(queue->ctx, CSO_NO_VBUF);
@@ -1475,6 +1485,9 @@ lvp_queue_finish(struct lvp_queue *queue)
 {
    vk_queue_finish(&queue->vk);
 
+   if (queue->last_fence)
+      queue->device->pscreen->fence_reference(queue->device->pscreen, &queue->last_fence, NULL);
+
    destroy_pipelines(queue);
    simple_mtx_destroy(&queue->pipeline_lock);
    util_dynarray_fini(&queue->pipeline_destroys);
@@ -1515,14 +1528,19 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    assert(pCreateInfo->sType == VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO);
 
-   size_t state_size = lvp_get_rendering_state_size();
+   assert(pCreateInfo->queueCreateInfoCount == 1);
+   assert(pCreateInfo->pQueueCreateInfos[0].queueFamilyIndex == 0);
+   assert(pCreateInfo->pQueueCreateInfos[0].queueCount <= physical_device->num_queues);
+   uint32_t num_queues = pCreateInfo->pQueueCreateInfos[0].queueCount;
+
+   /* Each queue records into a rendering state of its own. */
+   size_t state_size = align(lvp_get_rendering_state_size(), 8);
    device = vk_zalloc2(&physical_device->vk.instance->alloc, pAllocator,
-                       sizeof(*device) + state_size, 8,
+                       sizeof(*device) + state_size * num_queues, 8,
                        VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
    if (!device)
       return vk_error(instance, VK_ERROR_OUT_OF_HOST_MEMORY);
 
-   device->queue.state = device + 1;
    device->poison_mem = debug_get_bool_option("LVP_POISON_MEMORY", false);
 
    struct vk_device_dispatch_table dispatch_table;
@@ -1550,13 +1568,18 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    device->pscreen = physical_device->pscreen;
 
-   assert(pCreateInfo->queueCreateInfoCount == 1);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueFamilyIndex == 0);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueCount == 1);
-   result = lvp_queue_init(device, &device->queue, pCreateInfo->pQueueCreateInfos, 0);
-   if (result != VK_SUCCESS) {
-      vk_free(&device->vk.alloc, device);
-      return result;
+   for (uint32_t i = 0; i < num_queues; i++) {
+      result = lvp_queue_init(device, &device->queues[i],
+                              pCreateInfo->pQueueCreateInfos, i,
+                              (char *)(device + 1) + state_size * i);
+      if (result != VK_SUCCESS) {
+         while (i--)
+            lvp_queue_finish(&device->queues[i]);
+         vk_device_finish(&device->vk);
+         vk_free(&device->vk.alloc, device);
+         return result;
+      }
+      device->num_queues++;
    }
 
    *pDevice = lvp_device_to_handle(device);
@@ -1571,9 +1594,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
 
-   if (device->queue.last_fence)
-      device->pscreen->fence_reference(device->pscreen, &device->queue.last_fence, NULL);
-   lvp_queue_finish(&device->queue);
+   for (uint32_t i = 0; i < device->num_queues; i++)
+      lvp_queue_finish(&device->queues[i]);
    vk_device_finish(&device->vk);
    vk_free(&device->vk.alloc, device);
 }
@@ -70,6 +70,7 @@ struct rendering_state {
    struct pipe_context *pctx;
    struct u_upload_mgr *uploader;
    struct cso_context *cso;
+   unsigned queue_index;
 
    bool blend_dirty;
    bool rs_dirty;
@@ -453,7 +454,7 @@ static void handle_compute_pipeline(struct vk_cmd_queue_entry *cmd,
    state->dispatch_info.block[0] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[0];
    state->dispatch_info.block[1] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[1];
    state->dispatch_info.block[2] = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.workgroup_size[2];
-   state->pctx->bind_compute_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_COMPUTE]);
+   state->pctx->bind_compute_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_COMPUTE]);
 }
 
 static void
@@ -603,24 +604,24 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
          const VkPipelineShaderStageCreateInfo *sh = &pipeline->graphics_create_info.pStages[i];
          switch (sh->stage) {
          case VK_SHADER_STAGE_FRAGMENT_BIT:
-            state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+            state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_FRAGMENT]);
             has_stage[PIPE_SHADER_FRAGMENT] = true;
             break;
          case VK_SHADER_STAGE_VERTEX_BIT:
-            state->pctx->bind_vs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
+            state->pctx->bind_vs_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_VERTEX]);
             has_stage[PIPE_SHADER_VERTEX] = true;
             break;
          case VK_SHADER_STAGE_GEOMETRY_BIT:
-            state->pctx->bind_gs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
+            state->pctx->bind_gs_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_GEOMETRY]);
             state->gs_output_lines = pipeline->gs_output_lines ? GS_OUTPUT_LINES : GS_OUTPUT_NOT_LINES;
             has_stage[PIPE_SHADER_GEOMETRY] = true;
             break;
          case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-            state->pctx->bind_tcs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
+            state->pctx->bind_tcs_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_TESS_CTRL]);
             has_stage[PIPE_SHADER_TESS_CTRL] = true;
             break;
          case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
-            state->pctx->bind_tes_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
+            state->pctx->bind_tes_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_TESS_EVAL]);
             has_stage[PIPE_SHADER_TESS_EVAL] = true;
             break;
          default:
@@ -632,7 +633,7 @@ static void handle_graphics_pipeline(struct vk_cmd_queue_entry *cmd,
 
    /* there should always be a dummy fs. */
    if (!has_stage[PIPE_SHADER_FRAGMENT])
-      state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
+      state->pctx->bind_fs_state(state->pctx, pipeline->shader_cso[state->queue_index][PIPE_SHADER_FRAGMENT]);
    if (state->pctx->bind_gs_state && !has_stage[PIPE_SHADER_GEOMETRY])
       state->pctx->bind_gs_state(state->pctx, NULL);
    if (state->pctx->bind_tcs_state && !has_stage[PIPE_SHADER_TESS_CTRL])
@@ -2731,6 +2732,7 @@ static void handle_begin_query(struct vk_cmd_queue_entry *cmd,
       enum pipe_query_type qtype = pool->base_type;
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              qtype, 0);
+      pool->query_ctx[qcmd->query] = state->pctx;
    }
 
    state->pctx->begin_query(state->pctx, pool->queries[qcmd->query]);
@@ -2763,6 +2765,7 @@ static void handle_begin_query_indexed_ext(struct vk_cmd_queue_entry *cmd,
       enum pipe_query_type qtype = pool->base_type;
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              qtype, qcmd->index);
+      pool->query_ctx[qcmd->query] = state->pctx;
    }
 
    state->pctx->begin_query(state->pctx, pool->queries[qcmd->query]);
@@ -2785,7 +2788,7 @@ static void handle_reset_query_pool(struct vk_cmd_queue_entry *cmd,
    LVP_FROM_HANDLE(lvp_query_pool, pool, qcmd->query_pool);
    for (unsigned i = qcmd->first_query; i < qcmd->first_query + qcmd->query_count; i++) {
       if (pool->queries[i]) {
-         state->pctx->destroy_query(state->pctx, pool->queries[i]);
+         pool->query_ctx[i]->destroy_query(pool->query_ctx[i], pool->queries[i]);
          pool->queries[i] = NULL;
       }
    }
@@ -2799,6 +2802,7 @@ static void handle_write_timestamp2(struct vk_cmd_queue_entry *cmd,
    if (!pool->queries[qcmd->query]) {
       pool->queries[qcmd->query] = state->pctx->create_query(state->pctx,
                                                              PIPE_QUERY_TIMESTAMP, 0);
+      pool->query_ctx[qcmd->query] = state->pctx;
    }
 
    if (!(qcmd->stage == VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT))
@@ -4000,6 +4004,7 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    state->pctx = queue->ctx;
    state->uploader = queue->uploader;
    state->cso = queue->cso;
+   state->queue_index = queue->vk.index_in_family;
    state->blend_dirty = true;
    state->dsa_dirty = true;
    state->rs_dirty = true;
@@ -26,6 +26,7 @@
 #include "vk_util.h"
 #include "glsl_types.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
 #include "spirv/nir_spirv.h"
 #include "nir/nir_builder.h"
 #include "lvp_lower_vulkan_resource.h"
@@ -43,21 +44,28 @@
    } while(0)
 
 void
-lvp_pipeline_destroy(struct lvp_device *device, struct lvp_pipeline *pipeline)
+lvp_pipeline_destroy_shaders(struct lvp_queue *queue, struct lvp_pipeline *pipeline)
 {
-   if (pipeline->shader_cso[PIPE_SHADER_VERTEX])
-      device->queue.ctx->delete_vs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_VERTEX]);
-   if (pipeline->shader_cso[PIPE_SHADER_FRAGMENT])
-      device->queue.ctx->delete_fs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_FRAGMENT]);
-   if (pipeline->shader_cso[PIPE_SHADER_GEOMETRY])
-      device->queue.ctx->delete_gs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_GEOMETRY]);
-   if (pipeline->shader_cso[PIPE_SHADER_TESS_CTRL])
-      device->queue.ctx->delete_tcs_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_TESS_CTRL]);
-   if (pipeline->shader_cso[PIPE_SHADER_TESS_EVAL])
-      device->queue.ctx->delete_tes_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_TESS_EVAL]);
-   if (pipeline->shader_cso[PIPE_SHADER_COMPUTE])
-      device->queue.ctx->delete_compute_state(device->queue.ctx, pipeline->shader_cso[PIPE_SHADER_COMPUTE]);
+   struct pipe_context *ctx = queue->ctx;
+   void **shader_cso = pipeline->shader_cso[queue->vk.index_in_family];
+
+   if (shader_cso[PIPE_SHADER_VERTEX])
+      ctx->delete_vs_state(ctx, shader_cso[PIPE_SHADER_VERTEX]);
+   if (shader_cso[PIPE_SHADER_FRAGMENT])
+      ctx->delete_fs_state(ctx, shader_cso[PIPE_SHADER_FRAGMENT]);
+   if (shader_cso[PIPE_SHADER_GEOMETRY])
+      ctx->delete_gs_state(ctx, shader_cso[PIPE_SHADER_GEOMETRY]);
+   if (shader_cso[PIPE_SHADER_TESS_CTRL])
+      ctx->delete_tcs_state(ctx, shader_cso[PIPE_SHADER_TESS_CTRL]);
+   if (shader_cso[PIPE_SHADER_TESS_EVAL])
+      ctx->delete_tes_state(ctx, shader_cso[PIPE_SHADER_TESS_EVAL]);
+   if (shader_cso[PIPE_SHADER_COMPUTE])
+      ctx->delete_compute_state(ctx, shader_cso[PIPE_SHADER_COMPUTE]);
+}
 
+void
+lvp_pipeline_destroy(struct lvp_device *device, struct lvp_pipeline *pipeline)
+{
    for (unsigned i = 0; i < MESA_SHADER_STAGES; i++)
       ralloc_free(pipeline->pipeline_nir[i]);
 
@@ -80,9 +88,15 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipeline(
    if (!_pipeline)
       return;
 
-   simple_mtx_lock(&device->queue.pipeline_lock);
-   util_dynarray_append(&device->queue.pipeline_destroys, struct lvp_pipeline*, pipeline);
-   simple_mtx_unlock(&device->queue.pipeline_lock);
+   /* The shaders have to be deleted on the thread of each queue. */
+   pipeline->destroy_queue_refs = device->num_queues;
+   for (uint32_t i = 0; i < device->num_queues; i++) {
+      struct lvp_queue *queue = &device->queues[i];
+
+      simple_mtx_lock(&queue->pipeline_lock);
+      util_dynarray_append(&queue->pipeline_destroys, struct lvp_pipeline*, pipeline);
+      simple_mtx_unlock(&queue->pipeline_lock);
+   }
 }
 
 static VkResult
@@ -855,8 +869,69 @@ optimize(nir_shader *nir)
    } while (progress);
 }
 
+static void
+hash_pipeline_layout(struct mesa_sha1 *ctx, const struct lvp_pipeline_layout *layout)
+{
+   if (!layout)
+      return;
+
+   _mesa_sha1_update(ctx, &layout->num_sets, sizeof(layout->num_sets));
+   _mesa_sha1_update(ctx, &layout->push_constant_size, sizeof(layout->push_constant_size));
+   /* inline uniform blocks only come after the push constants in these stages */
+   _mesa_sha1_update(ctx, &layout->push_constant_stages, sizeof(layout->push_constant_stages));
+   _mesa_sha1_update(ctx, layout->stage, sizeof(layout->stage));
+   for (unsigned i = 0; i < layout->num_sets; i++) {
+      const struct lvp_descriptor_set_layout *set_layout = layout->set[i].layout;
+      /* the sets before a binding decide its index, so a missing set matters too */
+      const bool has_set = set_layout != NULL;
+      _mesa_sha1_update(ctx, &has_set, sizeof(has_set));
+      if (!set_layout)
+         continue;
+      _mesa_sha1_update(ctx, &set_layout->binding_count, sizeof(set_layout->binding_count));
+      _mesa_sha1_update(ctx, set_layout->stage, sizeof(set_layout->stage));
+      /* hash member by member: the binding struct has padding and pointers */
+      for (unsigned j = 0; j < set_layout->binding_count; j++) {
+         const struct lvp_descriptor_set_binding_layout *binding = &set_layout->binding[j];
+         _mesa_sha1_update(ctx, &binding->descriptor_index, sizeof(binding->descriptor_index));
+         _mesa_sha1_update(ctx, &binding->type, sizeof(binding->type));
+         _mesa_sha1_update(ctx, &binding->array_size, sizeof(binding->array_size));
+         _mesa_sha1_update(ctx, &binding->valid, sizeof(binding->valid));
+         _mesa_sha1_update(ctx, &binding->dynamic_index, sizeof(binding->dynamic_index));
+         _mesa_sha1_update(ctx, binding->stage, sizeof(binding->stage));
+      }
+   }
+}
+
+/* The lowered NIR only depends on the SPIR-V, the entrypoint, the
+ * specialization constants and the pipeline layout it was lowered against.
+ */
+static void
+hash_shader_stage(unsigned char sha1[20],
+                  const struct lvp_pipeline *pipeline,
+                  uint32_t size,
+                  const void *module,
+                  const char *entrypoint_name,
+                  gl_shader_stage stage,
+                  const VkSpecializationInfo *spec_info)
+{
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, &stage, sizeof(stage));
+   _mesa_sha1_update(&ctx, module, size);
+   _mesa_sha1_update(&ctx, entrypoint_name, strlen(entrypoint_name));
+   if (spec_info && spec_info->mapEntryCount) {
+      _mesa_sha1_update(&ctx, spec_info->pMapEntries,
+                        spec_info->mapEntryCount * sizeof(spec_info->pMapEntries[0]));
+      _mesa_sha1_update(&ctx, spec_info->pData, spec_info->dataSize);
+   }
+   hash_pipeline_layout(&ctx, pipeline->layout);
+   _mesa_sha1_final(&ctx, sha1);
+}
+
 static void
 lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
+                         struct vk_pipeline_cache *cache,
                          uint32_t size,
                          const void *module,
                          const char *entrypoint_name,
@@ -869,6 +944,17 @@ lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
    assert(spirv[0] == SPIR_V_MAGIC_NUMBER);
    assert(size % 4 == 0);
 
+   unsigned char sha1[20];
+   if (cache) {
+      hash_shader_stage(sha1, pipeline, size, module, entrypoint_name, stage, spec_info);
+      nir = lvp_pipeline_cache_lookup_shader(cache, sha1, drv_options,
+                                             &pipeline->access[stage]);
+      if (nir) {
+         pipeline->pipeline_nir[stage] = nir;
+         return;
+      }
+   }
+
    uint32_t num_spec_entries = 0;
    struct nir_spirv_specialization *spec_entries =
       vk_spec_info_to_nir_spirv(spec_info, &num_spec_entries);
@@ -1038,6 +1124,9 @@ lvp_shader_compile_to_ir(struct lvp_pipeline *pipeline,
    nir_assign_io_var_locations(nir, nir_var_shader_out, &nir->num_outputs,
                                nir->info.stage);
    pipeline->pipeline_nir[stage] = nir;
+
+   if (cache)
+      lvp_pipeline_cache_add_shader(cache, sha1, nir, &pipeline->access[stage]);
 }
 
 static void fill_shader_prog(struct pipe_shader_state *state, gl_shader_stage stage, struct lvp_pipeline *pipeline)
@@ -1114,14 +1203,16 @@ lvp_pipeline_compile(struct lvp_pipeline *pipeline,
    struct lvp_device *device = pipeline->device;
    device->physical_device->pscreen->finalize_nir(device->physical_device->pscreen, pipeline->pipeline_nir[stage]);
    if (stage == MESA_SHADER_COMPUTE) {
-      struct pipe_compute_state shstate = {0};
-      shstate.prog = (void *)nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_COMPUTE]);
-      shstate.ir_type = PIPE_SHADER_IR_NIR;
-      shstate.req_local_mem = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.shared_size;
-      pipeline->shader_cso[PIPE_SHADER_COMPUTE] = device->queue.ctx->create_compute_state(device->queue.ctx, &shstate);
+      for (uint32_t q = 0; q < device->num_queues; q++) {
+         struct pipe_context *ctx = device->queues[q].ctx;
+         struct pipe_compute_state shstate = {0};
+         shstate.prog = (void *)nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_COMPUTE]);
+         shstate.ir_type = PIPE_SHADER_IR_NIR;
+         shstate.req_local_mem = pipeline->pipeline_nir[MESA_SHADER_COMPUTE]->info.shared_size;
+         pipeline->shader_cso[q][PIPE_SHADER_COMPUTE] = ctx->create_compute_state(ctx, &shstate);
+      }
    } else {
       struct pipe_shader_state shstate = {0};
-      fill_shader_prog(&shstate, stage, pipeline);
 
       if (stage == MESA_SHADER_VERTEX ||
           stage == MESA_SHADER_GEOMETRY ||
@@ -1155,25 +1246,33 @@ lvp_pipeline_compile(struct lvp_pipeline *pipeline,
          }
       }
 
-      switch (stage) {
-      case MESA_SHADER_FRAGMENT:
-         pipeline->shader_cso[PIPE_SHADER_FRAGMENT] = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_VERTEX:
-         pipeline->shader_cso[PIPE_SHADER_VERTEX] = device->queue.ctx->create_vs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_GEOMETRY:
-         pipeline->shader_cso[PIPE_SHADER_GEOMETRY] = device->queue.ctx->create_gs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_TESS_CTRL:
-         pipeline->shader_cso[PIPE_SHADER_TESS_CTRL] = device->queue.ctx->create_tcs_state(device->queue.ctx, &shstate);
-         break;
-      case MESA_SHADER_TESS_EVAL:
-         pipeline->shader_cso[PIPE_SHADER_TESS_EVAL] = device->queue.ctx->create_tes_state(device->queue.ctx, &shstate);
-         break;
-      default:
-         unreachable("illegal shader");
-         break;
+      /* Every queue's context gets its own copy of the shader. */
+      for (uint32_t q = 0; q < device->num_queues; q++) {
+         struct pipe_context *ctx = device->queues[q].ctx;
+         void **shader_cso = pipeline->shader_cso[q];
+
+         fill_shader_prog(&shstate, stage, pipeline);
+
+         switch (stage) {
+         case MESA_SHADER_FRAGMENT:
+            shader_cso[PIPE_SHADER_FRAGMENT] = ctx->create_fs_state(ctx, &shstate);
+            break;
+         case MESA_SHADER_VERTEX:
+            shader_cso[PIPE_SHADER_VERTEX] = ctx->create_vs_state(ctx, &shstate);
+            break;
+         case MESA_SHADER_GEOMETRY:
+            shader_cso[PIPE_SHADER_GEOMETRY] = ctx->create_gs_state(ctx, &shstate);
+            break;
+         case MESA_SHADER_TESS_CTRL:
+            shader_cso[PIPE_SHADER_TESS_CTRL] = ctx->create_tcs_state(ctx, &shstate);
+            break;
+         case MESA_SHADER_TESS_EVAL:
+            shader_cso[PIPE_SHADER_TESS_EVAL] = ctx->create_tes_state(ctx, &shstate);
+            break;
+         default:
+            unreachable("illegal shader");
+            break;
+         }
       }
    }
    return VK_SUCCESS;
@@ -1255,7 +1354,7 @@ merge_layouts(struct lvp_pipeline *dst, struct lvp_pipeline_layout *src)
 static VkResult
 lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
                            struct lvp_device *device,
-                           struct lvp_pipeline_cache *cache,
+                           struct vk_pipeline_cache *cache,
                            const VkGraphicsPipelineCreateInfo *pCreateInfo)
 {
    const VkGraphicsPipelineLibraryCreateInfoEXT *libinfo = vk_find_struct_const(pCreateInfo,
@@ -1334,14 +1433,14 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
             continue;
       }
       if (module) {
-         lvp_shader_compile_to_ir(pipeline, module->size, module->data,
+         lvp_shader_compile_to_ir(pipeline, cache, module->size, module->data,
                                   pCreateInfo->pStages[i].pName,
                                   stage,
                                   pCreateInfo->pStages[i].pSpecializationInfo);
       } else {
          const VkShaderModuleCreateInfo *info = vk_find_struct_const(pCreateInfo->pStages[i].pNext, SHADER_MODULE_CREATE_INFO);
          assert(info);
-         lvp_shader_compile_to_ir(pipeline, info->codeSize, info->pCode,
+         lvp_shader_compile_to_ir(pipeline, cache, info->codeSize, info->pCode,
                                   pCreateInfo->pStages[i].pName,
                                   stage,
                                   pCreateInfo->pStages[i].pSpecializationInfo);
@@ -1442,10 +1541,13 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
                                                         "dummy_frag");
 
          pipeline->pipeline_nir[MESA_SHADER_FRAGMENT] = b.shader;
-         struct pipe_shader_state shstate = {0};
-         shstate.type = PIPE_SHADER_IR_NIR;
-         shstate.ir.nir = nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_FRAGMENT]);
-         pipeline->shader_cso[PIPE_SHADER_FRAGMENT] = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
+         for (uint32_t q = 0; q < device->num_queues; q++) {
+            struct pipe_context *ctx = device->queues[q].ctx;
+            struct pipe_shader_state shstate = {0};
+            shstate.type = PIPE_SHADER_IR_NIR;
+            shstate.ir.nir = nir_shader_clone(NULL, pipeline->pipeline_nir[MESA_SHADER_FRAGMENT]);
+            pipeline->shader_cso[q][PIPE_SHADER_FRAGMENT] = ctx->create_fs_state(ctx, &shstate);
+         }
       }
    }
    return VK_SUCCESS;
@@ -1459,7 +1561,7 @@ lvp_graphics_pipeline_create(
    VkPipeline *pPipeline)
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
-   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, _cache);
    struct lvp_pipeline *pipeline;
    VkResult result;
 
@@ -1527,7 +1629,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateGraphicsPipelines(
 static VkResult
 lvp_compute_pipeline_init(struct lvp_pipeline *pipeline,
                           struct lvp_device *device,
-                          struct lvp_pipeline_cache *cache,
+                          struct vk_pipeline_cache *cache,
                           const VkComputePipelineCreateInfo *pCreateInfo)
 {
    VK_FROM_HANDLE(vk_shader_module, module,
@@ -1542,7 +1644,7 @@ lvp_compute_pipeline_init(struct lvp_pipeline *pipeline,
                                  &pipeline->compute_create_info, pCreateInfo);
    pipeline->is_compute_pipeline = true;
 
-   lvp_shader_compile_to_ir(pipeline, module->size, module->data,
+   lvp_shader_compile_to_ir(pipeline, cache, module->size, module->data,
                             pCreateInfo->stage.pName,
                             MESA_SHADER_COMPUTE,
                             pCreateInfo->stage.pSpecializationInfo);
@@ -1560,7 +1662,7 @@ lvp_compute_pipeline_create(
    VkPipeline *pPipeline)
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
-   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, _cache);
    struct lvp_pipeline *pipeline;
    VkResult result;
 
@@ -22,81 +22,172 @@
  */
 
 #include "lvp_private.h"
+#include "nir_serialize.h"
+#include "util/blob.h"
 
-VKAPI_ATTR VkResult VKAPI_CALL lvp_CreatePipelineCache(
-    VkDevice                                    _device,
-    const VkPipelineCacheCreateInfo*            pCreateInfo,
-    const VkAllocationCallbacks*                pAllocator,
-    VkPipelineCache*                            pPipelineCache)
+/* Each cached shader is the final, lowered NIR of one pipeline stage along
+ * with the descriptor access masks that were scanned before the pipeline
+ * layout was applied, since those can't be recovered from the lowered NIR.
+ */
+struct lvp_shader_cache_object {
+   struct vk_pipeline_cache_object base;
+
+   struct lvp_access_info access;
+   size_t nir_size;
+   void *nir_data;
+};
+
+static bool
+lvp_shader_cache_serialize(struct vk_pipeline_cache_object *object,
+                           struct blob *blob);
+
+static struct vk_pipeline_cache_object *
+lvp_shader_cache_deserialize(struct vk_device *device,
+                             const void *key_data, size_t key_size,
+                             struct blob_reader *blob);
+
+static void
+lvp_shader_cache_destroy(struct vk_pipeline_cache_object *object)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
-   struct lvp_pipeline_cache *cache;
+   struct lvp_shader_cache_object *shader =
+      container_of(object, struct lvp_shader_cache_object, base);
+
+   free(shader->nir_data);
+   vk_pipeline_cache_object_finish(&shader->base);
+   vk_free(&object->device->alloc, shader);
+}
 
-   assert(pCreateInfo->sType == VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO);
+static const struct vk_pipeline_cache_object_ops lvp_shader_cache_ops = {
+   .serialize = lvp_shader_cache_serialize,
+   .deserialize = lvp_shader_cache_deserialize,
+   .destroy = lvp_shader_cache_destroy,
+};
 
-   cache = vk_alloc2(&device->vk.alloc, pAllocator,
-                       sizeof(*cache), 8,
-                       VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
-   if (cache == NULL)
-      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+const struct vk_pipeline_cache_object_ops *const lvp_pipeline_cache_import_ops[] = {
+   &lvp_shader_cache_ops,
+   NULL,
+};
 
-   vk_object_base_init(&device->vk, &cache->base,
-                       VK_OBJECT_TYPE_PIPELINE_CACHE);
-   if (pAllocator)
-     cache->alloc = *pAllocator;
-   else
-     cache->alloc = device->vk.alloc;
+static struct lvp_shader_cache_object *
+lvp_shader_cache_object_create(struct vk_device *device,
+                               const void *key_data, size_t key_size)
+{
+   VK_MULTIALLOC(ma);
+   VK_MULTIALLOC_DECL(&ma, struct lvp_shader_cache_object, shader, 1);
+   VK_MULTIALLOC_DECL_SIZE(&ma, void, obj_key_data, key_size);
+
+   if (!vk_multialloc_zalloc(&ma, &device->alloc,
+                             VK_SYSTEM_ALLOCATION_SCOPE_DEVICE))
+      return NULL;
 
-   cache->device = device;
-   *pPipelineCache = lvp_pipeline_cache_to_handle(cache);
+   memcpy(obj_key_data, key_data, key_size);
+   vk_pipeline_cache_object_init(device, &shader->base,
+                                 &lvp_shader_cache_ops, obj_key_data, key_size);
 
-   return VK_SUCCESS;
+   return shader;
 }
 
-VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipelineCache(
-    VkDevice                                    _device,
-    VkPipelineCache                             _cache,
-    const VkAllocationCallbacks*                pAllocator)
+static bool
+lvp_shader_cache_serialize(struct vk_pipeline_cache_object *object,
+                           struct blob *blob)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
-   LVP_FROM_HANDLE(lvp_pipeline_cache, cache, _cache);
+   struct lvp_shader_cache_object *shader =
+      container_of(object, struct lvp_shader_cache_object, base);
 
-   if (!_cache)
-      return;
-//   lvp_pipeline_cache_finish(cache);
-   vk_object_base_finish(&cache->base);
-   vk_free2(&device->vk.alloc, pAllocator, cache);
+   blob_write_bytes(blob, &shader->access, sizeof(shader->access));
+   blob_write_uint32(blob, shader->nir_size);
+   blob_write_bytes(blob, shader->nir_data, shader->nir_size);
+
+   return !blob->out_of_memory;
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL lvp_GetPipelineCacheData(
-        VkDevice                                    _device,
-        VkPipelineCache                             _cache,
-        size_t*                                     pDataSize,
-        void*                                       pData)
+static struct vk_pipeline_cache_object *
+lvp_shader_cache_deserialize(struct vk_device *device,
+                             const void *key_data, size_t key_size,
+                             struct blob_reader *blob)
 {
-   VkResult result = VK_SUCCESS;
-   if (pData) {
-      if (*pDataSize < 32) {
-         *pDataSize = 0;
-         result = VK_INCOMPLETE;
-      } else {
-         uint32_t *hdr = (uint32_t *)pData;
-         hdr[0] = 32;
-         hdr[1] = 1;
-         hdr[2] = VK_VENDOR_ID_MESA;
-         hdr[3] = 0;
-         lvp_device_get_cache_uuid(&hdr[4]);
-      }
-   } else
-      *pDataSize = 32;
-   return result;
+   struct lvp_access_info access;
+   blob_copy_bytes(blob, &access, sizeof(access));
+   uint32_t nir_size = blob_read_uint32(blob);
+   const void *nir_data = blob_read_bytes(blob, nir_size);
+   if (blob->overrun)
+      return NULL;
+
+   struct lvp_shader_cache_object *shader =
+      lvp_shader_cache_object_create(device, key_data, key_size);
+   if (!shader)
+      return NULL;
+
+   shader->nir_data = malloc(nir_size);
+   if (!shader->nir_data) {
+      lvp_shader_cache_destroy(&shader->base);
+      return NULL;
+   }
+   memcpy(shader->nir_data, nir_data, nir_size);
+   shader->nir_size = nir_size;
+   shader->access = access;
+
+   return &shader->base;
 }
 
-VKAPI_ATTR VkResult VKAPI_CALL lvp_MergePipelineCaches(
-        VkDevice                                    _device,
-        VkPipelineCache                             destCache,
-        uint32_t                                    srcCacheCount,
-        const VkPipelineCache*                      pSrcCaches)
+nir_shader *
+lvp_pipeline_cache_lookup_shader(struct vk_pipeline_cache *cache,
+                                 const unsigned char sha1[20],
+                                 const nir_shader_compiler_options *options,
+                                 struct lvp_access_info *access)
 {
-   return VK_SUCCESS;
+   if (!cache)
+      return NULL;
+
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_lookup_object(cache, sha1, 20,
+                                      &lvp_shader_cache_ops, NULL);
+   if (!object)
+      return NULL;
+
+   struct lvp_shader_cache_object *shader =
+      container_of(object, struct lvp_shader_cache_object, base);
+
+   struct blob_reader blob;
+   blob_reader_init(&blob, shader->nir_data, shader->nir_size);
+   nir_shader *nir = nir_deserialize(NULL, options, &blob);
+   if (blob.overrun) {
+      ralloc_free(nir);
+      nir = NULL;
+   } else {
+      *access = shader->access;
+   }
+
+   vk_pipeline_cache_object_unref(object);
+   return nir;
+}
+
+void
+lvp_pipeline_cache_add_shader(struct vk_pipeline_cache *cache,
+                              const unsigned char sha1[20],
+                              const nir_shader *nir,
+                              const struct lvp_access_info *access)
+{
+   if (!cache)
+      return;
+
+   struct lvp_shader_cache_object *shader =
+      lvp_shader_cache_object_create(cache->base.device, sha1, 20);
+   if (!shader)
+      return;
+
+   struct blob blob;
+   blob_init(&blob);
+   nir_serialize(&blob, nir, false);
+   if (blob.out_of_memory) {
+      blob_finish(&blob);
+      lvp_shader_cache_destroy(&shader->base);
+      return;
+   }
+   blob_finish_get_buffer(&blob, &shader->nir_data, &shader->nir_size);
+   shader->access = *access;
+
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_add_object(cache, &shader->base);
+   vk_pipeline_cache_object_unref(object);
 }
@@ -61,6 +61,7 @@ typedef uint32_t xcb_window_t;
 #include "vk_image.h"
 #include "vk_log.h"
 #include "vk_physical_device.h"
+#include "vk_pipeline_cache.h"
 #include "vk_shader_module.h"
 #include "vk_util.h"
 #include "vk_format.h"
@@ -79,6 +80,7 @@ extern "C" {
 #endif
 
 #define MAX_SETS         8
+#define LVP_MAX_QUEUES   8
 #define MAX_PUSH_CONSTANTS_SIZE 128
 #define MAX_PUSH_DESCRIPTORS 32
 #define MAX_DESCRIPTOR_UNIFORM_BLOCK_SIZE 4096
@@ -140,6 +142,7 @@ struct lvp_physical_device {
    struct pipe_loader_device *pld;
    struct pipe_screen *pscreen;
    uint32_t max_images;
+   uint32_t num_queues;
 
    struct vk_sync_timeline_type sync_timeline_type;
    const struct vk_sync_type *sync_types[3];
@@ -180,16 +183,11 @@ struct lvp_queue {
    simple_mtx_t pipeline_lock;
 };
 
-struct lvp_pipeline_cache {
-   struct vk_object_base                        base;
-   struct lvp_device *                          device;
-   VkAllocationCallbacks                        alloc;
-};
-
 struct lvp_device {
    struct vk_device vk;
 
-   struct lvp_queue queue;
+   struct lvp_queue queues[LVP_MAX_QUEUES];
+   uint32_t num_queues;
    struct lvp_instance *                       instance;
    struct lvp_physical_device *physical_device;
    struct pipe_screen *pscreen;
@@ -476,7 +474,10 @@ struct lvp_pipeline {
    bool is_compute_pipeline;
    bool force_min_sample;
    nir_shader *pipeline_nir[MESA_SHADER_STAGES];
-   void *shader_cso[PIPE_SHADER_TYPES];
+   /* Shader CSOs are per pipe context, so there is a set for each queue. */
+   void *shader_cso[LVP_MAX_QUEUES][PIPE_SHADER_TYPES];
+   /* Queues that still have to delete their shader CSOs once destroyed. */
+   uint32_t destroy_queue_refs;
    VkGraphicsPipelineCreateInfo graphics_create_info;
    VkComputePipelineCreateInfo compute_create_info;
    VkGraphicsPipelineLibraryFlagsEXT stages;
@@ -525,6 +526,10 @@ struct lvp_query_pool {
    uint32_t count;
    VkQueryPipelineStatisticFlags pipeline_stats;
    enum pipe_query_type base_type;
+   /* Context of the queue that created each query, queries[] is followed by
+    * count of these in the same allocation.
+    */
+   struct pipe_context **query_ctx;
    struct pipe_query *queries[0];
 };
 
@@ -587,8 +592,6 @@ VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_event, base, VkEvent, VK_OBJECT_TYPE_EVENT)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_image, vk.base, VkImage, VK_OBJECT_TYPE_IMAGE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_image_view, vk.base, VkImageView,
                                VK_OBJECT_TYPE_IMAGE_VIEW);
-VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_pipeline_cache, base, VkPipelineCache,
-                               VK_OBJECT_TYPE_PIPELINE_CACHE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_pipeline, base, VkPipeline,
                                VK_OBJECT_TYPE_PIPELINE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(lvp_pipeline_layout, base, VkPipelineLayout,
@@ -658,6 +661,21 @@ lvp_vk_format_to_pipe_format(VkFormat format)
 
 void
 lvp_pipeline_destroy(struct lvp_device *device, struct lvp_pipeline *pipeline);
+void
+lvp_pipeline_destroy_shaders(struct lvp_queue *queue, struct lvp_pipeline *pipeline);
+
+extern const struct vk_pipeline_cache_object_ops *const lvp_pipeline_cache_import_ops[];
+
+nir_shader *
+lvp_pipeline_cache_lookup_shader(struct vk_pipeline_cache *cache,
+                                 const unsigned char sha1[20],
+                                 const nir_shader_compiler_options *options,
+                                 struct lvp_access_info *access);
+void
+lvp_pipeline_cache_add_shader(struct vk_pipeline_cache *cache,
+                              const unsigned char sha1[20],
+                              const nir_shader *nir,
+                              const struct lvp_access_info *access);
 
 void
 queue_thread_noop(void *data, void *gdata, int thread_index);
@@ -28,6 +28,7 @@
 #include "compiler/nir/nir.h"
 #include "main/errors.h"
 #include "util/debug.h"
+#include "util/u_queue.h"
 
 #define COMMON_OPTIONS                                                        \
    .lower_fdiv = true,                                                        \
@@ -100,6 +101,30 @@ static const struct nir_shader_compiler_options vector_nir_options = {
    .max_unroll_iterations = 32,
 };
 
+static void
+simd_queue_destroy(void *queue)
+{
+   util_queue_destroy(queue);
+}
+
+static struct util_queue *
+simd_queue_create(struct brw_compiler *compiler)
+{
+   const unsigned num_threads = env_var_as_unsigned("INTEL_SIMD_THREADS", 0);
+   if (num_threads == 0)
+      return NULL;
+
+   struct util_queue *queue = rzalloc(compiler, struct util_queue);
+   if (!util_queue_init(queue, "brw_simd", 8, num_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL)) {
+      ralloc_free(queue);
+      return NULL;
+   }
+
+   ralloc_set_destructor(queue, simd_queue_destroy);
+   return queue;
+}
+
 struct brw_compiler *
 brw_compiler_create(void *mem_ctx, const struct intel_device_info *devinfo)
 {
@@ -112,6 +137,8 @@ brw_compiler_create(void *mem_ctx, const struct intel_device_info *devinfo)
 
    compiler->precise_trig = env_var_as_boolean("INTEL_PRECISE_TRIG", false);
 
+   compiler->simd_queue = simd_queue_create(compiler);
+
    compiler->use_tcs_8_patch =
       devinfo->ver >= 12 ||
       (devinfo->ver >= 9 && INTEL_DEBUG(DEBUG_TCS_EIGHT_PATCH));
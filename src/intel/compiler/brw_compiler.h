@@ -37,6 +37,7 @@ extern "C" {
 
 struct ra_regs;
 struct nir_shader;
+struct util_queue;
 struct brw_program;
 struct shader_info;
 
@@ -117,6 +118,13 @@ struct brw_compiler {
    bool indirect_ubos_use_sampler;
 
    struct nir_shader *clc_shader;
+
+   /**
+    * Queue on which the SIMD16 and SIMD32 variants of fragment and compute
+    * shaders are compiled concurrently, or NULL to compile them one after
+    * the other.  Set up from INTEL_SIMD_THREADS.
+    */
+   struct util_queue *simd_queue;
 };
 
 #define brw_shader_debug_log(compiler, data, fmt, ... ) do {    \
@@ -42,9 +42,22 @@
 #include "compiler/nir/nir_builder.h"
 #include "program/prog_parameter.h"
 #include "util/u_math.h"
+#include "util/u_queue.h"
 
 using namespace brw;
 
+/* The driver's shader_perf_log callback is only called on the thread the
+ * shader is compiled for, see brw_simd_job.
+ */
+#define fs_perf_log(v, fmt, ...) do {                                      \
+   if ((v)->deferred_perf_log) {                                           \
+      ralloc_asprintf_append(&(v)->deferred_perf_log, fmt, ##__VA_ARGS__); \
+   } else {                                                                \
+      brw_shader_perf_log((v)->compiler, (v)->log_data, fmt,               \
+                          ##__VA_ARGS__);                                  \
+   }                                                                       \
+} while (0)
+
 static unsigned get_lowered_simd_width(const struct intel_device_info *devinfo,
                                        const fs_inst *inst);
 
@@ -637,9 +650,8 @@ fs_visitor::limit_dispatch_width(unsigned n, const char *msg)
       fail("%s", msg);
    } else {
       max_dispatch_width = MIN2(max_dispatch_width, n);
-      brw_shader_perf_log(compiler, log_data,
-                          "Shader dispatch width limited to SIMD%d: %s\n",
-                          n, msg);
+      fs_perf_log(this, "Shader dispatch width limited to SIMD%d: %s\n",
+                  n, msg);
    }
 }
 
@@ -9011,11 +9023,10 @@ fs_visitor::allocate_registers(bool allow_spilling)
       fail("Failure to register allocate.  Reduce number of "
            "live scalar values to avoid this.");
    } else if (spilled_any_registers) {
-      brw_shader_perf_log(compiler, log_data,
-                          "%s shader triggered register spilling.  "
-                          "Try reducing the number of live scalar "
-                          "values to improve performance.\n",
-                          stage_name);
+      fs_perf_log(this, "%s shader triggered register spilling.  "
+                  "Try reducing the number of live scalar "
+                  "values to improve performance.\n",
+                  stage_name);
    }
 
    /* This must come after all optimization and register allocation, since
@@ -9881,6 +9892,93 @@ brw_register_blocks(int reg_count)
    return ALIGN(reg_count, 16) / 16 - 1;
 }
 
+/**
+ * A SIMD variant compiled on brw_compiler::simd_queue.
+ *
+ * The visitor gets its own ralloc context and copy of the prog_data, so that
+ * it doesn't race with the variant compiled on the calling thread.  Apart
+ * from total_scratch, what a visitor writes to the prog_data is the same for
+ * all dispatch widths, so only that needs merging back.
+ */
+struct brw_simd_job {
+   struct util_queue_fence fence;
+   void *mem_ctx;
+   union brw_any_prog_data prog_data;
+   fs_visitor *v;
+   bool allow_spilling;
+   bool success;
+
+   /* For compute shaders, the job also lowers the NIR for its dispatch width
+    * and creates the visitor.
+    */
+   const struct brw_compiler *compiler;
+   void *log_data;
+   const struct brw_cs_prog_key *key;
+   const nir_shader *nir;
+   unsigned dispatch_width;
+   fs_visitor *uniforms_from;
+};
+
+static brw_simd_job *
+brw_simd_job_create(void *mem_ctx, const struct brw_stage_prog_data *prog_data,
+                    size_t prog_data_size)
+{
+   brw_simd_job *job = rzalloc(mem_ctx, brw_simd_job);
+
+   job->mem_ctx = ralloc_context(NULL);
+   memcpy(&job->prog_data, prog_data, prog_data_size);
+   util_queue_fence_init(&job->fence);
+
+   return job;
+}
+
+static void
+brw_simd_job_start(const struct brw_compiler *compiler, brw_simd_job *job,
+                   util_queue_execute_func execute)
+{
+   util_queue_add_job(compiler->simd_queue, job, &job->fence, execute,
+                      NULL, 0);
+}
+
+/**
+ * Waits for the job and hands its allocations over to \p mem_ctx.
+ */
+static void
+brw_simd_job_wait(void *mem_ctx, brw_simd_job *job)
+{
+   util_queue_fence_wait(&job->fence);
+   util_queue_fence_destroy(&job->fence);
+   ralloc_steal(mem_ctx, job->mem_ctx);
+}
+
+/**
+ * Merges the results of a job whose variant is used, as if it had been
+ * compiled on the calling thread.
+ */
+static void
+brw_simd_job_merge(const struct brw_compiler *compiler, void *log_data,
+                   const brw_simd_job *job,
+                   struct brw_stage_prog_data *prog_data)
+{
+   prog_data->total_scratch = MAX2(prog_data->total_scratch,
+                                   job->prog_data.base.total_scratch);
+
+   if (job->v->deferred_perf_log[0] != '\0') {
+      brw_shader_perf_log(compiler, log_data, "%s",
+                          job->v->deferred_perf_log);
+   }
+   job->v->deferred_perf_log = NULL;
+}
+
+static void
+run_fs_job(void *data, void *gdata, int thread_index)
+{
+   brw_simd_job *job = (brw_simd_job *) data;
+   job->v->deferred_perf_log = ralloc_strdup(job->mem_ctx, "");
+   job->success = job->v->run_fs(job->allow_spilling,
+                                 false /* do_rep_send */);
+}
+
 const unsigned *
 brw_compile_fs(const struct brw_compiler *compiler,
                void *mem_ctx,
@@ -9973,9 +10071,37 @@ brw_compile_fs(const struct brw_compiler *compiler,
    if (nir->info.ray_queries > 0)
       v8->limit_dispatch_width(16, "SIMD32 with ray queries.\n");
 
-   if (!has_spilled &&
-       v8->max_dispatch_width >= 16 &&
-       (!INTEL_DEBUG(DEBUG_NO16) || params->use_rep_send)) {
+   const bool try_simd16 =
+      !has_spilled && v8->max_dispatch_width >= 16 &&
+      (!INTEL_DEBUG(DEBUG_NO16) || params->use_rep_send);
+
+   /* Currently, the compiler only supports SIMD32 on SNB+ */
+   const bool may_try_simd32 =
+      v8->max_dispatch_width >= 32 && !params->use_rep_send &&
+      devinfo->ver >= 6 && !INTEL_DEBUG(DEBUG_NO32);
+
+   /* With a SIMD queue, compile SIMD32 at the same time as SIMD16.  SIMD32
+    * is only tried if SIMD16 neither failed nor spilled, so this is
+    * speculative: the result is thrown away below if SIMD16 says so, and the
+    * selected variants are the same as when compiling one after the other.
+    * A SIMD32 compile that happens at all comes after a successful SIMD16
+    * one, so it is never allowed to spill.
+    */
+   brw_simd_job *job32 = NULL;
+   if (compiler->simd_queue && !debug_enabled &&
+       try_simd16 && may_try_simd32) {
+      job32 = brw_simd_job_create(mem_ctx, &prog_data->base,
+                                  sizeof(*prog_data));
+      v32 = new fs_visitor(compiler, params->log_data, job32->mem_ctx,
+                           &key->base, &job32->prog_data.base, nir, 32,
+                           debug_enabled);
+      v32->import_uniforms(v8);
+      job32->v = v32;
+      job32->allow_spilling = false;
+      brw_simd_job_start(compiler, job32, run_fs_job);
+   }
+
+   if (try_simd16) {
       /* Try a SIMD16 compile */
       v16 = new fs_visitor(compiler, params->log_data, mem_ctx, &key->base,
                            &prog_data->base, nir, 16,
@@ -9998,17 +10124,24 @@ brw_compile_fs(const struct brw_compiler *compiler,
 
    const bool simd16_failed = v16 && !simd16_cfg;
 
-   /* Currently, the compiler only supports SIMD32 on SNB+ */
-   if (!has_spilled &&
-       v8->max_dispatch_width >= 32 && !params->use_rep_send &&
-       devinfo->ver >= 6 && !simd16_failed &&
-       !INTEL_DEBUG(DEBUG_NO32)) {
+   if (!has_spilled && may_try_simd32 && !simd16_failed) {
       /* Try a SIMD32 compile */
-      v32 = new fs_visitor(compiler, params->log_data, mem_ctx, &key->base,
-                           &prog_data->base, nir, 32,
-                           debug_enabled);
-      v32->import_uniforms(v8);
-      if (!v32->run_fs(allow_spilling, false)) {
+      bool simd32_compiled;
+      if (job32) {
+         brw_simd_job_wait(mem_ctx, job32);
+         brw_simd_job_merge(compiler, params->log_data, job32,
+                            &prog_data->base);
+         simd32_compiled = job32->success;
+         job32 = NULL;
+      } else {
+         v32 = new fs_visitor(compiler, params->log_data, mem_ctx, &key->base,
+                              &prog_data->base, nir, 32,
+                              debug_enabled);
+         v32->import_uniforms(v8);
+         simd32_compiled = v32->run_fs(allow_spilling, false);
+      }
+
+      if (!simd32_compiled) {
          brw_shader_perf_log(compiler, params->log_data,
                              "SIMD32 shader failed to compile: %s\n",
                              v32->fail_msg);
@@ -10027,6 +10160,10 @@ brw_compile_fs(const struct brw_compiler *compiler,
       }
    }
 
+   /* The speculative SIMD32 compile wasn't needed after all. */
+   if (job32)
+      brw_simd_job_wait(mem_ctx, job32);
+
    /* When the caller requests a repclear shader, they want SIMD16-only */
    if (params->use_rep_send)
       simd8_cfg = NULL;
@@ -10254,6 +10391,44 @@ brw_nir_lower_simd(nir_shader *nir, unsigned dispatch_width)
                                  (void *)(uintptr_t)dispatch_width);
 }
 
+static fs_visitor *
+brw_cs_create_visitor(const struct brw_compiler *compiler, void *log_data,
+                      void *mem_ctx, const struct brw_cs_prog_key *key,
+                      struct brw_cs_prog_data *prog_data,
+                      const nir_shader *nir, unsigned dispatch_width,
+                      bool debug_enabled)
+{
+   nir_shader *shader = nir_shader_clone(mem_ctx, nir);
+   brw_nir_apply_key(shader, compiler, &key->base,
+                     dispatch_width, true /* is_scalar */);
+
+   NIR_PASS_V(shader, brw_nir_lower_simd, dispatch_width);
+
+   /* Clean up after the local index and ID calculations. */
+   NIR_PASS_V(shader, nir_opt_constant_folding);
+   NIR_PASS_V(shader, nir_opt_dce);
+
+   brw_postprocess_nir(shader, compiler, true, debug_enabled,
+                       key->base.robust_buffer_access);
+
+   return new fs_visitor(compiler, log_data, mem_ctx, &key->base,
+                         &prog_data->base, shader, dispatch_width,
+                         debug_enabled);
+}
+
+static void
+compile_cs_job(void *data, void *gdata, int thread_index)
+{
+   brw_simd_job *job = (brw_simd_job *) data;
+
+   job->v = brw_cs_create_visitor(job->compiler, job->log_data, job->mem_ctx,
+                                  job->key, &job->prog_data.cs, job->nir,
+                                  job->dispatch_width, false);
+   job->v->deferred_perf_log = ralloc_strdup(job->mem_ctx, "");
+   job->v->import_uniforms(job->uniforms_from);
+   job->success = job->v->run_cs(job->allow_spilling);
+}
+
 const unsigned *
 brw_compile_cs(const struct brw_compiler *compiler,
                void *mem_ctx,
@@ -10282,6 +10457,8 @@ brw_compile_cs(const struct brw_compiler *compiler,
 
    fs_visitor *v[3]     = {0};
    const char *error[3] = {0};
+   brw_simd_job *jobs[3] = {0};
+   bool jobs_started = false;
 
    for (unsigned simd = 0; simd < 3; simd++) {
       if (!brw_simd_should_compile(mem_ctx, simd, compiler->devinfo, prog_data,
@@ -10289,33 +10466,74 @@ brw_compile_cs(const struct brw_compiler *compiler,
          continue;
 
       const unsigned dispatch_width = 8u << simd;
+      const bool allow_spilling = !prog_data->prog_mask ||
+                                  nir->info.workgroup_size_variable;
 
-      nir_shader *shader = nir_shader_clone(mem_ctx, nir);
-      brw_nir_apply_key(shader, compiler, &key->base,
-                        dispatch_width, true /* is_scalar */);
-
-      NIR_PASS_V(shader, brw_nir_lower_simd, dispatch_width);
+      /* Once a variant has compiled, the remaining ones only need its
+       * uniform layout, so with a SIMD queue they are all compiled at the
+       * same time.  Compiling one only makes the following ones less likely
+       * to be wanted, so every variant still wanted in the loop below has
+       * been started here, and the ones which aren't are thrown away.
+       *
+       * With a fixed workgroup size, brw_simd_should_compile() never wants
+       * SIMD32 once a variant compiled, leaving nothing to overlap, so this
+       * is only done for variable size workgroups.
+       */
+      if (nir->info.workgroup_size_variable && prog_data->prog_mask &&
+          compiler->simd_queue && !debug_enabled && !jobs_started) {
+         const unsigned first = ffs(prog_data->prog_mask) - 1;
+         unsigned wanted = 1u << simd;
+
+         for (unsigned s = simd + 1; s < 3; s++) {
+            const char *unused_error;
+            if (brw_simd_should_compile(mem_ctx, s, compiler->devinfo,
+                                        prog_data, required_dispatch_width,
+                                        &unused_error))
+               wanted |= 1u << s;
+         }
 
-      /* Clean up after the local index and ID calculations. */
-      NIR_PASS_V(shader, nir_opt_constant_folding);
-      NIR_PASS_V(shader, nir_opt_dce);
+         jobs_started = true;
+         if (util_bitcount(wanted) < 2)
+            wanted = 0;
+
+         u_foreach_bit(s, wanted) {
+            brw_simd_job *job =
+               brw_simd_job_create(mem_ctx, &prog_data->base,
+                                   sizeof(*prog_data));
+            job->compiler = compiler;
+            job->log_data = params->log_data;
+            job->key = key;
+            job->nir = nir;
+            job->dispatch_width = 8u << s;
+            job->uniforms_from = v[first];
+            job->allow_spilling = allow_spilling;
+            brw_simd_job_start(compiler, job, compile_cs_job);
+            jobs[s] = job;
+         }
+      }
 
-      brw_postprocess_nir(shader, compiler, true, debug_enabled,
-                          key->base.robust_buffer_access);
+      bool compiled;
+      if (jobs[simd]) {
+         brw_simd_job_wait(mem_ctx, jobs[simd]);
+         brw_simd_job_merge(compiler, params->log_data, jobs[simd],
+                            &prog_data->base);
+         v[simd] = jobs[simd]->v;
+         compiled = jobs[simd]->success;
+         jobs[simd] = NULL;
+      } else {
+         v[simd] = brw_cs_create_visitor(compiler, params->log_data, mem_ctx,
+                                         key, prog_data, nir, dispatch_width,
+                                         debug_enabled);
 
-      v[simd] = new fs_visitor(compiler, params->log_data, mem_ctx, &key->base,
-                               &prog_data->base, shader, dispatch_width,
-                               debug_enabled);
+         if (prog_data->prog_mask) {
+            unsigned first = ffs(prog_data->prog_mask) - 1;
+            v[simd]->import_uniforms(v[first]);
+         }
 
-      if (prog_data->prog_mask) {
-         unsigned first = ffs(prog_data->prog_mask) - 1;
-         v[simd]->import_uniforms(v[first]);
+         compiled = v[simd]->run_cs(allow_spilling);
       }
 
-      const bool allow_spilling = !prog_data->prog_mask ||
-                                  nir->info.workgroup_size_variable;
-
-      if (v[simd]->run_cs(allow_spilling)) {
+      if (compiled) {
          /* We should always be able to do SIMD32 for compute shaders. */
          assert(v[simd]->max_dispatch_width >= 32);
 
@@ -10332,6 +10550,14 @@ brw_compile_cs(const struct brw_compiler *compiler,
       }
    }
 
+   /* Variants started on the SIMD queue which turned out not to be wanted. */
+   for (unsigned simd = 0; simd < 3; simd++) {
+      if (jobs[simd]) {
+         brw_simd_job_wait(mem_ctx, jobs[simd]);
+         delete jobs[simd]->v;
+      }
+   }
+
    const int selected_simd = brw_simd_select(prog_data);
    if (selected_simd < 0) {
       params->error_str = ralloc_asprintf(mem_ctx, "Can't compile shader: %s, %s and %s.\n",
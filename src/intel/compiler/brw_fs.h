@@ -421,6 +421,12 @@ public:
    unsigned grf_used;
    bool spilled_any_registers;
 
+   /**
+    * Perf log messages of a variant compiled on brw_compiler::simd_queue,
+    * sent by the calling thread if the variant is used.  NULL otherwise.
+    */
+   char *deferred_perf_log;
+
    const unsigned dispatch_width; /**< 8, 16 or 32 */
    unsigned max_dispatch_width;
 
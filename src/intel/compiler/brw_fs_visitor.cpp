@@ -1177,6 +1177,7 @@ fs_visitor::init()
 
    this->grf_used = 0;
    this->spilled_any_registers = false;
+   this->deferred_perf_log = NULL;
 }
 
 fs_visitor::~fs_visitor()
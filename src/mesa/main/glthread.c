@@ -36,12 +36,20 @@
 #include "main/glthread.h"
 #include "main/glthread_marshal.h"
 #include "main/hash.h"
+#include "util/os_time.h"
 #include "util/u_atomic.h"
+#include "util/u_math.h"
 #include "util/u_thread.h"
 #include "util/u_cpu_detect.h"
 
 #include "state_tracker/st_context.h"
 
+/* Batches are sized so that executing one takes about this long: long enough
+ * to amortize the handoff between the threads, short enough that the worker
+ * thread gets to work early and syncs don't wait for much.
+ */
+#define GLTHREAD_BATCH_EXEC_TIME_NS (100 * 1000)
+
 static void
 glthread_unmarshal_batch(void *job, void *gdata, int thread_index)
 {
@@ -89,6 +97,86 @@ glthread_thread_initialization(void *job, void *gdata, int thread_index)
    _glapi_set_context(ctx);
 }
 
+/* Execute submitted batches until the ring is empty. */
+static void
+glthread_execute_ring(void *job, void *gdata, int thread_index)
+{
+   struct gl_context *ctx = (struct gl_context*)job;
+   struct glthread_state *glthread = &ctx->GLThread;
+
+   while (true) {
+      struct glthread_batch *batch = &glthread->batches[glthread->next_exec];
+
+      if (!p_atomic_read(&batch->submitted)) {
+         /* Go idle, unless a batch was submitted just before the app thread
+          * saw us running, in which case nobody queued us again.
+          */
+         p_atomic_xchg(&glthread->worker_running, false);
+         if (!p_atomic_read(&batch->submitted) ||
+             p_atomic_cmpxchg(&glthread->worker_running, false, true))
+            return;
+      }
+
+      /* Not a plain store either: the exchange is also the acquire barrier
+       * that orders the reads of the batch after the flag, p_atomic_read
+       * doesn't give one with every atomics implementation.
+       */
+      p_atomic_xchg(&batch->submitted, false);
+
+      unsigned size = batch->used * 8;
+      int64_t start = os_time_get_nano();
+
+      glthread_unmarshal_batch(batch, NULL, thread_index);
+
+      /* Measure how long commands take to execute, to size the next
+       * batches.
+       */
+      unsigned time_per_kb =
+         MIN2((os_time_get_nano() - start) * 1024 / MAX2(size, 1), UINT_MAX);
+      unsigned average = p_atomic_read(&glthread->exec_time_per_kb);
+      p_atomic_set(&glthread->exec_time_per_kb,
+                   average ? (average * 7 + time_per_kb) / 8 : time_per_kb);
+
+      util_queue_fence_signal(&batch->fence);
+      glthread->next_exec = (glthread->next_exec + 1) % MARSHAL_MAX_BATCHES;
+   }
+}
+
+/* Hand the batch being filled over to the worker thread. */
+static void
+glthread_submit_batch(struct gl_context *ctx)
+{
+   struct glthread_state *glthread = &ctx->GLThread;
+   struct glthread_batch *next = glthread->next_batch;
+
+   next->used = glthread->used;
+   util_queue_fence_reset(&next->fence);
+   /* Not a plain store: the worker thread must not see the flag clear after
+    * we see it running, see glthread_execute_ring.
+    */
+   p_atomic_xchg(&next->submitted, true);
+
+   /* Only go through the queue if the worker thread went idle. */
+   if (!p_atomic_read(&glthread->worker_running) &&
+       !p_atomic_cmpxchg(&glthread->worker_running, false, true)) {
+      util_queue_add_job(&glthread->queue, ctx, NULL,
+                         glthread_execute_ring, NULL, 0);
+   }
+
+   glthread->last = glthread->next;
+   glthread->next = (glthread->next + 1) % MARSHAL_MAX_BATCHES;
+   glthread->next_batch = &glthread->batches[glthread->next];
+   glthread->used = 0;
+
+   /* All slots are busy: wait until the worker thread is done with the one
+    * we are about to fill.
+    */
+   if (!util_queue_fence_is_signalled(&glthread->next_batch->fence)) {
+      p_atomic_inc(&glthread->stats.num_stalls);
+      util_queue_fence_wait(&glthread->next_batch->fence);
+   }
+}
+
 void
 _mesa_glthread_init(struct gl_context *ctx)
 {
@@ -96,10 +184,8 @@ _mesa_glthread_init(struct gl_context *ctx)
 
    assert(!glthread->enabled);
 
-   if (!util_queue_init(&glthread->queue, "gl", MARSHAL_MAX_BATCHES - 2,
-                        1, 0, NULL)) {
+   if (!util_queue_init(&glthread->queue, "gl", 2, 1, 0, NULL))
       return;
-   }
 
    glthread->VAOs = _mesa_NewHashTable();
    if (!glthread->VAOs) {
@@ -116,12 +202,28 @@ _mesa_glthread_init(struct gl_context *ctx)
       return;
    }
 
+   for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++) {
+      glthread->batches[i].buffer = malloc(MARSHAL_MAX_BATCH_SIZE);
+      if (!glthread->batches[i].buffer) {
+         for (unsigned j = 0; j < i; j++)
+            free(glthread->batches[j].buffer);
+         _mesa_DeleteHashTable(glthread->VAOs);
+         util_queue_destroy(&glthread->queue);
+         return;
+      }
+   }
+
    for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++) {
       glthread->batches[i].ctx = ctx;
       util_queue_fence_init(&glthread->batches[i].fence);
+      glthread->batches[i].submitted = false;
    }
    glthread->next_batch = &glthread->batches[glthread->next];
    glthread->used = 0;
+   glthread->next_exec = glthread->next;
+   glthread->worker_running = false;
+   glthread->flush_threshold = MARSHAL_MAX_CMD_SIZE / 8;
+   glthread->exec_time_per_kb = 0;
 
    glthread->enabled = true;
    glthread->stats.queue = &glthread->queue;
@@ -170,8 +272,10 @@ _mesa_glthread_destroy(struct gl_context *ctx, const char *reason)
    _mesa_glthread_finish(ctx);
    util_queue_destroy(&glthread->queue);
 
-   for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++)
+   for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++) {
       util_queue_fence_destroy(&glthread->batches[i].fence);
+      free(glthread->batches[i].buffer);
+   }
 
    _mesa_HashDeleteAll(glthread->VAOs, free_vao, NULL);
    _mesa_DeleteHashTable(glthread->VAOs);
@@ -236,14 +340,19 @@ _mesa_glthread_flush_batch(struct gl_context *ctx)
    }
 
    p_atomic_add(&glthread->stats.num_offloaded_items, glthread->used);
-   next->used = glthread->used;
+   p_atomic_inc(&glthread->stats.num_flushes);
 
-   util_queue_add_job(&glthread->queue, next, &next->fence,
-                      glthread_unmarshal_batch, NULL, 0);
-   glthread->last = glthread->next;
-   glthread->next = (glthread->next + 1) % MARSHAL_MAX_BATCHES;
-   glthread->next_batch = &glthread->batches[glthread->next];
-   glthread->used = 0;
+   glthread_submit_batch(ctx);
+
+   /* Size the next batch so that it takes about GLTHREAD_BATCH_EXEC_TIME_NS
+    * to execute, based on how long the last ones took.
+    */
+   unsigned time_per_kb = p_atomic_read(&glthread->exec_time_per_kb);
+   uint64_t size = time_per_kb ?
+      (uint64_t)GLTHREAD_BATCH_EXEC_TIME_NS * 1024 / time_per_kb :
+      MARSHAL_MAX_CMD_SIZE;
+   glthread->flush_threshold =
+      CLAMP(size, MARSHAL_MAX_CMD_SIZE, MARSHAL_MAX_BATCH_SIZE) / 8;
 }
 
 /**
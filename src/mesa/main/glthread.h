@@ -24,17 +24,27 @@
 #ifndef _GLTHREAD_H
 #define _GLTHREAD_H
 
-/* The size of one batch and the maximum size of one call.
+/* The maximum size of one call, and the smallest size a batch is flushed at.
  *
  * This should be as low as possible, so that:
  * - multiple synchronizations within a frame don't slow us down much
  * - a smaller number of calls per frame can still get decent parallelism
  * - the memory footprint of the queue is low, and with that comes a lower
  *   chance of experiencing CPU cache thrashing
- * but it should be high enough so that u_queue overhead remains negligible.
+ * but it should be high enough so that the handoff overhead remains
+ * negligible.
  */
 #define MARSHAL_MAX_CMD_SIZE (8 * 1024)
 
+/* The capacity of one batch.
+ *
+ * Batches are flushed at glthread_state::flush_threshold, which is between
+ * MARSHAL_MAX_CMD_SIZE and this, depending on how long the worker thread
+ * takes to execute them. Cheap calls are batched more to amortize the
+ * handoff, expensive ones less so that the worker thread starts early.
+ */
+#define MARSHAL_MAX_BATCH_SIZE (32 * 1024)
+
 /* The number of batch slots in memory.
  *
  * One batch is being executed, one batch is being filled, the rest are
@@ -91,12 +101,24 @@ struct glthread_vao {
    } Attrib[VERT_ATTRIB_MAX];
 };
 
-/** A single batch of commands queued up for execution. */
+/**
+ * A single batch of commands queued up for execution.
+ *
+ * Batches are handed to the worker thread through a ring with a single
+ * producer and a single consumer, without taking any lock while the worker
+ * thread is busy.
+ */
 struct glthread_batch
 {
    /** Batch fence for waiting for the execution to finish. */
    struct util_queue_fence fence;
 
+   /**
+    * Set by the app thread when the batch is submitted, cleared by the worker
+    * thread when it starts executing it.
+    */
+   bool submitted;
+
    /** The worker thread will access the context with this. */
    struct gl_context *ctx;
 
@@ -108,8 +130,8 @@ struct glthread_batch
     */
    unsigned used;
 
-   /** Data contained in the command buffer. */
-   uint64_t buffer[MARSHAL_MAX_CMD_SIZE / 8];
+   /** Data contained in the command buffer, MARSHAL_MAX_BATCH_SIZE bytes. */
+   uint64_t *buffer;
 };
 
 struct glthread_client_attrib {
@@ -176,6 +198,25 @@ struct glthread_state
    /** Number of uint64_t elements filled already. */
    unsigned used;
 
+   /** Number of uint64_t elements at which the batch is flushed. */
+   unsigned flush_threshold;
+
+   /**
+    * Moving average of the time the worker thread takes to execute 1KB of
+    * commands, in nanoseconds. Written by the worker thread.
+    */
+   unsigned exec_time_per_kb;
+
+   /**
+    * Whether the worker thread is executing the ring. When it finds the ring
+    * empty it clears this and returns to the queue, and the next submission
+    * queues it again.
+    */
+   bool worker_running;
+
+   /** Index of the next batch the worker thread executes. */
+   unsigned next_exec;
+
    /** Upload buffer. */
    struct gl_buffer_object *upload_buffer;
    uint8_t *upload_ptr;
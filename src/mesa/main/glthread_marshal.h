@@ -61,7 +61,7 @@ _mesa_glthread_allocate_command(struct gl_context *ctx,
 
    assert (num_elements <= MARSHAL_MAX_CMD_SIZE / 8);
 
-   if (unlikely(glthread->used + num_elements > MARSHAL_MAX_CMD_SIZE / 8))
+   if (unlikely(glthread->used + num_elements > glthread->flush_threshold))
       _mesa_glthread_flush_batch(ctx);
 
    struct glthread_batch *next = glthread->next_batch;
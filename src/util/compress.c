@@ -36,14 +36,52 @@
 
 #ifdef HAVE_ZSTD
 #include "zstd.h"
+#include "zdict.h"
 #endif
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "util/compress.h"
 #include "macros.h"
 
 /* 3 is the recomended level, with 22 as the absolute maximum */
 #define ZSTD_COMPRESSION_LEVEL 3
 
+/* zlib only looks back this far, a larger preset dictionary is wasted. */
+#define ZLIB_MAX_DICT_SIZE 32768
+
+struct util_compress_dict {
+   enum util_compress_policy policy;
+#ifdef HAVE_ZSTD
+   ZSTD_CDict *cdict;
+   ZSTD_DDict *ddict;
+#elif defined(HAVE_ZLIB)
+   uint8_t *data;
+   size_t size;
+   uLong adler;
+#endif
+};
+
+static int
+compression_level(enum util_compress_policy policy)
+{
+#ifdef HAVE_ZSTD
+   switch (policy) {
+   case UTIL_COMPRESS_FAST:
+      return 1;
+   case UTIL_COMPRESS_SMALL:
+      return 19;
+   default:
+      return ZSTD_COMPRESSION_LEVEL;
+   }
+#elif defined(HAVE_ZLIB)
+   return policy == UTIL_COMPRESS_FAST ? Z_BEST_SPEED : Z_BEST_COMPRESSION;
+#else
+   STATIC_ASSERT(false);
+#endif
+}
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size)
 {
@@ -61,22 +99,125 @@ util_compress_max_compressed_len(size_t in_data_size)
     *    compress2(), the only expansion is an overhead of five bytes per 16 KB
     *    block (about 0.03%), plus a one-time overhead of six bytes for the
     *    entire stream."
+    *
+    * A preset dictionary adds another four bytes for its checksum.
     */
    size_t num_blocks = (in_data_size + 16383) / 16384; /* round up blocks */
-   return in_data_size + 6 + (num_blocks * 5);
+   return in_data_size + 6 + 4 + (num_blocks * 5);
+#else
+   STATIC_ASSERT(false);
+#endif
+}
+
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_capacity,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples)
+{
+#ifdef HAVE_ZSTD
+   size_t ret = ZDICT_trainFromBuffer(dict_data, dict_capacity, samples,
+                                      sample_sizes, num_samples);
+   if (ZDICT_isError(ret))
+      return 0;
+
+   return ret;
+#elif defined(HAVE_ZLIB)
+   /* A zlib dictionary is just content to match against, and matches at the
+    * end of it are the cheapest to encode, so keep the most recent samples.
+    */
+   size_t total_size = 0;
+   for (unsigned i = 0; i < num_samples; i++)
+      total_size += sample_sizes[i];
+
+   size_t size = MIN3(total_size, dict_capacity, ZLIB_MAX_DICT_SIZE);
+   memcpy(dict_data, (const uint8_t *)samples + total_size - size, size);
+   return size;
 #else
    STATIC_ASSERT(false);
 #endif
 }
 
+struct util_compress_dict *
+util_compress_dict_create(const void *dict_data, size_t dict_size,
+                          enum util_compress_policy policy)
+{
+   struct util_compress_dict *dict = calloc(1, sizeof(*dict));
+   if (!dict)
+      return NULL;
+
+   dict->policy = policy;
+
+#ifdef HAVE_ZSTD
+   dict->cdict = ZSTD_createCDict(dict_data, dict_size,
+                                  compression_level(policy));
+   dict->ddict = ZSTD_createDDict(dict_data, dict_size);
+   if (!dict->cdict || !dict->ddict) {
+      util_compress_dict_destroy(dict);
+      return NULL;
+   }
+#elif defined(HAVE_ZLIB)
+   dict->size = MIN2(dict_size, ZLIB_MAX_DICT_SIZE);
+   dict->data = malloc(dict->size);
+   if (!dict->data) {
+      free(dict);
+      return NULL;
+   }
+   memcpy(dict->data, (const uint8_t *)dict_data + dict_size - dict->size,
+          dict->size);
+   dict->adler = adler32(adler32(0, Z_NULL, 0), dict->data, dict->size);
+#else
+   STATIC_ASSERT(false);
+#endif
+
+   return dict;
+}
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict)
+{
+   if (!dict)
+      return;
+
+#ifdef HAVE_ZSTD
+   ZSTD_freeCDict(dict->cdict);
+   ZSTD_freeDDict(dict->ddict);
+#elif defined(HAVE_ZLIB)
+   free(dict->data);
+#endif
+   free(dict);
+}
+
 /* Compress data and return the size of the compressed data */
 size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size)
+{
+   return util_compress_deflate_dict(in_data, in_data_size, out_data,
+                                     out_buff_size, UTIL_COMPRESS_DEFAULT,
+                                     NULL);
+}
+
+size_t
+util_compress_deflate_dict(const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size,
+                           enum util_compress_policy policy,
+                           const struct util_compress_dict *dict)
 {
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
-                              ZSTD_COMPRESSION_LEVEL);
+   size_t ret;
+
+   if (dict) {
+      ZSTD_CCtx *cctx = ZSTD_createCCtx();
+      if (!cctx)
+         return 0;
+
+      ret = ZSTD_compress_usingCDict(cctx, out_data, out_buff_size,
+                                     in_data, in_data_size, dict->cdict);
+      ZSTD_freeCCtx(cctx);
+   } else {
+      ret = ZSTD_compress(out_data, out_buff_size, in_data, in_data_size,
+                          compression_level(policy));
+   }
    if (ZSTD_isError(ret))
       return 0;
 
@@ -84,6 +225,9 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
 #elif defined(HAVE_ZLIB)
    size_t compressed_size = 0;
 
+   if (dict)
+      policy = dict->policy;
+
    /* allocate deflate state */
    z_stream strm;
    strm.zalloc = Z_NULL;
@@ -94,12 +238,18 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
    strm.avail_in = in_data_size;
    strm.avail_out = out_buff_size;
 
-   int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
+   int ret = deflateInit(&strm, compression_level(policy));
    if (ret != Z_OK) {
        (void) deflateEnd(&strm);
        return 0;
    }
 
+   if (dict &&
+       deflateSetDictionary(&strm, dict->data, dict->size) != Z_OK) {
+       (void) deflateEnd(&strm);
+       return 0;
+   }
+
    /* compress until end of in_data */
    ret = deflate(&strm, Z_FINISH);
 
@@ -123,9 +273,36 @@ util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
 bool
 util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_data_size)
+{
+   return util_compress_inflate_dict(in_data, in_data_size, out_data,
+                                     out_data_size, NULL);
+}
+
+bool
+util_compress_inflate_dict(const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size,
+                           const struct util_compress_dict *dict)
 {
 #ifdef HAVE_ZSTD
-   size_t ret = ZSTD_decompress(out_data, out_data_size, in_data, in_data_size);
+   /* Frames record the id of the dictionary they were compressed with. */
+   unsigned dict_id = ZSTD_getDictID_fromFrame(in_data, in_data_size);
+   if (dict_id == 0) {
+      size_t ret = ZSTD_decompress(out_data, out_data_size,
+                                   in_data, in_data_size);
+      return !ZSTD_isError(ret);
+   }
+
+   if (!dict || ZSTD_getDictID_fromDDict(dict->ddict) != dict_id)
+      return false;
+
+   ZSTD_DCtx *dctx = ZSTD_createDCtx();
+   if (!dctx)
+      return false;
+
+   size_t ret = ZSTD_decompress_usingDDict(dctx, out_data, out_data_size,
+                                           in_data, in_data_size,
+                                           dict->ddict);
+   ZSTD_freeDCtx(dctx);
    return !ZSTD_isError(ret);
 #elif defined(HAVE_ZLIB)
    z_stream strm;
@@ -144,6 +321,18 @@ util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
       return false;
 
    ret = inflate(&strm, Z_NO_FLUSH);
+
+   /* The stream header carries the checksum of the preset dictionary it
+    * needs, if any.
+    */
+   if (ret == Z_NEED_DICT) {
+      if (!dict || strm.adler != dict->adler ||
+          inflateSetDictionary(&strm, dict->data, dict->size) != Z_OK) {
+         (void)inflateEnd(&strm);
+         return false;
+      }
+      ret = inflate(&strm, Z_NO_FLUSH);
+   }
    assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
 
    /* Unless there was an error we should have decompressed everything in one
@@ -24,11 +24,41 @@
 #ifdef HAVE_COMPRESSION
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <inttypes.h>
 
+/* Trade-off between compression speed and compressed size. */
+enum util_compress_policy {
+   UTIL_COMPRESS_DEFAULT,
+   UTIL_COMPRESS_FAST,
+   UTIL_COMPRESS_SMALL,
+};
+
+/* A dictionary shared by many small inputs that look alike, prepared for
+ * both compression and decompression.
+ */
+struct util_compress_dict;
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size);
 
+/**
+ * Build a dictionary of at most dict_capacity bytes from num_samples
+ * samples laid out back to back in samples. Returns the size of the
+ * dictionary written to dict_data, or 0 if there isn't enough to train on.
+ */
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_capacity,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples);
+
+struct util_compress_dict *
+util_compress_dict_create(const void *dict_data, size_t dict_size,
+                          enum util_compress_policy policy);
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict);
+
 bool
 util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_data_size);
@@ -37,4 +67,24 @@ size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size);
 
+/**
+ * Like util_compress_deflate(), with a speed/size policy and an optional
+ * dictionary. If dict is not NULL, the policy it was created with is used.
+ */
+size_t
+util_compress_deflate_dict(const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size,
+                           enum util_compress_policy policy,
+                           const struct util_compress_dict *dict);
+
+/**
+ * Like util_compress_inflate(), but also accepts data compressed with dict.
+ * Data compressed with a dictionary fails to decompress if dict is NULL or
+ * a different dictionary.
+ */
+bool
+util_compress_inflate_dict(const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size,
+                           const struct util_compress_dict *dict);
+
 #endif
@@ -39,6 +39,7 @@
 
 #include "util/crc32.h"
 #include "util/debug.h"
+#include "util/hash_table.h"
 #include "util/rand_xor.h"
 #include "util/u_atomic.h"
 #include "util/mesa-sha1.h"
@@ -68,6 +69,281 @@ do {                                       \
    _dst += _src_size;                      \
 } while (0);
 
+/* Parse a size given as a number optionally followed by K, M or G, with
+ * gigabytes assumed when there is no suffix. Returns 0 on error.
+ */
+static uint64_t
+parse_size_str(const char *str)
+{
+   char *end;
+   uint64_t size = strtoul(str, &end, 10);
+
+   if (end == str)
+      return 0;
+
+   switch (*end) {
+   case 'K':
+   case 'k':
+      return size * 1024;
+   case 'M':
+   case 'm':
+      return size * 1024*1024;
+   case '\0':
+   case 'G':
+   case 'g':
+   default:
+      return size * 1024*1024*1024;
+   }
+}
+
+/* An uncompressed item held by the in-memory tier. */
+struct disk_cache_ram_item {
+   struct list_head link;
+   cache_key key;
+   size_t size;
+   uint8_t data[];
+};
+
+static uint32_t
+ram_cache_key_hash(const void *key)
+{
+   /* The key is already a SHA-1, any part of it is a good hash. */
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+ram_cache_key_equals(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+static void
+ram_cache_evict_locked(struct disk_cache *cache,
+                       struct disk_cache_ram_item *item)
+{
+   _mesa_hash_table_remove_key(cache->ram_cache, item->key);
+   list_del(&item->link);
+   cache->ram_cache_size -= item->size;
+   free(item);
+}
+
+static void
+ram_cache_remove(struct disk_cache *cache, const cache_key key)
+{
+   if (!cache->ram_cache)
+      return;
+
+   simple_mtx_lock(&cache->ram_cache_mtx);
+   struct hash_entry *entry = _mesa_hash_table_search(cache->ram_cache, key);
+   if (entry)
+      ram_cache_evict_locked(cache, entry->data);
+   simple_mtx_unlock(&cache->ram_cache_mtx);
+}
+
+static void
+ram_cache_put(struct disk_cache *cache, const cache_key key,
+              const void *data, size_t size)
+{
+   if (!cache->ram_cache)
+      return;
+
+   /* Whatever happens, gets mustn't keep returning an older value. */
+   struct disk_cache_ram_item *item = NULL;
+   if (size <= cache->ram_cache_max_size)
+      item = malloc(sizeof(*item) + size);
+   if (!item) {
+      ram_cache_remove(cache, key);
+      return;
+   }
+
+   memcpy(item->key, key, CACHE_KEY_SIZE);
+   memcpy(item->data, data, size);
+   item->size = size;
+
+   simple_mtx_lock(&cache->ram_cache_mtx);
+
+   struct hash_entry *entry = _mesa_hash_table_search(cache->ram_cache, key);
+   if (entry)
+      ram_cache_evict_locked(cache, entry->data);
+
+   while (cache->ram_cache_size + size > cache->ram_cache_max_size) {
+      struct disk_cache_ram_item *lru =
+         list_last_entry(&cache->ram_cache_lru, struct disk_cache_ram_item, link);
+      ram_cache_evict_locked(cache, lru);
+      cache->stats.ram_evictions++;
+   }
+
+   _mesa_hash_table_insert(cache->ram_cache, item->key, item);
+   list_add(&item->link, &cache->ram_cache_lru);
+   cache->ram_cache_size += size;
+
+   simple_mtx_unlock(&cache->ram_cache_mtx);
+}
+
+static void *
+ram_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   void *data = NULL;
+
+   if (!cache->ram_cache)
+      return NULL;
+
+   simple_mtx_lock(&cache->ram_cache_mtx);
+
+   struct hash_entry *entry = _mesa_hash_table_search(cache->ram_cache, key);
+   if (entry) {
+      struct disk_cache_ram_item *item = entry->data;
+
+      list_del(&item->link);
+      list_add(&item->link, &cache->ram_cache_lru);
+
+      data = malloc(item->size);
+      if (data) {
+         memcpy(data, item->data, item->size);
+         *size = item->size;
+         cache->stats.ram_hits++;
+         cache->stats.ram_hit_bytes += item->size;
+      }
+   } else {
+      cache->stats.ram_misses++;
+   }
+
+   simple_mtx_unlock(&cache->ram_cache_mtx);
+
+   return data;
+}
+
+static bool
+ram_cache_contains(struct disk_cache *cache, const cache_key key)
+{
+   if (!cache->ram_cache)
+      return false;
+
+   simple_mtx_lock(&cache->ram_cache_mtx);
+   bool found = _mesa_hash_table_search(cache->ram_cache, key) != NULL;
+   simple_mtx_unlock(&cache->ram_cache_mtx);
+
+   return found;
+}
+
+static void
+ram_cache_destroy(struct disk_cache *cache)
+{
+   if (!cache->ram_cache)
+      return;
+
+   list_for_each_entry_safe(struct disk_cache_ram_item, item,
+                            &cache->ram_cache_lru, link)
+      free(item);
+
+   _mesa_hash_table_destroy(cache->ram_cache, NULL);
+   cache->ram_cache = NULL;
+   simple_mtx_destroy(&cache->ram_cache_mtx);
+}
+
+/* Prefetched items are dropped past this, oldest first. */
+#define PREFETCH_MAX_SIZE (64 * 1024 * 1024)
+
+/* An item requested by disk_cache_prefetch(), which is also the job loading
+ * it. It is in the prefetch table from the time it is queued, data and size
+ * are only valid once the fence is signalled. Misses move to prefetch_misses
+ * when their job completes, unless prefetch_take() already took them.
+ */
+struct disk_cache_prefetch_item {
+   struct util_queue_fence fence;
+   struct list_head link;
+   struct disk_cache *cache;
+   cache_key key;
+   void *data;
+   size_t size;
+   bool taken;
+};
+
+static void
+prefetch_evict_locked(struct disk_cache *cache,
+                      struct disk_cache_prefetch_item *item)
+{
+   _mesa_hash_table_remove_key(cache->prefetch, item->key);
+   list_del(&item->link);
+   cache->prefetch_size -= item->size;
+   util_queue_fence_destroy(&item->fence);
+   free(item->data);
+   free(item);
+}
+
+/* Free the misses whose jobs are done. */
+static void
+prefetch_reap_misses_locked(struct disk_cache *cache)
+{
+   list_for_each_entry_safe(struct disk_cache_prefetch_item, item,
+                            &cache->prefetch_misses, link) {
+      if (!util_queue_fence_is_signalled(&item->fence))
+         continue;
+
+      list_del(&item->link);
+      util_queue_fence_destroy(&item->fence);
+      free(item);
+   }
+}
+
+/* Remove the item for key from the prefetch table, waiting for it to finish
+ * loading if needed, and return its data.
+ */
+static void *
+prefetch_take(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   if (!cache->prefetch)
+      return NULL;
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+   struct hash_entry *entry = _mesa_hash_table_search(cache->prefetch, key);
+   if (!entry) {
+      simple_mtx_unlock(&cache->prefetch_mtx);
+      return NULL;
+   }
+
+   struct disk_cache_prefetch_item *item = entry->data;
+   _mesa_hash_table_remove(cache->prefetch, entry);
+   list_del(&item->link);
+   item->taken = true;
+   simple_mtx_unlock(&cache->prefetch_mtx);
+
+   /* Nobody else can find the item anymore, but it may still be loading. */
+   util_queue_fence_wait(&item->fence);
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+   cache->prefetch_size -= item->size;
+   if (item->data)
+      cache->stats.prefetch_hits++;
+   simple_mtx_unlock(&cache->prefetch_mtx);
+
+   void *data = item->data;
+   *size = item->size;
+   util_queue_fence_destroy(&item->fence);
+   free(item);
+
+   return data;
+}
+
+static void
+prefetch_destroy(struct disk_cache *cache)
+{
+   if (!cache->prefetch)
+      return;
+
+   /* The cache queue is idle, every item finished loading. */
+   list_for_each_entry_safe(struct disk_cache_prefetch_item, item,
+                            &cache->prefetch_list, link)
+      prefetch_evict_locked(cache, item);
+   prefetch_reap_misses_locked(cache);
+
+   _mesa_hash_table_destroy(cache->prefetch, NULL);
+   cache->prefetch = NULL;
+   simple_mtx_destroy(&cache->prefetch_mtx);
+}
+
 struct disk_cache *
 disk_cache_create(const char *gpu_name, const char *driver_id,
                   uint64_t driver_flags)
@@ -95,6 +371,10 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    /* Assume failure. */
    cache->path_init_failed = true;
 
+   simple_mtx_init(&cache->compress_dict_mtx, mtx_plain);
+   blob_init(&cache->compress_dict_samples);
+   util_dynarray_init(&cache->compress_dict_retired, NULL);
+
 #ifdef ANDROID
    /* Android needs the "disk cache" to be enabled for
     * EGL_ANDROID_blob_cache's callbacks to be called, but it doesn't actually
@@ -137,30 +417,8 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    }
    #endif
 
-   if (max_size_str) {
-      char *end;
-      max_size = strtoul(max_size_str, &end, 10);
-      if (end == max_size_str) {
-         max_size = 0;
-      } else {
-         switch (*end) {
-         case 'K':
-         case 'k':
-            max_size *= 1024;
-            break;
-         case 'M':
-         case 'm':
-            max_size *= 1024*1024;
-            break;
-         case '\0':
-         case 'G':
-         case 'g':
-         default:
-            max_size *= 1024*1024*1024;
-            break;
-         }
-      }
-   }
+   if (max_size_str)
+      max_size = parse_size_str(max_size_str);
 
    /* Default to 1GB for maximum cache size. */
    if (max_size == 0) {
@@ -168,6 +426,44 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    }
 
    cache->max_size = max_size;
+   cache->foz_db.max_size = max_size;
+
+   /* The in-memory tier is off by default, it duplicates what the page cache
+    * already holds for the compressed files.
+    */
+   const char *ram_size_str = getenv("MESA_SHADER_CACHE_RAM_SIZE");
+   if (ram_size_str)
+      cache->ram_cache_max_size = parse_size_str(ram_size_str);
+
+   const char *compression_str = getenv("MESA_SHADER_CACHE_COMPRESSION");
+   if (compression_str) {
+      if (!strcmp(compression_str, "fast")) {
+         cache->compress_policy = DISK_CACHE_COMPRESSION_FAST;
+         cache->compress_policy_forced = true;
+      } else if (!strcmp(compression_str, "small")) {
+         cache->compress_policy = DISK_CACHE_COMPRESSION_SMALL;
+         cache->compress_policy_forced = true;
+      } else if (!strcmp(compression_str, "default")) {
+         cache->compress_policy_forced = true;
+      }
+   }
+
+   if (cache->ram_cache_max_size) {
+      cache->ram_cache = _mesa_hash_table_create(NULL, ram_cache_key_hash,
+                                                 ram_cache_key_equals);
+      if (!cache->ram_cache)
+         goto fail;
+      list_inithead(&cache->ram_cache_lru);
+      simple_mtx_init(&cache->ram_cache_mtx, mtx_plain);
+   }
+
+   cache->prefetch = _mesa_hash_table_create(NULL, ram_cache_key_hash,
+                                             ram_cache_key_equals);
+   if (!cache->prefetch)
+      goto fail;
+   list_inithead(&cache->prefetch_list);
+   list_inithead(&cache->prefetch_misses);
+   simple_mtx_init(&cache->prefetch_mtx, mtx_plain);
 
    /* 4 threads were chosen below because just about all modern CPUs currently
     * available that run Mesa have *at least* 4 cores. For these CPUs allowing
@@ -223,13 +519,23 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
 
+   /* The dictionary is named after the driver keys, so this has to come
+    * after they are set up.
+    */
+   if (!cache->path_init_failed)
+      disk_cache_load_compress_dict(cache);
+
    ralloc_free(local);
 
    return cache;
 
  fail:
-   if (cache)
+   if (cache) {
+      ram_cache_destroy(cache);
+      prefetch_destroy(cache);
+      disk_cache_destroy_compress_dict(cache);
       ralloc_free(cache);
+   }
    ralloc_free(local);
 
    return NULL;
@@ -246,8 +552,13 @@ disk_cache_destroy(struct disk_cache *cache)
          foz_destroy(&cache->foz_db);
 
       disk_cache_destroy_mmap(cache);
+      ram_cache_destroy(cache);
+      prefetch_destroy(cache);
    }
 
+   if (cache)
+      disk_cache_destroy_compress_dict(cache);
+
    ralloc_free(cache);
 }
 
@@ -260,6 +571,11 @@ disk_cache_wait_for_idle(struct disk_cache *cache)
 void
 disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
+   ram_cache_remove(cache, key);
+
+   size_t size;
+   free(prefetch_take(cache, key, &size));
+
    char *filename = disk_cache_get_cache_filename(cache, key);
    if (filename == NULL) {
       return;
@@ -379,6 +695,12 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    if (cache->path_init_failed)
       return;
 
+   /* Don't let a get return what was prefetched before this put. */
+   size_t prefetch_size;
+   free(prefetch_take(cache, key, &prefetch_size));
+
+   ram_cache_put(cache, key, data, size);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, (void*)data, size, cache_item_metadata, false);
 
@@ -405,6 +727,11 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
       return;
    }
 
+   size_t prefetch_size;
+   free(prefetch_take(cache, key, &prefetch_size));
+
+   ram_cache_put(cache, key, data, size);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, data, size, cache_item_metadata, true);
 
@@ -415,6 +742,19 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
    }
 }
 
+static void *
+load_item(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   if (env_var_as_boolean("MESA_DISK_CACHE_SINGLE_FILE", false))
+      return disk_cache_load_item_foz(cache, key, size);
+
+   char *filename = disk_cache_get_cache_filename(cache, key);
+   if (filename == NULL)
+      return NULL;
+
+   return disk_cache_load_item(cache, filename, size);
+}
+
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
@@ -443,14 +783,100 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
-   if (env_var_as_boolean("MESA_DISK_CACHE_SINGLE_FILE", false)) {
-      return disk_cache_load_item_foz(cache, key, size);
-   } else {
-      char *filename = disk_cache_get_cache_filename(cache, key);
-      if (filename == NULL)
-         return NULL;
+   size_t item_size = 0;
+   void *data = ram_cache_get(cache, key, &item_size);
+
+   if (!data) {
+      data = prefetch_take(cache, key, &item_size);
+      if (!data)
+         data = load_item(cache, key, &item_size);
+
+      if (data)
+         ram_cache_put(cache, key, data, item_size);
+   }
+
+   if (data && size)
+      *size = item_size;
+   return data;
+}
+
+static void
+cache_prefetch(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_prefetch_item *item = job;
+   struct disk_cache *cache = item->cache;
+   size_t size = 0;
+
+   void *data = load_item(cache, item->key, &size);
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+
+   item->data = data;
+   item->size = data ? size : 0;
+   cache->prefetch_size += item->size;
+
+   /* A miss isn't worth keeping: the next get goes to the disk either way.
+    * The item is still this job and can't be freed before its fence is
+    * signalled, a later job reaps it.
+    */
+   prefetch_reap_misses_locked(cache);
+   if (!data && !item->taken) {
+      _mesa_hash_table_remove_key(cache->prefetch, item->key);
+      list_del(&item->link);
+      list_add(&item->link, &cache->prefetch_misses);
+   }
+
+   /* Make room by dropping the oldest items that finished loading. This one
+    * is still unsignalled and stays.
+    */
+   list_for_each_entry_safe_rev(struct disk_cache_prefetch_item, old,
+                                &cache->prefetch_list, link) {
+      if (cache->prefetch_size <= PREFETCH_MAX_SIZE)
+         break;
+      if (!util_queue_fence_is_signalled(&old->fence))
+         continue;
+
+      prefetch_evict_locked(cache, old);
+      cache->stats.prefetch_evictions++;
+   }
+
+   simple_mtx_unlock(&cache->prefetch_mtx);
+}
+
+void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys)
+{
+   if (cache->blob_get_cb || cache->path_init_failed)
+      return;
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      if (ram_cache_contains(cache, keys[i]))
+         continue;
+
+      simple_mtx_lock(&cache->prefetch_mtx);
+
+      if (_mesa_hash_table_search(cache->prefetch, keys[i])) {
+         simple_mtx_unlock(&cache->prefetch_mtx);
+         continue;
+      }
 
-      return disk_cache_load_item(cache, filename, size);
+      struct disk_cache_prefetch_item *item = calloc(1, sizeof(*item));
+      if (!item) {
+         simple_mtx_unlock(&cache->prefetch_mtx);
+         return;
+      }
+
+      item->cache = cache;
+      memcpy(item->key, keys[i], CACHE_KEY_SIZE);
+      util_queue_fence_init(&item->fence);
+      _mesa_hash_table_insert(cache->prefetch, item->key, item);
+      list_add(&item->link, &cache->prefetch_list);
+
+      simple_mtx_unlock(&cache->prefetch_mtx);
+
+      util_queue_add_job(&cache->cache_queue, item, &item->fence,
+                         cache_prefetch, NULL, 0);
    }
 }
 
@@ -522,4 +948,50 @@ disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
    cache->blob_get_cb = get;
 }
 
+void
+disk_cache_get_stats(struct disk_cache *cache, struct disk_cache_stats *stats)
+{
+   memset(stats, 0, sizeof(*stats));
+
+   if (cache->ram_cache) {
+      simple_mtx_lock(&cache->ram_cache_mtx);
+      stats->ram_hits = cache->stats.ram_hits;
+      stats->ram_misses = cache->stats.ram_misses;
+      stats->ram_hit_bytes = cache->stats.ram_hit_bytes;
+      stats->ram_evictions = cache->stats.ram_evictions;
+      stats->ram_size = cache->ram_cache_size;
+      simple_mtx_unlock(&cache->ram_cache_mtx);
+   }
+
+   if (cache->prefetch) {
+      simple_mtx_lock(&cache->prefetch_mtx);
+      stats->prefetch_hits = cache->stats.prefetch_hits;
+      stats->prefetch_evictions = cache->stats.prefetch_evictions;
+      stats->prefetch_size = cache->prefetch_size;
+      simple_mtx_unlock(&cache->prefetch_mtx);
+   }
+}
+
+void
+disk_cache_set_compression_policy(struct disk_cache *cache,
+                                  enum disk_cache_compression_policy policy)
+{
+   if (cache->compress_policy_forced || cache->compress_policy == policy)
+      return;
+
+   cache->compress_policy = policy;
+   if (!cache->path_init_failed)
+      disk_cache_reload_compress_dict(cache);
+}
+
+bool
+disk_cache_compact(struct disk_cache *cache, uint64_t max_size)
+{
+   if (cache->path_init_failed ||
+       !env_var_as_boolean("MESA_DISK_CACHE_SINGLE_FILE", false))
+      return false;
+
+   return foz_compact(&cache->foz_db, max_size ? max_size : cache->max_size);
+}
+
 #endif /* ENABLE_SHADER_CACHE */
@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <sys/stat.h>
 #include "util/mesa-sha1.h"
 
@@ -54,6 +55,30 @@ typedef uint8_t cache_key[CACHE_KEY_SIZE];
 #define CACHE_ITEM_TYPE_UNKNOWN  0x0
 #define CACHE_ITEM_TYPE_GLSL     0x1
 
+/* Counters for the in-memory tier of the cache. */
+struct disk_cache_stats {
+   uint64_t ram_hits;
+   uint64_t ram_misses;
+   /* Bytes returned by RAM hits. */
+   uint64_t ram_hit_bytes;
+   uint64_t ram_evictions;
+   /* Bytes currently held in RAM. */
+   uint64_t ram_size;
+   /* Gets served by an earlier disk_cache_prefetch(). */
+   uint64_t prefetch_hits;
+   /* Prefetched items dropped before anybody asked for them. */
+   uint64_t prefetch_evictions;
+   /* Bytes currently held by prefetched items. */
+   uint64_t prefetch_size;
+};
+
+/* Trade-off between the cost of compressing new entries and their size. */
+enum disk_cache_compression_policy {
+   DISK_CACHE_COMPRESSION_DEFAULT,
+   DISK_CACHE_COMPRESSION_FAST,
+   DISK_CACHE_COMPRESSION_SMALL,
+};
+
 typedef void
 (*disk_cache_put_cb) (const void *key, signed long keySize,
                       const void *value, signed long valueSize);
@@ -239,6 +264,18 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Start loading the items stored under \keys on the cache threads, so that
+ * the disk_cache_get() calls that follow don't have to read and decompress
+ * them one at a time. A get for an item still being loaded waits for it.
+ *
+ * Prefetched items are held in memory until the first get for them, up to
+ * a fixed budget past which the oldest ones are dropped.
+ */
+void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -275,6 +312,33 @@ void
 disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
                          disk_cache_get_cb get);
 
+/**
+ * Read the counters of the in-memory tier, which is enabled by setting
+ * MESA_SHADER_CACHE_RAM_SIZE, and of prefetching.
+ */
+void
+disk_cache_get_stats(struct disk_cache *cache, struct disk_cache_stats *stats);
+
+/**
+ * Choose how hard new entries are compressed. Must be called right after
+ * disk_cache_create(), before the cache is used. MESA_SHADER_CACHE_COMPRESSION
+ * overrides this when set.
+ */
+void
+disk_cache_set_compression_policy(struct disk_cache *cache,
+                                  enum disk_cache_compression_policy policy);
+
+/**
+ * Shrink a single file cache (MESA_DISK_CACHE_SINGLE_FILE) down to its most
+ * recently written items that fit in \max_size bytes, or in the maximum
+ * cache size when \max_size is 0. Other processes using the cache pick up
+ * the compacted files on their next write.
+ *
+ * \return false for multi-file caches, or if compaction failed.
+ */
+bool
+disk_cache_compact(struct disk_cache *cache, uint64_t max_size);
+
 #else
 
 static inline struct disk_cache *
@@ -317,6 +381,13 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys)
+{
+   return;
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -343,6 +414,25 @@ disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
    return;
 }
 
+static inline void
+disk_cache_get_stats(struct disk_cache *cache, struct disk_cache_stats *stats)
+{
+   memset(stats, 0, sizeof(*stats));
+}
+
+static inline void
+disk_cache_set_compression_policy(struct disk_cache *cache,
+                                  enum disk_cache_compression_policy policy)
+{
+   return;
+}
+
+static inline bool
+disk_cache_compact(struct disk_cache *cache, uint64_t max_size)
+{
+   return false;
+}
+
 #endif /* ENABLE_SHADER_CACHE */
 
 #ifdef __cplusplus
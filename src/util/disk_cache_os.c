@@ -64,6 +64,7 @@ struct cache_entry_file_data {
 #include "util/disk_cache_os.h"
 #include "util/ralloc.h"
 #include "util/rand_xor.h"
+#include "util/u_atomic.h"
 
 /* Create a directory named 'path' if it does not already exist.
  *
@@ -454,6 +455,268 @@ disk_cache_evict_item(struct disk_cache *cache, char *filename)
       p_atomic_add(cache->size, - (uint64_t)sb.st_blocks * 512);
 }
 
+/* Dictionaries are trained on the first entries written with a given set of
+ * driver keys: shader binaries and serialized IR from the same driver share
+ * most of their structure, which per-entry compression can't exploit.
+ */
+#define COMPRESS_DICT_MAGIC 0x4443444d /* "MDCD" */
+#define COMPRESS_DICT_MAX_SIZE (64 * 1024)
+#define COMPRESS_DICT_NUM_SAMPLES 256
+#define COMPRESS_DICT_MAX_SAMPLE_SIZE (64 * 1024)
+#define COMPRESS_DICT_MAX_SAMPLES_SIZE (4 * 1024 * 1024)
+
+struct compress_dict_file_header {
+   uint32_t magic;
+   uint32_t crc32;
+   uint32_t size;
+};
+
+static enum util_compress_policy
+get_compress_policy(struct disk_cache *cache)
+{
+   switch (cache->compress_policy) {
+   case DISK_CACHE_COMPRESSION_FAST:
+      return UTIL_COMPRESS_FAST;
+   case DISK_CACHE_COMPRESSION_SMALL:
+      return UTIL_COMPRESS_SMALL;
+   default:
+      return UTIL_COMPRESS_DEFAULT;
+   }
+}
+
+/* The dictionary is only valid for entries written with the same driver
+ * keys, so its name is derived from them.
+ */
+static char *
+get_compress_dict_filename(struct disk_cache *cache)
+{
+   unsigned char sha1[20];
+   char buf[41];
+   char *filename;
+
+   _mesa_sha1_compute(cache->driver_keys_blob, cache->driver_keys_blob_size,
+                      sha1);
+   _mesa_sha1_format(buf, sha1);
+   if (asprintf(&filename, "%s/dict-%s", cache->path, buf) == -1)
+      return NULL;
+
+   return filename;
+}
+
+static struct util_compress_dict *
+read_compress_dict(struct disk_cache *cache, const char *filename)
+{
+   struct compress_dict_file_header header;
+   struct util_compress_dict *dict = NULL;
+   uint8_t *data = NULL;
+
+   int fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return NULL;
+
+   if (read_all(fd, &header, sizeof(header)) == -1 ||
+       header.magic != COMPRESS_DICT_MAGIC ||
+       header.size == 0 || header.size > COMPRESS_DICT_MAX_SIZE)
+      goto fail;
+
+   data = malloc(header.size);
+   if (!data || read_all(fd, data, header.size) == -1)
+      goto fail;
+
+   if (header.crc32 != util_hash_crc32(data, header.size))
+      goto fail;
+
+   dict = util_compress_dict_create(data, header.size,
+                                    get_compress_policy(cache));
+
+ fail:
+   free(data);
+   close(fd);
+   return dict;
+}
+
+static void
+write_compress_dict(struct disk_cache *cache, const char *filename,
+                    const void *data, size_t size)
+{
+   struct compress_dict_file_header header = {
+      .magic = COMPRESS_DICT_MAGIC,
+      .crc32 = util_hash_crc32(data, size),
+      .size = size,
+   };
+   char *filename_tmp;
+
+   if (asprintf(&filename_tmp, "%s.%d.tmp", filename, getpid()) == -1)
+      return;
+
+   int fd = open(filename_tmp, O_WRONLY | O_CLOEXEC | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1) {
+      free(filename_tmp);
+      return;
+   }
+
+   bool written = write_all(fd, &header, sizeof(header)) != -1 &&
+                  write_all(fd, data, size) != -1;
+   close(fd);
+
+   /* link() doesn't replace an existing file, so if several processes train
+    * a dictionary at the same time the first one stays and everybody uses
+    * it.
+    */
+   if (written)
+      link(filename_tmp, filename);
+
+   unlink(filename_tmp);
+   free(filename_tmp);
+}
+
+static void
+discard_compress_dict_samples(struct disk_cache *cache)
+{
+   blob_finish(&cache->compress_dict_samples);
+   blob_init(&cache->compress_dict_samples);
+   free(cache->compress_dict_sample_sizes);
+   cache->compress_dict_sample_sizes = NULL;
+   cache->compress_dict_num_samples = 0;
+}
+
+static void
+load_compress_dict_locked(struct disk_cache *cache)
+{
+   char *filename = get_compress_dict_filename(cache);
+   if (!filename)
+      return;
+
+   struct util_compress_dict *dict = read_compress_dict(cache, filename);
+   if (dict) {
+      p_atomic_set(&cache->compress_dict, dict);
+      cache->compress_dict_done = true;
+      discard_compress_dict_samples(cache);
+   }
+
+   free(filename);
+}
+
+/* Pick up a dictionary trained by an earlier run or another process. */
+void
+disk_cache_load_compress_dict(struct disk_cache *cache)
+{
+   simple_mtx_lock(&cache->compress_dict_mtx);
+   if (!cache->compress_dict_done)
+      load_compress_dict_locked(cache);
+   simple_mtx_unlock(&cache->compress_dict_mtx);
+}
+
+/* A dictionary is prepared for one compression policy, recreate it after
+ * the policy changed. Other threads may still be using the old one, so it is
+ * kept until the cache is destroyed.
+ */
+void
+disk_cache_reload_compress_dict(struct disk_cache *cache)
+{
+   simple_mtx_lock(&cache->compress_dict_mtx);
+   struct util_compress_dict *old = cache->compress_dict;
+   if (old) {
+      load_compress_dict_locked(cache);
+      if (cache->compress_dict != old)
+         util_dynarray_append(&cache->compress_dict_retired,
+                              struct util_compress_dict *, old);
+   }
+   simple_mtx_unlock(&cache->compress_dict_mtx);
+}
+
+void
+disk_cache_destroy_compress_dict(struct disk_cache *cache)
+{
+   util_compress_dict_destroy(cache->compress_dict);
+   cache->compress_dict = NULL;
+   util_dynarray_foreach(&cache->compress_dict_retired,
+                         struct util_compress_dict *, dict)
+      util_compress_dict_destroy(*dict);
+   util_dynarray_fini(&cache->compress_dict_retired);
+   discard_compress_dict_samples(cache);
+   simple_mtx_destroy(&cache->compress_dict_mtx);
+}
+
+static void
+train_compress_dict(struct disk_cache *cache, const struct blob *samples,
+                    const size_t *sample_sizes, unsigned num_samples)
+{
+   char *filename = get_compress_dict_filename(cache);
+   if (!filename)
+      return;
+
+   void *dict_data = malloc(COMPRESS_DICT_MAX_SIZE);
+   if (dict_data) {
+      size_t dict_size =
+         util_compress_dict_train(dict_data, COMPRESS_DICT_MAX_SIZE,
+                                  samples->data, sample_sizes, num_samples);
+      if (dict_size)
+         write_compress_dict(cache, filename, dict_data, dict_size);
+      free(dict_data);
+   }
+   free(filename);
+
+   /* Use whichever dictionary made it to disk, ours or another process'. */
+   simple_mtx_lock(&cache->compress_dict_mtx);
+   load_compress_dict_locked(cache);
+   simple_mtx_unlock(&cache->compress_dict_mtx);
+}
+
+/* Keep a copy of an entry that was compressed without a dictionary, and
+ * train one once there are enough of them. Training runs on the cache queue
+ * thread that collected the last sample, other entries keep being compressed
+ * without a dictionary meanwhile.
+ */
+static void
+add_compress_dict_sample(struct disk_cache *cache, const void *data,
+                         size_t size)
+{
+   simple_mtx_lock(&cache->compress_dict_mtx);
+
+   if (cache->compress_dict_done) {
+      simple_mtx_unlock(&cache->compress_dict_mtx);
+      return;
+   }
+
+   if (!cache->compress_dict_sample_sizes) {
+      cache->compress_dict_sample_sizes =
+         malloc(COMPRESS_DICT_NUM_SAMPLES * sizeof(size_t));
+      if (!cache->compress_dict_sample_sizes) {
+         cache->compress_dict_done = true;
+         simple_mtx_unlock(&cache->compress_dict_mtx);
+         return;
+      }
+   }
+
+   size = MIN2(size, COMPRESS_DICT_MAX_SAMPLE_SIZE);
+   blob_write_bytes(&cache->compress_dict_samples, data, size);
+   cache->compress_dict_sample_sizes[cache->compress_dict_num_samples++] = size;
+
+   if (cache->compress_dict_num_samples < COMPRESS_DICT_NUM_SAMPLES &&
+       cache->compress_dict_samples.size < COMPRESS_DICT_MAX_SAMPLES_SIZE) {
+      simple_mtx_unlock(&cache->compress_dict_mtx);
+      return;
+   }
+
+   struct blob samples = cache->compress_dict_samples;
+   size_t *sample_sizes = cache->compress_dict_sample_sizes;
+   unsigned num_samples = cache->compress_dict_num_samples;
+
+   blob_init(&cache->compress_dict_samples);
+   cache->compress_dict_sample_sizes = NULL;
+   cache->compress_dict_num_samples = 0;
+   cache->compress_dict_done = true;
+
+   simple_mtx_unlock(&cache->compress_dict_mtx);
+
+   if (!samples.out_of_memory)
+      train_compress_dict(cache, &samples, sample_sizes, num_samples);
+
+   blob_finish(&samples);
+   free(sample_sizes);
+}
+
 static void *
 parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
                               size_t cache_item_size, size_t *size)
@@ -511,10 +774,27 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
 
    /* Uncompress the cache data */
    uncompressed_data = malloc(cf_data->uncompressed_size);
-   if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                              cf_data->uncompressed_size))
+   if (!uncompressed_data)
       goto fail;
 
+   struct util_compress_dict *dict = p_atomic_read(&cache->compress_dict);
+   if (!util_compress_inflate_dict(data, cache_data_size, uncompressed_data,
+                                   cf_data->uncompressed_size, dict)) {
+      /* The entry may need a dictionary another process trained since we
+       * started.
+       */
+      if (dict)
+         goto fail;
+
+      disk_cache_load_compress_dict(cache);
+      dict = p_atomic_read(&cache->compress_dict);
+      if (!dict ||
+          !util_compress_inflate_dict(data, cache_data_size,
+                                      uncompressed_data,
+                                      cf_data->uncompressed_size, dict))
+         goto fail;
+   }
+
    if (size)
       *size = cf_data->uncompressed_size;
 
@@ -603,12 +883,18 @@ create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
    if (compressed_data == NULL)
       return false;
 
+   struct disk_cache *cache = dc_job->cache;
+   struct util_compress_dict *dict = p_atomic_read(&cache->compress_dict);
    size_t compressed_size =
-      util_compress_deflate(dc_job->data, dc_job->size,
-                            compressed_data, max_buf);
+      util_compress_deflate_dict(dc_job->data, dc_job->size,
+                                 compressed_data, max_buf,
+                                 get_compress_policy(cache), dict);
    if (compressed_size == 0)
       goto fail;
 
+   if (!dict)
+      add_compress_dict_sample(cache, dc_job->data, dc_job->size);
+
    /* Copy the driver_keys_blob, this can be used find information about the
     * mesa version that produced the entry or deal with hash collisions,
     * should that ever become a real problem.
@@ -32,7 +32,11 @@
 
 #else
 
+#include "util/blob.h"
 #include "util/fossilize_db.h"
+#include "util/list.h"
+#include "util/simple_mtx.h"
+#include "util/u_dynarray.h"
 
 /* Number of bits to mask off from a cache key to get an index. */
 #define CACHE_INDEX_KEY_BITS 16
@@ -75,6 +79,47 @@ struct disk_cache {
 
    disk_cache_put_cb blob_put_cb;
    disk_cache_get_cb blob_get_cb;
+
+   /* In-memory tier of recently used items, in front of the disk. NULL if
+    * disabled.
+    */
+   struct hash_table *ram_cache;
+   /* Least recently used items are at the tail. */
+   struct list_head ram_cache_lru;
+   simple_mtx_t ram_cache_mtx;
+   uint64_t ram_cache_size;
+   uint64_t ram_cache_max_size;
+   struct disk_cache_stats stats;
+
+   /* Items requested by disk_cache_prefetch(), until the first get for each.
+    * Oldest items are at the tail.
+    */
+   struct hash_table *prefetch;
+   struct list_head prefetch_list;
+   /* Misses, out of the table, freed once their job is done. */
+   struct list_head prefetch_misses;
+   simple_mtx_t prefetch_mtx;
+   uint64_t prefetch_size;
+
+   enum disk_cache_compression_policy compress_policy;
+   /* Set by MESA_SHADER_CACHE_COMPRESSION, wins over the driver's choice. */
+   bool compress_policy_forced;
+
+   /* Dictionary trained on the first entries written with these driver keys
+    * and shared through a file in the cache directory. NULL until one is
+    * available. Only replaced when the compression policy changes, and
+    * readers may still hold the old one, so it goes to the retired list.
+    */
+   struct util_compress_dict *compress_dict;
+   /* Dictionaries replaced by a policy change, freed with the cache. */
+   struct util_dynarray compress_dict_retired;
+   simple_mtx_t compress_dict_mtx;
+   /* Set once a dictionary was loaded or training was attempted. */
+   bool compress_dict_done;
+   /* Uncompressed entries collected for training, back to back. */
+   struct blob compress_dict_samples;
+   size_t *compress_dict_sample_sizes;
+   unsigned compress_dict_num_samples;
 };
 
 struct disk_cache_put_job {
@@ -123,6 +168,15 @@ disk_cache_write_item_to_disk(struct disk_cache_put_job *dc_job,
 bool
 disk_cache_enabled(void);
 
+void
+disk_cache_load_compress_dict(struct disk_cache *cache);
+
+void
+disk_cache_reload_compress_dict(struct disk_cache *cache);
+
+void
+disk_cache_destroy_compress_dict(struct disk_cache *cache);
+
 bool
 disk_cache_load_cache_index(void *mem_ctx, struct disk_cache *cache);
 
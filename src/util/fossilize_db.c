@@ -36,7 +36,10 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
@@ -105,76 +108,145 @@ create_foz_db_filenames(char *cache_path, char *name, char **filename,
 }
 
 
-/* This looks at stuff that was added to the index since the last time we looked at it. This is safe
- * to do without locking the file as we assume the file is append only */
-static void
-update_foz_index(struct foz_db *foz_db, FILE *db_idx, unsigned file_idx)
+/* Size of one record of the index db: the hash, a payload header and the
+ * offset of the entry in the foz db.
+ */
+#define FOZ_IDX_RECORD_SIZE \
+   (FOSSILIZE_BLOB_HASH_LENGTH + sizeof(struct foz_payload_header) + sizeof(uint64_t))
+
+static bool
+check_foz_magic(const uint8_t *magic)
 {
-   uint64_t offset = ftell(db_idx);
-   fseek(db_idx, 0, SEEK_END);
-   uint64_t len = ftell(db_idx);
-   uint64_t parsed_offset = offset;
+   if (memcmp(magic, stream_reference_magic_and_version,
+              FOZ_REF_MAGIC_SIZE - 1))
+      return false;
 
-   if (offset == len)
-      return;
+   int version = magic[FOZ_REF_MAGIC_SIZE - 1];
+   return version <= FOSSILIZE_FORMAT_VERSION &&
+          version >= FOSSILIZE_FORMAT_MIN_COMPAT_VERSION;
+}
 
-   fseek(db_idx, offset, SEEK_SET);
-   while (offset < len) {
-      char bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(struct foz_payload_header)];
-      struct foz_payload_header *header;
+/* Validates one index db record and returns the offset it points at. */
+static bool
+read_idx_record(const uint8_t *record, struct foz_payload_header *header,
+                uint64_t *cache_offset)
+{
+   memcpy(header, record + FOSSILIZE_BLOB_HASH_LENGTH, sizeof(*header));
+   if (header->payload_size != sizeof(uint64_t))
+      return false;
 
-      /* Corrupt entry. Our process might have been killed before we
-       * could write all data.
-       */
-      if (offset + sizeof(bytes_to_read) > len)
-         break;
+   memcpy(cache_offset, record + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(*header),
+          sizeof(*cache_offset));
 
-      /* NAME + HEADER in one read */
-      if (fread(bytes_to_read, 1, sizeof(bytes_to_read), db_idx) !=
-          sizeof(bytes_to_read))
-         break;
+   /* Records written by older versions don't have a checksum. */
+   return header->crc == 0 ||
+          header->crc == util_hash_crc32(cache_offset, sizeof(*cache_offset));
+}
 
-      offset += sizeof(bytes_to_read);
-      header = (struct foz_payload_header*)&bytes_to_read[FOSSILIZE_BLOB_HASH_LENGTH];
+static bool
+is_hex_hash(const uint8_t *hash_str)
+{
+   for (unsigned i = 0; i < FOSSILIZE_BLOB_HASH_LENGTH; i++) {
+      if (!(hash_str[i] >= '0' && hash_str[i] <= '9') &&
+          !(hash_str[i] >= 'a' && hash_str[i] <= 'f') &&
+          !(hash_str[i] >= 'A' && hash_str[i] <= 'F'))
+         return false;
+   }
+   return true;
+}
 
-      /* Corrupt entry. Our process might have been killed before we
-       * could write all data.
-       */
-      if (offset + header->payload_size > len ||
-          header->payload_size != sizeof(uint64_t))
-         break;
+/* Returns the next valid index db record at or after *offset and moves
+ * *offset past it. A record torn by a short write or a killed process
+ * would misalign every record appended after it, so past invalid data the
+ * next record is searched for byte by byte. Returns NULL, with *offset at
+ * the first byte not looked at, when no complete record is left.
+ */
+static const uint8_t *
+next_idx_record(const uint8_t *data, uint64_t len, uint64_t *offset,
+                struct foz_payload_header *header, uint64_t *cache_offset)
+{
+   while (*offset + FOZ_IDX_RECORD_SIZE <= len) {
+      const uint8_t *record = data + *offset;
 
-      char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1] = {0};
-      memcpy(hash_str, bytes_to_read, FOSSILIZE_BLOB_HASH_LENGTH);
+      if (is_hex_hash(record) &&
+          read_idx_record(record, header, cache_offset)) {
+         *offset += FOZ_IDX_RECORD_SIZE;
+         return record;
+      }
 
-      /* read cache item offset from index file */
-      uint64_t cache_offset;
-      if (fread(&cache_offset, 1, sizeof(cache_offset), db_idx) !=
-          sizeof(cache_offset))
-         break;
+      (*offset)++;
+   }
 
-      offset += header->payload_size;
-      parsed_offset = offset;
+   return NULL;
+}
+
+/* Parses index db records from memory and adds them to the hash table.
+ * Returns the number of bytes of complete records.
+ */
+static uint64_t
+parse_foz_index(struct foz_db *foz_db, const uint8_t *data, uint64_t len,
+                unsigned file_idx)
+{
+   uint64_t offset = 0;
+   const uint8_t *record;
+   struct foz_payload_header header;
+   uint64_t cache_offset;
+
+   /* A trailing partial record means another process is still appending
+    * it, or was killed before it could write all data.
+    */
+   while ((record = next_idx_record(data, len, &offset, &header,
+                                    &cache_offset))) {
+      char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1] = {0};
+      memcpy(hash_str, record, FOSSILIZE_BLOB_HASH_LENGTH);
 
       struct foz_db_entry *entry = ralloc(foz_db->mem_ctx,
                                           struct foz_db_entry);
-      entry->header = *header;
+      entry->header = header;
       entry->file_idx = file_idx;
+      entry->offset = cache_offset;
       _mesa_sha1_hex_to_sha1(entry->key, hash_str);
 
-      /* Truncate the entry's hash string to a 64bit hash for use with a
-       * 64bit hash table for looking up file offsets.
+      /* Truncate the entry's hash to a 64bit hash for use with a 64bit hash
+       * table for looking up file offsets.
        */
-      hash_str[16] = '\0';
-      uint64_t key = strtoull(hash_str, NULL, 16);
+      uint64_t key = truncate_hash_to_64bits(entry->key);
 
-      entry->offset = cache_offset;
+      /* Concurrent writers may have appended the same entry more than once. */
+      if (_mesa_hash_table_u64_search(foz_db->index_db, key)) {
+         ralloc_free(entry);
+         continue;
+      }
 
       _mesa_hash_table_u64_insert(foz_db->index_db, key, entry);
    }
 
+   return offset;
+}
+
+/* This looks at stuff that was added to the writable index since the last
+ * time we looked at it. This is safe to do without locking the file as the
+ * file is append only and records are appended with a single write.
+ */
+static void
+update_foz_index(struct foz_db *foz_db)
+{
+   int fd = fileno(foz_db->db_idx);
+   struct stat st;
 
-   fseek(db_idx, parsed_offset, SEEK_SET);
+   if (fstat(fd, &st) == -1 || st.st_size <= foz_db->idx_offset)
+      return;
+
+   size_t len = st.st_size - foz_db->idx_offset;
+   uint8_t *data = malloc(len);
+   if (!data)
+      return;
+
+   ssize_t bytes = pread(fd, data, len, foz_db->idx_offset);
+   if (bytes > 0)
+      foz_db->idx_offset += parse_foz_index(foz_db, data, bytes, 0);
+
+   free(data);
 }
 
 /* exclusive flock with timeout. timeout is in nanoseconds */
@@ -195,10 +267,63 @@ static int lock_file_with_timeout(FILE *f, int64_t timeout)
    return err;
 }
 
+static const uint8_t *
+map_foz_file(FILE *f, size_t *size)
+{
+   struct stat st;
+
+   if (fstat(fileno(f), &st) == -1 || st.st_size == 0)
+      return NULL;
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fileno(f), 0);
+   if (map == MAP_FAILED)
+      return NULL;
+
+   *size = st.st_size;
+   return map;
+}
+
+/* Read only dbs can't change under us, so both files are mmapped and lookups
+ * are served straight from the mapping.
+ */
+static bool
+load_read_only_foz_db(struct foz_db *foz_db, FILE *db_idx, uint8_t file_idx)
+{
+   foz_db->ro_map[file_idx] =
+      map_foz_file(foz_db->file[file_idx], &foz_db->ro_map_size[file_idx]);
+   foz_db->ro_idx_map[file_idx] =
+      map_foz_file(db_idx, &foz_db->ro_idx_map_size[file_idx]);
+
+   if (!foz_db->ro_map[file_idx] || !foz_db->ro_idx_map[file_idx])
+      return false;
+
+   if (foz_db->ro_idx_map_size[file_idx] < FOZ_REF_MAGIC_SIZE ||
+       !check_foz_magic(foz_db->ro_idx_map[file_idx]))
+      return false;
+
+   parse_foz_index(foz_db, foz_db->ro_idx_map[file_idx] + FOZ_REF_MAGIC_SIZE,
+                   foz_db->ro_idx_map_size[file_idx] - FOZ_REF_MAGIC_SIZE,
+                   file_idx);
+
+   /* The mappings keep the files alive. */
+   fclose(foz_db->file[file_idx]);
+   foz_db->file[file_idx] = NULL;
+
+   return true;
+}
+
 static bool
 load_foz_dbs(struct foz_db *foz_db, FILE *db_idx, uint8_t file_idx,
              bool read_only)
 {
+   if (read_only) {
+      if (!load_read_only_foz_db(foz_db, db_idx, file_idx))
+         goto fail;
+
+      foz_db->alive = true;
+      return true;
+   }
+
    /* Scan through the archive and get the list of cache entries. */
    fseek(db_idx, 0, SEEK_END);
    size_t len = ftell(db_idx);
@@ -223,13 +348,7 @@ load_foz_dbs(struct foz_db *foz_db, FILE *db_idx, uint8_t file_idx,
       if (fread(magic, 1, FOZ_REF_MAGIC_SIZE, db_idx) != FOZ_REF_MAGIC_SIZE)
          goto fail;
 
-      if (memcmp(magic, stream_reference_magic_and_version,
-                 FOZ_REF_MAGIC_SIZE - 1))
-         goto fail;
-
-      int version = magic[FOZ_REF_MAGIC_SIZE - 1];
-      if (version > FOSSILIZE_FORMAT_VERSION ||
-          version < FOSSILIZE_FORMAT_MIN_COMPAT_VERSION)
+      if (!check_foz_magic(magic))
          goto fail;
 
    } else {
@@ -250,13 +369,15 @@ load_foz_dbs(struct foz_db *foz_db, FILE *db_idx, uint8_t file_idx,
 
    flock(fileno(foz_db->file[file_idx]), LOCK_UN);
 
-   update_foz_index(foz_db, db_idx, file_idx);
+   foz_db->idx_offset = FOZ_REF_MAGIC_SIZE;
+   update_foz_index(foz_db);
 
    foz_db->alive = true;
    return true;
 
 fail:
-   flock(fileno(foz_db->file[file_idx]), LOCK_UN);
+   if (!read_only)
+      flock(fileno(foz_db->file[file_idx]), LOCK_UN);
    foz_destroy(foz_db);
    return false;
 }
@@ -279,14 +400,22 @@ foz_prepare(struct foz_db *foz_db, char *cache_path)
    foz_db->file[0] = fopen(filename, "a+b");
    foz_db->db_idx = fopen(idx_filename, "a+b");
 
-   free(filename);
-   free(idx_filename);
-
-   if (!check_files_opened_successfully(foz_db->file[0], foz_db->db_idx))
+   /* Keep the paths to notice when another process compacts the db. */
+   foz_db->filename = filename;
+   foz_db->idx_filename = idx_filename;
+
+   if (!check_files_opened_successfully(foz_db->file[0], foz_db->db_idx)) {
+      foz_db->file[0] = NULL;
+      foz_db->db_idx = NULL;
+      free(foz_db->filename);
+      free(foz_db->idx_filename);
+      foz_db->filename = NULL;
+      foz_db->idx_filename = NULL;
       return false;
+   }
 
    simple_mtx_init(&foz_db->mtx, mtx_plain);
-   simple_mtx_init(&foz_db->flock_mtx, mtx_plain);
+   simple_mtx_init(&foz_db->write_mtx, mtx_plain);
    foz_db->mem_ctx = ralloc_context(NULL);
    foz_db->index_db = _mesa_hash_table_u64_create(NULL);
 
@@ -345,17 +474,50 @@ foz_destroy(struct foz_db *foz_db)
 {
    if (foz_db->db_idx)
       fclose(foz_db->db_idx);
+   foz_db->db_idx = NULL;
    for (unsigned i = 0; i < FOZ_MAX_DBS; i++) {
       if (foz_db->file[i])
          fclose(foz_db->file[i]);
+      foz_db->file[i] = NULL;
+
+      if (foz_db->ro_map[i])
+         munmap((void *)foz_db->ro_map[i], foz_db->ro_map_size[i]);
+      if (foz_db->ro_idx_map[i])
+         munmap((void *)foz_db->ro_idx_map[i], foz_db->ro_idx_map_size[i]);
+      foz_db->ro_map[i] = NULL;
+      foz_db->ro_idx_map[i] = NULL;
    }
 
+   free(foz_db->filename);
+   free(foz_db->idx_filename);
+   foz_db->filename = NULL;
+   foz_db->idx_filename = NULL;
+
    if (foz_db->mem_ctx) {
       _mesa_hash_table_u64_destroy(foz_db->index_db);
       ralloc_free(foz_db->mem_ctx);
-      simple_mtx_destroy(&foz_db->flock_mtx);
+      simple_mtx_destroy(&foz_db->write_mtx);
       simple_mtx_destroy(&foz_db->mtx);
+      foz_db->mem_ctx = NULL;
    }
+   foz_db->alive = false;
+}
+
+static bool
+read_foz_bytes(struct foz_db *foz_db, unsigned file_idx, uint64_t offset,
+               void *data, size_t size)
+{
+   if (foz_db->ro_map[file_idx]) {
+      if (offset > foz_db->ro_map_size[file_idx] ||
+          size > foz_db->ro_map_size[file_idx] - offset)
+         return false;
+
+      memcpy(data, foz_db->ro_map[file_idx] + offset, size);
+      return true;
+   }
+
+   return pread(fileno(foz_db->file[file_idx]), data, size, offset) ==
+          (ssize_t)size;
 }
 
 /* Here we lookup a cache entry in the index hash table. If an entry is found
@@ -377,7 +539,7 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    struct foz_db_entry *entry =
       _mesa_hash_table_u64_search(foz_db->index_db, hash);
    if (!entry) {
-      update_foz_index(foz_db, foz_db->db_idx, 0);
+      update_foz_index(foz_db);
       entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
    }
    if (!entry) {
@@ -385,31 +547,40 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
       return NULL;
    }
 
-   uint8_t file_idx = entry->file_idx;
-   if (fseek(foz_db->file[file_idx], entry->offset, SEEK_SET) < 0)
+   /* Check for collision using full 160bit hash for increased assurance
+    * against potential collisions.
+    */
+   if (memcmp(cache_key_160bit, entry->key, 20))
       goto fail;
 
-   uint32_t header_size = sizeof(struct foz_payload_header);
-   if (fread(&entry->header, 1, header_size, foz_db->file[file_idx]) !=
-       header_size)
+   /* The hash is stored again in front of the entry, check it to make sure
+    * the offset really points at this entry.
+    */
+   uint8_t record[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(struct foz_payload_header)];
+   if (entry->offset < FOSSILIZE_BLOB_HASH_LENGTH ||
+       !read_foz_bytes(foz_db, entry->file_idx,
+                       entry->offset - FOSSILIZE_BLOB_HASH_LENGTH,
+                       record, sizeof(record)))
       goto fail;
 
-   /* Check for collision using full 160bit hash for increased assurance
-    * against potential collisions.
-    */
-   for (int i = 0; i < 20; i++) {
-      if (cache_key_160bit[i] != entry->key[i])
-         goto fail;
-   }
+   char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1];
+   _mesa_sha1_format(hash_str, cache_key_160bit);
+   if (memcmp(record, hash_str, FOSSILIZE_BLOB_HASH_LENGTH))
+      goto fail;
+
+   struct foz_payload_header header;
+   memcpy(&header, record + FOSSILIZE_BLOB_HASH_LENGTH, sizeof(header));
 
-   uint32_t data_sz = entry->header.payload_size;
+   uint32_t data_sz = header.payload_size;
    data = malloc(data_sz);
-   if (fread(data, 1, data_sz, foz_db->file[file_idx]) != data_sz)
+   if (!data ||
+       !read_foz_bytes(foz_db, entry->file_idx, entry->offset + sizeof(header),
+                       data, data_sz))
       goto fail;
 
    /* verify checksum */
-   if (entry->header.crc != 0) {
-      if (util_hash_crc32(data, data_sz) != entry->header.crc)
+   if (header.crc != 0) {
+      if (util_hash_crc32(data, data_sz) != header.crc)
          goto fail;
    }
 
@@ -423,13 +594,100 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
 fail:
    free(data);
 
-   /* reading db entry failed. reset the file offset */
    simple_mtx_unlock(&foz_db->mtx);
 
    return NULL;
 }
 
+static void
+format_idx_record(uint8_t *record, const char *hash_str, uint64_t offset)
+{
+   struct foz_payload_header header;
+   header.uncompressed_size = sizeof(uint64_t);
+   header.format = FOSSILIZE_COMPRESSION_NONE;
+   header.payload_size = sizeof(uint64_t);
+   header.crc = util_hash_crc32(&offset, sizeof(offset));
+
+   memcpy(record, hash_str, FOSSILIZE_BLOB_HASH_LENGTH);
+   memcpy(record + FOSSILIZE_BLOB_HASH_LENGTH, &header, sizeof(header));
+   memcpy(record + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header), &offset,
+          sizeof(offset));
+}
+
+static bool
+foz_db_was_replaced(struct foz_db *foz_db)
+{
+   struct stat path_st, fd_st;
+
+   if (stat(foz_db->idx_filename, &path_st) == -1 ||
+       fstat(fileno(foz_db->db_idx), &fd_st) == -1)
+      return false;
+
+   return path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev;
+}
+
+/* Switch to the files another process compacted the db into, and rebuild the
+ * index from scratch since all offsets changed. Called with both mutexes
+ * held.
+ */
+static bool
+reopen_foz_db(struct foz_db *foz_db)
+{
+   FILE *file = fopen(foz_db->filename, "a+b");
+   FILE *db_idx = fopen(foz_db->idx_filename, "a+b");
+   if (!check_files_opened_successfully(file, db_idx))
+      return false;
+
+   uint8_t magic[FOZ_REF_MAGIC_SIZE];
+   if (pread(fileno(db_idx), magic, sizeof(magic), 0) != sizeof(magic) ||
+       !check_foz_magic(magic)) {
+      fclose(file);
+      fclose(db_idx);
+      return false;
+   }
+
+   fclose(foz_db->file[0]);
+   fclose(foz_db->db_idx);
+   foz_db->file[0] = file;
+   foz_db->db_idx = db_idx;
+
+   _mesa_hash_table_u64_clear(foz_db->index_db);
+   ralloc_free(foz_db->mem_ctx);
+   foz_db->mem_ctx = ralloc_context(NULL);
+
+   foz_db->idx_offset = FOZ_REF_MAGIC_SIZE;
+   update_foz_index(foz_db);
+
+   for (unsigned i = 1; i < FOZ_MAX_DBS; i++) {
+      if (foz_db->ro_idx_map[i]) {
+         parse_foz_index(foz_db, foz_db->ro_idx_map[i] + FOZ_REF_MAGIC_SIZE,
+                         foz_db->ro_idx_map_size[i] - FOZ_REF_MAGIC_SIZE, i);
+      }
+   }
+
+   return true;
+}
+
+static bool
+write_all(int fd, const void *data, size_t size)
+{
+   /* A single write keeps records from concurrent O_APPEND writers from
+    * interleaving, so a short write is treated as a failure. What it did
+    * write can't be truncated away since others may have appended after it,
+    * readers skip over it instead.
+    */
+   return write(fd, data, size) == (ssize_t)size;
+}
+
+static bool
+compact_foz_db(struct foz_db *foz_db, uint64_t max_size);
+
 /* Here we write the cache entry to disk and store its offset in the index db.
+ *
+ * Both files are opened with O_APPEND and each record is appended with a
+ * single write, which the kernel doesn't interleave with writes from other
+ * processes, so no file lock is needed. Threads of this process share the
+ * file descriptors and are serialized by write_mtx.
  */
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
@@ -440,29 +698,23 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    if (!foz_db->alive)
       return false;
 
-   /* The flock is per-fd, not per thread, we do it outside of the main mutex to avoid having to
-    * wait in the mutex potentially blocking reads. We use the secondary flock_mtx to stop race
-    * conditions between the write threads sharing the same file descriptor. */
-   simple_mtx_lock(&foz_db->flock_mtx);
-
-   /* Wait for 1 second. This is done outside of the main mutex as I believe there is more potential
-    * for file contention than mtx contention of significant length. */
-   int err = lock_file_with_timeout(foz_db->file[0], 1000000000);
-   if (err == -1)
-      goto fail_file;
-
+   /* Writers take write_mtx first so that reads only wait on the main mutex
+    * while the index is looked up and updated, not during the actual writes.
+    */
+   simple_mtx_lock(&foz_db->write_mtx);
    simple_mtx_lock(&foz_db->mtx);
 
-   update_foz_index(foz_db, foz_db->db_idx, 0);
+   if (foz_db_was_replaced(foz_db) && !reopen_foz_db(foz_db))
+      goto fail_locked;
+
+   update_foz_index(foz_db);
 
    struct foz_db_entry *entry =
       _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   if (entry) {
-      simple_mtx_unlock(&foz_db->mtx);
-      flock(fileno(foz_db->file[0]), LOCK_UN);
-      simple_mtx_unlock(&foz_db->flock_mtx);
-      return NULL;
-   }
+   if (entry)
+      goto fail_locked;
+
+   simple_mtx_unlock(&foz_db->mtx);
 
    /* Prepare db entry header and blob ready for writing */
    struct foz_payload_header header;
@@ -471,68 +723,297 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    header.payload_size = blob_size;
    header.crc = util_hash_crc32(blob, blob_size);
 
-   fseek(foz_db->file[0], 0, SEEK_END);
-
-   /* Write hash header to db */
    char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1]; /* 40 digits + null */
    _mesa_sha1_format(hash_str, cache_key_160bit);
-   if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->file[0]) !=
-       FOSSILIZE_BLOB_HASH_LENGTH)
+
+   size_t record_size = FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header) + blob_size;
+   uint8_t *record = malloc(record_size);
+   if (!record)
       goto fail;
 
-   off_t offset = ftell(foz_db->file[0]);
+   memcpy(record, hash_str, FOSSILIZE_BLOB_HASH_LENGTH);
+   memcpy(record + FOSSILIZE_BLOB_HASH_LENGTH, &header, sizeof(header));
+   memcpy(record + FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header), blob, blob_size);
 
-   /* Write db entry header */
-   if (fwrite(&header, 1, sizeof(header), foz_db->file[0]) != sizeof(header))
+   int fd = fileno(foz_db->file[0]);
+   bool written = write_all(fd, record, record_size);
+   free(record);
+   if (!written)
       goto fail;
 
-   /* Now write the db entry blob */
-   if (fwrite(blob, 1, blob_size, foz_db->file[0]) != blob_size)
+   /* The file offset is left at the end of our own record, wherever other
+    * processes appended theirs.
+    */
+   off_t end = lseek(fd, 0, SEEK_CUR);
+   if (end == -1)
       goto fail;
 
-   /* Flush everything to file to reduce chance of cache corruption */
-   fflush(foz_db->file[0]);
+   uint64_t offset = end - blob_size - sizeof(header);
 
-   /* Write hash header to index db */
-   if (fwrite(hash_str, 1, FOSSILIZE_BLOB_HASH_LENGTH, foz_db->db_idx) !=
-       FOSSILIZE_BLOB_HASH_LENGTH)
+   uint8_t idx_record[FOZ_IDX_RECORD_SIZE];
+   format_idx_record(idx_record, hash_str, offset);
+   if (!write_all(fileno(foz_db->db_idx), idx_record, sizeof(idx_record)))
       goto fail;
 
-   header.uncompressed_size = sizeof(uint64_t);
-   header.format = FOSSILIZE_COMPRESSION_NONE;
-   header.payload_size = sizeof(uint64_t);
-   header.crc = 0;
+   simple_mtx_lock(&foz_db->mtx);
 
-   if (fwrite(&header, 1, sizeof(header), foz_db->db_idx) !=
-       sizeof(header))
-      goto fail;
+   /* Add the entry now so we don't have to wait for the index to be parsed
+    * again, that will skip it as a duplicate.
+    */
+   if (!_mesa_hash_table_u64_search(foz_db->index_db, hash)) {
+      entry = ralloc(foz_db->mem_ctx, struct foz_db_entry);
+      memcpy(&entry->header, idx_record + FOSSILIZE_BLOB_HASH_LENGTH,
+             sizeof(entry->header));
+      entry->offset = offset;
+      entry->file_idx = 0;
+      memcpy(entry->key, cache_key_160bit, sizeof(entry->key));
+      _mesa_hash_table_u64_insert(foz_db->index_db, hash, entry);
+   }
 
-   if (fwrite(&offset, 1, sizeof(uint64_t), foz_db->db_idx) !=
-       sizeof(uint64_t))
-      goto fail;
+   simple_mtx_unlock(&foz_db->mtx);
 
-   /* Flush everything to file to reduce chance of cache corruption */
-   fflush(foz_db->db_idx);
+   if (foz_db->max_size && (uint64_t)end > foz_db->max_size) {
+      /* Keep the most recent half so we don't compact again right away. */
+      compact_foz_db(foz_db, foz_db->max_size / 2);
+   }
 
-   entry = ralloc(foz_db->mem_ctx, struct foz_db_entry);
-   entry->header = header;
-   entry->offset = offset;
-   entry->file_idx = 0;
-   _mesa_sha1_hex_to_sha1(entry->key, hash_str);
-   _mesa_hash_table_u64_insert(foz_db->index_db, hash, entry);
+   simple_mtx_unlock(&foz_db->write_mtx);
 
+   return true;
+
+fail_locked:
    simple_mtx_unlock(&foz_db->mtx);
-   flock(fileno(foz_db->file[0]), LOCK_UN);
-   simple_mtx_unlock(&foz_db->flock_mtx);
+fail:
+   simple_mtx_unlock(&foz_db->write_mtx);
+   return false;
+}
+
+struct foz_compact_entry {
+   uint64_t old_offset;
+   uint32_t payload_size;
+   const char *hash_str;
+};
+
+/* Picks the most recently added entries of the writable db that fit in
+ * max_size, newest first. idx holds the index records, without the magic.
+ */
+static unsigned
+select_compacted_entries(struct foz_db *foz_db, const uint8_t *idx,
+                         unsigned num_records, uint64_t max_size,
+                         struct foz_compact_entry *entries)
+{
+   struct hash_table_u64 *kept = _mesa_hash_table_u64_create(NULL);
+   uint64_t size = FOZ_REF_MAGIC_SIZE;
+   unsigned num_entries = 0;
+
+   if (!kept)
+      return 0;
+
+   for (unsigned i = num_records; i-- > 0;) {
+      const uint8_t *record = idx + i * FOZ_IDX_RECORD_SIZE;
+      struct foz_payload_header header;
+      uint64_t offset;
+
+      if (!read_idx_record(record, &header, &offset))
+         continue;
+
+      char hash_str[FOSSILIZE_BLOB_HASH_LENGTH + 1] = {0};
+      uint8_t key[20];
+      memcpy(hash_str, record, FOSSILIZE_BLOB_HASH_LENGTH);
+      _mesa_sha1_hex_to_sha1(key, hash_str);
+      uint64_t hash = truncate_hash_to_64bits(key);
+      if (_mesa_hash_table_u64_search(kept, hash))
+         continue;
+
+      /* Skip records which don't point at their entry. */
+      uint8_t data_record[FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header)];
+      if (offset < FOSSILIZE_BLOB_HASH_LENGTH ||
+          !read_foz_bytes(foz_db, 0, offset - FOSSILIZE_BLOB_HASH_LENGTH,
+                          data_record, sizeof(data_record)) ||
+          memcmp(data_record, record, FOSSILIZE_BLOB_HASH_LENGTH))
+         continue;
+
+      memcpy(&header, data_record + FOSSILIZE_BLOB_HASH_LENGTH, sizeof(header));
+
+      size += FOSSILIZE_BLOB_HASH_LENGTH + sizeof(header) + header.payload_size;
+      if (size > max_size)
+         break;
+
+      entries[num_entries].old_offset = offset;
+      entries[num_entries].payload_size = header.payload_size;
+      entries[num_entries].hash_str = (const char *)record;
+      num_entries++;
+      _mesa_hash_table_u64_insert(kept, hash, (void *)record);
+   }
+
+   _mesa_hash_table_u64_destroy(kept);
+   return num_entries;
+}
+
+/* Writes the selected entries to new db files, oldest first. */
+static bool
+write_compacted_foz_db(struct foz_db *foz_db, struct foz_compact_entry *entries,
+                       unsigned num_entries, FILE *file, FILE *db_idx)
+{
+   int fd = fileno(file);
+   int idx_fd = fileno(db_idx);
+   uint64_t offset = FOZ_REF_MAGIC_SIZE;
+
+   if (!write_all(fd, stream_reference_magic_and_version, FOZ_REF_MAGIC_SIZE) ||
+       !write_all(idx_fd, stream_reference_magic_and_version, FOZ_REF_MAGIC_SIZE))
+      return false;
+
+   for (unsigned i = num_entries; i-- > 0;) {
+      size_t record_size = FOSSILIZE_BLOB_HASH_LENGTH +
+                           sizeof(struct foz_payload_header) +
+                           entries[i].payload_size;
+      uint8_t *record = malloc(record_size);
+      if (!record)
+         return false;
+
+      uint8_t idx_record[FOZ_IDX_RECORD_SIZE];
+      format_idx_record(idx_record, entries[i].hash_str,
+                        offset + FOSSILIZE_BLOB_HASH_LENGTH);
+
+      bool ret = read_foz_bytes(foz_db, 0,
+                                entries[i].old_offset - FOSSILIZE_BLOB_HASH_LENGTH,
+                                record, record_size) &&
+                 write_all(fd, record, record_size) &&
+                 write_all(idx_fd, idx_record, sizeof(idx_record));
+      free(record);
+      if (!ret)
+         return false;
+
+      offset += record_size;
+   }
 
    return true;
+}
 
-fail:
+/* Rewrites the writable foz db with its most recently added entries that fit
+ * in max_size, dropping everything else, including duplicates and corrupt
+ * records. The new files are renamed over the old ones, other processes
+ * switch to them the next time they write an entry and keep reading the old
+ * ones until then.
+ *
+ * Called with write_mtx held, which keeps the files open. Readers are only
+ * blocked by mtx while this process switches to the new files.
+ */
+static bool
+compact_foz_db(struct foz_db *foz_db, uint64_t max_size)
+{
+   struct foz_compact_entry *entries = NULL;
+   char *filename = NULL, *idx_filename = NULL;
+   FILE *file = NULL, *db_idx = NULL;
+   uint8_t *idx = NULL;
+   bool ret = false;
+
+   /* Only one process compacts at a time, the others carry on. */
+   if (flock(fileno(foz_db->db_idx), LOCK_EX | LOCK_NB) == -1)
+      return false;
+
+   if (foz_db_was_replaced(foz_db)) {
+      /* Somebody else compacted the db while we weren't looking. */
+      simple_mtx_lock(&foz_db->mtx);
+      ret = reopen_foz_db(foz_db);
+      simple_mtx_unlock(&foz_db->mtx);
+      goto out;
+   }
+
+   /* The index is read from the file rather than the hash table, which
+    * readers keep using meanwhile.
+    */
+   struct stat st;
+   if (fstat(fileno(foz_db->db_idx), &st) == -1 ||
+       st.st_size < FOZ_REF_MAGIC_SIZE)
+      goto out;
+
+   size_t idx_size = st.st_size - FOZ_REF_MAGIC_SIZE;
+   unsigned num_records = idx_size / FOZ_IDX_RECORD_SIZE;
+
+   idx = malloc(MAX2(idx_size, 1));
+   entries = malloc(MAX2(num_records, 1) * sizeof(*entries));
+   if (!idx || !entries ||
+       pread(fileno(foz_db->db_idx), idx, idx_size, FOZ_REF_MAGIC_SIZE) !=
+       (ssize_t)idx_size)
+      goto out;
+
+   /* Pack the valid records, torn ones may have misaligned the rest. */
+   uint64_t offset = 0;
+   const uint8_t *record;
+   struct foz_payload_header header;
+   uint64_t cache_offset;
+   num_records = 0;
+   while ((record = next_idx_record(idx, idx_size, &offset, &header,
+                                    &cache_offset))) {
+      memmove(idx + num_records * FOZ_IDX_RECORD_SIZE, record,
+              FOZ_IDX_RECORD_SIZE);
+      num_records++;
+   }
+
+   unsigned num_entries =
+      select_compacted_entries(foz_db, idx, num_records, max_size, entries);
+
+   if (asprintf(&filename, "%s.%d.tmp", foz_db->filename, getpid()) == -1) {
+      filename = NULL;
+      goto out;
+   }
+   if (asprintf(&idx_filename, "%s.%d.tmp", foz_db->idx_filename, getpid()) == -1) {
+      idx_filename = NULL;
+      goto out;
+   }
+
+   file = fopen(filename, "wb");
+   db_idx = fopen(idx_filename, "wb");
+   if (!file || !db_idx ||
+       !write_compacted_foz_db(foz_db, entries, num_entries, file, db_idx))
+      goto out;
+
+   /* Rename the db first: until the index is replaced too, other processes
+    * keep using both old files.
+    */
+   if (rename(filename, foz_db->filename) == -1 ||
+       rename(idx_filename, foz_db->idx_filename) == -1)
+      goto out;
+
+   /* This drops our flock along with the old index. */
+   simple_mtx_lock(&foz_db->mtx);
+   ret = reopen_foz_db(foz_db);
    simple_mtx_unlock(&foz_db->mtx);
-fail_file:
-   flock(fileno(foz_db->file[0]), LOCK_UN);
-   simple_mtx_unlock(&foz_db->flock_mtx);
-   return false;
+
+out:
+   if (file)
+      fclose(file);
+   if (db_idx)
+      fclose(db_idx);
+   if (filename) {
+      unlink(filename);
+      free(filename);
+   }
+   if (idx_filename) {
+      unlink(idx_filename);
+      free(idx_filename);
+   }
+   free(entries);
+   free(idx);
+   flock(fileno(foz_db->db_idx), LOCK_UN);
+   return ret;
+}
+
+/* Compacts the writable db down to its most recently added entries that fit
+ * in max_size, for tools and for callers that don't set a max size.
+ */
+bool
+foz_compact(struct foz_db *foz_db, uint64_t max_size)
+{
+   if (!foz_db->alive)
+      return false;
+
+   simple_mtx_lock(&foz_db->write_mtx);
+   bool ret = compact_foz_db(foz_db, max_size);
+   simple_mtx_unlock(&foz_db->write_mtx);
+
+   return ret;
 }
 #else
 
@@ -564,4 +1045,10 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    return false;
 }
 
+bool
+foz_compact(struct foz_db *foz_db, uint64_t max_size)
+{
+   return false;
+}
+
 #endif
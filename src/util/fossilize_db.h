@@ -43,6 +43,10 @@
 
 #include "simple_mtx.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Max number of DBs our implementation can read from at once */
 #define FOZ_MAX_DBS 9 /* Default DB + 8 Read only DBs */
 
@@ -76,10 +80,20 @@ struct foz_db {
    FILE *file[FOZ_MAX_DBS];          /* An array of all foz dbs */
    FILE *db_idx;                     /* The default writable foz db idx */
    simple_mtx_t mtx;                 /* Mutex for file/hash table read/writes */
-   simple_mtx_t flock_mtx;           /* Mutex for flocking the file for writes */
+   simple_mtx_t write_mtx;           /* Mutex for appending to the writable db */
    void *mem_ctx;
    struct hash_table_u64 *index_db;  /* Hash table of all foz db entries */
    bool alive;
+
+   char *filename;                   /* Paths of the default writable foz db */
+   char *idx_filename;
+   uint64_t idx_offset;              /* How far the writable idx was parsed */
+   uint64_t max_size;                /* Compact the writable db past this size, 0 = never */
+
+   const uint8_t *ro_map[FOZ_MAX_DBS];     /* Read only foz dbs are mmapped */
+   size_t ro_map_size[FOZ_MAX_DBS];
+   const uint8_t *ro_idx_map[FOZ_MAX_DBS];
+   size_t ro_idx_map_size[FOZ_MAX_DBS];
 };
 
 bool
@@ -96,4 +110,11 @@ bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size);
 
+bool
+foz_compact(struct foz_db *foz_db, uint64_t max_size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* FOSSILIZE_DB_H */
@@ -28,6 +28,7 @@
 #include <string.h>
 #include <stdint.h>
 
+#include "util/list.h"
 #include "util/macros.h"
 #include "util/u_math.h"
 #include "util/u_printf.h"
@@ -892,3 +893,288 @@ linear_strcat(void *parent, char **dest, const char *str)
 {
    return linear_cat(parent, dest, str, strlen(str));
 }
+
+/***************************************************************************
+ * Garbage-collected allocator.
+ ***************************************************************************
+ *
+ * Small blocks come from 32K slabs, one list of slabs per size class, and
+ * each slab keeps a free list threaded through its free blocks.  Every block
+ * starts with a gc_block_header telling where its slab is and which
+ * generation it was last marked live in, so that a block can be freed
+ * without knowing its context and a sweep only has to walk the slabs.
+ *
+ * Blocks too large for the slabs are ralloc children of the context.  A
+ * sweep moves them to a temporary context and gc_mark_live steals the live
+ * ones back, like nir_sweep does for the rest of a shader.
+ */
+
+#define GC_SLAB_SIZE       (32 * 1024)
+#define GC_BLOCK_ALIGNMENT 32
+#define GC_NUM_BUCKETS     16
+#define GC_LARGE_BUCKET    0xff
+#define GC_CANARY          0x6c3e5a11
+
+#define GC_IS_USED            (1 << 0)
+#define GC_CURRENT_GENERATION (1 << 1)
+
+typedef struct {
+   unsigned canary;       /* only checked in debug builds */
+   uint16_t slab_offset;  /* offset of this header from its slab */
+   uint8_t bucket;        /* size class, or GC_LARGE_BUCKET */
+   uint8_t flags;
+} gc_block_header;
+
+typedef struct {
+   gc_ctx *ctx;
+   struct list_head link;       /* in gc_bucket::slabs */
+   struct list_head free_link;  /* in gc_bucket::free_slabs, if not full */
+   gc_block_header *freelist;
+   unsigned bucket;
+   unsigned num_blocks;
+   unsigned num_free;
+} gc_slab;
+
+struct gc_ctx {
+   struct {
+      struct list_head slabs;
+      struct list_head free_slabs;
+   } buckets[GC_NUM_BUCKETS];
+
+   /* GC_CURRENT_GENERATION or 0, flipped by each sweep */
+   uint8_t current_gen;
+
+   /* the large blocks not marked live yet, during a sweep */
+   void *rubbish;
+};
+
+#define GC_FIRST_BLOCK_OFFSET ALIGN_POT(sizeof(gc_slab), GC_BLOCK_ALIGNMENT)
+
+static inline unsigned
+gc_block_size(unsigned bucket)
+{
+   return (bucket + 1) * GC_BLOCK_ALIGNMENT;
+}
+
+static inline gc_block_header *
+gc_get_header(const void *ptr)
+{
+   gc_block_header *header = (gc_block_header *) ptr - 1;
+   assert(header->canary == GC_CANARY);
+   return header;
+}
+
+static inline gc_slab *
+gc_get_slab(gc_block_header *header)
+{
+   return (gc_slab *) ((char *) header - header->slab_offset);
+}
+
+static inline gc_block_header **
+gc_next_free(gc_block_header *header)
+{
+   return (gc_block_header **) (header + 1);
+}
+
+static inline gc_block_header *
+gc_slab_block(gc_slab *slab, unsigned i)
+{
+   return (gc_block_header *) ((char *) slab + GC_FIRST_BLOCK_OFFSET +
+                               i * gc_block_size(slab->bucket));
+}
+
+static void
+gc_push_free(gc_slab *slab, gc_block_header *header)
+{
+   header->flags = 0;
+   *gc_next_free(header) = slab->freelist;
+   slab->freelist = header;
+
+   if (slab->num_free++ == 0)
+      list_add(&slab->free_link, &slab->ctx->buckets[slab->bucket].free_slabs);
+}
+
+static gc_slab *
+gc_create_slab(gc_ctx *ctx, unsigned bucket)
+{
+   gc_slab *slab = malloc(GC_SLAB_SIZE);
+   if (unlikely(!slab))
+      return NULL;
+
+   slab->ctx = ctx;
+   slab->freelist = NULL;
+   slab->bucket = bucket;
+   slab->num_blocks = (GC_SLAB_SIZE - GC_FIRST_BLOCK_OFFSET) /
+                      gc_block_size(bucket);
+   slab->num_free = 0;
+   list_add(&slab->link, &ctx->buckets[bucket].slabs);
+
+   /* Push the blocks in reverse so that they're handed out in order. */
+   for (unsigned i = slab->num_blocks; i-- > 0;) {
+      gc_block_header *header = gc_slab_block(slab, i);
+
+      header->canary = GC_CANARY;
+      header->slab_offset = (char *) header - (char *) slab;
+      header->bucket = bucket;
+      gc_push_free(slab, header);
+   }
+
+   return slab;
+}
+
+static void
+gc_free_slab(gc_slab *slab)
+{
+   list_del(&slab->link);
+   if (slab->num_free)
+      list_del(&slab->free_link);
+   free(slab);
+}
+
+static void
+gc_context_destructor(void *ptr)
+{
+   gc_ctx *ctx = ptr;
+
+   for (unsigned i = 0; i < GC_NUM_BUCKETS; i++) {
+      list_for_each_entry_safe(gc_slab, slab, &ctx->buckets[i].slabs, link)
+         free(slab);
+   }
+}
+
+gc_ctx *
+gc_context(const void *parent)
+{
+   gc_ctx *ctx = rzalloc(parent, gc_ctx);
+   if (unlikely(!ctx))
+      return NULL;
+
+   for (unsigned i = 0; i < GC_NUM_BUCKETS; i++) {
+      list_inithead(&ctx->buckets[i].slabs);
+      list_inithead(&ctx->buckets[i].free_slabs);
+   }
+
+   ralloc_set_destructor(ctx, gc_context_destructor);
+   return ctx;
+}
+
+void *
+gc_alloc_size(gc_ctx *ctx, size_t size)
+{
+   gc_block_header *header;
+   size_t bucket = (size + sizeof(gc_block_header) - 1) / GC_BLOCK_ALIGNMENT;
+
+   if (likely(bucket < GC_NUM_BUCKETS)) {
+      struct list_head *free_slabs = &ctx->buckets[bucket].free_slabs;
+      gc_slab *slab;
+
+      if (list_is_empty(free_slabs)) {
+         slab = gc_create_slab(ctx, bucket);
+         if (unlikely(!slab))
+            return NULL;
+      } else {
+         slab = list_first_entry(free_slabs, gc_slab, free_link);
+      }
+
+      header = slab->freelist;
+      slab->freelist = *gc_next_free(header);
+      if (--slab->num_free == 0)
+         list_del(&slab->free_link);
+   } else {
+      header = ralloc_size(ctx, sizeof(gc_block_header) + size);
+      if (unlikely(!header))
+         return NULL;
+
+      header->canary = GC_CANARY;
+      header->slab_offset = 0;
+      header->bucket = GC_LARGE_BUCKET;
+   }
+
+   header->flags = GC_IS_USED | ctx->current_gen;
+   return header + 1;
+}
+
+void *
+gc_zalloc_size(gc_ctx *ctx, size_t size)
+{
+   void *ptr = gc_alloc_size(ctx, size);
+
+   if (likely(ptr))
+      memset(ptr, 0, size);
+
+   return ptr;
+}
+
+void
+gc_free(void *ptr)
+{
+   gc_block_header *header;
+
+   if (unlikely(ptr == NULL))
+      return;
+
+   header = gc_get_header(ptr);
+   assert(header->flags & GC_IS_USED);
+
+   if (header->bucket == GC_LARGE_BUCKET)
+      ralloc_free(header);
+   else
+      gc_push_free(gc_get_slab(header), header);
+}
+
+gc_ctx *
+gc_get_context(void *ptr)
+{
+   gc_block_header *header = gc_get_header(ptr);
+
+   if (header->bucket == GC_LARGE_BUCKET)
+      return ralloc_parent(header);
+   else
+      return gc_get_slab(header)->ctx;
+}
+
+void
+gc_sweep_start(gc_ctx *ctx)
+{
+   assert(!ctx->rubbish);
+
+   ctx->current_gen ^= GC_CURRENT_GENERATION;
+
+   ctx->rubbish = ralloc_context(NULL);
+   ralloc_adopt(ctx->rubbish, ctx);
+}
+
+void
+gc_mark_live(gc_ctx *ctx, const void *mem)
+{
+   gc_block_header *header = gc_get_header(mem);
+
+   if (header->bucket == GC_LARGE_BUCKET)
+      ralloc_steal(ctx, header);
+   else
+      header->flags = GC_IS_USED | ctx->current_gen;
+}
+
+void
+gc_sweep_end(gc_ctx *ctx)
+{
+   assert(ctx->rubbish);
+
+   for (unsigned i = 0; i < GC_NUM_BUCKETS; i++) {
+      list_for_each_entry_safe(gc_slab, slab, &ctx->buckets[i].slabs, link) {
+         for (unsigned j = 0; j < slab->num_blocks; j++) {
+            gc_block_header *header = gc_slab_block(slab, j);
+
+            if ((header->flags & GC_IS_USED) &&
+                (header->flags & GC_CURRENT_GENERATION) != ctx->current_gen)
+               gc_push_free(slab, header);
+         }
+
+         if (slab->num_free == slab->num_blocks)
+            gc_free_slab(slab);
+      }
+   }
+
+   ralloc_free(ctx->rubbish);
+   ctx->rubbish = NULL;
+}
@@ -597,6 +597,51 @@ bool linear_vasprintf_rewrite_tail(void *parent, char **str, size_t *start,
                                    const char *fmt, va_list args);
 bool linear_strcat(void *parent, char **dest, const char *str);
 
+/**
+ * \defgroup gc Garbage-collected allocator for objects freed one by one
+ *
+ * A gc_ctx hands out blocks from slabs, with one size class per 32 bytes up
+ * to 512 bytes; larger blocks are ralloc'd.  Blocks can be freed one at a
+ * time with gc_free, all at once by freeing the context, or by a mark and
+ * sweep pass: gc_sweep_start, gc_mark_live on every block still in use, and
+ * gc_sweep_end, which frees the unmarked blocks and the slabs left empty.
+ *
+ * Blocks are aligned to 8 bytes.
+ * @{
+ */
+typedef struct gc_ctx gc_ctx;
+
+/**
+ * Create a garbage-collected allocation context, which is freed with its
+ * ralloc parent.
+ */
+gc_ctx *gc_context(const void *parent);
+
+#define gc_alloc(ctx, type, count) \
+   ((type *) gc_alloc_size(ctx, sizeof(type) * (count)))
+
+#define gc_zalloc(ctx, type, count) \
+   ((type *) gc_zalloc_size(ctx, sizeof(type) * (count)))
+
+void *gc_alloc_size(gc_ctx *ctx, size_t size) MALLOCLIKE;
+void *gc_zalloc_size(gc_ctx *ctx, size_t size) MALLOCLIKE;
+
+/**
+ * Free a single block.  Does nothing if \p ptr is NULL.
+ */
+void gc_free(void *ptr);
+
+/**
+ * Return the context a block was allocated from.  Only valid outside of a
+ * sweep.
+ */
+gc_ctx *gc_get_context(void *ptr);
+
+void gc_sweep_start(gc_ctx *ctx);
+void gc_mark_live(gc_ctx *ctx, const void *mem);
+void gc_sweep_end(gc_ctx *ctx);
+/** @} */
+
 #ifdef __cplusplus
 } /* end of extern "C" */
 #endif
@@ -36,9 +36,13 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <dirent.h>
 
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
+#include "util/fossilize_db.h"
 #include "util/ralloc.h"
 
 #ifdef ENABLE_SHADER_CACHE
@@ -519,6 +523,477 @@ test_put_and_get_between_instances()
    disk_cache_destroy(cache1);
    disk_cache_destroy(cache2);
 }
+
+static void
+test_put_and_get_ram_tier()
+{
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   uint8_t one_KB_key[20];
+   uint8_t *one_KB;
+   struct disk_cache_stats stats;
+   char *result;
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_SHADER_CACHE_RAM_SIZE", "1K", 1);
+   struct disk_cache *cache = disk_cache_create("test_ram_tier",
+                                                "make_check", 0);
+   unsetenv("MESA_SHADER_CACHE_RAM_SIZE");
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_EQ(result, nullptr) << "disk_cache_get with non-existent item (pointer)";
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.ram_misses, 1) << "RAM miss on non-existent item";
+
+   /* The RAM tier is filled synchronously, so no need to wait for the
+    * disk write before reading the item back.
+    */
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(blob, result) << "disk_cache_get of RAM item (pointer)";
+   EXPECT_EQ(size, sizeof(blob)) << "disk_cache_get of RAM item (size)";
+   free(result);
+
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.ram_hits, 1) << "RAM hit on put item";
+   EXPECT_EQ(stats.ram_hit_bytes, sizeof(blob)) << "RAM hit bytes";
+   EXPECT_EQ(stats.ram_size, sizeof(blob)) << "RAM size after put";
+
+   /* A 1KB item doesn't fit next to the blob, which gets evicted from RAM
+    * but can still be loaded from disk.
+    */
+   one_KB = (uint8_t *) calloc(1, 1024);
+   disk_cache_compute_key(cache, one_KB, 1024, one_KB_key);
+   disk_cache_put(cache, one_KB_key, one_KB, 1024, NULL);
+   free(one_KB);
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.ram_evictions, 1) << "RAM eviction of LRU item";
+   EXPECT_EQ(stats.ram_size, 1024) << "RAM size after eviction";
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(blob, result) << "disk_cache_get of evicted RAM item (pointer)";
+   free(result);
+
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.ram_hits, 1) << "evicted item is not a RAM hit";
+   EXPECT_EQ(stats.ram_misses, 2) << "evicted item is a RAM miss";
+
+   /* A put too large for RAM still drops what RAM held for the key. */
+   uint8_t *two_KB = (uint8_t *) calloc(1, 2048);
+   disk_cache_put(cache, blob_key, two_KB, 2048, NULL);
+   free(two_KB);
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.ram_size, 0) << "RAM size after put of a larger item";
+
+   /* Removing an item drops it from RAM too. */
+   disk_cache_remove(cache, blob_key);
+   EXPECT_FALSE(does_cache_contain(cache, blob_key)) << "removed item";
+
+   disk_cache_destroy(cache);
+}
+
+static bool
+cache_dir_has_compress_dict(const char *path)
+{
+   bool found = false;
+
+   DIR *dir = opendir(path);
+   if (!dir)
+      return false;
+
+   struct dirent *entry;
+   while ((entry = readdir(dir))) {
+      if (!strncmp(entry->d_name, "dict-", 5) &&
+          !strstr(entry->d_name, ".tmp"))
+         found = true;
+   }
+   closedir(dir);
+
+   return found;
+}
+
+static void
+test_prefetch()
+{
+   const unsigned num_items = 16;
+   cache_key keys[num_items + 1];
+   char data[64];
+   struct disk_cache_stats stats;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   struct disk_cache *cache = disk_cache_create("test_prefetch",
+                                                "make_check", 0);
+
+   for (unsigned i = 0; i < num_items; i++) {
+      snprintf(data, sizeof(data), "prefetched item %u", i);
+      disk_cache_compute_key(cache, data, sizeof(data), keys[i]);
+      disk_cache_put(cache, keys[i], data, sizeof(data), NULL);
+   }
+   disk_cache_wait_for_idle(cache);
+   disk_cache_destroy(cache);
+
+   /* A fresh instance, so that nothing is held in memory yet. */
+   cache = disk_cache_create("test_prefetch", "make_check", 0);
+
+   snprintf(data, sizeof(data), "never stored");
+   disk_cache_compute_key(cache, data, sizeof(data), keys[num_items]);
+
+   disk_cache_prefetch(cache, keys, num_items + 1);
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.prefetch_size, num_items * sizeof(data))
+      << "prefetched items held in memory";
+
+   unsigned count = 0;
+   for (unsigned i = 0; i < num_items; i++) {
+      snprintf(data, sizeof(data), "prefetched item %u", i);
+
+      size_t size;
+      char *result = (char *) disk_cache_get(cache, keys[i], &size);
+      if (result && size == sizeof(data) && !strcmp(result, data))
+         count++;
+      free(result);
+   }
+   EXPECT_EQ(count, num_items) << "gets of prefetched items";
+
+   EXPECT_FALSE(does_cache_contain(cache, keys[num_items]))
+      << "get of prefetched item that doesn't exist";
+
+   disk_cache_get_stats(cache, &stats);
+   EXPECT_EQ(stats.prefetch_hits, num_items) << "gets served by prefetch";
+   EXPECT_EQ(stats.prefetch_size, 0) << "prefetched items released by get";
+
+   /* A get right after the prefetch waits for the item to be loaded. */
+   disk_cache_prefetch(cache, keys, 1);
+   EXPECT_TRUE(does_cache_contain(cache, keys[0])) << "get during prefetch";
+
+   /* A put replaces what was prefetched for the same key. */
+   disk_cache_remove(cache, keys[0]);
+   disk_cache_prefetch(cache, keys, 1);
+   snprintf(data, sizeof(data), "replaced item");
+   disk_cache_put(cache, keys[0], data, sizeof(data), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   size_t size;
+   char *result = (char *) disk_cache_get(cache, keys[0], &size);
+   EXPECT_TRUE(result && size == sizeof(data) && !strcmp(result, data))
+      << "get after put of a prefetched item";
+   free(result);
+
+   disk_cache_destroy(cache);
+}
+
+/* Fills data with text that looks alike for every seed, like shaders from
+ * the same driver do.
+ */
+static void
+fill_shader_like_data(char *data, size_t size, unsigned seed)
+{
+   memset(data, 0, size);
+   snprintf(data, size,
+            "shader %u: decl_var uniform vec4 u%u; load_const ssa_%u = "
+            "0x%08x; fmul ssa_%u, ssa_%u, ssa_%u; store_output ssa_%u",
+            seed, seed % 7, seed, seed * 2654435761u, seed + 1, seed,
+            seed % 13, seed + 1);
+}
+
+static void
+test_put_and_get_compress_dict()
+{
+   const unsigned num_items = 320;
+   char data[512];
+   uint8_t key[20];
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   /* Every item takes a whole block on disk, make room for all of them. */
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "16M", 1);
+   struct disk_cache *cache = disk_cache_create("test_compress_dict",
+                                                "make_check", 0);
+   disk_cache_set_compression_policy(cache, DISK_CACHE_COMPRESSION_SMALL);
+
+   /* The dictionary is trained once enough entries were written, the rest
+    * are compressed with it.
+    */
+   for (unsigned i = 0; i < num_items; i++) {
+      fill_shader_like_data(data, sizeof(data), i);
+      disk_cache_compute_key(cache, data, sizeof(data), key);
+      disk_cache_put(cache, key, data, sizeof(data), NULL);
+
+      /* Keep the queue from dropping puts. */
+      if (i % 16 == 15)
+         disk_cache_wait_for_idle(cache);
+   }
+   disk_cache_wait_for_idle(cache);
+
+   EXPECT_TRUE(cache_dir_has_compress_dict(CACHE_TEST_TMP
+                                           "/mesa-shader-cache-dir/"
+                                           CACHE_DIR_NAME))
+      << "dictionary written to the cache directory";
+
+   disk_cache_destroy(cache);
+
+   /* A new instance loads the dictionary and reads every entry back. */
+   cache = disk_cache_create("test_compress_dict", "make_check", 0);
+
+   unsigned count = 0;
+   for (unsigned i = 0; i < num_items; i++) {
+      fill_shader_like_data(data, sizeof(data), i);
+      disk_cache_compute_key(cache, data, sizeof(data), key);
+
+      size_t size;
+      char *result = (char *) disk_cache_get(cache, key, &size);
+      if (result && size == sizeof(data) && !memcmp(result, data, size))
+         count++;
+      free(result);
+   }
+   EXPECT_EQ(count, num_items) << "items compressed with and without dictionary";
+
+   disk_cache_destroy(cache);
+   unsetenv("MESA_SHADER_CACHE_MAX_SIZE");
+}
+
+/* Fills data with bytes that don't compress, derived from seed. */
+static void
+fill_test_data(uint8_t *data, size_t size, unsigned seed)
+{
+   uint32_t x = seed * 2654435761u + 1;
+   for (size_t i = 0; i < size; i++) {
+      x = x * 1664525u + 1013904223u;
+      data[i] = x >> 24;
+   }
+}
+
+static void
+put_test_item(struct disk_cache *cache, unsigned seed, uint8_t *key)
+{
+   uint8_t data[512];
+
+   fill_test_data(data, sizeof(data), seed);
+   disk_cache_compute_key(cache, data, sizeof(data), key);
+   disk_cache_put(cache, key, data, sizeof(data), NULL);
+   disk_cache_wait_for_idle(cache);
+}
+
+static void
+test_foz_compaction()
+{
+   const unsigned num_items = 16;
+   uint8_t keys[num_items][20];
+   uint8_t key[20];
+   struct stat sb;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "4K", 1);
+   struct disk_cache *cache = disk_cache_create("test", "make_check", 0);
+   struct disk_cache *other = disk_cache_create("test", "make_check", 0);
+   unsetenv("MESA_SHADER_CACHE_MAX_SIZE");
+
+   put_test_item(other, num_items, key);
+
+   for (unsigned i = 0; i < num_items; i++)
+      put_test_item(cache, i, keys[i]);
+
+   EXPECT_FALSE(does_cache_contain(cache, keys[0]))
+      << "oldest item evicted by compaction";
+   EXPECT_TRUE(does_cache_contain(cache, keys[num_items - 1]))
+      << "newest item kept by compaction";
+
+   int err = stat(CACHE_TEST_TMP "/mesa-shader-cache-dir/"
+                  CACHE_DIR_NAME_SF "/make_check/test/foz_cache.foz", &sb);
+   EXPECT_EQ(err, 0) << "stat of the foz db";
+   EXPECT_LE(sb.st_size, 4096) << "foz db size after compaction";
+
+   /* The other instance keeps reading the old files until it writes, then
+    * switches to the compacted ones.
+    */
+   EXPECT_TRUE(does_cache_contain(other, key))
+      << "item of other instance before it noticed the compaction";
+   put_test_item(other, num_items + 1, key);
+   EXPECT_TRUE(does_cache_contain(other, key))
+      << "item written after the compaction";
+   EXPECT_TRUE(does_cache_contain(other, keys[num_items - 1]))
+      << "item of the compacted db";
+
+   disk_cache_destroy(other);
+   disk_cache_destroy(cache);
+}
+
+static void
+test_foz_corrupt_index_record()
+{
+   uint8_t keys[3][20];
+   struct stat sb;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   struct disk_cache *cache = disk_cache_create("test", "make_check", 0);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++)
+      put_test_item(cache, 2000 + i, keys[i]);
+   disk_cache_destroy(cache);
+
+   /* Flip a byte of the offset stored by the middle record. */
+   const size_t record_size = FOSSILIZE_BLOB_HASH_LENGTH +
+                              sizeof(struct foz_payload_header) +
+                              sizeof(uint64_t);
+   int fd = open(CACHE_TEST_TMP "/mesa-shader-cache-dir/"
+                 CACHE_DIR_NAME_SF "/make_check/test/foz_cache_idx.foz", O_RDWR);
+   EXPECT_NE(fd, -1) << "open of the foz db index";
+   EXPECT_EQ(fstat(fd, &sb), 0);
+   off_t offset = sb.st_size - record_size - sizeof(uint64_t);
+   uint8_t byte = 0;
+   EXPECT_EQ(pread(fd, &byte, 1, offset), 1);
+   byte ^= 0xff;
+   EXPECT_EQ(pwrite(fd, &byte, 1, offset), 1);
+   close(fd);
+
+   cache = disk_cache_create("test", "make_check", 0);
+   EXPECT_TRUE(does_cache_contain(cache, keys[0]))
+      << "item before the corrupt index record";
+   EXPECT_FALSE(does_cache_contain(cache, keys[1]))
+      << "item of the corrupt index record";
+   EXPECT_TRUE(does_cache_contain(cache, keys[2]))
+      << "item after the corrupt index record";
+   disk_cache_destroy(cache);
+}
+
+static void
+test_foz_torn_index_record()
+{
+   uint8_t keys[3][20];
+   struct stat sb;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   /* Start from an empty db to know the size of the compacted index. */
+   unlink(CACHE_TEST_TMP "/mesa-shader-cache-dir/"
+          CACHE_DIR_NAME_SF "/make_check/test/foz_cache.foz");
+   unlink(CACHE_TEST_TMP "/mesa-shader-cache-dir/"
+          CACHE_DIR_NAME_SF "/make_check/test/foz_cache_idx.foz");
+
+   struct disk_cache *cache = disk_cache_create("test", "make_check", 0);
+   put_test_item(cache, 3000, keys[0]);
+   disk_cache_destroy(cache);
+
+   /* Append the first half of the last record, as a short write would. */
+   const size_t record_size = FOSSILIZE_BLOB_HASH_LENGTH +
+                              sizeof(struct foz_payload_header) +
+                              sizeof(uint64_t);
+   int fd = open(CACHE_TEST_TMP "/mesa-shader-cache-dir/"
+                 CACHE_DIR_NAME_SF "/make_check/test/foz_cache_idx.foz",
+                 O_RDWR | O_APPEND);
+   EXPECT_NE(fd, -1) << "open of the foz db index";
+   EXPECT_EQ(fstat(fd, &sb), 0);
+   uint8_t record[record_size];
+   EXPECT_EQ(pread(fd, record, record_size, sb.st_size - record_size),
+             (ssize_t)record_size);
+   EXPECT_EQ(write(fd, record, record_size / 2), (ssize_t)(record_size / 2));
+   close(fd);
+
+   cache = disk_cache_create("test", "make_check", 0);
+   put_test_item(cache, 3001, keys[1]);
+   put_test_item(cache, 3002, keys[2]);
+   disk_cache_destroy(cache);
+
+   cache = disk_cache_create("test", "make_check", 0);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++) {
+      EXPECT_TRUE(does_cache_contain(cache, keys[i]))
+         << "item around the torn index record";
+   }
+   disk_cache_destroy(cache);
+
+   /* Compaction drops the torn record and realigns the index. */
+   cache = disk_cache_create("test", "make_check", 0);
+   EXPECT_TRUE(disk_cache_compact(cache, 0)) << "disk_cache_compact";
+   disk_cache_destroy(cache);
+
+   int err = stat(CACHE_TEST_TMP "/mesa-shader-cache-dir/"
+                  CACHE_DIR_NAME_SF "/make_check/test/foz_cache_idx.foz", &sb);
+   EXPECT_EQ(err, 0) << "stat of the foz db index";
+   EXPECT_EQ(sb.st_size, (off_t)(16 + ARRAY_SIZE(keys) * record_size))
+      << "index size after compaction";
+
+   cache = disk_cache_create("test", "make_check", 0);
+   for (unsigned i = 0; i < ARRAY_SIZE(keys); i++) {
+      EXPECT_TRUE(does_cache_contain(cache, keys[i]))
+         << "item kept by compaction";
+   }
+   disk_cache_destroy(cache);
+}
+
+static void
+test_foz_concurrent_writers()
+{
+   const unsigned num_procs = 4;
+   const unsigned num_items = 16;
+   pid_t pids[num_procs];
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   for (unsigned p = 0; p < num_procs; p++) {
+      pids[p] = fork();
+      if (pids[p] == 0) {
+         struct disk_cache *cache = disk_cache_create("test", "make_check", 0);
+         uint8_t key[20];
+         for (unsigned i = 0; i < num_items; i++)
+            put_test_item(cache, 1000 + p * num_items + i, key);
+         disk_cache_destroy(cache);
+         _exit(0);
+      }
+   }
+
+   for (unsigned p = 0; p < num_procs; p++) {
+      int status;
+      waitpid(pids[p], &status, 0);
+      EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+         << "writer process exited cleanly";
+   }
+
+   struct disk_cache *cache = disk_cache_create("test", "make_check", 0);
+   unsigned count = 0;
+   for (unsigned i = 0; i < num_procs * num_items; i++) {
+      uint8_t data[512];
+      uint8_t key[20];
+
+      fill_test_data(data, sizeof(data), 1000 + i);
+      disk_cache_compute_key(cache, data, sizeof(data), key);
+
+      size_t size;
+      uint8_t *result = (uint8_t *) disk_cache_get(cache, key, &size);
+      if (result && size == sizeof(data) && !memcmp(result, data, size))
+         count++;
+      free(result);
+   }
+   EXPECT_EQ(count, num_procs * num_items) << "items of all writer processes";
+
+   disk_cache_destroy(cache);
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 class Cache : public ::testing::Test {
@@ -567,9 +1042,59 @@ TEST_F(Cache, SingleFile)
 
    test_put_and_get_between_instances();
 
+   test_foz_concurrent_writers();
+
+   test_foz_compaction();
+
+   test_foz_corrupt_index_record();
+
+   test_foz_torn_index_record();
+
    setenv("MESA_DISK_CACHE_SINGLE_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
    EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
 #endif
 }
+
+TEST_F(Cache, RamTier)
+{
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME);
+
+   test_put_and_get_ram_tier();
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
+TEST_F(Cache, CompressDict)
+{
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME);
+
+   test_put_and_get_compress_dict();
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
+TEST_F(Cache, Prefetch)
+{
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME);
+
+   test_prefetch();
+
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
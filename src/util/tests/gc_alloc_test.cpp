@@ -0,0 +1,101 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <gtest/gtest.h>
+
+#include "util/ralloc.h"
+
+/**
+ * \file gc_alloc_test.cpp
+ *
+ * Test the garbage-collected allocator in ralloc.
+ */
+
+class gc_alloc : public ::testing::Test {
+public:
+   void *mem_ctx;
+   gc_ctx *ctx;
+
+   virtual void SetUp();
+   virtual void TearDown();
+};
+
+void
+gc_alloc::SetUp()
+{
+   mem_ctx = ralloc_context(NULL);
+   ctx = gc_context(mem_ctx);
+}
+
+void
+gc_alloc::TearDown()
+{
+   ralloc_free(mem_ctx);
+}
+
+TEST_F(gc_alloc, alignment_and_context)
+{
+   static const size_t sizes[] = { 1, 8, 24, 25, 100, 504, 505, 4096 };
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+      char *ptr = (char *) gc_zalloc_size(ctx, sizes[i]);
+
+      ASSERT_NE(ptr, nullptr);
+      EXPECT_EQ((uintptr_t) ptr % 8, 0u);
+      EXPECT_EQ(gc_get_context(ptr), ctx);
+      for (size_t j = 0; j < sizes[i]; j++)
+         EXPECT_EQ(ptr[j], 0);
+
+      memset(ptr, 0xff, sizes[i]);
+   }
+}
+
+TEST_F(gc_alloc, free_reuses_blocks)
+{
+   void *a = gc_alloc_size(ctx, 64);
+   gc_free(a);
+
+   void *b = gc_alloc_size(ctx, 64);
+   EXPECT_EQ(a, b);
+
+   void *large = gc_alloc_size(ctx, 4096);
+   gc_free(large);
+   gc_free(NULL);
+}
+
+TEST_F(gc_alloc, sweep)
+{
+   enum { count = 4096 };
+   uint32_t *ptrs[count];
+
+   for (unsigned i = 0; i < count; i++) {
+      ptrs[i] = gc_alloc(ctx, uint32_t, i % 2 ? 4 : 1024);
+      *ptrs[i] = i;
+   }
+
+   gc_sweep_start(ctx);
+   for (unsigned i = 0; i < count; i += 3)
+      gc_mark_live(ctx, ptrs[i]);
+   gc_sweep_end(ctx);
+
+   /* The live blocks are untouched and allocations keep working. */
+   for (unsigned i = 0; i < count; i += 3) {
+      EXPECT_EQ(*ptrs[i], i);
+      EXPECT_EQ(gc_get_context(ptrs[i]), ctx);
+   }
+
+   for (unsigned i = 0; i < count; i++)
+      EXPECT_NE(gc_alloc(ctx, uint32_t, i % 2 ? 4 : 1024), nullptr);
+
+   /* Blocks allocated during a sweep survive it. */
+   gc_sweep_start(ctx);
+   uint32_t *during = gc_alloc(ctx, uint32_t, 4);
+   *during = 42;
+   gc_sweep_end(ctx);
+
+   EXPECT_EQ(*during, 42u);
+   gc_free(during);
+}
@@ -273,6 +273,10 @@ struct util_queue_monitoring
    unsigned num_offloaded_items;
    unsigned num_direct_items;
    unsigned num_syncs;
+   /* Number of batches handed to the thread. */
+   unsigned num_flushes;
+   /* Number of times the producer waited because all batches were busy. */
+   unsigned num_stalls;
 };
 
 #ifdef __cplusplus